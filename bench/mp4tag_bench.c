@@ -0,0 +1,742 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+/*
+ * Benchmarks for libmp4tag's read and write paths.
+ *
+ * Generates synthetic files in realistic shapes (large ilst, large cover
+ * art, moov after mdat, fragmented, multi-GB sparse mdat), then times
+ * each operation against each file and prints one JSON object per line:
+ *
+ *   {"version":"1.0.0","file":"ilst200","op":"read_tags",
+ *    "strategy":null,"iterations":200,"seconds":0.0123,
+ *    "ops_per_sec":16260.2,"read_syscalls":3.0,"write_syscalls":0.0,
+ *    "bytes_read":12345.0,"bytes_written":0.0,
+ *    "alloc_peak_bytes":40960,"peak_rss_kb":2048}
+ *
+ * Syscall and byte figures are per operation, from /proc/self/io (null
+ * where that isn't available). alloc_peak_bytes is the high-water mark
+ * of the context allocator over one operation; peak_rss_kb is the
+ * process high-water mark, taken per (file, op) pair by running each in
+ * its own child process. Each operation creates a context, opens the
+ * file, makes its calls and destroys the context; write operations
+ * run on a freshly generated copy, outside the timed region.
+ *
+ * Usage: mp4tag_bench [-n iterations] [--dir path] [--sparse-mb size]
+ *                     [--only name]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include <mp4tag/mp4tag.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MOOF_COUNT     10000
+#define BENCH_COVER_SIZE     (10u * 1024 * 1024)
+#define BENCH_ILST_PADDING   4096u
+#define BENCH_VALUE_SIZE     32u
+
+/* ------------------------------------------------------------------ */
+/*  Synthetic files                                                    */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Shape of a generated file:
+ *   ftyp, [mdat], moov { mvhd, trak/.../stco, udta { meta { hdlr, ilst,
+ *   free } } }, [mdat], moof/mdat pairs
+ * Every file has TITLE and ARTIST, `items` more text items named
+ * b000..., an optional cover, and a two-chunk stco into the mdat.
+ */
+typedef struct {
+    const char *name;
+    unsigned    items;          /* Extra text items */
+    uint32_t    cover_size;     /* covr payload, 0 for none */
+    int         mdat_first;     /* moov after mdat */
+    unsigned    moofs;          /* Trailing moof/mdat pairs */
+    uint64_t    mdat_payload;   /* mdat payload bytes */
+    int         sparse;         /* Leave the mdat payload as a hole */
+} bench_file_t;
+
+static const char *g_dir = "/tmp";
+static uint64_t    g_sparse_mb = 4096;
+
+static void put_be32(FILE *f, uint32_t v)
+{
+    uint8_t b[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16),
+                     (uint8_t)(v >> 8),  (uint8_t)v };
+    fwrite(b, 1, 4, f);
+}
+
+static void put_be64(FILE *f, uint64_t v)
+{
+    put_be32(f, (uint32_t)(v >> 32));
+    put_be32(f, (uint32_t)v);
+}
+
+static void put_box(FILE *f, uint32_t size, const char *type)
+{
+    put_be32(f, size);
+    fwrite(type, 1, 4, f);
+}
+
+static void put_zeros(FILE *f, size_t n)
+{
+    static const uint8_t zeros[256];
+    while (n > 0) {
+        size_t k = n < sizeof(zeros) ? n : sizeof(zeros);
+        fwrite(zeros, 1, k, f);
+        n -= k;
+    }
+}
+
+/* Cover art bytes: a JPEG SOI marker, then a repeating pattern. */
+static void put_cover(FILE *f, uint32_t size)
+{
+    uint8_t chunk[65536];
+    for (size_t i = 0; i < sizeof(chunk); i++)
+        chunk[i] = (uint8_t)(i * 31u + 7u);
+    chunk[0] = 0xFF; chunk[1] = 0xD8; chunk[2] = 0xFF; chunk[3] = 0xE0;
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t k = size - done < sizeof(chunk) ? size - done
+                                                 : (uint32_t)sizeof(chunk);
+        fwrite(chunk, 1, k, f);
+        if (done == 0) chunk[0] = chunk[1] = chunk[2] = chunk[3] = 0x5A;
+        done += k;
+    }
+}
+
+/* Text of item `index`, padded with dots to BENCH_VALUE_SIZE bytes. */
+static void item_value(unsigned index, char out[BENCH_VALUE_SIZE + 1])
+{
+    char head[BENCH_VALUE_SIZE + 1];
+    int n = snprintf(head, sizeof(head), "benchmark value %05u ", index);
+    memset(out, '.', BENCH_VALUE_SIZE);
+    memcpy(out, head, (size_t)n < BENCH_VALUE_SIZE ? (size_t)n : BENCH_VALUE_SIZE);
+    out[BENCH_VALUE_SIZE] = '\0';
+}
+
+static void put_text_item(FILE *f, const char *type, const char *value)
+{
+    uint32_t len = (uint32_t)strlen(value);
+    put_box(f, 24 + len, type);
+    put_box(f, 16 + len, "data");
+    put_be32(f, 1);            /* UTF-8 */
+    put_be32(f, 0);
+    fwrite(value, 1, len, f);
+}
+
+static uint32_t ilst_size(const bench_file_t *spec)
+{
+    uint32_t size = 8;
+    size += 24 + (uint32_t)strlen("Benchmark Title");
+    size += 24 + (uint32_t)strlen("Benchmark Artist");
+    size += spec->items * (24 + BENCH_VALUE_SIZE);
+    if (spec->cover_size > 0)
+        size += 24 + spec->cover_size;
+    return size;
+}
+
+static void put_mdat(FILE *f, const bench_file_t *spec)
+{
+    uint64_t total = 16 + spec->mdat_payload;
+    put_be32(f, 1);                         /* 64-bit size follows */
+    fwrite("mdat", 1, 4, f);
+    put_be64(f, total);
+
+    if (spec->sparse) {
+        fseeko(f, (off_t)spec->mdat_payload, SEEK_CUR);
+        return;
+    }
+    uint8_t chunk[65536];
+    memset(chunk, 0xA5, sizeof(chunk));
+    uint64_t left = spec->mdat_payload;
+    while (left > 0) {
+        size_t k = left < sizeof(chunk) ? (size_t)left : sizeof(chunk);
+        fwrite(chunk, 1, k, f);
+        left -= k;
+    }
+}
+
+static int generate(const bench_file_t *spec, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+
+    put_box(f, 20, "ftyp");
+    fwrite("M4A ", 1, 4, f);
+    put_be32(f, 0);
+    fwrite("isom", 1, 4, f);
+
+    uint32_t ilst     = ilst_size(spec);
+    uint32_t meta     = 12 + 33 + ilst + BENCH_ILST_PADDING;
+    uint32_t udta     = 8 + meta;
+    uint32_t moov     = 8 + 108 + 56 + udta;
+    uint64_t mdat_at  = spec->mdat_first ? 20 : 20 + (uint64_t)moov;
+
+    if (spec->mdat_first)
+        put_mdat(f, spec);
+
+    put_box(f, moov, "moov");
+    put_box(f, 108, "mvhd");
+    {
+        uint8_t mvhd[100] = { 0 };
+        mvhd[14] = 0x03; mvhd[15] = 0xE8;   /* timescale 1000 */
+        mvhd[99] = 1;                       /* next track ID */
+        fwrite(mvhd, 1, sizeof(mvhd), f);
+    }
+    put_box(f, 56, "trak");
+    put_box(f, 48, "mdia");
+    put_box(f, 40, "minf");
+    put_box(f, 32, "stbl");
+    put_box(f, 24, "stco");
+    put_be32(f, 0);
+    put_be32(f, 2);
+    put_be32(f, (uint32_t)(mdat_at + 16));
+    put_be32(f, (uint32_t)(mdat_at + 16 + 8));
+
+    put_box(f, udta, "udta");
+    put_box(f, meta, "meta");
+    put_be32(f, 0);
+    put_box(f, 33, "hdlr");
+    put_be32(f, 0); put_be32(f, 0);
+    fwrite("mdirappl", 1, 8, f);
+    put_zeros(f, 9);
+
+    put_box(f, ilst, "ilst");
+    put_text_item(f, "\xA9nam", "Benchmark Title");
+    put_text_item(f, "\xA9" "ART", "Benchmark Artist");
+    for (unsigned i = 0; i < spec->items; i++) {
+        char type[5], value[BENCH_VALUE_SIZE + 1];
+        snprintf(type, sizeof(type), "b%03u", i % 1000);
+        item_value(i, value);
+        put_text_item(f, type, value);
+    }
+    if (spec->cover_size > 0) {
+        put_box(f, 24 + spec->cover_size, "covr");
+        put_box(f, 16 + spec->cover_size, "data");
+        put_be32(f, 13);        /* JPEG */
+        put_be32(f, 0);
+        put_cover(f, spec->cover_size);
+    }
+    put_box(f, BENCH_ILST_PADDING, "free");
+    put_zeros(f, BENCH_ILST_PADDING - 8);
+
+    if (!spec->mdat_first)
+        put_mdat(f, spec);
+
+    for (unsigned i = 0; i < spec->moofs; i++) {
+        put_box(f, 24, "moof");
+        put_box(f, 16, "mfhd");
+        put_be32(f, 0);
+        put_be32(f, i + 1);
+        put_box(f, 24, "mdat");
+        put_zeros(f, 16);
+    }
+
+    /* A trailing hole needs the size set explicitly */
+    off_t end = ftello(f);
+    int rc = fflush(f) == 0 && ftruncate(fileno(f), end) == 0 ? 0 : -1;
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+/* The cover of every generated file, as a file of its own. */
+static int generate_cover(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    put_cover(f, BENCH_COVER_SIZE);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Measurement                                                        */
+/* ------------------------------------------------------------------ */
+
+/* Counters from /proc/self/io; `valid` is 0 where there are none. */
+typedef struct {
+    int      valid;
+    uint64_t syscr, syscw, rchar, wchar;
+} io_counters_t;
+
+static void io_snapshot(io_counters_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    int fd = open("/proc/self/io", O_RDONLY);
+    if (fd < 0) return;
+    char buf[512];
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return;
+    buf[n] = '\0';
+
+    for (char *line = buf; line && *line; ) {
+        unsigned long long v;
+        if      (sscanf(line, "rchar: %llu", &v) == 1) c->rchar = v;
+        else if (sscanf(line, "wchar: %llu", &v) == 1) c->wchar = v;
+        else if (sscanf(line, "syscr: %llu", &v) == 1) c->syscr = v;
+        else if (sscanf(line, "syscw: %llu", &v) == 1) c->syscw = v;
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+    c->valid = 1;
+}
+
+static void io_add_delta(io_counters_t *sum, const io_counters_t *a,
+                         const io_counters_t *b, const io_counters_t *bias)
+{
+    sum->valid  = a->valid && b->valid;
+    sum->syscr += b->syscr - a->syscr - bias->syscr;
+    sum->syscw += b->syscw - a->syscw - bias->syscw;
+    sum->rchar += b->rchar - a->rchar - bias->rchar;
+    sum->wchar += b->wchar - a->wchar - bias->wchar;
+}
+
+/* What one back-to-back pair of snapshots costs by itself. */
+static void io_bias(io_counters_t *bias)
+{
+    io_counters_t a, b;
+    io_snapshot(&a);
+    io_snapshot(&b);
+    memset(bias, 0, sizeof(*bias));
+    if (!a.valid || !b.valid) return;
+    bias->syscr = b.syscr - a.syscr;
+    bias->syscw = b.syscw - a.syscw;
+    bias->rchar = b.rchar - a.rchar;
+    bias->wchar = b.wchar - a.wchar;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Context allocator that tracks live bytes. Each block carries its size
+ * in a header so frees and reallocs can be accounted.
+ */
+typedef struct {
+    size_t live;
+    size_t peak;
+} heap_stats_t;
+
+#define HEAP_HEADER 16
+
+static void *heap_alloc(size_t size, void *user_data)
+{
+    heap_stats_t *h = user_data;
+    uint8_t *p = malloc(HEAP_HEADER + size);
+    if (!p) return NULL;
+    memcpy(p, &size, sizeof(size));
+    h->live += size;
+    if (h->live > h->peak) h->peak = h->live;
+    return p + HEAP_HEADER;
+}
+
+static void heap_free(void *ptr, void *user_data)
+{
+    if (!ptr) return;
+    heap_stats_t *h = user_data;
+    uint8_t *p = (uint8_t *)ptr - HEAP_HEADER;
+    size_t size;
+    memcpy(&size, p, sizeof(size));
+    h->live -= size;
+    free(p);
+}
+
+static void *heap_realloc(void *ptr, size_t size, void *user_data)
+{
+    if (!ptr) return heap_alloc(size, user_data);
+    heap_stats_t *h = user_data;
+    uint8_t *p = (uint8_t *)ptr - HEAP_HEADER;
+    size_t old;
+    memcpy(&old, p, sizeof(old));
+    uint8_t *q = realloc(p, HEAP_HEADER + size);
+    if (!q) return NULL;
+    memcpy(q, &size, sizeof(size));
+    h->live = h->live - old + size;
+    if (h->live > h->peak) h->peak = h->live;
+    return q + HEAP_HEADER;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Operations                                                         */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    const bench_file_t *spec;
+    const char         *path;       /* File the operation runs on */
+    const char         *cover_path;
+    int                 cover_fd;
+} bench_run_t;
+
+typedef struct {
+    const char *name;
+    unsigned    iterations;         /* Default count */
+    int         writes;             /* Needs a fresh copy per iteration */
+    int       (*run)(mp4tag_context_t *ctx, const bench_run_t *r);
+} bench_op_t;
+
+/*
+ * The file's own tags with a longer TITLE and, for `comment_size`, a
+ * COMMENT of that many bytes. The cover is streamed from its own file.
+ */
+static mp4tag_collection_t *build_tags(mp4tag_context_t *ctx,
+                                       const bench_run_t *r,
+                                       size_t comment_size)
+{
+    mp4tag_collection_t *coll = mp4tag_collection_create(ctx);
+    mp4tag_tag_t *tag = coll ? mp4tag_collection_add_tag(ctx, coll,
+                                                         MP4TAG_TARGET_ALBUM)
+                             : NULL;
+    if (!tag) {
+        mp4tag_collection_free(ctx, coll);
+        return NULL;
+    }
+
+    int ok = mp4tag_tag_add_simple(ctx, tag, "TITLE",
+                                   "Benchmark Title (retagged)") != NULL &&
+             mp4tag_tag_add_simple(ctx, tag, "ARTIST",
+                                   "Benchmark Artist") != NULL;
+    for (unsigned i = 0; ok && i < r->spec->items; i++) {
+        char name[5], value[BENCH_VALUE_SIZE + 1];
+        snprintf(name, sizeof(name), "b%03u", i % 1000);
+        item_value(i, value);
+        ok = mp4tag_tag_add_simple(ctx, tag, name, value) != NULL;
+    }
+    if (ok && r->spec->cover_size > 0) {
+        mp4tag_binary_source_t src;
+        memset(&src, 0, sizeof(src));
+        src.fd     = r->cover_fd;
+        src.offset = 0;
+        src.size   = r->spec->cover_size;
+        ok = mp4tag_tag_add_binary_source(ctx, tag, "COVER_ART", &src) != NULL;
+    }
+    if (ok && comment_size > 0) {
+        char *comment = malloc(comment_size + 1);
+        ok = comment != NULL;
+        if (ok) {
+            memset(comment, 'c', comment_size);
+            comment[comment_size] = '\0';
+            ok = mp4tag_tag_add_simple(ctx, tag, "COMMENT", comment) != NULL;
+            free(comment);
+        }
+    }
+    if (!ok) {
+        mp4tag_collection_free(ctx, coll);
+        return NULL;
+    }
+    return coll;
+}
+
+static int op_read_tags(mp4tag_context_t *ctx, const bench_run_t *r)
+{
+    int rc = mp4tag_open(ctx, r->path);
+    if (rc != MP4TAG_OK) return rc;
+    mp4tag_collection_t *coll = NULL;      /* Owned by the context */
+    return mp4tag_read_tags(ctx, &coll);
+}
+
+static int op_set_tag_string(mp4tag_context_t *ctx, const bench_run_t *r)
+{
+    int rc = mp4tag_open_rw(ctx, r->path);
+    if (rc != MP4TAG_OK) return rc;
+    return mp4tag_set_tag_string(ctx, "TITLE", "Benchmark Title (retagged)");
+}
+
+static int op_write(mp4tag_context_t *ctx, const bench_run_t *r,
+                    size_t comment_size, unsigned write_flags)
+{
+    int rc = mp4tag_open_rw(ctx, r->path);
+    if (rc != MP4TAG_OK) return rc;
+    rc = mp4tag_set_write_flags(ctx, write_flags);
+    if (rc != MP4TAG_OK) return rc;
+    mp4tag_collection_t *coll = build_tags(ctx, r, comment_size);
+    if (!coll) return MP4TAG_ERR_NO_MEMORY;
+    rc = mp4tag_write_tags(ctx, coll);
+    mp4tag_collection_free(ctx, coll);
+    return rc;
+}
+
+/* Fits the free box after the ilst */
+static int op_write_inplace(mp4tag_context_t *ctx, const bench_run_t *r)
+{
+    return op_write(ctx, r, 0, MP4TAG_WRITE_DEFAULT);
+}
+
+/* Outgrows the padding with the moov kept in place: a full rewrite */
+static int op_rewrite(mp4tag_context_t *ctx, const bench_run_t *r)
+{
+    return op_write(ctx, r, 2 * BENCH_ILST_PADDING, 0);
+}
+
+static const bench_op_t g_ops[] = {
+    { "read_tags",      200, 0, op_read_tags },
+    { "set_tag_string",  50, 1, op_set_tag_string },
+    { "write_inplace",   50, 1, op_write_inplace },
+    { "rewrite",         10, 1, op_rewrite },
+};
+
+static const char *strategy_name(mp4tag_write_strategy_t s)
+{
+    switch (s) {
+    case MP4TAG_STRATEGY_IN_PLACE:        return "in_place";
+    case MP4TAG_STRATEGY_PADDED_IN_PLACE: return "padded_in_place";
+    case MP4TAG_STRATEGY_RESHUFFLE:       return "reshuffle";
+    case MP4TAG_STRATEGY_RELOCATE:        return "relocate";
+    case MP4TAG_STRATEGY_REWRITE:         return "rewrite";
+    }
+    return "unknown";
+}
+
+/*
+ * The strategy an op_write-style operation will take on a fresh copy;
+ * NULL for operations that don't go through a collection.
+ */
+static const char *planned_strategy(const bench_op_t *op, const bench_run_t *r)
+{
+    size_t comment_size;
+    unsigned flags;
+    if (op->run == op_write_inplace) {
+        comment_size = 0; flags = MP4TAG_WRITE_DEFAULT;
+    } else if (op->run == op_rewrite) {
+        comment_size = 2 * BENCH_ILST_PADDING; flags = 0;
+    } else {
+        return NULL;
+    }
+
+    const char *name = NULL;
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    if (ctx && mp4tag_open(ctx, r->path) == MP4TAG_OK &&
+        mp4tag_set_write_flags(ctx, flags) == MP4TAG_OK) {
+        mp4tag_collection_t *coll = build_tags(ctx, r, comment_size);
+        mp4tag_write_plan_t plan;
+        if (coll && mp4tag_plan_write(ctx, coll, &plan) == MP4TAG_OK)
+            name = strategy_name(plan.strategy);
+        mp4tag_collection_free(ctx, coll);
+    }
+    mp4tag_destroy(ctx);
+    return name;
+}
+
+static void print_per_op(const char *key, int valid, uint64_t total,
+                         unsigned iterations)
+{
+    if (valid) printf(",\"%s\":%.1f", key, (double)total / iterations);
+    else       printf(",\"%s\":null", key);
+}
+
+/* Run one operation against one file; the child process of run_case. */
+static int bench_case(const bench_file_t *spec, const bench_op_t *op,
+                      unsigned iterations, const char *master,
+                      const char *cover_path)
+{
+    char work[1024];
+    snprintf(work, sizeof(work), "%s/mp4tag_bench_%s.work.mp4", g_dir,
+             spec->name);
+
+    bench_run_t r;
+    r.spec       = spec;
+    r.path       = op->writes ? work : master;
+    r.cover_path = cover_path;
+    r.cover_fd   = spec->cover_size > 0 ? open(cover_path, O_RDONLY) : -1;
+    if (spec->cover_size > 0 && r.cover_fd < 0) {
+        fprintf(stderr, "mp4tag_bench: %s: %s\n", cover_path, strerror(errno));
+        return 1;
+    }
+
+    const char *strategy = NULL;
+    if (op->writes) {
+        if (generate(spec, work) != 0) {
+            fprintf(stderr, "mp4tag_bench: cannot create %s\n", work);
+            close(r.cover_fd);
+            return 1;
+        }
+        strategy = planned_strategy(op, &r);
+    }
+
+    io_counters_t bias, io;
+    io_bias(&bias);
+    memset(&io, 0, sizeof(io));
+    io.valid = 1;
+
+    heap_stats_t heap = { 0, 0 };
+    size_t alloc_peak = 0;
+    mp4tag_allocator_t allocator = { heap_alloc, heap_realloc, heap_free, &heap };
+
+    double elapsed = 0;
+    int rc = MP4TAG_OK;
+    for (unsigned i = 0; i < iterations && rc == MP4TAG_OK; i++) {
+        if (op->writes && i > 0 && generate(spec, work) != 0) {
+            rc = MP4TAG_ERR_IO;
+            break;
+        }
+
+        io_counters_t a, b;
+        heap.live = heap.peak = 0;
+        io_snapshot(&a);
+        double t0 = now_seconds();
+
+        mp4tag_context_t *ctx = mp4tag_create(&allocator);
+        rc = ctx ? op->run(ctx, &r) : MP4TAG_ERR_NO_MEMORY;
+        mp4tag_destroy(ctx);
+
+        elapsed += now_seconds() - t0;
+        io_snapshot(&b);
+        io_add_delta(&io, &a, &b, &bias);
+        if (heap.peak > alloc_peak) alloc_peak = heap.peak;
+    }
+
+    if (r.cover_fd >= 0) close(r.cover_fd);
+    if (op->writes) remove(work);
+    if (rc != MP4TAG_OK) {
+        fprintf(stderr, "mp4tag_bench: %s/%s: %s\n", spec->name, op->name,
+                mp4tag_strerror(rc));
+        return 1;
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    long peak_rss_kb = (long)(ru.ru_maxrss / 1024);     /* bytes on macOS */
+#else
+    long peak_rss_kb = (long)ru.ru_maxrss;
+#endif
+
+    printf("{\"version\":\"%s\",\"file\":\"%s\",\"op\":\"%s\"",
+           mp4tag_version(), spec->name, op->name);
+    if (strategy) printf(",\"strategy\":\"%s\"", strategy);
+    else          printf(",\"strategy\":null");
+    printf(",\"iterations\":%u,\"seconds\":%.6f,\"ops_per_sec\":%.1f",
+           iterations, elapsed, elapsed > 0 ? iterations / elapsed : 0.0);
+    print_per_op("read_syscalls",  io.valid, io.syscr, iterations);
+    print_per_op("write_syscalls", io.valid, io.syscw, iterations);
+    print_per_op("bytes_read",     io.valid, io.rchar, iterations);
+    print_per_op("bytes_written",  io.valid, io.wchar, iterations);
+    printf(",\"alloc_peak_bytes\":%zu,\"peak_rss_kb\":%ld}\n",
+           alloc_peak, peak_rss_kb);
+    fflush(stdout);
+    return 0;
+}
+
+/*
+ * Fork so that each (file, op) pair starts from a small process and its
+ * peak RSS is its own.
+ */
+static int run_case(const bench_file_t *spec, const bench_op_t *op,
+                    unsigned iterations, const char *master,
+                    const char *cover_path)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) return bench_case(spec, op, iterations, master, cover_path);
+    if (pid == 0)
+        _exit(bench_case(spec, op, iterations, master, cover_path));
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR) return 1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Main                                                               */
+/* ------------------------------------------------------------------ */
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: mp4tag_bench [-n iterations] [--dir path] "
+            "[--sparse-mb size] [--only name]\n"
+            "  -n           iterations per operation (default: per op)\n"
+            "  --dir        where the generated files go (default /tmp)\n"
+            "  --sparse-mb  sparse mdat size in MiB, 0 to skip (default 4096)\n"
+            "  --only       run only files or operations with this name\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned iterations = 0;
+    const char *only = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            g_dir = argv[++i];
+        } else if (strcmp(argv[i], "--sparse-mb") == 0 && i + 1 < argc) {
+            g_sparse_mb = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    const bench_file_t files[] = {
+        { "ilst200",  200, 0,                0, 0,                 65536, 0 },
+        { "covr10m",  8,   BENCH_COVER_SIZE, 0, 0,                 65536, 0 },
+        { "moov_end", 8,   0,                1, 0,             1u << 20, 0 },
+        { "frag10k",  8,   0,                0, BENCH_MOOF_COUNT,  65536, 0 },
+        { "sparse",   8,   0,                0, 0, g_sparse_mb << 20,     1 },
+    };
+
+    char cover_path[1024];
+    snprintf(cover_path, sizeof(cover_path), "%s/mp4tag_bench_cover.jpg", g_dir);
+    if (generate_cover(cover_path) != 0) {
+        fprintf(stderr, "mp4tag_bench: cannot create %s\n", cover_path);
+        return 1;
+    }
+
+    int failed = 0;
+    for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+        const bench_file_t *spec = &files[f];
+        if (spec->sparse && g_sparse_mb == 0) continue;
+        int file_selected = !only || strcmp(only, spec->name) == 0;
+
+        char master[1024];
+        snprintf(master, sizeof(master), "%s/mp4tag_bench_%s.mp4", g_dir,
+                 spec->name);
+        int generated = 0;
+
+        for (size_t o = 0; o < sizeof(g_ops) / sizeof(g_ops[0]); o++) {
+            const bench_op_t *op = &g_ops[o];
+            if (!file_selected && strcmp(only, op->name) != 0) continue;
+
+            if (!generated) {
+                if (generate(spec, master) != 0) {
+                    fprintf(stderr, "mp4tag_bench: cannot create %s\n", master);
+                    failed = 1;
+                    break;
+                }
+                generated = 1;
+            }
+
+            /* A multi-GB copy per iteration is measured once */
+            unsigned n = iterations ? iterations : op->iterations;
+            if (spec->sparse && op->run == op_rewrite) n = 1;
+            if (run_case(spec, op, n, master, cover_path) != 0) failed = 1;
+        }
+        if (generated) remove(master);
+    }
+
+    remove(cover_path);
+    return failed ? 1 : 0;
+}
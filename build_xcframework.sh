@@ -22,9 +22,20 @@ IOS_DEPLOYMENT_TARGET="13.0"
 # Source files
 SOURCES=(
     src/mp4tag.c
+    src/mp4tag_cache.c
+    src/mp4tag_probe.c
+    src/mp4tag_scan.c
+    src/mp4tag_snapshot.c
     src/mp4/mp4_atoms.c
+    src/mp4/mp4_moov.c
     src/mp4/mp4_parser.c
     src/mp4/mp4_tags.c
+    src/util/mp4_arena.c
+    src/util/mp4_block_cache.c
+    src/util/mp4_copy.c
+    src/util/mp4_io_count.c
+    src/util/mp4_text.c
+    src/util/mp4_uring.c
     deps/libtag_common/src/file_io.c
     deps/libtag_common/src/buffer.c
     deps/libtag_common/src/string_util.c
@@ -26,9 +26,79 @@ void              mp4tag_destroy(mp4tag_context_t *ctx);
 
 int  mp4tag_open(mp4tag_context_t *ctx, const char *path);
 int  mp4tag_open_rw(mp4tag_context_t *ctx, const char *path);
+
+/*
+ * Open a file read-only through a private memory mapping. Boxes and tag
+ * values are decoded straight from the mapping; no read calls are made.
+ */
+int  mp4tag_open_mapped(mp4tag_context_t *ctx, const char *path);
+
+/*
+ * Parse a complete MP4 file the caller already holds in memory. The
+ * bytes are not copied and must stay valid and unchanged until
+ * mp4tag_close. The context is read-only.
+ */
+int  mp4tag_open_memory(mp4tag_context_t *ctx, const void *data, size_t size);
+
+/*
+ * Open through caller-supplied I/O (see mp4tag_io_t). The callbacks and
+ * `user` must stay valid until mp4tag_close. The moov box is always
+ * held in memory, so one larger than the moov read limit is
+ * MP4TAG_ERR_UNSUPPORTED. With a write_at callback the context is
+ * writable, but only the strategies that write inside the object are
+ * available: a write that would need a full rewrite returns
+ * MP4TAG_ERR_UNSUPPORTED, and durability is up to the callbacks.
+ */
+int  mp4tag_open_io(mp4tag_context_t *ctx, const mp4tag_io_t *io);
+
+/*
+ * Close the file. The context keeps its moov, serialization and arena
+ * buffers, up to the retain limit, for the next open to reuse.
+ */
 void mp4tag_close(mp4tag_context_t *ctx);
 int  mp4tag_is_open(const mp4tag_context_t *ctx);
 
+/*
+ * Close the file and put every setting back to its mp4tag_create
+ * default (the allocator and retain limit stay), so one context can
+ * serve many files without being destroyed and created again.
+ */
+void mp4tag_reset(mp4tag_context_t *ctx);
+
+/* Default upper bound on the memory a closed context keeps. */
+#define MP4TAG_DEFAULT_RETAIN_LIMIT (4u * 1024u * 1024u)
+
+/*
+ * Set how many bytes of buffer and arena capacity the context keeps
+ * across mp4tag_close and mp4tag_reset; anything beyond is freed at
+ * close. 0 frees everything, as a new context would start.
+ */
+int  mp4tag_set_retain_limit(mp4tag_context_t *ctx, size_t bytes);
+
+/* ---------- Parse options ---------- */
+
+/* Default upper bound for reading the whole moov box in one go. */
+#define MP4TAG_DEFAULT_MOOV_READ_LIMIT (16u * 1024u * 1024u)
+
+/*
+ * Set the largest moov box (in bytes) that open reads into memory with a
+ * single read; structure and tag parsing then run without further file
+ * I/O. Larger moov boxes are walked box by box. 0 disables buffering.
+ * Takes effect on the next open.
+ */
+int mp4tag_set_moov_read_limit(mp4tag_context_t *ctx, size_t limit);
+
+/* Default buffer sizes for mp4tag_io_options_t. */
+#define MP4TAG_DEFAULT_COPY_BUFFER (1024u * 1024u)
+#define MP4TAG_DEFAULT_TAIL_READ   (1024u * 1024u)
+
+/*
+ * Set buffer sizes and page cache behaviour (see mp4tag_io_options_t);
+ * NULL restores the defaults. The tail read takes effect on the next
+ * open, the rest on the next write.
+ */
+int mp4tag_set_io_options(mp4tag_context_t *ctx, const mp4tag_io_options_t *opts);
+
 /* ---------- Tag reading ---------- */
 
 /*
@@ -46,6 +116,57 @@ int mp4tag_read_tags(mp4tag_context_t *ctx, mp4tag_collection_t **tags);
 int mp4tag_read_tag_string(mp4tag_context_t *ctx, const char *name,
                            char *value, size_t size);
 
+/*
+ * Read a single tag value by item FourCC (e.g. MP4TAG_FOURCC(0xA9,'n',
+ * 'a','m') for TITLE) without any name comparison. Lookups by FourCC and
+ * by a mapped name use an index built once per parse.
+ */
+int mp4tag_read_tag_fourcc(mp4tag_context_t *ctx, uint32_t fourcc,
+                           char *value, size_t size);
+
+/*
+ * Read-only view of every ilst data box, without building a collection.
+ * `*items` points at `*count` entries owned by the context; their `data`
+ * borrows the buffered moov (or the mapping in memory modes), so no
+ * per-item allocation or copy takes place. When moov was too large to
+ * buffer, the ilst box is read into the context once. An item with more
+ * than one data box (several cover images) yields one entry per box.
+ * The view remains valid until the next mp4tag_write_tags,
+ * mp4tag_set_tag_string, mp4tag_remove_tag, edit commit, option change
+ * that discards the cache, or mp4tag_close.
+ */
+int mp4tag_read_tags_view(mp4tag_context_t *ctx,
+                          const mp4tag_item_view_t **items, size_t *count);
+
+/*
+ * Lazy binary mode: when enabled, binary values (cover art and other
+ * non-text items) are not read by mp4tag_read_tags. Their simple tags
+ * have binary == NULL, with binary_size and binary_offset describing
+ * where the bytes live; fetch them with mp4tag_read_binary. A
+ * collection holding lazy values can be written back as is: the write
+ * reads them in first (mp4tag_write_tags_to streams them from the
+ * file). Off by default. Changing the mode discards the cached
+ * collection.
+ */
+int mp4tag_set_lazy_binary(mp4tag_context_t *ctx, int enable);
+
+/*
+ * Copy `len` bytes starting `offset` bytes into a simple tag's binary
+ * value into `buf`. Works for both loaded and lazy values; lazy values
+ * are streamed from the file (or mapping) on demand.
+ */
+int mp4tag_read_binary(mp4tag_context_t *ctx, const mp4tag_simple_tag_t *tag,
+                       size_t offset, void *buf, size_t len);
+
+/*
+ * Get a pointer to a simple tag's binary value without copying. Lazy
+ * values are only available this way in mapped/memory modes and on
+ * tag index hits (returns MP4TAG_ERR_UNSUPPORTED otherwise). The pointer
+ * shares the lifetime of the collection.
+ */
+int mp4tag_binary_view(mp4tag_context_t *ctx, const mp4tag_simple_tag_t *tag,
+                       const uint8_t **data);
+
 /* ---------- Tag writing ---------- */
 
 /*
@@ -54,6 +175,18 @@ int mp4tag_read_tag_string(mp4tag_context_t *ctx, const char *name,
  */
 int mp4tag_write_tags(mp4tag_context_t *ctx, const mp4tag_collection_t *tags);
 
+/*
+ * Write a copy of the file carrying `tags` to `sink` in one sequential
+ * pass: ftyp, the rebuilt moov, then the untouched media ranges, laid
+ * out as a full rewrite would lay them out (MP4TAG_WRITE_FASTSTART and
+ * the padding settings apply). The source file and the context are left
+ * as they are, so any open context will do, read-only or not. Nothing
+ * is written on the source filesystem. On error the sink may have
+ * received part of the file.
+ */
+int mp4tag_write_tags_to(mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                         const mp4tag_sink_t *sink);
+
 /*
  * Set or create a single tag. Pass NULL as value to remove the tag.
  * Tags are placed at the ALBUM target level (type 50).
@@ -66,8 +199,82 @@ int mp4tag_set_tag_string(mp4tag_context_t *ctx, const char *name,
  */
 int mp4tag_remove_tag(mp4tag_context_t *ctx, const char *name);
 
+/* ---------- Edit transactions ---------- */
+
+/*
+ * Stage several changes and write them together. mp4tag_edit_begin
+ * snapshots the current tags; mp4tag_edit_set / mp4tag_edit_remove (and
+ * mp4tag_set_tag_string / mp4tag_remove_tag while the edit is open)
+ * change only that snapshot; mp4tag_edit_commit writes it with a single
+ * mp4tag_write_tags and ends the edit, whether or not the write succeeds.
+ * mp4tag_edit_abort discards it. Closing the file aborts an open edit.
+ *
+ * A set replaces an existing tag of that name where it stands; a value
+ * of NULL removes it. Returns MP4TAG_ERR_EDIT_ACTIVE from begin if an
+ * edit is already open and MP4TAG_ERR_NO_EDIT from the others if none is.
+ */
+int  mp4tag_edit_begin(mp4tag_context_t *ctx);
+int  mp4tag_edit_set(mp4tag_context_t *ctx, const char *name, const char *value);
+int  mp4tag_edit_remove(mp4tag_context_t *ctx, const char *name);
+int  mp4tag_edit_commit(mp4tag_context_t *ctx);
+void mp4tag_edit_abort(mp4tag_context_t *ctx);
+
+/*
+ * Set how much padding a full rewrite reserves after the new ilst
+ * (see mp4tag_padding_mode_t). The padding is emitted as a free box
+ * inside meta, which the next in-place write can grow into.
+ */
+int mp4tag_set_padding(mp4tag_context_t *ctx, mp4tag_padding_mode_t mode,
+                       uint32_t value);
+
+/*
+ * Choose the write strategies mp4tag_write_tags may use (MP4TAG_WRITE_*
+ * flags, default MP4TAG_WRITE_DEFAULT). Clear MP4TAG_WRITE_RELOCATE_MOOV
+ * to keep moov where it is (e.g. ahead of mdat for progressive playback)
+ * at the cost of a full-file rewrite when the tags grow. Set
+ * MP4TAG_WRITE_FASTSTART to also move a trailing moov to the front when
+ * the file is rewritten.
+ */
+int mp4tag_set_write_flags(mp4tag_context_t *ctx, unsigned flags);
+
+/*
+ * Set the durability of writes (see mp4tag_durability_t). Takes effect
+ * on the next write.
+ */
+int mp4tag_set_durability(mp4tag_context_t *ctx, mp4tag_durability_t mode);
+
+/*
+ * Dry run of mp4tag_write_tags: fill `plan` with the strategy that
+ * writing `tags` would use under the current padding and write flags,
+ * and what it would cost. Reads the file as needed but never writes to
+ * it, so a read-only context will do. Returns the error the write would
+ * fail with, if any; MP4TAG_ERR_READ_ONLY for memory-backed contexts.
+ */
+int mp4tag_plan_write(mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                      mp4tag_write_plan_t *plan);
+
+/* ---------- Statistics ---------- */
+
+/*
+ * Copy the context's counters and phase timings (see mp4tag_stats_t).
+ * They accumulate across open/close until mp4tag_reset_stats.
+ */
+int  mp4tag_get_stats(const mp4tag_context_t *ctx, mp4tag_stats_t *stats);
+void mp4tag_reset_stats(mp4tag_context_t *ctx);
+
+/*
+ * Install trace callbacks around each phase (see mp4tag_trace_t), or
+ * remove them with NULL. The struct is copied.
+ */
+int mp4tag_set_trace(mp4tag_context_t *ctx, const mp4tag_trace_t *trace);
+
 /* ---------- Collection building ---------- */
 
+/*
+ * A collection and everything added to it share one arena drawn from the
+ * context's allocator; mp4tag_collection_free releases it all at once.
+ */
+
 mp4tag_collection_t *mp4tag_collection_create(mp4tag_context_t *ctx);
 void                 mp4tag_collection_free(mp4tag_context_t *ctx,
                                             mp4tag_collection_t *coll);
@@ -86,6 +293,21 @@ mp4tag_simple_tag_t *mp4tag_simple_tag_add_nested(mp4tag_context_t *ctx,
                                                   const char *name,
                                                   const char *value);
 
+/*
+ * Add a simple tag whose binary value (COVER_ART) is streamed from
+ * `source` when the collection is written, so a large image never has
+ * to be loaded into memory. The source description is copied; the fd or
+ * callback behind it must stay usable until the last write of the
+ * collection. JPEG or PNG is told from the first bytes of the value.
+ * A regular file too short for `size` fails the write before anything
+ * is written; a callback that fails part way through an in-place write
+ * leaves the ilst partly written, as an I/O error would.
+ */
+mp4tag_simple_tag_t *mp4tag_tag_add_binary_source(mp4tag_context_t *ctx,
+                                                  mp4tag_tag_t *tag,
+                                                  const char *name,
+                                                  const mp4tag_binary_source_t *source);
+
 int mp4tag_simple_tag_set_language(mp4tag_context_t *ctx,
                                   mp4tag_simple_tag_t *simple_tag,
                                   const char *language);
@@ -93,6 +315,164 @@ int mp4tag_simple_tag_set_language(mp4tag_context_t *ctx,
 int mp4tag_tag_add_track_uid(mp4tag_context_t *ctx, mp4tag_tag_t *tag,
                              uint64_t uid);
 
+/* ---------- Batch scanning ---------- */
+
+/*
+ * Read the tags of many files on a pool of worker threads. Each worker
+ * owns one context for the whole scan, so moov buffers and the view
+ * array are reused from file to file. Workers take paths from their own
+ * queue and steal half of another worker's remaining queue when theirs
+ * runs dry, so slow files (cold cache, network storage) do not hold up
+ * the rest. `opts` may be NULL for defaults.
+ *
+ * With MP4TAG_SCAN_ASYNC_IO (Linux), each worker also overlaps the
+ * structure reads of up to `queue_depth` files on an io_uring instead of
+ * waiting on one file at a time; results are the same as without it.
+ *
+ * Returns MP4TAG_OK once every path was handled or the callback asked to
+ * stop; per-file failures are reported through the callback only.
+ */
+int mp4tag_scan_paths(const char *const *paths, size_t count,
+                      const mp4tag_scan_options_t *opts,
+                      mp4tag_scan_result_fn on_result, void *user_data);
+
+/*
+ * As mp4tag_scan_paths, with paths pulled from `next` (a directory walker,
+ * say) in small batches as workers need them. Returns
+ * MP4TAG_ERR_NO_MEMORY if the scan had to stop pulling paths early.
+ */
+int mp4tag_scan_walk(mp4tag_scan_next_fn next, void *next_data,
+                     const mp4tag_scan_options_t *opts,
+                     mp4tag_scan_result_fn on_result, void *user_data);
+
+/* ---------- Read planning ---------- */
+
+/*
+ * Plan the reads for a file of `file_size` bytes without doing them, so
+ * the ranges of many files can be fetched concurrently:
+ *
+ *   while (mp4tag_probe_plan(p, r, n, &count) == MP4TAG_OK && count > 0)
+ *       for each r[i]: fetch it, then mp4tag_probe_feed(p, ...)
+ *   mp4tag_probe_result(p, &data, &size);
+ *   mp4tag_open_memory(ctx, data, size);
+ *
+ * The first plan asks for the head of the file and (with room for two
+ * ranges) its tail, which between them hold moov for most files; later
+ * plans ask for top-level box headers until moov is found, then for
+ * whatever of moov is still missing. A plan with count 0 means the
+ * result is ready.
+ */
+mp4tag_probe_t *mp4tag_probe_create(uint64_t file_size);
+void            mp4tag_probe_destroy(mp4tag_probe_t *probe);
+
+/*
+ * The ranges needed next (at most `max`). Returns MP4TAG_ERR_NOT_MP4,
+ * _TRUNCATED or _CORRUPT once the bytes fed show the file can't be
+ * parsed.
+ */
+int mp4tag_probe_plan(mp4tag_probe_t *probe, mp4tag_range_t *ranges,
+                      size_t max, size_t *count);
+
+/*
+ * Hand over `size` fetched bytes starting at `offset` (copied). Any
+ * range inside the file may be fed, planned or not.
+ */
+int mp4tag_probe_feed(mp4tag_probe_t *probe, uint64_t offset,
+                      const void *data, size_t size);
+
+/*
+ * Once planning is done: a compact stand-in for the file, its ftyp
+ * followed by its moov, to open with mp4tag_open_memory. Tags read the
+ * same as from the file itself, but box offsets are those of the
+ * stand-in. The bytes belong to the probe. MP4TAG_ERR_NOT_OPEN while
+ * ranges are still outstanding.
+ */
+int mp4tag_probe_result(const mp4tag_probe_t *probe, const uint8_t **data,
+                        size_t *size);
+
+/* ---------- Tag index cache ---------- */
+
+/*
+ * Open (creating if need be) a persistent tag index at `path`. Entries
+ * are keyed by device, inode, mtime and size, so an entry is only used
+ * while the file is unchanged. New entries are appended; a file written
+ * by a different build, or a record cut short by a crash, is discarded
+ * rather than misread. One index may be shared by contexts on several
+ * threads, and should outlive them.
+ */
+int  mp4tag_cache_open(const char *path, mp4tag_cache_t **cache);
+void mp4tag_cache_close(mp4tag_cache_t *cache);
+
+/* Default limit on the ilst size of a stored entry. */
+#define MP4TAG_CACHE_DEFAULT_MAX_ILST (1024u * 1024u)
+
+/*
+ * Largest ilst box (cover art included) stored in the index; files with
+ * bigger tags are parsed from the file every time.
+ */
+int  mp4tag_cache_set_max_ilst(mp4tag_cache_t *cache, size_t bytes);
+
+/*
+ * Open `path` read-only, answering from `cache` when it holds an entry
+ * for the file as it is now: the only system call is a stat, and tags
+ * and views are served from the entry (lazy binaries and
+ * mp4tag_binary_view included). Otherwise the file is opened as with
+ * mp4tag_open and an entry is stored for next time. A context opened
+ * from the index has no file behind it: mp4tag_write_tags_to returns
+ * MP4TAG_ERR_UNSUPPORTED.
+ */
+int  mp4tag_open_cached(mp4tag_context_t *ctx, mp4tag_cache_t *cache,
+                        const char *path);
+
+/*
+ * Keep `cache` up to date from this context: every successful write
+ * stores a fresh entry for the file. NULL detaches it. Reset by
+ * mp4tag_reset.
+ */
+int  mp4tag_set_cache(mp4tag_context_t *ctx, mp4tag_cache_t *cache);
+
+/* ---------- Shared snapshots ---------- */
+
+/*
+ * Parse the tags of the open file into a new snapshot with a reference
+ * count of 1. The snapshot copies everything it needs (the ilst bytes
+ * once, with binary values and views pointing into that copy), so it
+ * outlives the context and never changes. Any number of threads may
+ * read one snapshot at once; only the retain/release calls touch it.
+ * Its memory comes from the context allocator, which must outlive it.
+ * MP4TAG_ERR_NO_TAGS if the file has no ilst.
+ */
+int  mp4tag_read_snapshot(mp4tag_context_t *ctx, mp4tag_snapshot_t **snap);
+
+/* Take another reference; returns `snap`. */
+mp4tag_snapshot_t *mp4tag_snapshot_retain(mp4tag_snapshot_t *snap);
+
+/* Drop a reference; the last one frees the snapshot. NULL is a no-op. */
+void mp4tag_snapshot_release(mp4tag_snapshot_t *snap);
+
+/*
+ * 1 while no context in this process has written the file since the
+ * snapshot was taken, 0 after one has (the snapshot stays readable, it
+ * is just out of date). Each file has a generation counter that every
+ * write through mp4tag_write_tags and its wrappers bumps, and this is
+ * one atomic load. Writes by other processes are not seen: check
+ * mtime, or use the tag index, for those.
+ */
+int  mp4tag_snapshot_is_current(const mp4tag_snapshot_t *snap);
+
+/* The parsed collection; binary values are always loaded. */
+const mp4tag_collection_t *mp4tag_snapshot_tags(const mp4tag_snapshot_t *snap);
+
+/* As mp4tag_read_tags_view; the views share the snapshot's lifetime. */
+int  mp4tag_snapshot_views(const mp4tag_snapshot_t *snap,
+                           const mp4tag_item_view_t **items, size_t *count);
+
+/* As mp4tag_read_tag_string / mp4tag_read_tag_fourcc. */
+int  mp4tag_snapshot_tag_string(const mp4tag_snapshot_t *snap, const char *name,
+                                char *value, size_t size);
+int  mp4tag_snapshot_tag_fourcc(const mp4tag_snapshot_t *snap, uint32_t fourcc,
+                                char *value, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
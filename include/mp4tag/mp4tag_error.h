@@ -37,6 +37,10 @@ extern "C" {
 #define MP4TAG_ERR_SEEK_FAILED    -32
 #define MP4TAG_ERR_RENAME_FAILED  -33
 
+/* Edit transaction errors */
+#define MP4TAG_ERR_EDIT_ACTIVE    -40
+#define MP4TAG_ERR_NO_EDIT        -41
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,20 +25,56 @@ typedef enum {
     MP4TAG_TARGET_SHOT       = 10
 } mp4tag_target_type_t;
 
+/* Storage behind a collection (internal to the library) */
+struct mp4_arena;
+
+/*
+ * A binary value read at write time instead of held in memory (see
+ * mp4tag_tag_add_binary_source). The bytes come from `fd` with pread,
+ * starting at `offset`, or with `fd` < 0 from `read`, whose offsets are
+ * relative to the start of the value. `size` must be exact: box headers
+ * are sized from it before a byte is read.
+ */
+typedef struct {
+    int      fd;
+    int64_t  offset;
+    /* Bytes read into `buf` (short only at the end), or -1 */
+    int64_t (*read)(void *user, void *buf, size_t len, uint64_t offset);
+    void    *user;
+    uint64_t size;
+} mp4tag_binary_source_t;
+
 /*
  * A name/value tag pair. Forms a singly-linked list.
  * Names use human-readable identifiers (e.g. "TITLE", "ARTIST").
+ *
+ * Collections own all their nodes and strings in a single arena that is
+ * released by mp4tag_collection_free; create nodes with the collection
+ * building functions rather than allocating them yourself. Fields marked
+ * internal are maintained by the library.
  */
 typedef struct mp4tag_simple_tag {
     char    *name;          /* Tag name (UTF-8) */
-    char    *value;         /* String value (UTF-8, may be NULL) */
+    char    *value;         /* String value (UTF-8, may be NULL); UTF-16
+                               atoms are transcoded on read */
     uint8_t *binary;        /* Binary value (may be NULL) */
     size_t   binary_size;   /* Size of binary data */
+    int64_t  binary_offset; /* File offset of binary data when loaded lazily
+                               (binary == NULL, binary_size > 0) */
     char    *language;      /* Language code (may be NULL, defaults to "und") */
     int      is_default;    /* Whether this is the default for the language */
+    int      text_invalid;  /* Value held malformed UTF-8 (kept as-is) or
+                               UTF-16 (bad units replaced with U+FFFD) */
+    const mp4tag_binary_source_t *binary_source;
+                            /* Streamed binary value, written in place of
+                               `binary` (may be NULL) */
 
     struct mp4tag_simple_tag *nested;  /* First nested child */
     struct mp4tag_simple_tag *next;    /* Next sibling */
+
+    struct mp4tag_simple_tag *nested_tail; /* Internal: last nested child
+                                              (or NULL) */
+    struct mp4_arena *arena;           /* Internal: owning storage */
 } mp4tag_simple_tag_t;
 
 /*
@@ -60,6 +96,9 @@ typedef struct mp4tag_tag {
 
     mp4tag_simple_tag_t  *simple_tags;
     struct mp4tag_tag    *next;
+
+    mp4tag_simple_tag_t  *simple_tail;  /* Internal: last simple tag (or NULL) */
+    struct mp4_arena     *arena;        /* Internal: owning storage */
 } mp4tag_tag_t;
 
 /*
@@ -68,8 +107,212 @@ typedef struct mp4tag_tag {
 typedef struct {
     mp4tag_tag_t *tags;
     size_t        count;
+
+    mp4tag_tag_t     *tail;   /* Internal: last tag (or NULL) */
+    struct mp4_arena *arena;  /* Internal: owning storage */
 } mp4tag_collection_t;
 
+/* Build an item FourCC from its four bytes (for mp4tag_read_tag_fourcc) */
+#define MP4TAG_FOURCC(a, b, c, d) \
+    (((uint32_t)(uint8_t)(a) << 24) | ((uint32_t)(uint8_t)(b) << 16) | \
+     ((uint32_t)(uint8_t)(c) << 8)  |  (uint32_t)(uint8_t)(d))
+
+/*
+ * Padding reserved after ilst when the file has to be rewritten, so that
+ * later edits that grow the tags can still be made in place.
+ */
+typedef enum {
+    MP4TAG_PADDING_NONE     = 0,  /* No slack (default) */
+    MP4TAG_PADDING_FIXED    = 1,  /* value = padding bytes */
+    MP4TAG_PADDING_PERCENT  = 2,  /* value = percentage of the ilst size */
+    MP4TAG_PADDING_ROUND_UP = 3   /* value = round ilst + padding up to a
+                                     multiple of this many bytes */
+} mp4tag_padding_mode_t;
+
+/*
+ * Write strategy flags (mp4tag_set_write_flags). When the new tags no
+ * longer fit inside the existing moov, these decide how it grows.
+ */
+#define MP4TAG_WRITE_RELOCATE_MOOV  0x1u  /* Append the grown moov at the end
+                                             of the file and turn the old one
+                                             into a free box, instead of
+                                             rewriting the whole file. Files
+                                             with moov before mdat lose
+                                             faststart layout. */
+#define MP4TAG_WRITE_FASTSTART      0x2u  /* A full rewrite places moov ahead
+                                             of the first mdat (chunk offsets
+                                             are adjusted). Takes precedence
+                                             over RELOCATE_MOOV. */
+
+#define MP4TAG_WRITE_DEFAULT        (MP4TAG_WRITE_RELOCATE_MOOV)
+
+/*
+ * How hard a write works to be on stable storage before it returns
+ * (mp4tag_set_durability).
+ */
+typedef enum {
+    MP4TAG_DURABILITY_NONE = 0,   /* No syncs at all: for batch jobs that
+                                     sync the volume once at the end. A
+                                     crash before then can leave an edit
+                                     half written */
+    MP4TAG_DURABILITY_DATA = 1,   /* fdatasync the written data, and order
+                                     the steps of a moov relocation */
+    MP4TAG_DURABILITY_FULL = 2    /* fsync, and after a rewrite's rename
+                                     fsync the directory too (default) */
+} mp4tag_durability_t;
+
+/*
+ * I/O policy (mp4tag_set_io_options). Zero sizes select the defaults.
+ * The cache flags only affect full rewrites, where the whole file is
+ * copied: without them a large rewrite can push everything else out of
+ * the page cache.
+ */
+#define MP4TAG_IO_FADVISE  0x1u   /* Read the source sequentially and drop
+                                     copied pages of the source and the
+                                     temp file from the page cache as the
+                                     copy goes */
+#define MP4TAG_IO_DIRECT   0x2u   /* Copy large source ranges with uncached
+                                     aligned reads (O_DIRECT, F_NOCACHE on
+                                     Apple platforms), where supported */
+
+typedef struct {
+    size_t   copy_buffer_size;    /* Rewrite copy buffer, 0 = 1 MiB */
+    size_t   tail_read_size;      /* Read at EOF that finds a trailing
+                                     moov in one go, 0 = 1 MiB (at most
+                                     the moov read limit) */
+    unsigned flags;               /* MP4TAG_IO_* */
+} mp4tag_io_options_t;
+
+/*
+ * Caller-supplied I/O (mp4tag_open_io), e.g. HTTP range requests
+ * against object storage. Offsets are absolute. Reads go through a
+ * block cache that merges the parser's small reads into a few
+ * block-aligned requests; with moov near the start, opening a file and
+ * reading its tags typically takes one or two.
+ */
+typedef struct {
+    /* Bytes read into `buf` (short only at the end of the object), or -1 */
+    int64_t (*read_at)(void *user, void *buf, size_t len, uint64_t offset);
+    /* Bytes written, or -1. NULL opens the context read-only */
+    int64_t (*write_at)(void *user, const void *buf, size_t len, uint64_t offset);
+    /* Object size in bytes, or -1 */
+    int64_t (*size)(void *user);
+    void    *user;
+    size_t   block_size;          /* Cache block and smallest request,
+                                     0 = 256 KiB */
+    size_t   cache_blocks;        /* Blocks kept, 0 = 16 */
+} mp4tag_io_t;
+
+/*
+ * Strategy mp4tag_write_tags would use for a set of tags, cheapest first
+ * (see mp4tag_plan_write).
+ */
+typedef enum {
+    MP4TAG_STRATEGY_IN_PLACE        = 0,  /* Same-size ilst: only the items
+                                             that changed are rewritten */
+    MP4TAG_STRATEGY_PADDED_IN_PLACE = 1,  /* ilst rewritten over itself and
+                                             the free box after it */
+    MP4TAG_STRATEGY_RESHUFFLE       = 2,  /* moov rewritten at its current
+                                             size, absorbing its padding */
+    MP4TAG_STRATEGY_RELOCATE        = 3,  /* Grown moov appended at EOF */
+    MP4TAG_STRATEGY_REWRITE         = 4   /* Whole file copied to a temp
+                                             file, then renamed over it */
+} mp4tag_write_strategy_t;
+
+typedef struct {
+    mp4tag_write_strategy_t strategy;
+    uint64_t bytes_written;   /* New bytes written (items, ilst, moov) */
+    uint64_t bytes_copied;    /* Existing bytes copied into the new file
+                                 (REWRITE only; reflinks may make this
+                                 cheaper than it looks) */
+    uint64_t temp_space;      /* Extra disk space needed while writing */
+    uint64_t file_size;       /* File size once written */
+} mp4tag_write_plan_t;
+
+/*
+ * Phases of a read or write, for mp4tag_get_stats timings and the trace
+ * callbacks. Phases nest: a write contains its serialize, sync and
+ * rename phases, and often a parse of what it wrote.
+ */
+typedef enum {
+    MP4TAG_PHASE_PARSE     = 0,   /* File structure or ilst parsing */
+    MP4TAG_PHASE_SERIALIZE = 1,   /* Encoding ilst or udta */
+    MP4TAG_PHASE_WRITE     = 2,   /* Running the chosen write strategy */
+    MP4TAG_PHASE_SYNC      = 3,   /* fsync/fdatasync (per durability) */
+    MP4TAG_PHASE_RENAME    = 4,   /* A rewrite's temp file over the original */
+    MP4TAG_PHASE_COUNT     = 5
+} mp4tag_phase_t;
+
+/* Why the last write was not made in place (mp4tag_stats_t). */
+typedef enum {
+    MP4TAG_INPLACE_OK        = 0, /* It was, or no write has been made */
+    MP4TAG_INPLACE_NO_ILST   = 1, /* The file had no ilst to replace */
+    MP4TAG_INPLACE_TOO_LARGE = 2, /* The new ilst outgrew the old one and
+                                     the free box after it */
+    MP4TAG_INPLACE_FAILED    = 3  /* The in-place write returned an error */
+} mp4tag_inplace_result_t;
+
+/*
+ * Counters of a context since it was created or mp4tag_reset_stats
+ * (mp4tag_get_stats). reads, seeks and writes count the calls made on
+ * the file handle or the caller's I/O (cache misses, for mp4tag_open_io);
+ * a rewrite's copy is counted in bytes only.
+ */
+typedef struct {
+    uint64_t reads;
+    uint64_t seeks;
+    uint64_t writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;   /* New bytes: tags, moov, rewrite output
+                                 other than copied ranges */
+    uint64_t bytes_copied;    /* Existing bytes copied by rewrites */
+
+    uint64_t                write_count;    /* Successful writes */
+    mp4tag_write_strategy_t last_strategy;  /* Of the last one */
+    mp4tag_inplace_result_t inplace_result; /* Of the last one */
+
+    uint64_t phase_ns[MP4TAG_PHASE_COUNT];    /* Total time per phase */
+    uint64_t phase_count[MP4TAG_PHASE_COUNT]; /* Times each phase ran */
+} mp4tag_stats_t;
+
+/*
+ * Trace callbacks (mp4tag_set_trace), called around every phase on the
+ * thread making the call. `end` gets the phase's duration. Either may
+ * be NULL.
+ */
+typedef struct {
+    void (*begin)(void *user, mp4tag_phase_t phase);
+    void (*end)(void *user, mp4tag_phase_t phase, uint64_t elapsed_ns);
+    void  *user;
+} mp4tag_trace_t;
+
+/*
+ * Destination of mp4tag_write_tags_to. With `fd` >= 0 the file is
+ * written to it from its current position with plain write(2), so a
+ * pipe or socket will do; otherwise every byte goes to `write`, which
+ * returns the number of bytes it took (at least 1) or -1 to abort.
+ */
+typedef struct {
+    int      fd;
+    int64_t (*write)(void *user, const void *buf, size_t len);
+    void    *user;
+} mp4tag_sink_t;
+
+/*
+ * Borrowed view of one ilst data box, as returned by
+ * mp4tag_read_tags_view. Nothing is decoded or copied: `data` points at
+ * the raw payload (after the type indicator and locale) inside the
+ * context's moov buffer or file mapping.
+ */
+typedef struct {
+    uint32_t        fourcc;     /* Item atom type (e.g. 0xA96E616D for \251nam) */
+    const char     *name;       /* Canonical name ("TITLE"), NULL if unmapped */
+    uint32_t        data_type;  /* Well-known type: 1 UTF-8, 2 UTF-16,
+                                   13 JPEG, 14 PNG, 21 integer, 0 implicit */
+    const uint8_t  *data;
+    size_t          size;
+} mp4tag_item_view_t;
+
 /*
  * Custom allocator interface.
  */
@@ -85,6 +328,71 @@ typedef struct {
  */
 typedef struct mp4tag_context mp4tag_context_t;
 
+/*
+ * Persistent tag index (mp4tag_cache_*): parsed structure and tags of
+ * many files kept in one file, so unchanged files need no reads.
+ */
+typedef struct mp4tag_cache mp4tag_cache_t;
+
+/*
+ * Immutable parsed tags of one file (mp4tag_read_snapshot), shared by
+ * reference count and readable from any thread without locking.
+ */
+typedef struct mp4tag_snapshot mp4tag_snapshot_t;
+
+/*
+ * Batch scanning (mp4tag_scan_paths / mp4tag_scan_walk).
+ */
+
+/*
+ * Path source for mp4tag_scan_walk: return the next path, or NULL when
+ * there are no more. Calls are serialized; the string only needs to stay
+ * valid until the next call.
+ */
+typedef const char *(*mp4tag_scan_next_fn)(void *user_data);
+
+/*
+ * Per-file result. `index` is the order in which the path was supplied,
+ * `status` the result of opening and reading the file. `ctx` is open on
+ * the file whenever the open succeeded (otherwise NULL), so any read
+ * function may be used on it; `tags` is the parsed collection, or NULL
+ * on failure or with MP4TAG_SCAN_VIEWS_ONLY. Both are only valid during
+ * the call. Results arrive in completion order and calls are serialized.
+ * Return non-zero to stop the scan.
+ */
+typedef int (*mp4tag_scan_result_fn)(const char *path, size_t index, int status,
+                                     mp4tag_context_t *ctx,
+                                     const mp4tag_collection_t *tags,
+                                     void *user_data);
+
+#define MP4TAG_SCAN_LAZY_BINARY  0x1u  /* Leave binary values in the file */
+#define MP4TAG_SCAN_MAPPED       0x2u  /* Open files with mp4tag_open_mapped */
+#define MP4TAG_SCAN_VIEWS_ONLY   0x4u  /* Skip mp4tag_read_tags; use the ctx */
+#define MP4TAG_SCAN_ASYNC_IO     0x8u  /* Overlap structure reads with io_uring
+                                          (Linux; ignored with MAPPED or
+                                          where unavailable) */
+
+typedef struct {
+    unsigned                  threads;    /* Worker count, 0 = online CPUs */
+    unsigned                  flags;      /* MP4TAG_SCAN_* */
+    const mp4tag_allocator_t *allocator;  /* For the per-worker contexts */
+    unsigned                  queue_depth;/* ASYNC_IO: files in flight per
+                                             worker, 0 = 16 */
+    mp4tag_cache_t           *cache;      /* Tag index to answer from and
+                                             fill, or NULL */
+} mp4tag_scan_options_t;
+
+/*
+ * Read planning (mp4tag_probe_*): works out which byte ranges of a file
+ * the parser needs, for callers that fetch them themselves.
+ */
+typedef struct mp4tag_probe mp4tag_probe_t;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} mp4tag_range_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -2,6 +2,7 @@
 /* Copyright (c) 2025 Morgan Prior */
 
 #include "mp4_atoms.h"
+#include "../util/mp4_io_count.h"
 #include "../../include/mp4tag/mp4tag_error.h"
 
 #include <string.h>
@@ -14,7 +15,7 @@ int mp4_read_box_header(file_handle_t *fh, mp4_box_t *box)
     if (box->offset < 0) return MP4TAG_ERR_IO;
 
     uint8_t hdr[8];
-    int rc = file_read(fh, hdr, 8);
+    int rc = mp4_file_read(fh, hdr, 8);
     if (rc != 0) return rc;
 
     uint32_t raw_size = ((uint32_t)hdr[0] << 24) | ((uint32_t)hdr[1] << 16) |
@@ -25,7 +26,7 @@ int mp4_read_box_header(file_handle_t *fh, mp4_box_t *box)
     if (raw_size == 1) {
         /* Extended 64-bit size */
         uint8_t ext[8];
-        rc = file_read(fh, ext, 8);
+        rc = mp4_file_read(fh, ext, 8);
         if (rc != 0) return rc;
 
         box->size = ((int64_t)ext[0] << 56) | ((int64_t)ext[1] << 48) |
@@ -50,6 +51,54 @@ int mp4_read_box_header(file_handle_t *fh, mp4_box_t *box)
     return MP4TAG_OK;
 }
 
+int mp4_parse_box_header(const uint8_t *data, size_t avail, int64_t offset,
+                         mp4_box_t *box)
+{
+    if (!data || !box) return MP4TAG_ERR_INVALID_ARG;
+    if (avail < 8)     return MP4TAG_ERR_TRUNCATED;
+
+    uint32_t raw_size = mp4_load_be32(data);
+    box->type   = mp4_load_be32(data + 4);
+    box->offset = offset;
+
+    if (raw_size == 1) {
+        if (avail < 16) return MP4TAG_ERR_TRUNCATED;
+        uint64_t ext = mp4_load_be64(data + 8);
+        if (ext > (uint64_t)INT64_MAX) return MP4TAG_ERR_BAD_BOX;
+        box->size = (int64_t)ext;
+        box->header_size = 16;
+    } else if (raw_size == 0) {
+        box->size = (int64_t)avail;
+        box->header_size = 8;
+    } else {
+        box->size = raw_size;
+        box->header_size = 8;
+    }
+
+    box->data_offset = box->offset + box->header_size;
+    box->data_size   = box->size - box->header_size;
+
+    return MP4TAG_OK;
+}
+
+int mp4_span_read_box_header(const mp4_span_t *span, int64_t pos, int64_t end,
+                             mp4_box_t *box)
+{
+    if (!span || !box) return MP4TAG_ERR_INVALID_ARG;
+    if (pos < span->offset || end < pos ||
+        end > span->offset + (int64_t)span->size)
+        return MP4TAG_ERR_TRUNCATED;
+
+    int rc = mp4_parse_box_header(mp4_span_at(span, pos), (size_t)(end - pos),
+                                  pos, box);
+    if (rc != MP4TAG_OK) return rc;
+
+    if (box->size < box->header_size || box->size > end - pos)
+        return MP4TAG_ERR_CORRUPT;
+
+    return MP4TAG_OK;
+}
+
 void mp4_fourcc_to_str(uint32_t fourcc, char out[5])
 {
     out[0] = (char)((fourcc >> 24) & 0xFF);
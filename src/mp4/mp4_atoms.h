@@ -28,6 +28,16 @@ typedef struct {
     int      header_size;   /* 8 or 16 */
 } mp4_box_t;
 
+/*
+ * A run of file bytes held in memory: data[0] is the byte at file
+ * offset `offset`. Used to walk boxes without further file I/O.
+ */
+typedef struct {
+    const uint8_t *data;
+    int64_t        offset;
+    size_t         size;
+} mp4_span_t;
+
 /* Create a FourCC from a string literal */
 #define MP4_FOURCC(a,b,c,d) \
     (((uint32_t)(uint8_t)(a) << 24) | ((uint32_t)(uint8_t)(b) << 16) | \
@@ -47,6 +57,10 @@ typedef struct {
 #define MP4_BOX_TRAK  MP4_FOURCC('t','r','a','k')
 #define MP4_BOX_MDIA  MP4_FOURCC('m','d','i','a')
 #define MP4_BOX_MVHD  MP4_FOURCC('m','v','h','d')
+#define MP4_BOX_MINF  MP4_FOURCC('m','i','n','f')
+#define MP4_BOX_STBL  MP4_FOURCC('s','t','b','l')
+#define MP4_BOX_STCO  MP4_FOURCC('s','t','c','o')
+#define MP4_BOX_CO64  MP4_FOURCC('c','o','6','4')
 
 /* iTunes-specific tag atom types */
 #define MP4_TAG_NAM   MP4_FOURCC(0xA9,'n','a','m')  /* Title */
@@ -86,6 +100,29 @@ typedef struct {
 /* Read a box header at the current file position. */
 int mp4_read_box_header(file_handle_t *fh, mp4_box_t *box);
 
+/*
+ * Parse a box header from memory. `data` points at the box start, which
+ * lives at file offset `offset`; `avail` is the number of bytes from
+ * `data` to the end of the enclosing container (a to-EOF box is sized
+ * to fill it). The header itself must fit within `avail`.
+ */
+int mp4_parse_box_header(const uint8_t *data, size_t avail, int64_t offset,
+                         mp4_box_t *box);
+
+/*
+ * Parse the header of the box starting at file offset `pos` from a span.
+ * The box must lie entirely within [pos, end), and `end` must not extend
+ * past the span. Returns MP4TAG_ERR_CORRUPT for boxes that overrun.
+ */
+int mp4_span_read_box_header(const mp4_span_t *span, int64_t pos, int64_t end,
+                             mp4_box_t *box);
+
+/* Pointer to the in-memory byte at file offset `pos` (must be in span). */
+static inline const uint8_t *mp4_span_at(const mp4_span_t *span, int64_t pos)
+{
+    return span->data + (pos - span->offset);
+}
+
 /* Convert a FourCC to a string (writes 5 bytes including NUL). */
 void mp4_fourcc_to_str(uint32_t fourcc, char out[5]);
 
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#include "mp4_moov.h"
+#include "../util/mp4_buffer_ext.h"
+#include "../../include/mp4tag/mp4tag_error.h"
+
+#include <string.h>
+
+/* ------------------------------------------------------------------ */
+/*  Offset map                                                         */
+/* ------------------------------------------------------------------ */
+
+int64_t mp4_offset_map_apply(const mp4_offset_map_t *map, int64_t offset)
+{
+    size_t lo = 0, hi = map->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const mp4_offset_range_t *r = &map->ranges[mid];
+        if (offset < r->src_offset)
+            hi = mid;
+        else if (offset >= r->src_offset + r->size)
+            lo = mid + 1;
+        else
+            return offset - r->src_offset + r->dst_offset;
+    }
+    return offset;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Rebuild                                                            */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    const mp4_span_t       *src;
+    const uint8_t          *udta;
+    size_t                  udta_size;
+    uint64_t                udta_extern;
+    const mp4_offset_map_t *map;
+    dyn_buffer_t           *out;
+} rebuild_t;
+
+/* Containers on the path from moov to the chunk offset tables */
+static int is_offset_container(uint32_t type)
+{
+    return type == MP4_BOX_TRAK || type == MP4_BOX_MDIA ||
+           type == MP4_BOX_MINF || type == MP4_BOX_STBL;
+}
+
+static int copy_box(rebuild_t *rb, const mp4_box_t *box)
+{
+    if (buffer_append(rb->out, mp4_span_at(rb->src, box->offset),
+                      (size_t)box->size) != 0)
+        return MP4TAG_ERR_NO_MEMORY;
+    return MP4TAG_OK;
+}
+
+/* Rewrite an stco/co64 table through the offset map. */
+static int rebuild_chunk_offsets(rebuild_t *rb, const mp4_box_t *box)
+{
+    int is64 = box->type == MP4_BOX_CO64;
+    int64_t payload = box->size - box->header_size;
+    if (payload < 8) return MP4TAG_ERR_CORRUPT;
+
+    const uint8_t *p = mp4_span_at(rb->src, box->data_offset);
+    uint32_t count = mp4_load_be32(p + 4);
+    size_t width = is64 ? 8 : 4;
+    if ((uint64_t)count > (uint64_t)(payload - 8) / width)
+        return MP4TAG_ERR_CORRUPT;
+    const uint8_t *entries = p + 8;
+
+    /* Promote to co64 if any relocated offset passes 4 GiB */
+    int out64 = is64;
+    for (uint32_t i = 0; i < count && !out64; i++) {
+        int64_t off = mp4_offset_map_apply(rb->map, mp4_load_be32(entries + 4 * i));
+        if (off > (int64_t)UINT32_MAX) out64 = 1;
+    }
+
+    uint64_t size = 16 + (uint64_t)count * (out64 ? 8 : 4);
+    if (size > UINT32_MAX) return MP4TAG_ERR_UNSUPPORTED;
+
+    dyn_buffer_t *out = rb->out;
+    if (mp4_write_box_header(out, out64 ? MP4_BOX_CO64 : MP4_BOX_STCO,
+                             (uint32_t)size) != 0 ||
+        buffer_append(out, p, 8) != 0)           /* version/flags, count */
+        return MP4TAG_ERR_NO_MEMORY;
+
+    for (uint32_t i = 0; i < count; i++) {
+        int64_t src = is64 ? (int64_t)mp4_load_be64(entries + 8 * i)
+                           : (int64_t)mp4_load_be32(entries + 4 * i);
+        int64_t dst = mp4_offset_map_apply(rb->map, src);
+        int rc = out64 ? buffer_append_be64(out, (uint64_t)dst)
+                       : buffer_append_be32(out, (uint32_t)dst);
+        if (rc != 0) return MP4TAG_ERR_NO_MEMORY;
+    }
+    return MP4TAG_OK;
+}
+
+/*
+ * Rebuild a container: 8-byte header, children (recursing towards the
+ * chunk offset tables when remapping), and for moov the new udta. The
+ * size is patched in once the children are written.
+ */
+static int rebuild_container(rebuild_t *rb, const mp4_box_t *box)
+{
+    dyn_buffer_t *out = rb->out;
+    size_t start = out->size;
+    int is_moov = box->type == MP4_BOX_MOOV;
+
+    if (mp4_write_box_header(out, box->type, 0) != 0)
+        return MP4TAG_ERR_NO_MEMORY;
+
+    int64_t end = box->offset + box->size;
+    int64_t pos = box->data_offset;
+    while (pos + 8 <= end) {
+        mp4_box_t child;
+        int rc = mp4_span_read_box_header(rb->src, pos, end, &child);
+        if (rc != MP4TAG_OK) return rc;
+
+        if (is_moov && (child.type == MP4_BOX_UDTA ||
+                        child.type == MP4_BOX_FREE ||
+                        child.type == MP4_BOX_SKIP))
+            rc = MP4TAG_OK;             /* udta replaced below, padding dropped */
+        else if (rb->map && is_offset_container(child.type))
+            rc = rebuild_container(rb, &child);
+        else if (rb->map && (child.type == MP4_BOX_STCO ||
+                             child.type == MP4_BOX_CO64))
+            rc = rebuild_chunk_offsets(rb, &child);
+        else
+            rc = copy_box(rb, &child);
+        if (rc != MP4TAG_OK) return rc;
+
+        pos = child.offset + child.size;
+    }
+
+    if (is_moov && rb->udta_size > 0 &&
+        buffer_append(out, rb->udta, rb->udta_size) != 0)
+        return MP4TAG_ERR_NO_MEMORY;
+
+    uint64_t size = out->size - start;
+    if (is_moov) size += rb->udta_extern;
+    if (size > UINT32_MAX) return MP4TAG_ERR_UNSUPPORTED;
+    mp4_store_be32(out->data + start, (uint32_t)size);
+    return MP4TAG_OK;
+}
+
+int mp4_moov_rebuild(const mp4_span_t *moov, const uint8_t *udta,
+                     size_t udta_size, uint64_t udta_extern,
+                     const mp4_offset_map_t *map, dyn_buffer_t *out)
+{
+    if (!moov || !out || (!udta && udta_size > 0))
+        return MP4TAG_ERR_INVALID_ARG;
+
+    mp4_box_t box;
+    int rc = mp4_span_read_box_header(moov, moov->offset,
+                                      moov->offset + (int64_t)moov->size, &box);
+    if (rc != MP4TAG_OK) return rc;
+    if (box.type != MP4_BOX_MOOV) return MP4TAG_ERR_BAD_BOX;
+
+    rebuild_t rb = { moov, udta, udta_size, udta_extern, map, out };
+    out->size = 0;
+    return rebuild_container(&rb, &box);
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#ifndef MP4_MOOV_H
+#define MP4_MOOV_H
+
+#include "mp4_atoms.h"
+#include <tag_common/buffer.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Where a byte range of the source file lands in the output file.
+ * A rewrite describes every copied top-level box with one of these so
+ * that chunk offsets can follow the media data they point at.
+ */
+typedef struct {
+    int64_t src_offset;
+    int64_t size;
+    int64_t dst_offset;
+} mp4_offset_range_t;
+
+typedef struct {
+    const mp4_offset_range_t *ranges;   /* Sorted by src_offset */
+    size_t                    count;
+} mp4_offset_map_t;
+
+/*
+ * Translate a source file offset through the map. Offsets outside every
+ * range are returned unchanged.
+ */
+int64_t mp4_offset_map_apply(const mp4_offset_map_t *map, int64_t offset);
+
+/*
+ * Rebuild a moov box in memory with a replacement udta.
+ *
+ * `moov` must hold the complete source moov box (header included).
+ * Every child except udta and free/skip padding is copied in order, then
+ * `udta` (a complete udta box, as produced by mp4_tags_wrap_udta) is
+ * appended. The result is written to `out` (cleared first) with 8-byte
+ * headers. `udta_extern` counts udta bytes streamed in later rather than
+ * held in `udta` (see mp4_splices_t); the udta starts at
+ * out->size - udta_size.
+ *
+ * If `map` is non-NULL, every stco/co64 table under trak/mdia/minf/stbl
+ * is rewritten through it; an stco whose offsets no longer fit in 32
+ * bits is promoted to co64 (growing moov and its parents). With a NULL
+ * map the tables are copied verbatim.
+ */
+int mp4_moov_rebuild(const mp4_span_t *moov, const uint8_t *udta,
+                     size_t udta_size, uint64_t udta_extern,
+                     const mp4_offset_map_t *map, dyn_buffer_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MP4_MOOV_H */
@@ -2,40 +2,28 @@
 /* Copyright (c) 2025 Morgan Prior */
 
 #include "mp4_parser.h"
+#include "../util/mp4_io_count.h"
 #include "../../include/mp4tag/mp4tag_error.h"
 
 #include <string.h>
 
-int mp4_validate_ftyp(file_handle_t *fh)
+/*
+ * Check the brands in an ftyp payload (major brand, minor version,
+ * compatible brands) against the ones this library handles.
+ */
+static int check_ftyp_brands(const uint8_t *data, size_t size)
 {
-    if (!fh) return MP4TAG_ERR_INVALID_ARG;
-
-    int rc = file_seek(fh, 0);
-    if (rc != 0) return MP4TAG_ERR_SEEK_FAILED;
-
-    mp4_box_t box;
-    rc = mp4_read_box_header(fh, &box);
-    if (rc != 0) return MP4TAG_ERR_NOT_MP4;
-
-    if (box.type != MP4_BOX_FTYP)
-        return MP4TAG_ERR_NOT_MP4;
-
     /* Read major brand (4 bytes) */
-    if (box.data_size < 4)
+    if (size < 4)
         return MP4TAG_ERR_NOT_MP4;
 
-    uint8_t brand[4];
-    rc = file_read(fh, brand, 4);
-    if (rc != 0) return MP4TAG_ERR_NOT_MP4;
-
     /*
      * Accept common MP4/M4A/M4V brands:
      *   isom, iso2, iso5, iso6, mp41, mp42, M4A , M4B , M4P , M4V ,
      *   avc1, f4v , qt  , MSNV, NDAS, dash
      * Also accept 3gp/3g2 variants.
      */
-    uint32_t major = ((uint32_t)brand[0] << 24) | ((uint32_t)brand[1] << 16) |
-                     ((uint32_t)brand[2] << 8)  |  (uint32_t)brand[3];
+    uint32_t major = mp4_load_be32(data);
 
     switch (major) {
     case MP4_FOURCC('i','s','o','m'):
@@ -67,39 +55,93 @@ int mp4_validate_ftyp(file_handle_t *fh)
      * If the major brand isn't recognized, scan compatible brands.
      * This handles files whose major brand is unusual but list
      * a recognized brand in their compatible list.
+     * Skip major brand (4) + minor version (4) = 8 bytes from data start.
      */
-    if (box.data_size >= 12) {
-        /* Skip major brand (4) + minor version (4) = 8 bytes from data start */
-        int64_t compat_offset = box.data_offset + 8;
-        int64_t compat_end = box.data_offset + box.data_size;
-        rc = file_seek(fh, compat_offset);
-        if (rc != 0) return MP4TAG_ERR_NOT_MP4;
-
-        while (compat_offset + 4 <= compat_end) {
-            uint8_t cb[4];
-            rc = file_read(fh, cb, 4);
-            if (rc != 0) break;
-            uint32_t compat = ((uint32_t)cb[0] << 24) | ((uint32_t)cb[1] << 16) |
-                              ((uint32_t)cb[2] << 8)  |  (uint32_t)cb[3];
-            switch (compat) {
-            case MP4_FOURCC('i','s','o','m'):
-            case MP4_FOURCC('m','p','4','1'):
-            case MP4_FOURCC('m','p','4','2'):
-            case MP4_FOURCC('M','4','A',' '):
-            case MP4_FOURCC('M','4','B',' '):
-            case MP4_FOURCC('M','4','V',' '):
-            case MP4_FOURCC('a','v','c','1'):
-                return MP4TAG_OK;
-            default:
-                break;
-            }
-            compat_offset += 4;
+    for (size_t off = 8; off + 4 <= size; off += 4) {
+        switch (mp4_load_be32(data + off)) {
+        case MP4_FOURCC('i','s','o','m'):
+        case MP4_FOURCC('m','p','4','1'):
+        case MP4_FOURCC('m','p','4','2'):
+        case MP4_FOURCC('M','4','A',' '):
+        case MP4_FOURCC('M','4','B',' '):
+        case MP4_FOURCC('M','4','V',' '):
+        case MP4_FOURCC('a','v','c','1'):
+            return MP4TAG_OK;
+        default:
+            break;
         }
     }
 
     return MP4TAG_ERR_NOT_MP4;
 }
 
+/* Upper bound on the ftyp payload examined for compatible brands. */
+#define MP4_FTYP_SCAN_MAX 1024
+
+int mp4_validate_ftyp(file_handle_t *fh)
+{
+    if (!fh) return MP4TAG_ERR_INVALID_ARG;
+
+    int rc = mp4_file_seek(fh, 0);
+    if (rc != 0) return MP4TAG_ERR_SEEK_FAILED;
+
+    mp4_box_t box;
+    rc = mp4_read_box_header(fh, &box);
+    if (rc != 0) return MP4TAG_ERR_NOT_MP4;
+
+    if (box.type != MP4_BOX_FTYP || box.data_size < 4)
+        return MP4TAG_ERR_NOT_MP4;
+
+    uint8_t payload[MP4_FTYP_SCAN_MAX];
+    size_t  n = box.data_size < MP4_FTYP_SCAN_MAX
+              ? (size_t)box.data_size : MP4_FTYP_SCAN_MAX;
+    n &= ~(size_t)3;
+    rc = mp4_file_read(fh, payload, n);
+    if (rc != 0) return MP4TAG_ERR_NOT_MP4;
+
+    return check_ftyp_brands(payload, n);
+}
+
+int mp4_validate_ftyp_reader(const mp4_reader_t *reader)
+{
+    if (!reader || !reader->read_at) return MP4TAG_ERR_INVALID_ARG;
+
+    uint8_t head[16];
+    size_t n = reader->size < 16 ? (size_t)(reader->size > 0 ? reader->size : 0) : 16;
+    mp4_box_t box;
+    if (reader->read_at(reader->user, head, n, 0) != MP4TAG_OK ||
+        mp4_parse_box_header(head, n, 0, &box) != MP4TAG_OK)
+        return MP4TAG_ERR_NOT_MP4;
+
+    if (box.type != MP4_BOX_FTYP || box.data_size < 4 || box.size > reader->size)
+        return MP4TAG_ERR_NOT_MP4;
+
+    uint8_t payload[MP4_FTYP_SCAN_MAX];
+    size_t  len = box.data_size < MP4_FTYP_SCAN_MAX
+                ? (size_t)box.data_size : MP4_FTYP_SCAN_MAX;
+    len &= ~(size_t)3;
+    if (reader->read_at(reader->user, payload, len, box.data_offset) != MP4TAG_OK)
+        return MP4TAG_ERR_NOT_MP4;
+
+    return check_ftyp_brands(payload, len);
+}
+
+int mp4_validate_ftyp_span(const mp4_span_t *file)
+{
+    if (!file || file->offset != 0) return MP4TAG_ERR_INVALID_ARG;
+
+    mp4_box_t box;
+    if (mp4_parse_box_header(file->data, file->size, 0, &box) != MP4TAG_OK)
+        return MP4TAG_ERR_NOT_MP4;
+
+    if (box.type != MP4_BOX_FTYP || box.data_size < 4 ||
+        box.size > (int64_t)file->size)
+        return MP4TAG_ERR_NOT_MP4;
+
+    return check_ftyp_brands(file->data + box.header_size,
+                             (size_t)box.data_size);
+}
+
 /*
  * Scan children of a container box looking for a specific type.
  * Returns MP4TAG_OK and fills `found` if the box is found.
@@ -112,7 +154,7 @@ static int find_child_box(file_handle_t *fh, int64_t parent_data_offset,
     int64_t end = parent_data_offset + parent_data_size;
 
     while (pos + 8 <= end) {
-        int rc = file_seek(fh, pos);
+        int rc = mp4_file_seek(fh, pos);
         if (rc != 0) return rc;
 
         mp4_box_t child;
@@ -143,7 +185,7 @@ static int find_free_after(file_handle_t *fh, int64_t after_offset,
     if (after_offset + 8 > container_end)
         return MP4TAG_ERR_TAG_NOT_FOUND;
 
-    int rc = file_seek(fh, after_offset);
+    int rc = mp4_file_seek(fh, after_offset);
     if (rc != 0) return rc;
 
     mp4_box_t box;
@@ -159,119 +201,511 @@ static int find_free_after(file_handle_t *fh, int64_t after_offset,
     return MP4TAG_ERR_TAG_NOT_FOUND;
 }
 
-int mp4_parse_structure(file_handle_t *fh, mp4_file_info_t *info)
+/*
+ * Span equivalent of find_child_box: scan children of a container box
+ * that has already been read into memory.
+ */
+static int find_child_box_span(const mp4_span_t *span, int64_t parent_data_offset,
+                               int64_t parent_data_size, uint32_t target_type,
+                               mp4_box_t *found)
 {
-    if (!fh || !info) return MP4TAG_ERR_INVALID_ARG;
+    int64_t pos = parent_data_offset;
+    int64_t end = parent_data_offset + parent_data_size;
+
+    while (pos + 8 <= end) {
+        mp4_box_t child;
+        int rc = mp4_span_read_box_header(span, pos, end, &child);
+        if (rc != MP4TAG_OK) return rc;
+
+        if (child.type == target_type) {
+            *found = child;
+            return MP4TAG_OK;
+        }
+
+        pos = child.offset + child.size;
+    }
+
+    return MP4TAG_ERR_TAG_NOT_FOUND;
+}
 
+/*
+ * Walk the top-level boxes and record ftyp, moov and mdat positions.
+ * The walk stops once moov is known; everything after it (mdat, and on
+ * fragmented files every moof/mdat pair) is only visited when a writer
+ * asks for it through mp4_parse_top_level_finish.
+ */
+void mp4_top_level_begin(mp4_file_info_t *info)
+{
     memset(info, 0, sizeof(*info));
-    info->ftyp_offset = -1;
-    info->moov_offset = -1;
-    info->mdat_offset = -1;
+    info->ftyp_offset     = -1;
+    info->moov_offset     = -1;
+    info->mdat_offset     = -1;
+    info->last_box_offset = -1;
+}
 
-    int64_t fsize = file_size(fh);
-    if (fsize < 8) return MP4TAG_ERR_TRUNCATED;
+void mp4_top_level_note(mp4_file_info_t *info, const mp4_box_t *box)
+{
+    info->last_box_offset = box->offset;
 
-    /* Scan top-level boxes */
-    int64_t pos = 0;
-    while (pos + 8 <= fsize) {
-        int rc = file_seek(fh, pos);
-        if (rc != 0) return rc;
+    switch (box->type) {
+    case MP4_BOX_FTYP:
+        info->ftyp_offset = box->offset;
+        break;
+    case MP4_BOX_MOOV:
+        /* The first moov is the one in use */
+        if (info->moov_offset < 0) {
+            info->moov_offset = box->offset;
+            info->moov_size   = box->size;
+        }
+        break;
+    case MP4_BOX_MDAT:
+        info->mdat_offset = box->offset;
+        info->mdat_size   = box->size;
+        break;
+    default:
+        break;
+    }
+}
+
+#define WALK_STOP_MOOV 0x1     /* Pause after moov */
+#define WALK_STOP_MDAT 0x2     /* Pause after an mdat while moov is unknown */
 
+/*
+ * Walk from info->top_level_pos, taking headers from `tail` (which ends
+ * at EOF) once the walk reaches it, and from `reader` instead of `fh`
+ * when one is given. A paused walk leaves top_level_done clear and
+ * top_level_pos at the next box.
+ */
+static int walk_top_level(file_handle_t *fh, const mp4_reader_t *reader,
+                          mp4_file_info_t *info, int64_t fsize,
+                          const mp4_span_t *tail, unsigned stop)
+{
+    int64_t pos = info->top_level_pos;
+    while (pos + 8 <= fsize) {
         mp4_box_t box;
-        rc = mp4_read_box_header(fh, &box);
+        int rc;
+        if (tail && tail->size > 0 && pos >= tail->offset) {
+            rc = mp4_parse_box_header(mp4_span_at(tail, pos),
+                                      (size_t)(fsize - pos), pos, &box);
+        } else if (reader) {
+            /* avail is the rest of the file: a size-0 box runs to EOF */
+            uint8_t hdr[16];
+            size_t n = fsize - pos < 16 ? (size_t)(fsize - pos) : 16;
+            rc = reader->read_at(reader->user, hdr, n, pos);
+            if (rc == MP4TAG_OK)
+                rc = mp4_parse_box_header(hdr, (size_t)(fsize - pos), pos, &box);
+        } else {
+            rc = mp4_file_seek(fh, pos);
+            if (rc != 0) return rc;
+            rc = mp4_read_box_header(fh, &box);
+        }
         if (rc != 0) break;
 
         if (box.size < 8) break;
+        mp4_top_level_note(info, &box);
+        pos = box.offset + box.size;
 
-        switch (box.type) {
-        case MP4_BOX_FTYP:
-            info->ftyp_offset = box.offset;
-            break;
-        case MP4_BOX_MOOV:
-            info->moov_offset = box.offset;
-            info->moov_size   = box.size;
-            break;
-        case MP4_BOX_MDAT:
-            info->mdat_offset = box.offset;
-            info->mdat_size   = box.size;
-            break;
-        default:
-            break;
+        if (((stop & WALK_STOP_MOOV) && box.type == MP4_BOX_MOOV) ||
+            ((stop & WALK_STOP_MDAT) && box.type == MP4_BOX_MDAT &&
+             info->moov_offset < 0)) {
+            info->top_level_pos = pos;
+            return MP4TAG_OK;
         }
+    }
 
-        pos = box.offset + box.size;
+    info->top_level_pos  = pos;
+    info->top_level_done = 1;
+    return MP4TAG_OK;
+}
+
+int mp4_parse_top_level_finish(file_handle_t *fh, mp4_file_info_t *info)
+{
+    if (!fh || !info) return MP4TAG_ERR_INVALID_ARG;
+    if (info->top_level_done) return MP4TAG_OK;
+
+    int64_t fsize = file_size(fh);
+    if (fsize < 0) return MP4TAG_ERR_IO;
+    return walk_top_level(fh, NULL, info, fsize, NULL, 0);
+}
+
+int mp4_parse_top_level_finish_reader(const mp4_reader_t *reader,
+                                      mp4_file_info_t *info)
+{
+    if (!reader || !reader->read_at || !info) return MP4TAG_ERR_INVALID_ARG;
+    if (info->top_level_done) return MP4TAG_OK;
+    return walk_top_level(NULL, reader, info, reader->size, NULL, 0);
+}
+
+/*
+ * Find a moov box that ends exactly at EOF in `tail`, the usual place
+ * for it in files written moov-last. A byte match alone could be a moov
+ * nested in a trailing free/uuid box or payload inside an mdat, so a
+ * candidate is only taken if walking top-level boxes from `from` lands
+ * exactly on it without meeting an earlier moov. Returns its offset,
+ * or -1.
+ */
+static int64_t find_tail_moov(file_handle_t *fh, const mp4_span_t *tail,
+                              int64_t from, int64_t fsize)
+{
+    int64_t pos = from;
+    for (size_t i = 0; i + 8 <= tail->size; i++) {
+        const uint8_t *p = tail->data + i;
+        if (p[4] != 'm' || mp4_load_be32(p + 4) != MP4_BOX_MOOV) continue;
+
+        mp4_box_t box;
+        int64_t off = tail->offset + (int64_t)i;
+        if (mp4_parse_box_header(p, tail->size - i, off, &box) != MP4TAG_OK ||
+            box.size < box.header_size || box.size != fsize - off)
+            continue;
+
+        /* The walk only moves forward, so it carries over between candidates */
+        while (pos < off) {
+            int rc;
+            if (pos >= tail->offset) {
+                rc = mp4_parse_box_header(mp4_span_at(tail, pos),
+                                          (size_t)(fsize - pos), pos, &box);
+            } else {
+                rc = mp4_file_seek(fh, pos);
+                if (rc == 0) rc = mp4_read_box_header(fh, &box);
+            }
+            if (rc != 0 || box.size < 8 || box.type == MP4_BOX_MOOV) return -1;
+            pos = box.offset + box.size;
+        }
+        if (pos == off) return off;
+        if (pos >= fsize) return -1;
+    }
+    return -1;
+}
+
+/*
+ * Top-level walk for the buffered parse. Once the walk meets an mdat
+ * before any moov, the last `probe` bytes of the file are read into
+ * `tail_buf` in one go: the rest of the walk (typically just moov) then
+ * comes from memory, and if the walk would not reach the tail directly
+ * a moov ending at EOF is looked for there instead. `*tail` describes
+ * what was loaded (size 0 if nothing).
+ */
+static int scan_top_level(file_handle_t *fh, mp4_file_info_t *info,
+                          size_t probe, dyn_buffer_t *tail_buf,
+                          mp4_span_t *tail)
+{
+    mp4_top_level_begin(info);
+    tail->data   = NULL;
+    tail->offset = 0;
+    tail->size   = 0;
+
+    int64_t fsize = file_size(fh);
+    if (fsize < 8) return MP4TAG_ERR_TRUNCATED;
+
+    int probing = tail_buf && probe > 0;
+    int rc = walk_top_level(fh, NULL, info, fsize, NULL,
+                            WALK_STOP_MOOV | (probing ? WALK_STOP_MDAT : 0));
+    if (rc != MP4TAG_OK) return rc;
+
+    if (info->moov_offset < 0 && !info->top_level_done) {
+        /* Paused after an mdat: whatever follows comes from the tail */
+        int64_t next  = info->top_level_pos;
+        int64_t start = fsize - (int64_t)probe;
+        if (start < next) start = next;
+
+        tail_buf->size = 0;
+        if (start < fsize &&
+            buffer_append_zeros(tail_buf, (size_t)(fsize - start)) == 0 &&
+            mp4_file_seek(fh, start) == 0 &&
+            mp4_file_read(fh, tail_buf->data, tail_buf->size) == 0) {
+            tail->data   = tail_buf->data;
+            tail->offset = start;
+            tail->size   = tail_buf->size;
+
+            int64_t moov = start > next ? find_tail_moov(fh, tail, next, fsize) : -1;
+            if (moov >= 0) {
+                mp4_box_t box;
+                mp4_parse_box_header(mp4_span_at(tail, moov),
+                                     (size_t)(fsize - moov), moov, &box);
+                mp4_top_level_note(info, &box);
+            } else {
+                rc = walk_top_level(fh, NULL, info, fsize, tail, WALK_STOP_MOOV);
+                if (rc != MP4TAG_OK) return rc;
+            }
+        } else {
+            tail_buf->size = 0;
+            rc = walk_top_level(fh, NULL, info, fsize, NULL, WALK_STOP_MOOV);
+            if (rc != MP4TAG_OK) return rc;
+        }
     }
 
     if (info->moov_offset < 0)
         return MP4TAG_ERR_NOT_MP4;
 
-    /* Parse moov to find udta */
-    {
-        mp4_box_t moov;
-        int rc = file_seek(fh, info->moov_offset);
-        if (rc != 0) return rc;
-        rc = mp4_read_box_header(fh, &moov);
-        if (rc != 0) return rc;
+    return MP4TAG_OK;
+}
+
+/*
+ * Locate udta/meta/hdlr/ilst and trailing free space by seeking through
+ * the file box by box.
+ */
+static int parse_moov_file(file_handle_t *fh, mp4_file_info_t *info)
+{
+    mp4_box_t moov;
+    int rc = mp4_file_seek(fh, info->moov_offset);
+    if (rc != 0) return rc;
+    rc = mp4_read_box_header(fh, &moov);
+    if (rc != 0) return rc;
 
-        mp4_box_t udta;
-        rc = find_child_box(fh, moov.data_offset, moov.data_size,
-                            MP4_BOX_UDTA, &udta);
+    mp4_box_t udta;
+    rc = find_child_box(fh, moov.data_offset, moov.data_size,
+                        MP4_BOX_UDTA, &udta);
+    if (rc == MP4TAG_OK) {
+        info->has_udta    = 1;
+        info->udta_offset = udta.offset;
+        info->udta_size   = udta.size;
+
+        /* Parse udta to find meta */
+        mp4_box_t meta;
+        rc = find_child_box(fh, udta.data_offset, udta.data_size,
+                            MP4_BOX_META, &meta);
         if (rc == MP4TAG_OK) {
-            info->has_udta    = 1;
-            info->udta_offset = udta.offset;
-            info->udta_size   = udta.size;
-
-            /* Parse udta to find meta */
-            mp4_box_t meta;
-            rc = find_child_box(fh, udta.data_offset, udta.data_size,
-                                MP4_BOX_META, &meta);
-            if (rc == MP4TAG_OK) {
-                info->has_meta    = 1;
-                info->meta_offset = meta.offset;
-                info->meta_size   = meta.size;
-
-                /*
-                 * The 'meta' box is a "full box" with 4 extra bytes
-                 * (version + flags) after the standard header.
-                 */
-                int64_t meta_content_offset = meta.data_offset + 4;
-                int64_t meta_content_size   = meta.data_size - 4;
-                if (meta_content_size < 0) meta_content_size = 0;
-
-                /* Check for hdlr */
-                mp4_box_t hdlr;
-                rc = find_child_box(fh, meta_content_offset, meta_content_size,
-                                    MP4_BOX_HDLR, &hdlr);
-                info->meta_has_hdlr = (rc == MP4TAG_OK);
-
-                /* Find ilst */
-                mp4_box_t ilst;
-                rc = find_child_box(fh, meta_content_offset, meta_content_size,
-                                    MP4_BOX_ILST, &ilst);
-                if (rc == MP4TAG_OK) {
-                    info->has_ilst    = 1;
-                    info->ilst_offset = ilst.offset;
-                    info->ilst_size   = ilst.size;
-
-                    /* Look for free space after ilst */
-                    int64_t after_ilst = ilst.offset + ilst.size;
-                    int64_t meta_end   = meta.offset + meta.size;
-                    rc = find_free_after(fh, after_ilst, meta_end,
-                                         &info->free_after_ilst_offset,
-                                         &info->free_after_ilst_size);
-                    info->has_free_after_ilst = (rc == MP4TAG_OK);
-                }
-            }
+            info->has_meta    = 1;
+            info->meta_offset = meta.offset;
+            info->meta_size   = meta.size;
 
             /*
-             * Note: we intentionally do NOT look for free space after
-             * udta within moov, because that space is not contiguous
-             * with ilst and cannot be used for simple in-place writes.
-             * Non-contiguous cases fall through to the full rewrite path.
+             * The 'meta' box is a "full box" with 4 extra bytes
+             * (version + flags) after the standard header.
              */
+            int64_t meta_content_offset = meta.data_offset + 4;
+            int64_t meta_content_size   = meta.data_size - 4;
+            if (meta_content_size < 0) meta_content_size = 0;
+
+            /* Check for hdlr */
+            mp4_box_t hdlr;
+            rc = find_child_box(fh, meta_content_offset, meta_content_size,
+                                MP4_BOX_HDLR, &hdlr);
+            info->meta_has_hdlr = (rc == MP4TAG_OK);
+
+            /* Find ilst */
+            mp4_box_t ilst;
+            rc = find_child_box(fh, meta_content_offset, meta_content_size,
+                                MP4_BOX_ILST, &ilst);
+            if (rc == MP4TAG_OK) {
+                info->has_ilst    = 1;
+                info->ilst_offset = ilst.offset;
+                info->ilst_size   = ilst.size;
+
+                /* Look for free space after ilst */
+                int64_t after_ilst = ilst.offset + ilst.size;
+                int64_t meta_end   = meta.offset + meta.size;
+                rc = find_free_after(fh, after_ilst, meta_end,
+                                     &info->free_after_ilst_offset,
+                                     &info->free_after_ilst_size);
+                info->has_free_after_ilst = (rc == MP4TAG_OK);
+            }
         }
+
+        /*
+         * Note: we intentionally do NOT look for free space after
+         * udta within moov, because that space is not contiguous
+         * with ilst and cannot be used for simple in-place writes.
+         * Non-contiguous cases fall through to the moov reshuffle,
+         * which reclaims every free box in moov at once.
+         */
     }
 
+    return MP4TAG_OK;
+}
+
+int mp4_parse_moov_span(const mp4_span_t *moov_span, mp4_file_info_t *info)
+{
+    if (!moov_span || !info) return MP4TAG_ERR_INVALID_ARG;
+
+    mp4_box_t moov;
+    int rc = mp4_span_read_box_header(moov_span, moov_span->offset,
+                                      moov_span->offset + (int64_t)moov_span->size,
+                                      &moov);
+    if (rc != MP4TAG_OK) return rc;
+    if (moov.type != MP4_BOX_MOOV) return MP4TAG_ERR_BAD_BOX;
+
+    mp4_box_t udta;
+    rc = find_child_box_span(moov_span, moov.data_offset, moov.data_size,
+                             MP4_BOX_UDTA, &udta);
+    if (rc != MP4TAG_OK)
+        return MP4TAG_OK;
+
+    info->has_udta    = 1;
+    info->udta_offset = udta.offset;
+    info->udta_size   = udta.size;
+
+    mp4_box_t meta;
+    rc = find_child_box_span(moov_span, udta.data_offset, udta.data_size,
+                             MP4_BOX_META, &meta);
+    if (rc != MP4TAG_OK)
+        return MP4TAG_OK;
+
+    info->has_meta    = 1;
+    info->meta_offset = meta.offset;
+    info->meta_size   = meta.size;
+
+    /* 'meta' is a full box: skip version + flags */
+    int64_t meta_content_offset = meta.data_offset + 4;
+    int64_t meta_content_size   = meta.data_size - 4;
+    if (meta_content_size < 0) meta_content_size = 0;
+
+    mp4_box_t hdlr;
+    rc = find_child_box_span(moov_span, meta_content_offset, meta_content_size,
+                             MP4_BOX_HDLR, &hdlr);
+    info->meta_has_hdlr = (rc == MP4TAG_OK);
+
+    mp4_box_t ilst;
+    rc = find_child_box_span(moov_span, meta_content_offset, meta_content_size,
+                             MP4_BOX_ILST, &ilst);
+    if (rc != MP4TAG_OK)
+        return MP4TAG_OK;
+
+    info->has_ilst    = 1;
+    info->ilst_offset = ilst.offset;
+    info->ilst_size   = ilst.size;
+
+    /* A free/skip box directly after ilst can absorb growth in place */
+    int64_t after_ilst = ilst.offset + ilst.size;
+    int64_t meta_end   = meta.offset + meta.size;
+    mp4_box_t next;
+    if (after_ilst + 8 <= meta_end &&
+        mp4_span_read_box_header(moov_span, after_ilst, meta_end, &next) == MP4TAG_OK &&
+        (next.type == MP4_BOX_FREE || next.type == MP4_BOX_SKIP)) {
+        info->has_free_after_ilst    = 1;
+        info->free_after_ilst_offset = next.offset;
+        info->free_after_ilst_size   = next.size;
+    }
+
+    return MP4TAG_OK;
+}
+
+int mp4_parse_structure_buffered(file_handle_t *fh, mp4_file_info_t *info,
+                                 size_t moov_limit, size_t tail_size,
+                                 dyn_buffer_t *moov_buf)
+{
+    if (!fh || !info) return MP4TAG_ERR_INVALID_ARG;
+
+    if (moov_buf) moov_buf->size = 0;
+
+    /* The tail probe lands in moov_buf, so it is bounded by the same limit */
+    size_t probe = moov_limit < tail_size ? moov_limit : tail_size;
+    mp4_span_t tail;
+    int rc = scan_top_level(fh, info, probe, moov_buf, &tail);
+    if (rc != MP4TAG_OK) return rc;
+
+    /* A moov-last file may already have its moov in the tail probe */
+    if (tail.size > 0 && info->moov_offset >= tail.offset &&
+        info->moov_size >= 8 && (uint64_t)info->moov_size <= moov_limit &&
+        info->moov_offset + info->moov_size <= tail.offset + (int64_t)tail.size) {
+        memmove(moov_buf->data, mp4_span_at(&tail, info->moov_offset),
+                (size_t)info->moov_size);
+        moov_buf->size = (size_t)info->moov_size;
+
+        mp4_span_t span = { moov_buf->data, info->moov_offset, moov_buf->size };
+        rc = mp4_parse_moov_span(&span, info);
+        if (rc != MP4TAG_OK) return rc;
+        info->valid = 1;
+        return MP4TAG_OK;
+    }
+    if (moov_buf) moov_buf->size = 0;
+
+    /*
+     * Pull the whole moov box in with one read when it is small enough,
+     * then walk it in memory. A short read (truncated file) falls back
+     * to the box-by-box path, which reports the error precisely.
+     */
+    if (moov_buf && moov_limit > 0 &&
+        info->moov_size >= 8 && (uint64_t)info->moov_size <= moov_limit &&
+        buffer_append_zeros(moov_buf, (size_t)info->moov_size) == 0) {
+        if (mp4_file_seek(fh, info->moov_offset) == 0 &&
+            mp4_file_read(fh, moov_buf->data, moov_buf->size) == 0) {
+            mp4_span_t span = { moov_buf->data, info->moov_offset,
+                                moov_buf->size };
+            rc = mp4_parse_moov_span(&span, info);
+            if (rc != MP4TAG_OK) return rc;
+            info->valid = 1;
+            return MP4TAG_OK;
+        }
+        moov_buf->size = 0;
+    }
+
+    rc = parse_moov_file(fh, info);
+    if (rc != MP4TAG_OK) return rc;
+
+    info->valid = 1;
+    return MP4TAG_OK;
+}
+
+int mp4_parse_structure_span(const mp4_span_t *file, mp4_file_info_t *info)
+{
+    if (!file || !info || file->offset != 0) return MP4TAG_ERR_INVALID_ARG;
+
+    mp4_top_level_begin(info);
+
+    int64_t fsize = (int64_t)file->size;
+    if (fsize < 8) return MP4TAG_ERR_TRUNCATED;
+
+    /* Same walk as scan_top_level; a box may run past EOF (truncated mdat) */
+    int rc = walk_top_level(NULL, NULL, info, fsize, file, WALK_STOP_MOOV);
+    if (rc != MP4TAG_OK) return rc;
+
+    if (info->moov_offset < 0)
+        return MP4TAG_ERR_NOT_MP4;
+    if (info->moov_offset + info->moov_size > fsize)
+        return MP4TAG_ERR_TRUNCATED;
+
+    mp4_span_t moov = { file->data + info->moov_offset, info->moov_offset,
+                        (size_t)info->moov_size };
+    rc = mp4_parse_moov_span(&moov, info);
+    if (rc != MP4TAG_OK) return rc;
+
     info->valid = 1;
     return MP4TAG_OK;
 }
+
+int mp4_parse_structure_reader(const mp4_reader_t *reader,
+                               mp4_file_info_t *info, size_t moov_limit,
+                               dyn_buffer_t *moov_buf)
+{
+    if (!reader || !reader->read_at || !info || !moov_buf)
+        return MP4TAG_ERR_INVALID_ARG;
+
+    moov_buf->size = 0;
+    mp4_top_level_begin(info);
+    if (reader->size < 8) return MP4TAG_ERR_TRUNCATED;
+
+    /*
+     * No tail probe: behind a block cache the header reads of a
+     * moov-last file cost a request per box, and the one that finds
+     * moov usually brings in its first block as well.
+     */
+    int rc = walk_top_level(NULL, reader, info, reader->size, NULL,
+                            WALK_STOP_MOOV);
+    if (rc != MP4TAG_OK) return rc;
+
+    if (info->moov_offset < 0)
+        return MP4TAG_ERR_NOT_MP4;
+    if (info->moov_size < 8 || info->moov_offset + info->moov_size > reader->size)
+        return MP4TAG_ERR_TRUNCATED;
+    if ((uint64_t)info->moov_size > moov_limit)
+        return MP4TAG_ERR_UNSUPPORTED;
+
+    if (buffer_append_zeros(moov_buf, (size_t)info->moov_size) != 0)
+        return MP4TAG_ERR_NO_MEMORY;
+    rc = reader->read_at(reader->user, moov_buf->data, moov_buf->size,
+                         info->moov_offset);
+    if (rc != MP4TAG_OK) { moov_buf->size = 0; return rc; }
+
+    mp4_span_t span = { moov_buf->data, info->moov_offset, moov_buf->size };
+    rc = mp4_parse_moov_span(&span, info);
+    if (rc != MP4TAG_OK) return rc;
+
+    info->valid = 1;
+    return MP4TAG_OK;
+}
+
+int mp4_parse_structure(file_handle_t *fh, mp4_file_info_t *info)
+{
+    return mp4_parse_structure_buffered(fh, info, 0, 0, NULL);
+}
@@ -6,6 +6,7 @@
 
 #include "mp4_atoms.h"
 #include <tag_common/file_io.h>
+#include <tag_common/buffer.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -46,23 +47,101 @@ typedef struct {
     int64_t free_after_ilst_offset;
     int64_t free_after_ilst_size;
 
-    /* mdat position (needed for rewrite) */
+    /* mdat position (last mdat; final only once top_level_done) */
     int64_t mdat_offset;
     int64_t mdat_size;
+
+    /* Top-level walk: opening stops after moov, writers finish it */
+    int     top_level_done;     /* Walk reached EOF or an unreadable box */
+    int64_t top_level_pos;      /* Next box to visit, or where the walk ended */
+    int64_t last_box_offset;    /* Last top-level box visited */
 } mp4_file_info_t;
 
+/*
+ * Positioned reads from a source that isn't a file_handle_t (caller
+ * I/O through a block cache). `read_at` returns MP4TAG_OK once all
+ * `len` bytes are in `buf`; `size` is the source size.
+ */
+typedef struct {
+    int   (*read_at)(void *user, void *buf, size_t len, int64_t offset);
+    void   *user;
+    int64_t size;
+} mp4_reader_t;
+
 /*
  * Validate that a file is an MP4/M4A/M4V type by checking the ftyp box.
  * Returns MP4TAG_OK if valid.
  */
 int mp4_validate_ftyp(file_handle_t *fh);
 
+/*
+ * As mp4_validate_ftyp, for a whole file held in memory (span offset 0).
+ */
+int mp4_validate_ftyp_span(const mp4_span_t *file);
+
+/* As mp4_validate_ftyp, through a reader. */
+int mp4_validate_ftyp_reader(const mp4_reader_t *reader);
+
+/*
+ * Building blocks of the top-level walk, for callers that fetch the box
+ * headers themselves (the asynchronous scanner): reset `info`, then note
+ * each top-level box in file order. A walk ends at EOF or at the first
+ * unreadable header or box shorter than 8 bytes.
+ */
+void mp4_top_level_begin(mp4_file_info_t *info);
+void mp4_top_level_note(mp4_file_info_t *info, const mp4_box_t *box);
+
+/*
+ * Continue a top-level walk that stopped after moov through to EOF, so
+ * that mdat_* and last_box_offset describe the whole file and
+ * top_level_pos is where the boxes end. No-op if already done.
+ */
+int mp4_parse_top_level_finish(file_handle_t *fh, mp4_file_info_t *info);
+int mp4_parse_top_level_finish_reader(const mp4_reader_t *reader,
+                                      mp4_file_info_t *info);
+
 /*
  * Parse the top-level box structure of an MP4 file and locate
- * moov, udta, meta, ilst, and free boxes.
+ * moov, udta, meta, ilst, and free boxes. The top-level walk ends at
+ * the first moov (see mp4_parse_top_level_finish).
  */
 int mp4_parse_structure(file_handle_t *fh, mp4_file_info_t *info);
 
+/*
+ * As mp4_parse_structure, but when the moov box is no larger than
+ * `moov_limit` bytes it is read into `moov_buf` with a single read and
+ * the udta/meta/ilst walk runs in memory. On return `moov_buf->size` is
+ * the moov size if it was loaded, or 0 if the file path was used.
+ * A `moov_limit` of 0 disables buffering. When an mdat comes first, up
+ * to `tail_size` bytes (at most `moov_limit`) are read from the end of
+ * the file in one go to find a trailing moov.
+ */
+int mp4_parse_structure_buffered(file_handle_t *fh, mp4_file_info_t *info,
+                                 size_t moov_limit, size_t tail_size,
+                                 dyn_buffer_t *moov_buf);
+
+/*
+ * As mp4_parse_structure, through a reader. The moov is always loaded
+ * into `moov_buf` (one read) and walked in memory; a moov larger than
+ * `moov_limit` is MP4TAG_ERR_UNSUPPORTED.
+ */
+int mp4_parse_structure_reader(const mp4_reader_t *reader,
+                               mp4_file_info_t *info, size_t moov_limit,
+                               dyn_buffer_t *moov_buf);
+
+/*
+ * As mp4_parse_structure, for a whole file held in memory (span offset
+ * 0), e.g. a read-only mapping or a caller-supplied buffer.
+ */
+int mp4_parse_structure_span(const mp4_span_t *file, mp4_file_info_t *info);
+
+/*
+ * Locate udta/meta/hdlr/ilst and trailing free space inside a moov box
+ * held in memory. The span must start at the moov header. Top-level
+ * fields of `info` (moov/mdat/ftyp) are left untouched.
+ */
+int mp4_parse_moov_span(const mp4_span_t *moov_span, mp4_file_info_t *info);
+
 #ifdef __cplusplus
 }
 #endif
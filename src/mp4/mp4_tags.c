@@ -2,12 +2,17 @@
 /* Copyright (c) 2025 Morgan Prior */
 
 #include "mp4_tags.h"
+#include "../util/mp4_io_count.h"
+#include "../util/mp4_text.h"
 #include "../../include/mp4tag/mp4tag_error.h"
 #include <tag_common/string_util.h>
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 /* ------------------------------------------------------------------ */
 /*  Tag name <-> FourCC mapping table                                  */
@@ -18,42 +23,97 @@ typedef struct {
     uint32_t    fourcc;
 } tag_mapping_t;
 
+/*
+ * The mapping is kept twice, sorted by name (ASCII case-insensitive, as
+ * compared by name_cmp) and by FourCC, so both directions are a binary
+ * search. Keep the two tables in step and in order when adding tags.
+ */
 static const tag_mapping_t g_tag_map[] = {
-    { "TITLE",             MP4_TAG_NAM  },
-    { "ARTIST",            MP4_TAG_ART  },
     { "ALBUM",             MP4_TAG_ALB  },
     { "ALBUM_ARTIST",      MP4_TAG_AART },
+    { "ARTIST",            MP4_TAG_ART  },
+    { "BPM",               MP4_TAG_TMPO },
+    { "COMMENT",           MP4_TAG_CMT  },
+    { "COMPILATION",       MP4_TAG_CPIL },
+    { "COMPOSER",          MP4_TAG_WRT  },
+    { "COPYRIGHT",         MP4_TAG_CPRT },
+    { "COVER_ART",         MP4_TAG_COVR },
     { "DATE_RELEASED",     MP4_TAG_DAY  },
-    { "TRACK_NUMBER",      MP4_TAG_TRKN },
+    { "DESCRIPTION",       MP4_TAG_DESC },
     { "DISC_NUMBER",       MP4_TAG_DISK },
-    { "GENRE",             MP4_TAG_GEN  },
-    { "COMPOSER",          MP4_TAG_WRT  },
-    { "COMMENT",           MP4_TAG_CMT  },
     { "ENCODER",           MP4_TAG_TOO  },
-    { "COPYRIGHT",         MP4_TAG_CPRT },
-    { "BPM",               MP4_TAG_TMPO },
-    { "LYRICS",            MP4_TAG_LYR  },
+    { "GAPLESS",           MP4_TAG_PGAP },
+    { "GENRE",             MP4_TAG_GEN  },
     { "GROUPING",          MP4_TAG_GRP  },
-    { "DESCRIPTION",       MP4_TAG_DESC },
+    { "LYRICS",            MP4_TAG_LYR  },
+    { "SORT_ALBUM",        MP4_TAG_SOAL },
+    { "SORT_ALBUM_ARTIST", MP4_TAG_SOAA },
+    { "SORT_ARTIST",       MP4_TAG_SOAR },
+    { "SORT_COMPOSER",     MP4_TAG_SOCO },
+    { "SORT_NAME",         MP4_TAG_SONM },
+    { "TITLE",             MP4_TAG_NAM  },
+    { "TRACK_NUMBER",      MP4_TAG_TRKN },
+};
+
+static const tag_mapping_t g_fourcc_map[] = {
+    { "ALBUM_ARTIST",      MP4_TAG_AART },   /* aART */
     { "COVER_ART",         MP4_TAG_COVR },
     { "COMPILATION",       MP4_TAG_CPIL },
+    { "COPYRIGHT",         MP4_TAG_CPRT },
+    { "DESCRIPTION",       MP4_TAG_DESC },
+    { "DISC_NUMBER",       MP4_TAG_DISK },
     { "GAPLESS",           MP4_TAG_PGAP },
-    { "SORT_NAME",         MP4_TAG_SONM },
-    { "SORT_ARTIST",       MP4_TAG_SOAR },
-    { "SORT_ALBUM",        MP4_TAG_SOAL },
     { "SORT_ALBUM_ARTIST", MP4_TAG_SOAA },
+    { "SORT_ALBUM",        MP4_TAG_SOAL },
+    { "SORT_ARTIST",       MP4_TAG_SOAR },
     { "SORT_COMPOSER",     MP4_TAG_SOCO },
-    { NULL, 0 }
+    { "SORT_NAME",         MP4_TAG_SONM },
+    { "BPM",               MP4_TAG_TMPO },
+    { "TRACK_NUMBER",      MP4_TAG_TRKN },
+    { "ARTIST",            MP4_TAG_ART  },   /* 0xA9 atoms sort last */
+    { "ALBUM",             MP4_TAG_ALB  },
+    { "COMMENT",           MP4_TAG_CMT  },
+    { "DATE_RELEASED",     MP4_TAG_DAY  },
+    { "GENRE",             MP4_TAG_GEN  },
+    { "GROUPING",          MP4_TAG_GRP  },
+    { "LYRICS",            MP4_TAG_LYR  },
+    { "TITLE",             MP4_TAG_NAM  },
+    { "ENCODER",           MP4_TAG_TOO  },
+    { "COMPOSER",          MP4_TAG_WRT  },
 };
 
+#define TAG_MAP_COUNT (sizeof(g_tag_map) / sizeof(g_tag_map[0]))
+
+/* ASCII case-insensitive compare, folding to upper case */
+static int name_cmp(const char *a, const char *b)
+{
+    for (;; a++, b++) {
+        int ca = (unsigned char)*a, cb = (unsigned char)*b;
+        if (ca >= 'a' && ca <= 'z') ca -= 'a' - 'A';
+        if (cb >= 'a' && cb <= 'z') cb -= 'a' - 'A';
+        if (ca != cb || ca == 0) return ca - cb;
+    }
+}
+
+/* FourCC of a name in the mapping table, or 0. */
+static uint32_t mapped_fourcc(const char *name)
+{
+    size_t lo = 0, hi = TAG_MAP_COUNT;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = name_cmp(name, g_tag_map[mid].name);
+        if (c == 0) return g_tag_map[mid].fourcc;
+        if (c < 0) hi = mid; else lo = mid + 1;
+    }
+    return 0;
+}
+
 uint32_t mp4_tag_name_to_fourcc(const char *name)
 {
     if (!name) return 0;
 
-    for (const tag_mapping_t *m = g_tag_map; m->name; m++) {
-        if (str_casecmp(name, m->name) == 0)
-            return m->fourcc;
-    }
+    uint32_t fourcc = mapped_fourcc(name);
+    if (fourcc != 0) return fourcc;
 
     /* If exactly 4 chars, treat as raw FourCC */
     if (strlen(name) == 4)
@@ -64,63 +124,349 @@ uint32_t mp4_tag_name_to_fourcc(const char *name)
 
 const char *mp4_tag_fourcc_to_name(uint32_t fourcc)
 {
-    for (const tag_mapping_t *m = g_tag_map; m->name; m++) {
-        if (m->fourcc == fourcc)
-            return m->name;
+    size_t lo = 0, hi = TAG_MAP_COUNT;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t f = g_fourcc_map[mid].fourcc;
+        if (f == fourcc) return g_fourcc_map[mid].name;
+        if (fourcc < f) hi = mid; else lo = mid + 1;
     }
     return NULL;
 }
 
 /* ------------------------------------------------------------------ */
-/*  Free helpers                                                       */
+/*  Per-collection index                                               */
 /* ------------------------------------------------------------------ */
 
-static void free_simple_tags(mp4tag_simple_tag_t *st)
-{
-    while (st) {
-        mp4tag_simple_tag_t *next = st->next;
-        free(st->name);
-        free(st->value);
-        free(st->binary);
-        free(st->language);
-        free_simple_tags(st->nested);
-        free(st);
-        st = next;
+static int index_entry_cmp(const void *a, const void *b)
+{
+    const mp4_tag_index_entry_t *x = a, *y = b;
+    if (x->fourcc != y->fourcc) return x->fourcc < y->fourcc ? -1 : 1;
+    return x->order < y->order ? -1 : (x->order > y->order);
+}
+
+int mp4_tag_index_build(const mp4tag_collection_t *coll, mp4_tag_index_t *idx)
+{
+    idx->count = 0;
+    if (!coll) return MP4TAG_OK;
+
+    size_t count = 0;
+    for (const mp4tag_tag_t *tag = coll->tags; tag; tag = tag->next)
+        for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next)
+            count++;
+    if (count == 0) return MP4TAG_OK;
+
+    /* The entries live in the collection's arena and go with it */
+    idx->entries = count <= SIZE_MAX / sizeof(*idx->entries)
+                 ? mp4_arena_alloc(coll->arena, count * sizeof(*idx->entries))
+                 : NULL;
+    if (!idx->entries) return MP4TAG_ERR_NO_MEMORY;
+
+    for (const mp4tag_tag_t *tag = coll->tags; tag; tag = tag->next) {
+        for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next) {
+            uint32_t fourcc = mp4_tag_name_to_fourcc(st->name);
+            if (fourcc == 0) continue;
+            mp4_tag_index_entry_t *e = &idx->entries[idx->count];
+            e->fourcc = fourcc;
+            e->order  = idx->count;
+            e->tag    = st;
+            idx->count++;
+        }
     }
+    qsort(idx->entries, idx->count, sizeof(*idx->entries), index_entry_cmp);
+    return MP4TAG_OK;
 }
 
-static void free_tag(mp4tag_tag_t *tag)
+const mp4tag_simple_tag_t *mp4_tag_index_find(const mp4_tag_index_t *idx,
+                                              uint32_t fourcc)
 {
-    while (tag) {
-        mp4tag_tag_t *next = tag->next;
-        free(tag->target_type_str);
-        free(tag->track_uids);
-        free(tag->edition_uids);
-        free(tag->chapter_uids);
-        free(tag->attachment_uids);
-        free_simple_tags(tag->simple_tags);
-        free(tag);
-        tag = next;
+    size_t lo = 0, hi = idx->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].fourcc < fourcc) lo = mid + 1; else hi = mid;
     }
+    for (; lo < idx->count && idx->entries[lo].fourcc == fourcc; lo++) {
+        if (idx->entries[lo].tag->value)
+            return idx->entries[lo].tag;
+    }
+    return NULL;
+}
+
+void mp4_tag_index_free(mp4_tag_index_t *idx)
+{
+    memset(idx, 0, sizeof(*idx));
+}
+
+const mp4tag_simple_tag_t *mp4_tags_find_name(const mp4tag_collection_t *coll,
+                                              const mp4_tag_index_t *idx,
+                                              const char *name)
+{
+    /*
+     * Mapped names go through the index. A raw FourCC name keeps its
+     * case in the FourCC, so it is matched by the case-insensitive scan
+     */
+    uint32_t fourcc = mapped_fourcc(name);
+    if (fourcc != 0 && idx->entries)
+        return mp4_tag_index_find(idx, fourcc);
+
+    for (const mp4tag_tag_t *tag = coll->tags; tag; tag = tag->next) {
+        for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next) {
+            if (st->name && st->value && str_casecmp(st->name, name) == 0)
+                return st;
+        }
+    }
+    return NULL;
+}
+
+int mp4_tags_copy_value(const mp4tag_simple_tag_t *st, char *value, size_t size)
+{
+    if (!st) return MP4TAG_ERR_TAG_NOT_FOUND;
+    return str_copy(value, size, st->value) == 0
+           ? MP4TAG_OK : MP4TAG_ERR_TAG_TOO_LARGE;
+}
+
+const mp4tag_simple_tag_t *mp4_tags_find_fourcc(const mp4tag_collection_t *coll,
+                                                const mp4_tag_index_t *idx,
+                                                uint32_t fourcc)
+{
+    if (idx->entries)
+        return mp4_tag_index_find(idx, fourcc);
+
+    for (const mp4tag_tag_t *tag = coll->tags; tag; tag = tag->next) {
+        for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next) {
+            if (st->value && mp4_tag_name_to_fourcc(st->name) == fourcc)
+                return st;
+        }
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Collection storage                                                 */
+/* ------------------------------------------------------------------ */
+
+mp4tag_collection_t *mp4_tags_new_collection_in(mp4_arena_t *arena)
+{
+    mp4tag_collection_t *coll = mp4_arena_alloc(arena, sizeof(*coll));
+    if (!coll) return NULL;
+    coll->arena = arena;
+    return coll;
+}
+
+mp4tag_collection_t *mp4_tags_new_collection(const mp4tag_allocator_t *allocator)
+{
+    mp4_arena_t *arena = mp4_arena_create(allocator);
+    if (!arena) return NULL;
+
+    mp4tag_collection_t *coll = mp4_tags_new_collection_in(arena);
+    if (!coll) mp4_arena_destroy(arena);
+    return coll;
 }
 
 void mp4_tags_free_collection(mp4tag_collection_t *coll)
 {
     if (!coll) return;
-    free_tag(coll->tags);
-    free(coll);
+    /* The collection itself lives in the arena */
+    mp4_arena_destroy(coll->arena);
+}
+
+mp4tag_tag_t *mp4_tags_add_tag(mp4tag_collection_t *coll,
+                               mp4tag_target_type_t type)
+{
+    mp4tag_tag_t *tag = mp4_arena_alloc(coll->arena, sizeof(*tag));
+    if (!tag) return NULL;
+    tag->target_type = type;
+    tag->arena       = coll->arena;
+
+    /* The tail is a hint: catch up if the list was extended behind it */
+    mp4tag_tag_t *tail = coll->tail ? coll->tail : coll->tags;
+    if (tail) {
+        while (tail->next) tail = tail->next;
+        tail->next = tag;
+    } else {
+        coll->tags = tag;
+    }
+    coll->tail = tag;
+    coll->count++;
+    return tag;
+}
+
+mp4tag_simple_tag_t *mp4_tags_new_simple(mp4_arena_t *arena, const char *name,
+                                         const char *value)
+{
+    mp4tag_simple_tag_t *st = mp4_arena_alloc(arena, sizeof(*st));
+    if (!st) return NULL;
+    st->arena = arena;
+    st->name  = mp4_arena_strdup(arena, name);
+    st->value = mp4_arena_strdup(arena, value);
+    if ((name && !st->name) || (value && !st->value)) return NULL;
+    return st;
+}
+
+void mp4_tags_append_simple(mp4tag_tag_t *tag, mp4tag_simple_tag_t *st)
+{
+    mp4tag_simple_tag_t *tail = tag->simple_tail ? tag->simple_tail
+                                                 : tag->simple_tags;
+    if (tail) {
+        while (tail->next) tail = tail->next;
+        tail->next = st;
+    } else {
+        tag->simple_tags = st;
+    }
+    tag->simple_tail = st;
+}
+
+void mp4_tags_append_nested(mp4tag_simple_tag_t *parent, mp4tag_simple_tag_t *st)
+{
+    mp4tag_simple_tag_t *tail = parent->nested_tail ? parent->nested_tail
+                                                    : parent->nested;
+    if (tail) {
+        while (tail->next) tail = tail->next;
+        tail->next = st;
+    } else {
+        parent->nested = st;
+    }
+    parent->nested_tail = st;
 }
 
 /* ------------------------------------------------------------------ */
 /*  Parsing: ilst -> collection                                        */
 /* ------------------------------------------------------------------ */
 
+/*
+ * Well-known integer atoms: handled regardless of data_type, since some
+ * encoders use IMPLICIT (0) and others use INTEGER (21) for the same atoms.
+ */
+static int is_int_atom(uint32_t item_type)
+{
+    return item_type == MP4_TAG_TRKN ||
+           item_type == MP4_TAG_DISK ||
+           item_type == MP4_TAG_TMPO ||
+           item_type == MP4_TAG_CPIL ||
+           item_type == MP4_TAG_PGAP;
+}
+
+/* Whether decode_item_value stores this value in st->binary. */
+static int value_is_binary(uint32_t item_type, uint32_t data_type,
+                           size_t value_size)
+{
+    if (is_int_atom(item_type) && value_size > 0 && value_size <= 8)
+        return 0;
+    return data_type != MP4_DATA_UTF8 && data_type != MP4_DATA_UTF16 &&
+           data_type != MP4_DATA_IMPLICIT && data_type != MP4_DATA_INTEGER;
+}
+
+/*
+ * Decode the payload of an item's 'data' box into a simple tag.
+ * `value` points at the bytes after the type indicator and locale, which
+ * start at file offset `value_offset`. With MP4_PARSE_LAZY_BINARY, binary
+ * values are not copied (and `value` may be NULL for them): only their
+ * offset and size are recorded. With DECODE_IN_ARENA, `value` is already
+ * in `arena` and a binary value takes it over rather than copying it.
+ */
+#define DECODE_IN_ARENA 0x80000000u
+
+static int decode_item_value(mp4_arena_t *arena, uint32_t item_type,
+                             uint32_t data_type, const uint8_t *value,
+                             size_t value_size, int64_t value_offset,
+                             unsigned flags, mp4tag_simple_tag_t **out)
+{
+    /* Map the item FourCC to a name */
+    char fourcc_str[5];
+    const char *name = mp4_tag_fourcc_to_name(item_type);
+    if (!name) {
+        mp4_fourcc_to_str(item_type, fourcc_str);
+        name = fourcc_str;
+    }
+
+    mp4tag_simple_tag_t *st = mp4_tags_new_simple(arena, name, NULL);
+    if (!st) return MP4TAG_ERR_NO_MEMORY;
+
+    if (is_int_atom(item_type) && value_size > 0 && value_size <= 8) {
+        if ((item_type == MP4_TAG_TRKN ||
+             item_type == MP4_TAG_DISK) && value_size >= 6) {
+            uint16_t num   = mp4_load_be16(value + 2);
+            uint16_t total = mp4_load_be16(value + 4);
+            char num_str[32];
+            if (total > 0)
+                snprintf(num_str, sizeof(num_str), "%u/%u", num, total);
+            else
+                snprintf(num_str, sizeof(num_str), "%u", num);
+            st->value = mp4_arena_strdup(arena, num_str);
+        } else if (item_type == MP4_TAG_TMPO && value_size == 2) {
+            char bpm_str[16];
+            snprintf(bpm_str, sizeof(bpm_str), "%u", mp4_load_be16(value));
+            st->value = mp4_arena_strdup(arena, bpm_str);
+        } else if (value_size == 1) {
+            char bool_str[4];
+            snprintf(bool_str, sizeof(bool_str), "%u", value[0]);
+            st->value = mp4_arena_strdup(arena, bool_str);
+        } else {
+            uint64_t ival = 0;
+            for (size_t i = 0; i < value_size; i++)
+                ival = (ival << 8) | value[i];
+            char ival_str[32];
+            snprintf(ival_str, sizeof(ival_str), "%llu",
+                     (unsigned long long)ival);
+            st->value = mp4_arena_strdup(arena, ival_str);
+        }
+    } else if (data_type == MP4_DATA_UTF8 ||
+               data_type == MP4_DATA_IMPLICIT) {
+        /* Text data: validated while it is copied */
+        if (value_size > 0) {
+            uint8_t *text = mp4_arena_alloc(arena, value_size + 1);
+            if (!text) return MP4TAG_ERR_NO_MEMORY;
+            st->text_invalid = !mp4_text_copy_utf8(text, value, value_size);
+            st->value = (char *)text;
+        }
+    } else if (data_type == MP4_DATA_UTF16) {
+        /* UTF-16BE text, handed out as UTF-8 */
+        if (value_size > 0) {
+            uint8_t *text = mp4_arena_alloc(arena,
+                                            MP4_TEXT_UTF16_MAX_UTF8(value_size) + 1);
+            if (!text) return MP4TAG_ERR_NO_MEMORY;
+            int valid = 1;
+            text[mp4_text_utf16be_to_utf8(text, value, value_size, &valid)] = '\0';
+            st->text_invalid = !valid;
+            st->value = (char *)text;
+        }
+    } else if (data_type == MP4_DATA_INTEGER) {
+        /* Generic integer data */
+        if (value_size > 0 && value_size <= 8) {
+            uint64_t ival = 0;
+            for (size_t i = 0; i < value_size; i++)
+                ival = (ival << 8) | value[i];
+            char ival_str[32];
+            snprintf(ival_str, sizeof(ival_str), "%llu",
+                     (unsigned long long)ival);
+            st->value = mp4_arena_strdup(arena, ival_str);
+        }
+    } else if (flags & MP4_PARSE_LAZY_BINARY) {
+        /* Binary data, left in the file until mp4tag_read_binary */
+        st->binary_size   = value_size;
+        st->binary_offset = value_offset;
+    } else {
+        /* Binary data: JPEG/PNG images and anything else */
+        if (value_size > 0) {
+            st->binary = (flags & DECODE_IN_ARENA)
+                       ? (uint8_t *)value : mp4_arena_memdup(arena, value, value_size);
+            if (!st->binary) return MP4TAG_ERR_NO_MEMORY;
+            st->binary_size = value_size;
+        }
+    }
+
+    st->is_default = 1;
+    *out = st;
+    return MP4TAG_OK;
+}
+
 /*
  * Read a single ilst item atom and extract name + value.
  * Each ilst item is a box whose type is the tag key (e.g. ©nam).
  * Inside is a 'data' box with: 4-byte type indicator + 4-byte locale + data.
  */
-static int parse_ilst_item(file_handle_t *fh, const mp4_box_t *item_box,
+static int parse_ilst_item(mp4_arena_t *arena, file_handle_t *fh,
+                           const mp4_box_t *item_box, unsigned flags,
                            mp4tag_simple_tag_t **out)
 {
     /* Look for the 'data' sub-box */
@@ -128,7 +474,7 @@ static int parse_ilst_item(file_handle_t *fh, const mp4_box_t *item_box,
     int64_t end = item_box->offset + item_box->size;
 
     while (pos + 8 <= end) {
-        int rc = file_seek(fh, pos);
+        int rc = mp4_file_seek(fh, pos);
         if (rc != 0) return rc;
 
         mp4_box_t child;
@@ -140,127 +486,61 @@ static int parse_ilst_item(file_handle_t *fh, const mp4_box_t *item_box,
         if (child.type == MP4_BOX_DATA && child.data_size >= 8) {
             /* Read type indicator (4 bytes) + locale (4 bytes) */
             uint8_t hdr[8];
-            rc = file_read(fh, hdr, 8);
+            rc = mp4_file_read(fh, hdr, 8);
             if (rc != 0) return rc;
 
-            uint32_t data_type = ((uint32_t)hdr[0] << 24) |
-                                 ((uint32_t)hdr[1] << 16) |
-                                 ((uint32_t)hdr[2] << 8)  |
-                                  (uint32_t)hdr[3];
-
-            int64_t value_size = child.data_size - 8;
+            uint32_t data_type    = mp4_load_be32(hdr);
+            size_t   value_size   = (size_t)child.data_size - 8;
+            int64_t  value_offset = child.data_offset + 8;
 
-            mp4tag_simple_tag_t *st = calloc(1, sizeof(*st));
-            if (!st) return MP4TAG_ERR_NO_MEMORY;
-
-            /* Map the item FourCC to a name */
-            const char *name = mp4_tag_fourcc_to_name(item_box->type);
-            if (name) {
-                st->name = str_dup(name);
-            } else {
-                char fourcc_str[5];
-                mp4_fourcc_to_str(item_box->type, fourcc_str);
-                st->name = str_dup(fourcc_str);
-            }
+            int binary = value_is_binary(item_box->type, data_type, value_size);
+            if (binary && (flags & MP4_PARSE_LAZY_BINARY))
+                return decode_item_value(arena, item_box->type, data_type, NULL,
+                                         value_size, value_offset, flags, out);
 
             /*
-             * Well-known integer atoms: handle regardless of data_type,
-             * since some encoders use IMPLICIT (0) and others use
-             * INTEGER (21) for the same atoms.
+             * Binary values are read straight into the arena and kept
+             * there; text only passes through on its way to being decoded
              */
-            int is_int_atom = (item_box->type == MP4_TAG_TRKN ||
-                               item_box->type == MP4_TAG_DISK ||
-                               item_box->type == MP4_TAG_TMPO ||
-                               item_box->type == MP4_TAG_CPIL ||
-                               item_box->type == MP4_TAG_PGAP);
-
-            if (is_int_atom && value_size > 0 && value_size <= 8) {
-                uint8_t int_buf[8];
-                rc = file_read(fh, int_buf, (size_t)value_size);
-                if (rc != 0) { free(st->name); free(st); return rc; }
-
-                if ((item_box->type == MP4_TAG_TRKN ||
-                     item_box->type == MP4_TAG_DISK) && value_size >= 6) {
-                    uint16_t num   = ((uint16_t)int_buf[2] << 8) | int_buf[3];
-                    uint16_t total = ((uint16_t)int_buf[4] << 8) | int_buf[5];
-                    char num_str[32];
-                    if (total > 0)
-                        snprintf(num_str, sizeof(num_str), "%u/%u", num, total);
-                    else
-                        snprintf(num_str, sizeof(num_str), "%u", num);
-                    st->value = str_dup(num_str);
-                } else if (item_box->type == MP4_TAG_TMPO && value_size == 2) {
-                    uint16_t bpm = ((uint16_t)int_buf[0] << 8) | int_buf[1];
-                    char bpm_str[16];
-                    snprintf(bpm_str, sizeof(bpm_str), "%u", bpm);
-                    st->value = str_dup(bpm_str);
-                } else if (value_size == 1) {
-                    char bool_str[4];
-                    snprintf(bool_str, sizeof(bool_str), "%u", int_buf[0]);
-                    st->value = str_dup(bool_str);
-                } else {
-                    uint64_t ival = 0;
-                    for (int64_t i = 0; i < value_size; i++)
-                        ival = (ival << 8) | int_buf[i];
-                    char ival_str[32];
-                    snprintf(ival_str, sizeof(ival_str), "%llu",
-                             (unsigned long long)ival);
-                    st->value = str_dup(ival_str);
-                }
-            } else if (data_type == MP4_DATA_UTF8 ||
-                       data_type == MP4_DATA_IMPLICIT) {
-                /* Text data */
-                if (value_size > 0) {
-                    char *text = malloc((size_t)value_size + 1);
-                    if (!text) { free(st->name); free(st); return MP4TAG_ERR_NO_MEMORY; }
-                    rc = file_read(fh, text, (size_t)value_size);
-                    if (rc != 0) { free(text); free(st->name); free(st); return rc; }
-                    text[value_size] = '\0';
-                    st->value = text;
-                }
-            } else if (data_type == MP4_DATA_INTEGER) {
-                /* Generic integer data */
-                if (value_size > 0 && value_size <= 8) {
-                    uint8_t int_buf[8];
-                    rc = file_read(fh, int_buf, (size_t)value_size);
-                    if (rc != 0) { free(st->name); free(st); return rc; }
-                    uint64_t ival = 0;
-                    for (int64_t i = 0; i < value_size; i++)
-                        ival = (ival << 8) | int_buf[i];
-                    char ival_str[32];
-                    snprintf(ival_str, sizeof(ival_str), "%llu",
-                             (unsigned long long)ival);
-                    st->value = str_dup(ival_str);
-                }
-            } else if (data_type == MP4_DATA_JPEG || data_type == MP4_DATA_PNG) {
-                /* Binary image data */
-                if (value_size > 0) {
-                    st->binary = malloc((size_t)value_size);
-                    if (!st->binary) { free(st->name); free(st); return MP4TAG_ERR_NO_MEMORY; }
-                    rc = file_read(fh, st->binary, (size_t)value_size);
-                    if (rc != 0) {
-                        free(st->binary); free(st->name); free(st);
-                        return rc;
-                    }
-                    st->binary_size = (size_t)value_size;
-                }
-            } else {
-                /* Other binary data */
-                if (value_size > 0) {
-                    st->binary = malloc((size_t)value_size);
-                    if (!st->binary) { free(st->name); free(st); return MP4TAG_ERR_NO_MEMORY; }
-                    rc = file_read(fh, st->binary, (size_t)value_size);
-                    if (rc != 0) {
-                        free(st->binary); free(st->name); free(st);
-                        return rc;
-                    }
-                    st->binary_size = (size_t)value_size;
-                }
-            }
+            const mp4tag_allocator_t *allocator = mp4_arena_allocator(arena);
+            uint8_t *value = binary ? mp4_arena_alloc(arena, value_size)
+                                    : mp4_mem_alloc(allocator, value_size);
+            if (!value) return MP4TAG_ERR_NO_MEMORY;
+            rc = mp4_file_read(fh, value, value_size);
+            if (rc == 0)
+                rc = decode_item_value(arena, item_box->type, data_type, value,
+                                       value_size, value_offset,
+                                       flags | (binary ? DECODE_IN_ARENA : 0), out);
+            if (!binary) mp4_mem_free(allocator, value);
+            return rc;
+        }
+
+        pos = child.offset + child.size;
+    }
 
-            st->is_default = 1;
-            *out = st;
-            return MP4TAG_OK;
+    return MP4TAG_ERR_TAG_NOT_FOUND;
+}
+
+/*
+ * Span equivalent of parse_ilst_item: the item box is already in memory.
+ */
+static int parse_ilst_item_span(mp4_arena_t *arena, const mp4_span_t *span,
+                                const mp4_box_t *item_box, unsigned flags,
+                                mp4tag_simple_tag_t **out)
+{
+    int64_t pos = item_box->data_offset;
+    int64_t end = item_box->offset + item_box->size;
+
+    while (pos + 8 <= end) {
+        mp4_box_t child;
+        int rc = mp4_span_read_box_header(span, pos, end, &child);
+        if (rc != MP4TAG_OK) return rc;
+
+        if (child.type == MP4_BOX_DATA && child.data_size >= 8) {
+            const uint8_t *payload = mp4_span_at(span, child.data_offset);
+            return decode_item_value(arena, item_box->type, mp4_load_be32(payload),
+                                     payload + 8, (size_t)child.data_size - 8,
+                                     child.data_offset + 8, flags, out);
         }
 
         pos = child.offset + child.size;
@@ -269,27 +549,32 @@ static int parse_ilst_item(file_handle_t *fh, const mp4_box_t *item_box,
     return MP4TAG_ERR_TAG_NOT_FOUND;
 }
 
+/* Start an empty collection in `arena` holding a single ALBUM-level tag. */
+static mp4tag_collection_t *new_album_collection(mp4_arena_t *arena)
+{
+    mp4tag_collection_t *coll = mp4_tags_new_collection_in(arena);
+    if (!coll || !mp4_tags_add_tag(coll, MP4TAG_TARGET_ALBUM))
+        return NULL;
+    return coll;
+}
+
 int mp4_tags_parse_ilst(file_handle_t *fh, const mp4_file_info_t *info,
+                        unsigned flags, mp4_arena_t *arena,
                         mp4tag_collection_t **out)
 {
-    if (!fh || !info || !out) return MP4TAG_ERR_INVALID_ARG;
+    if (!fh || !info || !arena || !out) return MP4TAG_ERR_INVALID_ARG;
     if (!info->has_ilst) return MP4TAG_ERR_NO_TAGS;
 
-    mp4tag_collection_t *coll = calloc(1, sizeof(*coll));
+    mp4tag_collection_t *coll = new_album_collection(arena);
     if (!coll) return MP4TAG_ERR_NO_MEMORY;
-
-    mp4tag_tag_t *tag = calloc(1, sizeof(*tag));
-    if (!tag) { free(coll); return MP4TAG_ERR_NO_MEMORY; }
-    tag->target_type = MP4TAG_TARGET_ALBUM;
-    coll->tags  = tag;
-    coll->count = 1;
+    mp4tag_tag_t *tag = coll->tags;
 
     /* Iterate ilst children */
     int64_t pos = info->ilst_offset + 8;  /* Skip ilst header */
     int64_t end = info->ilst_offset + info->ilst_size;
 
     while (pos + 8 <= end) {
-        int rc = file_seek(fh, pos);
+        int rc = mp4_file_seek(fh, pos);
         if (rc != 0) break;
 
         mp4_box_t item;
@@ -298,22 +583,173 @@ int mp4_tags_parse_ilst(file_handle_t *fh, const mp4_file_info_t *info,
         if (item.size < 8) break;
 
         mp4tag_simple_tag_t *st = NULL;
-        rc = parse_ilst_item(fh, &item, &st);
-        if (rc == MP4TAG_OK && st) {
-            /* Append to tag's simple_tags list */
-            if (!tag->simple_tags) {
-                tag->simple_tags = st;
-            } else {
-                mp4tag_simple_tag_t *tail = tag->simple_tags;
-                while (tail->next) tail = tail->next;
-                tail->next = st;
+        rc = parse_ilst_item(arena, fh, &item, flags, &st);
+        if (rc == MP4TAG_ERR_NO_MEMORY)
+            return rc;
+        if (rc == MP4TAG_OK && st)
+            mp4_tags_append_simple(tag, st);
+
+        pos = item.offset + item.size;
+    }
+
+    *out = coll;
+    return MP4TAG_OK;
+}
+
+int mp4_tags_parse_ilst_span(const mp4_span_t *span, const mp4_file_info_t *info,
+                             unsigned flags, mp4_arena_t *arena,
+                             mp4tag_collection_t **out)
+{
+    if (!span || !info || !arena || !out) return MP4TAG_ERR_INVALID_ARG;
+    if (!info->has_ilst) return MP4TAG_ERR_NO_TAGS;
+
+    mp4tag_collection_t *coll = new_album_collection(arena);
+    if (!coll) return MP4TAG_ERR_NO_MEMORY;
+    mp4tag_tag_t *tag = coll->tags;
+
+    int64_t pos = info->ilst_offset + 8;  /* Skip ilst header */
+    int64_t end = info->ilst_offset + info->ilst_size;
+
+    while (pos + 8 <= end) {
+        mp4_box_t item;
+        if (mp4_span_read_box_header(span, pos, end, &item) != MP4TAG_OK)
+            break;
+
+        mp4tag_simple_tag_t *st = NULL;
+        int rc = parse_ilst_item_span(arena, span, &item, flags, &st);
+        if (rc == MP4TAG_ERR_NO_MEMORY)
+            return rc;
+        if (rc == MP4TAG_OK && st)
+            mp4_tags_append_simple(tag, st);
+
+        pos = item.offset + item.size;
+    }
+
+    *out = coll;
+    return MP4TAG_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Borrowed views: ilst -> flat item array                            */
+/* ------------------------------------------------------------------ */
+
+int mp4_tags_view_ilst(const mp4_span_t *span, const mp4_file_info_t *info,
+                       const mp4tag_allocator_t *allocator,
+                       mp4tag_item_view_t **items, size_t *count,
+                       size_t *capacity)
+{
+    if (!span || !info || !items || !count || !capacity)
+        return MP4TAG_ERR_INVALID_ARG;
+    if (!info->has_ilst) return MP4TAG_ERR_NO_TAGS;
+
+    size_t n = 0;
+    int64_t pos = info->ilst_offset + 8;  /* Skip ilst header */
+    int64_t end = info->ilst_offset + info->ilst_size;
+
+    while (pos + 8 <= end) {
+        mp4_box_t item;
+        if (mp4_span_read_box_header(span, pos, end, &item) != MP4TAG_OK)
+            break;
+
+        const char *name = mp4_tag_fourcc_to_name(item.type);
+        int64_t child_pos = item.data_offset;
+        int64_t child_end = item.offset + item.size;
+
+        while (child_pos + 8 <= child_end) {
+            mp4_box_t child;
+            if (mp4_span_read_box_header(span, child_pos, child_end,
+                                         &child) != MP4TAG_OK)
+                break;
+
+            if (child.type == MP4_BOX_DATA && child.data_size >= 8) {
+                if (n == *capacity) {
+                    size_t cap = *capacity ? *capacity * 2 : 32;
+                    mp4tag_item_view_t *grown =
+                        mp4_mem_realloc(allocator, *items,
+                                        *capacity * sizeof(**items),
+                                        cap * sizeof(**items));
+                    if (!grown) return MP4TAG_ERR_NO_MEMORY;
+                    *items    = grown;
+                    *capacity = cap;
+                }
+
+                const uint8_t *payload = mp4_span_at(span, child.data_offset);
+                mp4tag_item_view_t *v = &(*items)[n++];
+                v->fourcc    = item.type;
+                v->name      = name;
+                v->data_type = mp4_load_be32(payload);
+                v->data      = payload + 8;
+                v->size      = (size_t)child.data_size - 8;
             }
+
+            child_pos = child.offset + child.size;
         }
 
         pos = item.offset + item.size;
     }
 
-    *out = coll;
+    *count = n;
+    return MP4TAG_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Streamed values                                                    */
+/* ------------------------------------------------------------------ */
+
+void mp4_splices_init(mp4_splices_t *sp, const mp4tag_allocator_t *allocator)
+{
+    memset(sp, 0, sizeof(*sp));
+    sp->allocator = allocator;
+}
+
+void mp4_splices_free(mp4_splices_t *sp)
+{
+    mp4_mem_free(sp->allocator, sp->items);
+    mp4_splices_init(sp, sp->allocator);
+}
+
+static int splices_add(mp4_splices_t *sp, size_t at,
+                       const mp4tag_binary_source_t *src)
+{
+    if (sp->count == sp->capacity) {
+        size_t cap = sp->capacity ? sp->capacity * 2 : 4;
+        mp4_splice_t *grown = mp4_mem_realloc(sp->allocator, sp->items,
+                                              sp->capacity * sizeof(*grown),
+                                              cap * sizeof(*grown));
+        if (!grown) return MP4TAG_ERR_NO_MEMORY;
+        sp->items    = grown;
+        sp->capacity = cap;
+    }
+    sp->items[sp->count].at  = at;
+    sp->items[sp->count].src = src;
+    sp->count++;
+    sp->size += src->size;
+    return MP4TAG_OK;
+}
+
+int mp4_binary_source_read(const mp4tag_binary_source_t *src, void *buf,
+                           size_t len, uint64_t offset)
+{
+    if (offset > src->size || len > src->size - offset)
+        return MP4TAG_ERR_INVALID_ARG;
+
+    uint8_t *p = buf;
+    while (len > 0) {
+        int64_t n;
+        if (src->fd >= 0) {
+            n = pread(src->fd, p, len, (off_t)(src->offset + (int64_t)offset));
+            if (n < 0 && errno == EINTR) continue;
+        } else if (src->read) {
+            n = src->read(src->user, p, len, offset);
+        } else {
+            return MP4TAG_ERR_INVALID_ARG;
+        }
+        if (n < 0) return MP4TAG_ERR_IO;
+        if (n == 0 || (uint64_t)n > len) return MP4TAG_ERR_TRUNCATED;
+        p      += n;
+        len    -= (size_t)n;
+        offset += (uint64_t)n;
+    }
     return MP4TAG_OK;
 }
 
@@ -322,11 +758,59 @@ int mp4_tags_parse_ilst(file_handle_t *fh, const mp4_file_info_t *info,
 /* ------------------------------------------------------------------ */
 
 /*
- * Serialize a single tag item into the buffer.
- * Format: item_box { data_box { type_indicator + locale + value } }
+ * Serialization runs in two passes. The sizing pass (ilst_layout) works
+ * out every item box up front: its FourCC, data type and where its
+ * value bytes live, borrowed from the simple tag or packed into the
+ * item for integers. The encoding pass then writes the whole ilst into
+ * memory reserved at its exact size in one step: no per-item buffers,
+ * no growth while writing. Both run once per write; the udta for the
+ * strategies that need one is built around the finished ilst.
  */
-static int serialize_tag_item(const mp4tag_simple_tag_t *st, dyn_buffer_t *buf)
+typedef struct {
+    uint32_t                      fourcc;
+    uint32_t                      data_type;
+    const uint8_t                *value;        /* Borrowed, or `packed` */
+    size_t                        value_size;
+    uint8_t                       packed[8];    /* Integer encodings */
+    const mp4tag_binary_source_t *source;       /* Streamed instead */
+} ilst_item_t;
+
+typedef struct {
+    ilst_item_t *items;
+    size_t       count;
+    size_t       buffered;      /* ilst payload bytes held in memory */
+    uint64_t     streamed;      /* Payload bytes from binary sources */
+} ilst_layout_t;
+
+/* Item box + data box header, type indicator and locale */
+#define ILST_ITEM_OVERHEAD 24u
+
+/* udta + meta (with version/flags) + hdlr headers ahead of the ilst */
+#define UDTA_PREFIX_SIZE   (MP4_UDTA_HEADROOM - 8u)
+
+static void pack_u16(ilst_item_t *it, unsigned v)
 {
+    it->packed[0] = (uint8_t)(v >> 8);
+    it->packed[1] = (uint8_t)v;
+    it->value      = it->packed;
+    it->value_size = 2;
+}
+
+static unsigned parse_uint(const char *value)
+{
+    unsigned v = 0;
+    if (value) sscanf(value, "%u", &v);
+    return v;
+}
+
+/*
+ * Sizing pass for one simple tag. Returns 0 with it->fourcc == 0 for a
+ * tag that isn't serialized (unknown name, empty cover).
+ */
+static int layout_item(const mp4tag_simple_tag_t *st, ilst_item_t *it)
+{
+    memset(it, 0, sizeof(*it));
+
     uint32_t fourcc = mp4_tag_name_to_fourcc(st->name);
     if (fourcc == 0) {
         /* Use as raw FourCC if exactly 4 chars, otherwise skip */
@@ -336,10 +820,6 @@ static int serialize_tag_item(const mp4tag_simple_tag_t *st, dyn_buffer_t *buf)
             return 0;  /* Skip unknown tags */
     }
 
-    dyn_buffer_t data_content;
-    buffer_init(&data_content);
-
-    /* Determine data type and build content */
     uint32_t data_type = MP4_DATA_UTF8;
 
     if (fourcc == MP4_TAG_TRKN || fourcc == MP4_TAG_DISK) {
@@ -350,115 +830,188 @@ static int serialize_tag_item(const mp4tag_simple_tag_t *st, dyn_buffer_t *buf)
             if (sscanf(st->value, "%u/%u", &num, &total) < 1)
                 sscanf(st->value, "%u", &num);
         }
-        uint8_t pair[8] = { 0, 0,
-                            (uint8_t)(num >> 8),   (uint8_t)num,
-                            (uint8_t)(total >> 8),  (uint8_t)total,
-                            0, 0 };
-        buffer_append(&data_content, pair, 8);
+        it->packed[2] = (uint8_t)(num >> 8);
+        it->packed[3] = (uint8_t)num;
+        it->packed[4] = (uint8_t)(total >> 8);
+        it->packed[5] = (uint8_t)total;
+        it->value      = it->packed;
+        it->value_size = 8;
     } else if (fourcc == MP4_TAG_TMPO) {
         /* BPM: 2-byte integer */
         data_type = MP4_DATA_INTEGER;
-        unsigned bpm = 0;
-        if (st->value) sscanf(st->value, "%u", &bpm);
-        uint8_t bpm_bytes[2] = { (uint8_t)(bpm >> 8), (uint8_t)bpm };
-        buffer_append(&data_content, bpm_bytes, 2);
+        pack_u16(it, parse_uint(st->value));
     } else if (fourcc == MP4_TAG_CPIL || fourcc == MP4_TAG_PGAP) {
         /* Boolean: 1 byte */
         data_type = MP4_DATA_INTEGER;
-        uint8_t val = 0;
-        if (st->value) {
-            unsigned v = 0;
-            sscanf(st->value, "%u", &v);
-            val = (uint8_t)(v ? 1 : 0);
-        }
-        buffer_append_byte(&data_content, val);
+        it->packed[0]  = parse_uint(st->value) ? 1 : 0;
+        it->value      = it->packed;
+        it->value_size = 1;
+    } else if (fourcc == MP4_TAG_COVR && st->binary_source) {
+        /* Streamed cover art: only the headers are held in memory */
+        const mp4tag_binary_source_t *src = st->binary_source;
+        if (src->size == 0)
+            return 0;  /* No image data */
+        if (src->size > UINT32_MAX - ILST_ITEM_OVERHEAD)
+            return MP4TAG_ERR_TAG_TOO_LARGE;
+
+        /* A file too short for the value is caught before anything is written */
+        struct stat st_fd;
+        if (src->fd >= 0 && fstat(src->fd, &st_fd) == 0 && S_ISREG(st_fd.st_mode) &&
+            (src->offset < 0 ||
+             (uint64_t)src->offset + src->size > (uint64_t)st_fd.st_size))
+            return MP4TAG_ERR_TRUNCATED;
+        uint8_t magic[2] = { 0, 0 };
+        int rc = mp4_binary_source_read(src, magic, src->size < 2 ? 1 : 2, 0);
+        if (rc != MP4TAG_OK) return rc;
+        data_type = magic[0] == 0x89 && magic[1] == 0x50 ? MP4_DATA_PNG
+                                                         : MP4_DATA_JPEG;
+        it->source = src;
     } else if (fourcc == MP4_TAG_COVR) {
         /* Cover art: binary */
-        if (st->binary && st->binary_size > 0) {
-            /* Detect JPEG vs PNG */
-            if (st->binary_size >= 4 &&
-                st->binary[0] == 0x89 && st->binary[1] == 0x50)
-                data_type = MP4_DATA_PNG;
-            else
-                data_type = MP4_DATA_JPEG;
-            buffer_append(&data_content, st->binary, st->binary_size);
-        } else {
-            buffer_free(&data_content);
+        if (!st->binary || st->binary_size == 0)
             return 0;  /* No image data */
-        }
+        /* Detect JPEG vs PNG */
+        if (st->binary_size >= 4 &&
+            st->binary[0] == 0x89 && st->binary[1] == 0x50)
+            data_type = MP4_DATA_PNG;
+        else
+            data_type = MP4_DATA_JPEG;
+        it->value      = st->binary;
+        it->value_size = st->binary_size;
     } else if (fourcc == MP4_TAG_GNRE) {
         /* Genre number: 2-byte integer */
         data_type = MP4_DATA_IMPLICIT;
-        unsigned genre = 0;
-        if (st->value) sscanf(st->value, "%u", &genre);
-        uint8_t genre_bytes[2] = { (uint8_t)(genre >> 8), (uint8_t)genre };
-        buffer_append(&data_content, genre_bytes, 2);
-    } else {
+        pack_u16(it, parse_uint(st->value));
+    } else if (st->value) {
         /* UTF-8 text */
-        data_type = MP4_DATA_UTF8;
-        if (st->value)
-            buffer_append(&data_content, st->value, strlen(st->value));
+        it->value      = (const uint8_t *)st->value;
+        it->value_size = strlen(st->value);
     }
 
-    /* Build data box: header(8) + type_indicator(4) + locale(4) + content */
-    uint32_t data_box_size = 8 + 4 + 4 + (uint32_t)data_content.size;
-
-    /* Build item box: header(8) + data_box */
-    uint32_t item_box_size = 8 + data_box_size;
-
-    /* Write item box header */
-    mp4_write_box_header(buf, fourcc, item_box_size);
-
-    /* Write data box header */
-    mp4_write_box_header(buf, MP4_BOX_DATA, data_box_size);
-
-    /* Write type indicator (4 bytes) */
-    buffer_append_be32(buf, data_type);
-
-    /* Write locale (4 bytes, always 0) */
-    buffer_append_be32(buf, 0);
-
-    /* Write content */
-    buffer_append(buf, data_content.data, data_content.size);
-
-    buffer_free(&data_content);
+    if (it->value_size > UINT32_MAX - ILST_ITEM_OVERHEAD)
+        return MP4TAG_ERR_TAG_TOO_LARGE;
+    it->fourcc    = fourcc;
+    it->data_type = data_type;
     return 0;
 }
 
-int mp4_tags_serialize_ilst(const mp4tag_collection_t *coll, dyn_buffer_t *buf)
+/* Sizing pass over the whole collection; the items come from `scratch`. */
+static int ilst_layout(const mp4tag_collection_t *coll, mp4_arena_t *scratch,
+                       ilst_layout_t *l)
 {
-    if (!coll || !buf) return MP4TAG_ERR_INVALID_ARG;
+    memset(l, 0, sizeof(*l));
+
+    size_t n = 0;
+    for (const mp4tag_tag_t *tag = coll->tags; tag; tag = tag->next)
+        for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next)
+            n++;
+    if (n == 0) return MP4TAG_OK;
+
+    l->items = n <= SIZE_MAX / sizeof(*l->items)
+             ? mp4_arena_alloc(scratch, n * sizeof(*l->items)) : NULL;
+    if (!l->items) return MP4TAG_ERR_NO_MEMORY;
 
     for (const mp4tag_tag_t *tag = coll->tags; tag; tag = tag->next) {
         for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next) {
             if (!st->name) continue;
-            int rc = serialize_tag_item(st, buf);
+            ilst_item_t *it = &l->items[l->count];
+            int rc = layout_item(st, it);
             if (rc != 0) return rc;
+            if (it->fourcc == 0) continue;
+
+            l->count++;
+            l->buffered += ILST_ITEM_OVERHEAD + it->value_size;
+            if (it->source) l->streamed += it->source->size;
         }
     }
+    if ((uint64_t)l->buffered + l->streamed > UINT32_MAX)
+        return MP4TAG_ERR_TAG_TOO_LARGE;
+    return MP4TAG_OK;
+}
+
+static uint8_t *put_header(uint8_t *p, uint32_t type, uint32_t size)
+{
+    mp4_store_be32(p, size);
+    mp4_store_be32(p + 4, type);
+    return p + 8;
+}
 
+/*
+ * Encoding pass: the ilst payload into `dst`, exactly l->buffered
+ * bytes. `at` is dst's offset in the caller's buffer, for the splices.
+ */
+static int ilst_encode(const ilst_layout_t *l, uint8_t *dst, size_t at,
+                       mp4_splices_t *splices)
+{
+    uint8_t *p = dst;
+    for (size_t i = 0; i < l->count; i++) {
+        const ilst_item_t *it = &l->items[i];
+        uint64_t value = it->source ? it->source->size : it->value_size;
+        uint32_t data_box_size = 16 + (uint32_t)value;
+
+        p = put_header(p, it->fourcc, 8 + data_box_size);
+        p = put_header(p, MP4_BOX_DATA, data_box_size);
+        mp4_store_be32(p, it->data_type);
+        mp4_store_be32(p + 4, 0);           /* Locale */
+        p += 8;
+
+        if (it->source) {
+            int rc = splices_add(splices, at + (size_t)(p - dst), it->source);
+            if (rc != MP4TAG_OK) return rc;
+        } else if (it->value_size > 0) {
+            memcpy(p, it->value, it->value_size);
+            p += it->value_size;
+        }
+    }
     return MP4TAG_OK;
 }
 
-int mp4_tags_build_udta(const mp4tag_collection_t *coll, dyn_buffer_t *buf)
+static void splices_reset(mp4_splices_t *splices)
 {
-    if (!coll || !buf) return MP4TAG_ERR_INVALID_ARG;
+    splices->count = 0;
+    splices->size  = 0;
+}
 
-    /* Serialize ilst content */
-    dyn_buffer_t ilst_content;
-    buffer_init(&ilst_content);
-    int rc = mp4_tags_serialize_ilst(coll, &ilst_content);
-    if (rc != 0) { buffer_free(&ilst_content); return rc; }
+int mp4_tags_serialize_ilst(const mp4tag_collection_t *coll, mp4_arena_t *scratch,
+                            dyn_buffer_t *buf, mp4_splices_t *splices)
+{
+    if (!coll || !scratch || !buf || !splices) return MP4TAG_ERR_INVALID_ARG;
+    splices_reset(splices);
 
-    /* Build ilst box */
-    uint32_t ilst_size = 8 + (uint32_t)ilst_content.size;
+    ilst_layout_t l;
+    int rc = ilst_layout(coll, scratch, &l);
+    if (rc != MP4TAG_OK) return rc;
+
+    size_t at = buf->size;
+    if (buffer_append_zeros(buf, l.buffered) != 0)
+        return MP4TAG_ERR_NO_MEMORY;
+    return ilst_encode(&l, buf->data + at, at, splices);
+}
+
+int mp4_tags_wrap_udta(dyn_buffer_t *buf, size_t ilst_end,
+                       const mp4_splices_t *splices, uint32_t padding)
+{
+    if (!buf || !splices || ilst_end < MP4_UDTA_HEADROOM || ilst_end > buf->size)
+        return MP4TAG_ERR_INVALID_ARG;
+    if (padding > 0 && padding < 8) return MP4TAG_ERR_INVALID_ARG;
+
+    /* Streamed values count towards the sizes but aren't buffered */
+    uint64_t ilst_total = (uint64_t)(ilst_end - UDTA_PREFIX_SIZE) + splices->size;
+    uint64_t udta_size  = UDTA_PREFIX_SIZE + ilst_total + padding;
+    if (udta_size > UINT32_MAX) return MP4TAG_ERR_TAG_TOO_LARGE;
+
+    /* Drop any earlier padding, then reserve room for in-place growth */
+    buf->size = ilst_end;
+    if (buffer_append_zeros(buf, padding) != 0) return MP4TAG_ERR_NO_MEMORY;
+    if (padding > 0)
+        put_header(buf->data + ilst_end, MP4_BOX_FREE, padding);
 
     /*
-     * Build hdlr box for meta:
+     * hdlr box for meta:
      * hdlr box = header(8) + version/flags(4) + pre-defined(4) +
      *            handler_type(4) + reserved(12) + name(1) = 33 bytes
      */
-    uint8_t hdlr_data[] = {
+    static const uint8_t hdlr_data[] = {
         0, 0, 0, 0,              /* version + flags */
         0, 0, 0, 0,              /* pre-defined */
         'm', 'd', 'i', 'r',     /* handler_type = 'mdir' */
@@ -467,30 +1020,16 @@ int mp4_tags_build_udta(const mp4tag_collection_t *coll, dyn_buffer_t *buf)
         0, 0, 0, 0,              /* reserved */
         0                        /* name (empty C string) */
     };
-    uint32_t hdlr_size = 8 + (uint32_t)sizeof(hdlr_data);
-
-    /* meta box = header(8) + version/flags(4) + hdlr + ilst */
-    uint32_t meta_content_size = 4 + hdlr_size + ilst_size;
-    uint32_t meta_size = 8 + meta_content_size;
-
-    /* udta box = header(8) + meta */
-    uint32_t udta_size = 8 + meta_size;
-
-    /* Write udta header */
-    mp4_write_box_header(buf, MP4_BOX_UDTA, udta_size);
-
-    /* Write meta header */
-    mp4_write_box_header(buf, MP4_BOX_META, meta_size);
-    buffer_append_be32(buf, 0);  /* version + flags */
-
-    /* Write hdlr */
-    mp4_write_box_header(buf, MP4_BOX_HDLR, hdlr_size);
-    buffer_append(buf, hdlr_data, sizeof(hdlr_data));
-
-    /* Write ilst */
-    mp4_write_box_header(buf, MP4_BOX_ILST, ilst_size);
-    buffer_append(buf, ilst_content.data, ilst_content.size);
 
-    buffer_free(&ilst_content);
+    /* udta > meta (full box) > hdlr, ilst [, free], over the headroom */
+    uint8_t *p = buf->data;
+    p = put_header(p, MP4_BOX_UDTA, (uint32_t)udta_size);
+    p = put_header(p, MP4_BOX_META, (uint32_t)udta_size - 8);
+    memset(p, 0, 4);                        /* version + flags */
+    p += 4;
+    p = put_header(p, MP4_BOX_HDLR, 8 + (uint32_t)sizeof(hdlr_data));
+    memcpy(p, hdlr_data, sizeof(hdlr_data));
+    p += sizeof(hdlr_data);
+    put_header(p, MP4_BOX_ILST, (uint32_t)ilst_total);
     return MP4TAG_OK;
 }
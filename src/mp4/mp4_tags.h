@@ -8,6 +8,7 @@
 #include <tag_common/file_io.h>
 #include <tag_common/buffer.h>
 #include "../util/mp4_buffer_ext.h"
+#include "../util/mp4_arena.h"
 #include "mp4_atoms.h"
 #include "mp4_parser.h"
 
@@ -15,31 +16,182 @@
 extern "C" {
 #endif
 
+/* Parse flags */
+#define MP4_PARSE_LAZY_BINARY  0x1u  /* Record binary offset/size, don't copy */
+
 /*
- * Parse the ilst box and build a collection.
- * The caller must free the collection with mp4_tags_free_collection().
+ * Parse the ilst box and build a collection in `arena`, which the
+ * collection then owns: free it with mp4_tags_free_collection(). On
+ * failure the arena stays the caller's, possibly partly used.
  */
 int mp4_tags_parse_ilst(file_handle_t *fh, const mp4_file_info_t *info,
+                        unsigned flags, mp4_arena_t *arena,
                         mp4tag_collection_t **out);
 
+/*
+ * As mp4_tags_parse_ilst, but decodes from a span that holds the whole
+ * ilst box in memory (typically the buffered moov). No file I/O.
+ */
+int mp4_tags_parse_ilst_span(const mp4_span_t *span, const mp4_file_info_t *info,
+                             unsigned flags, mp4_arena_t *arena,
+                             mp4tag_collection_t **out);
+
+/*
+ * Fill a view array with every data box of the ilst held in `span`.
+ * `*items` / `*capacity` describe a caller-owned array grown through
+ * `allocator` (see mp4_mem_realloc) as needed; `*count` receives the
+ * number of entries.
+ */
+int mp4_tags_view_ilst(const mp4_span_t *span, const mp4_file_info_t *info,
+                       const mp4tag_allocator_t *allocator,
+                       mp4tag_item_view_t **items, size_t *count,
+                       size_t *capacity);
+
+/*
+ * Streamed values left out of a serialized buffer. Splice `i` stands
+ * for `src->size` bytes that belong just before byte `at` of the buffer
+ * (as passed to the serializer, whatever it held before), so the
+ * bytes to write are the buffer with every splice expanded in order:
+ * buf->size + `size` in all. Box headers already count them.
+ */
+typedef struct {
+    size_t                        at;
+    const mp4tag_binary_source_t *src;
+} mp4_splice_t;
+
+typedef struct {
+    mp4_splice_t *items;
+    size_t        count;
+    size_t        capacity;
+    uint64_t      size;         /* Sum of the spliced value sizes */
+    const mp4tag_allocator_t *allocator;    /* Of items */
+} mp4_splices_t;
+
+/* `allocator` (NULL for the C heap) must outlive the splices. */
+void mp4_splices_init(mp4_splices_t *sp, const mp4tag_allocator_t *allocator);
+void mp4_splices_free(mp4_splices_t *sp);
+
+/*
+ * Read `len` bytes at `offset` into a streamed value. MP4TAG_OK once
+ * all of them are in `buf`; a short source is MP4TAG_ERR_TRUNCATED.
+ */
+int mp4_binary_source_read(const mp4tag_binary_source_t *src, void *buf,
+                           size_t len, uint64_t offset);
+
 /*
  * Serialize a tag collection into an ilst box payload (not including
- * the ilst header itself).
+ * the ilst header itself). Streamed values are recorded in `splices`
+ * (reset first) rather than read. The sizing pass allocates from
+ * `scratch`, which the caller resets afterwards.
+ */
+int mp4_tags_serialize_ilst(const mp4tag_collection_t *coll, mp4_arena_t *scratch,
+                            dyn_buffer_t *buf, mp4_splices_t *splices);
+
+/*
+ * Bytes a write leaves ahead of the ilst payload it serializes: room for
+ * the udta, meta and hdlr headers and the ilst header itself, so the
+ * ilst box starts at MP4_UDTA_HEADROOM - 8 and the udta at 0.
  */
-int mp4_tags_serialize_ilst(const mp4tag_collection_t *coll, dyn_buffer_t *buf);
+#define MP4_UDTA_HEADROOM  61u
 
 /*
- * Build a complete moov > udta > meta > ilst hierarchy ready to write.
- * Includes hdlr box and the ilst content. Output is the udta box payload
- * (starting from udta header).
+ * Turn `buf` into a complete udta > meta > hdlr, ilst hierarchy ready to
+ * write, in place: the headers go into the MP4_UDTA_HEADROOM bytes at
+ * its start, ahead of the ilst payload that ends at `ilst_end`. The
+ * streamed values in `splices` count towards the sizes and keep their
+ * positions. Anything after `ilst_end` (an earlier call's padding) is
+ * dropped; a non-zero `padding` (at least 8) appends a free box of that
+ * total size after ilst inside meta, so the call can be repeated to
+ * re-pad the same udta.
  */
-int mp4_tags_build_udta(const mp4tag_collection_t *coll, dyn_buffer_t *buf);
+int mp4_tags_wrap_udta(dyn_buffer_t *buf, size_t ilst_end,
+                       const mp4_splices_t *splices, uint32_t padding);
 
 /*
- * Free a tag collection and all its contents.
+ * Create an empty collection in a new arena drawn from `allocator`
+ * (NULL for the C heap). Returns NULL when out of memory.
+ */
+mp4tag_collection_t *mp4_tags_new_collection(const mp4tag_allocator_t *allocator);
+
+/*
+ * Create an empty collection in an existing (typically reset) arena,
+ * which it then owns. NULL when out of memory; the arena stays the
+ * caller's.
+ */
+mp4tag_collection_t *mp4_tags_new_collection_in(mp4_arena_t *arena);
+
+/*
+ * Free a tag collection and all its contents (its whole arena).
  */
 void mp4_tags_free_collection(mp4tag_collection_t *coll);
 
+/* Append a new, empty tag to the collection. NULL when out of memory. */
+mp4tag_tag_t *mp4_tags_add_tag(mp4tag_collection_t *coll,
+                               mp4tag_target_type_t type);
+
+/*
+ * Allocate an unlinked simple tag in `arena` with copies of `name` and
+ * `value` (either may be NULL). NULL when out of memory.
+ */
+mp4tag_simple_tag_t *mp4_tags_new_simple(mp4_arena_t *arena, const char *name,
+                                         const char *value);
+
+/* Append `st` to the tag's simple tags using the tail pointer. */
+void mp4_tags_append_simple(mp4tag_tag_t *tag, mp4tag_simple_tag_t *st);
+
+/* Append `st` to the parent's nested children the same way. */
+void mp4_tags_append_nested(mp4tag_simple_tag_t *parent, mp4tag_simple_tag_t *st);
+
+/*
+ * FourCC -> simple tag index over a collection, sorted by FourCC. Entries
+ * with the same FourCC keep their collection order. Tags whose name maps
+ * to no FourCC are not indexed. The index borrows the tags: rebuild it
+ * whenever the collection changes.
+ */
+typedef struct {
+    uint32_t                   fourcc;
+    size_t                     order;
+    const mp4tag_simple_tag_t *tag;
+} mp4_tag_index_entry_t;
+
+typedef struct {
+    mp4_tag_index_entry_t *entries;
+    size_t                 count;
+} mp4_tag_index_t;
+
+/*
+ * Build the index into `idx`. The entries are allocated in the
+ * collection's arena, so the index is only valid as long as `coll` and
+ * mp4_tag_index_free (which just clears it) has nothing to release.
+ */
+int mp4_tag_index_build(const mp4tag_collection_t *coll, mp4_tag_index_t *idx);
+
+/* First indexed tag with this FourCC that has a string value, or NULL. */
+const mp4tag_simple_tag_t *mp4_tag_index_find(const mp4_tag_index_t *idx,
+                                              uint32_t fourcc);
+
+void mp4_tag_index_free(mp4_tag_index_t *idx);
+
+/*
+ * First simple tag with a string value under `name` (case-insensitive)
+ * or `fourcc`, or NULL. Uses `idx` when it was built (entries set) and
+ * a linear scan of the collection otherwise. Neither modifies anything,
+ * so concurrent lookups on one collection are safe.
+ */
+const mp4tag_simple_tag_t *mp4_tags_find_name(const mp4tag_collection_t *coll,
+                                              const mp4_tag_index_t *idx,
+                                              const char *name);
+const mp4tag_simple_tag_t *mp4_tags_find_fourcc(const mp4tag_collection_t *coll,
+                                                const mp4_tag_index_t *idx,
+                                                uint32_t fourcc);
+
+/*
+ * Copy the string value of a found tag into `value`: MP4TAG_OK, or
+ * MP4TAG_ERR_TAG_NOT_FOUND for NULL `st` and MP4TAG_ERR_TAG_TOO_LARGE if
+ * it doesn't fit.
+ */
+int mp4_tags_copy_value(const mp4tag_simple_tag_t *st, char *value, size_t size);
+
 /*
  * Map a human-readable tag name to an MP4 atom FourCC.
  * Returns 0 if no mapping exists (caller should use as-is or TXXX-style).
@@ -2,49 +2,462 @@
 /* Copyright (c) 2025 Morgan Prior */
 
 #include "../include/mp4tag/mp4tag.h"
+#include "mp4tag_internal.h"
 #include "mp4/mp4_parser.h"
 #include "mp4/mp4_tags.h"
 #include "mp4/mp4_atoms.h"
+#include "mp4/mp4_moov.h"
+#include "util/mp4_copy.h"
+#include "util/mp4_block_cache.h"
+#include "util/mp4_buffer_ext.h"
+#include "util/mp4_io_count.h"
+#include "util/mp4_arena.h"
 #include <tag_common/file_io.h>
 #include <tag_common/buffer.h>
 #include <tag_common/string_util.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 /* ------------------------------------------------------------------ */
 /*  Internal context definition                                        */
 /* ------------------------------------------------------------------ */
 
+/* Emptied arenas kept: the cached read, a working copy and write scratch */
+#define MP4_SPARE_ARENAS 3
+
 struct mp4tag_context {
     mp4tag_allocator_t  allocator;
     int                 has_allocator;
 
     file_handle_t      *fh;
-    char               *path;
+    char               *path;           /* path_buf while open, else NULL */
     int                 writable;
+    mp4_cache_key_t     fh_id;          /* File fh has open, if fh_id_valid */
+    int                 fh_id_valid;
+
+    /* Memory-backed modes: whole file in memory instead of fh */
+    const uint8_t      *mem;
+    size_t              mem_size;
+    int64_t             mem_offset;     /* File offset of mem[0] */
+    int                 mem_mapped;     /* mem is our mmap, unmap on close */
+
+    /* Opened from a tag index entry: mem is its ilst copy (or NULL) */
+    int                 cache_hit;
+    mp4tag_cache_t     *cache;          /* mp4tag_set_cache */
+
+    /* Write generation of the open file, once a snapshot or write needs it */
+    mp4_generation_t   *gen;
+
+    /* Caller I/O (mp4tag_open_io): reads go through the block cache */
+    int                 has_user_io;
+    mp4tag_io_t         user_io;
+    mp4_block_cache_t   block_cache;
 
     /* Parsed file structure */
     mp4_file_info_t     info;
 
-    /* Cached tag collection (owned by context) */
+    /* Whole moov box, when it fit under moov_read_limit (size 0 if not) */
+    dyn_buffer_t        moov_buf;
+    size_t              moov_read_limit;
+
+    /* Flags passed to the ilst parser (MP4_PARSE_*) */
+    unsigned            parse_flags;
+
+    /* Slack reserved after ilst on rewrite */
+    mp4tag_padding_mode_t padding_mode;
+    uint32_t              padding_value;
+
+    /* Write strategies allowed (MP4TAG_WRITE_*) */
+    unsigned            write_flags;
+
+    /* Buffer sizes and cache policy, zero sizes resolved to defaults */
+    mp4tag_io_options_t io;
+    mp4tag_durability_t durability;
+
+    /* Cached tag collection (owned by context) and its FourCC index */
     mp4tag_collection_t *cached_tags;
+    mp4_tag_index_t      tag_index;
+
+    /* Staged edits between mp4tag_edit_begin and commit/abort (owned) */
+    mp4tag_collection_t *edit;
+
+    /* Borrowed item views (mp4tag_read_tags_view); the array is reused */
+    mp4tag_item_view_t  *views;
+    size_t               view_count;
+    size_t               view_capacity;
+    int                  views_valid;
+    dyn_buffer_t         view_ilst;     /* ilst copy when moov isn't buffered */
+
+    /* Counters and phase timings (mp4tag_get_stats), trace callbacks */
+    mp4_io_count_t       io_count;
+    mp4tag_stats_t       stats;
+    mp4tag_trace_t       trace;
+
+    /*
+     * Kept warm from one file to the next, trimmed to retain_limit bytes
+     * at close: the path, serialization scratch, and emptied arenas for
+     * the next collections
+     */
+    size_t               retain_limit;
+    char                *path_buf;
+    size_t               path_cap;
+    dyn_buffer_t         ilst_buf;
+    dyn_buffer_t         old_moov;
+    dyn_buffer_t         new_moov;
+    mp4_arena_t         *spare_arenas[MP4_SPARE_ARENAS];
+    size_t               spare_arena_count;
 };
 
 /* ------------------------------------------------------------------ */
 /*  Cache helpers                                                      */
 /* ------------------------------------------------------------------ */
 
+/* Allocator for collection arenas: the context's, or NULL for the heap */
+static const mp4tag_allocator_t *ctx_allocator(const mp4tag_context_t *ctx)
+{
+    return ctx->has_allocator ? &ctx->allocator : NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Statistics and tracing                                             */
+/* ------------------------------------------------------------------ */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Start timing `phase`; returns the start time for phase_end. */
+static uint64_t phase_begin(mp4tag_context_t *ctx, mp4tag_phase_t phase)
+{
+    if (ctx->trace.begin) ctx->trace.begin(ctx->trace.user, phase);
+    return now_ns();
+}
+
+static void phase_end(mp4tag_context_t *ctx, mp4tag_phase_t phase,
+                      uint64_t start)
+{
+    uint64_t elapsed = now_ns() - start;
+    ctx->stats.phase_ns[phase] += elapsed;
+    ctx->stats.phase_count[phase]++;
+    if (ctx->trace.end) ctx->trace.end(ctx->trace.user, phase, elapsed);
+}
+
+/* An emptied arena from a freed collection, or a new one. */
+static mp4_arena_t *ctx_take_arena(mp4tag_context_t *ctx)
+{
+    if (ctx->spare_arena_count > 0)
+        return ctx->spare_arenas[--ctx->spare_arena_count];
+    return mp4_arena_create(ctx_allocator(ctx));
+}
+
+static void ctx_give_arena(mp4tag_context_t *ctx, mp4_arena_t *arena)
+{
+    if (ctx->spare_arena_count < MP4_SPARE_ARENAS) {
+        mp4_arena_reset(arena, ctx->retain_limit);
+        ctx->spare_arenas[ctx->spare_arena_count++] = arena;
+    } else {
+        mp4_arena_destroy(arena);
+    }
+}
+
+/* Context-internal collections recycle their arenas. */
+static mp4tag_collection_t *ctx_new_collection(mp4tag_context_t *ctx)
+{
+    mp4_arena_t *arena = ctx_take_arena(ctx);
+    if (!arena) return NULL;
+    mp4tag_collection_t *coll = mp4_tags_new_collection_in(arena);
+    if (!coll) ctx_give_arena(ctx, arena);
+    return coll;
+}
+
+static void ctx_free_collection(mp4tag_context_t *ctx, mp4tag_collection_t *coll)
+{
+    if (coll) ctx_give_arena(ctx, coll->arena);
+}
+
 static void invalidate_cache(mp4tag_context_t *ctx)
 {
+    ctx->views_valid = 0;
+    ctx->view_count  = 0;
     if (ctx->cached_tags) {
-        mp4_tags_free_collection(ctx->cached_tags);
+        mp4_tag_index_free(&ctx->tag_index);    /* Its entries go too */
+        ctx_free_collection(ctx, ctx->cached_tags);
         ctx->cached_tags = NULL;
     }
 }
 
+/* Copy `path` into the retained path buffer; NULL when out of memory. */
+static char *ctx_keep_path(mp4tag_context_t *ctx, const char *path)
+{
+    size_t len = strlen(path) + 1;
+    if (len > ctx->path_cap) {
+        char *grown = mp4_mem_realloc(ctx_allocator(ctx), ctx->path_buf,
+                                      ctx->path_cap, len);
+        if (!grown) return NULL;
+        ctx->path_buf = grown;
+        ctx->path_cap = len;
+    }
+    memcpy(ctx->path_buf, path, len);
+    return ctx->path_buf;
+}
+
+/* Note which file fh has open, from a stat of the path just after opening. */
+static void ctx_note_file(mp4tag_context_t *ctx)
+{
+    ctx->fh_id_valid = ctx->fh && ctx->path &&
+                       mp4_cache_key(ctx->path, &ctx->fh_id) == MP4TAG_OK;
+}
+
+/*
+ * Open ctx->path again for descriptor copies (sendfile, copy_file_range).
+ * Returns -1 unless it is still the file fh has open: after a rename over
+ * the path the planned layout would pull in another file's bytes.
+ */
+static int ctx_reopen_fd(const mp4tag_context_t *ctx)
+{
+    if (!ctx->fh || !ctx->path || !ctx->fh_id_valid) return -1;
+
+    int fd = open(ctx->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd >= 0 && (fstat(fd, &st) != 0 ||
+                    (uint64_t)st.st_dev != ctx->fh_id.dev ||
+                    (uint64_t)st.st_ino != ctx->fh_id.ino)) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/* Keep `buf`'s capacity if it fits in `budget`, otherwise release it. */
+static void retain_buffer(dyn_buffer_t *buf, size_t *budget)
+{
+    if (buf->capacity <= *budget) {
+        *budget -= buf->capacity;
+        buf->size = 0;
+    } else {
+        buffer_free(buf);
+        buffer_init(buf);
+    }
+}
+
+/*
+ * Bound what a closed context holds on to. Buffers are kept in order of
+ * how likely the next file is to need them while they fit under the
+ * retain limit; everything past it is freed.
+ */
+static void trim_retained(mp4tag_context_t *ctx)
+{
+    size_t budget = ctx->retain_limit;
+    retain_buffer(&ctx->moov_buf, &budget);
+    retain_buffer(&ctx->ilst_buf, &budget);
+    retain_buffer(&ctx->new_moov, &budget);
+    retain_buffer(&ctx->old_moov, &budget);
+
+    size_t n = 0;
+    for (size_t i = 0; i < ctx->spare_arena_count; i++) {
+        size_t kept = mp4_arena_reset(ctx->spare_arenas[i], budget);
+        if (kept == 0) {
+            mp4_arena_destroy(ctx->spare_arenas[i]);
+            continue;
+        }
+        budget -= kept;
+        ctx->spare_arenas[n++] = ctx->spare_arenas[i];
+    }
+    ctx->spare_arena_count = n;
+
+    retain_buffer(&ctx->view_ilst, &budget);
+
+    size_t views = ctx->view_capacity * sizeof(*ctx->views);
+    if (views <= budget) {
+        budget -= views;
+    } else {
+        mp4_mem_free(ctx_allocator(ctx), ctx->views);
+        ctx->views         = NULL;
+        ctx->view_capacity = 0;
+    }
+
+    if (ctx->path_cap > budget) {
+        mp4_mem_free(ctx_allocator(ctx), ctx->path_buf);
+        ctx->path_buf = NULL;
+        ctx->path_cap = 0;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Structure parsing                                                  */
+/* ------------------------------------------------------------------ */
+
+static int ctx_is_open(const mp4tag_context_t *ctx)
+{
+    return ctx->fh != NULL || ctx->mem != NULL || ctx->has_user_io ||
+           ctx->cache_hit;
+}
+
+static int cache_read_at(void *user, void *buf, size_t len, int64_t offset)
+{
+    return mp4_block_cache_read(user, buf, len, offset);
+}
+
+/* Parser reader over the block cache of a caller-I/O context. */
+static mp4_reader_t ctx_reader(mp4tag_context_t *ctx)
+{
+    mp4_reader_t reader = { cache_read_at, &ctx->block_cache,
+                            ctx->block_cache.size };
+    return reader;
+}
+
+/* Read `len` bytes at `offset` from whichever source the context has. */
+static int ctx_read_at(mp4tag_context_t *ctx, void *buf, size_t len,
+                       int64_t offset)
+{
+    if (ctx->mem || ctx->cache_hit) {
+        if (offset < ctx->mem_offset ||
+            (uint64_t)(offset - ctx->mem_offset) + len > ctx->mem_size)
+            return MP4TAG_ERR_TRUNCATED;
+        memcpy(buf, ctx->mem + (offset - ctx->mem_offset), len);
+        return MP4TAG_OK;
+    }
+    if (ctx->has_user_io)
+        return mp4_block_cache_read(&ctx->block_cache, buf, len, offset);
+
+    ctx->io_count.seeks++;
+    if (file_seek(ctx->fh, offset) != 0) return MP4TAG_ERR_SEEK_FAILED;
+    ctx->io_count.reads++;
+    if (file_read(ctx->fh, buf, len) != 0) return MP4TAG_ERR_TRUNCATED;
+    ctx->io_count.bytes_read += len;
+    return MP4TAG_OK;
+}
+
+/* Write `len` bytes at `offset`, keeping the block cache coherent. */
+static int ctx_write_at(mp4tag_context_t *ctx, const void *data, size_t len,
+                        int64_t offset)
+{
+    if (!ctx->has_user_io) {
+        ctx->io_count.seeks++;
+        if (file_seek(ctx->fh, offset) != 0) return MP4TAG_ERR_SEEK_FAILED;
+        ctx->io_count.writes++;
+        if (file_write(ctx->fh, data, len) != 0) return MP4TAG_ERR_WRITE_FAILED;
+        ctx->io_count.bytes_written += len;
+        return MP4TAG_OK;
+    }
+
+    const uint8_t *p = data;
+    size_t left = len;
+    while (left > 0) {
+        int64_t n = ctx->user_io.write_at(ctx->user_io.user, p, left,
+                                          (uint64_t)(offset + (int64_t)(p - (const uint8_t *)data)));
+        ctx->io_count.writes++;
+        if (n <= 0 || (uint64_t)n > left) return MP4TAG_ERR_WRITE_FAILED;
+        ctx->io_count.bytes_written += (uint64_t)n;
+        p    += n;
+        left -= (size_t)n;
+    }
+    mp4_block_cache_wrote(&ctx->block_cache, data, len, offset);
+    return MP4TAG_OK;
+}
+
+static int64_t ctx_file_size(mp4tag_context_t *ctx)
+{
+    if (ctx->mem) return (int64_t)ctx->mem_size;
+    return ctx->has_user_io ? ctx->block_cache.size : file_size(ctx->fh);
+}
+
+/*
+ * Span covering the moov box in memory: the buffered moov, or the whole
+ * file in memory-backed modes. Returns 0 if moov is only on disk.
+ */
+static int moov_span(const mp4tag_context_t *ctx, mp4_span_t *span)
+{
+    if (ctx->mem) {
+        span->data   = ctx->mem;
+        span->offset = ctx->mem_offset;
+        span->size   = ctx->mem_size;
+        return 1;
+    }
+    if (ctx->moov_buf.size > 0) {
+        span->data   = ctx->moov_buf.data;
+        span->offset = ctx->info.moov_offset;
+        span->size   = ctx->moov_buf.size;
+        return 1;
+    }
+    return 0;
+}
+
+/* (Re-)parse the file structure, refreshing the buffered moov. */
+static int parse_structure(mp4tag_context_t *ctx)
+{
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_PARSE);
+    int rc;
+    if (ctx->has_user_io) {
+        mp4_reader_t reader = ctx_reader(ctx);
+        rc = mp4_parse_structure_reader(&reader, &ctx->info,
+                                        ctx->moov_read_limit, &ctx->moov_buf);
+    } else {
+        mp4_io_count_t *prev = mp4_io_count_begin(&ctx->io_count);
+        rc = mp4_parse_structure_buffered(ctx->fh, &ctx->info,
+                                          ctx->moov_read_limit,
+                                          ctx->io.tail_read_size, &ctx->moov_buf);
+        mp4_io_count_end(prev);
+    }
+    phase_end(ctx, MP4TAG_PHASE_PARSE, start);
+    return rc;
+}
+
+/* mp4_validate_ftyp on the context's file handle, counted. */
+static int validate_ftyp(mp4tag_context_t *ctx)
+{
+    mp4_io_count_t *prev = mp4_io_count_begin(&ctx->io_count);
+    int rc = mp4_validate_ftyp(ctx->fh);
+    mp4_io_count_end(prev);
+    return rc;
+}
+
+/*
+ * Take a moov the write path just wrote at `offset` as the current one:
+ * udta/meta/ilst are found again in memory and the bytes become the
+ * buffered moov (swapped with `moov`, which gets the old buffer back),
+ * so the file isn't read again. Top-level fields besides moov's own are
+ * the caller's to update.
+ */
+static void adopt_moov(mp4tag_context_t *ctx, dyn_buffer_t *moov,
+                       size_t moov_size, int64_t offset)
+{
+    mp4_file_info_t *info = &ctx->info;
+    info->has_udta            = 0;
+    info->has_meta            = 0;
+    info->meta_has_hdlr       = 0;
+    info->has_ilst            = 0;
+    info->has_free_after_ilst = 0;
+    info->moov_offset         = offset;
+    info->moov_size           = (int64_t)moov_size;
+
+    mp4_span_t span = { moov->data, offset, moov_size };
+    if (moov_size > moov->size || mp4_parse_moov_span(&span, info) != MP4TAG_OK) {
+        /* Cannot happen for a moov we built, but the file has the truth */
+        parse_structure(ctx);
+        return;
+    }
+    info->valid = 1;
+
+    dyn_buffer_t prev = ctx->moov_buf;
+    ctx->moov_buf = *moov;
+    *moov = prev;
+    /* Caller I/O keeps its moov in memory whatever the limit */
+    ctx->moov_buf.size = moov_size <= ctx->moov_read_limit || ctx->has_user_io
+                       ? moov_size : 0;
+}
+
 /* ------------------------------------------------------------------ */
 /*  Version / Error                                                    */
 /* ------------------------------------------------------------------ */
@@ -76,6 +489,8 @@ const char *mp4tag_strerror(int error)
     case MP4TAG_ERR_WRITE_FAILED:  return "Write operation failed";
     case MP4TAG_ERR_SEEK_FAILED:   return "Seek operation failed";
     case MP4TAG_ERR_RENAME_FAILED: return "File rename failed";
+    case MP4TAG_ERR_EDIT_ACTIVE:   return "An edit is already in progress";
+    case MP4TAG_ERR_NO_EDIT:       return "No edit in progress";
     default:                       return "Unknown error";
     }
 }
@@ -84,6 +499,22 @@ const char *mp4tag_strerror(int error)
 /*  Context lifecycle                                                  */
 /* ------------------------------------------------------------------ */
 
+/* Every per-context setting as mp4tag_create leaves it. */
+static void set_defaults(mp4tag_context_t *ctx)
+{
+    ctx->moov_read_limit = MP4TAG_DEFAULT_MOOV_READ_LIMIT;
+    ctx->parse_flags     = 0;
+    ctx->padding_mode    = MP4TAG_PADDING_NONE;
+    ctx->padding_value   = 0;
+    ctx->write_flags     = MP4TAG_WRITE_DEFAULT;
+    ctx->durability      = MP4TAG_DURABILITY_FULL;
+    mp4tag_set_io_options(ctx, NULL);
+    memset(&ctx->trace, 0, sizeof(ctx->trace));
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    memset(&ctx->io_count, 0, sizeof(ctx->io_count));
+    ctx->cache = NULL;
+}
+
 mp4tag_context_t *mp4tag_create(const mp4tag_allocator_t *allocator)
 {
     mp4tag_context_t *ctx;
@@ -96,8 +527,17 @@ mp4tag_context_t *mp4tag_create(const mp4tag_allocator_t *allocator)
         ctx->has_allocator = 1;
     } else {
         ctx = calloc(1, sizeof(*ctx));
+        if (!ctx) return NULL;
     }
 
+    buffer_init(&ctx->moov_buf);
+    buffer_init(&ctx->view_ilst);
+    buffer_init(&ctx->ilst_buf);
+    buffer_init(&ctx->old_moov);
+    buffer_init(&ctx->new_moov);
+    ctx->retain_limit = MP4TAG_DEFAULT_RETAIN_LIMIT;
+    set_defaults(ctx);
+
     return ctx;
 }
 
@@ -105,6 +545,15 @@ void mp4tag_destroy(mp4tag_context_t *ctx)
 {
     if (!ctx) return;
     mp4tag_close(ctx);
+    buffer_free(&ctx->moov_buf);
+    buffer_free(&ctx->view_ilst);
+    buffer_free(&ctx->ilst_buf);
+    buffer_free(&ctx->old_moov);
+    buffer_free(&ctx->new_moov);
+    for (size_t i = 0; i < ctx->spare_arena_count; i++)
+        mp4_arena_destroy(ctx->spare_arenas[i]);
+    mp4_mem_free(ctx_allocator(ctx), ctx->views);
+    mp4_mem_free(ctx_allocator(ctx), ctx->path_buf);
 
     if (ctx->has_allocator && ctx->allocator.free)
         ctx->allocator.free(ctx, ctx->allocator.user_data);
@@ -115,23 +564,24 @@ void mp4tag_destroy(mp4tag_context_t *ctx)
 int mp4tag_open(mp4tag_context_t *ctx, const char *path)
 {
     if (!ctx || !path)           return MP4TAG_ERR_INVALID_ARG;
-    if (ctx->fh)                 return MP4TAG_ERR_ALREADY_OPEN;
+    if (ctx_is_open(ctx))        return MP4TAG_ERR_ALREADY_OPEN;
 
     ctx->fh = file_open_read(path);
     if (!ctx->fh)                return MP4TAG_ERR_IO;
 
-    ctx->path     = str_dup(path);
+    ctx->path     = ctx_keep_path(ctx, path);
     ctx->writable = 0;
+    ctx_note_file(ctx);
 
     /* Validate file type */
-    int rc = mp4_validate_ftyp(ctx->fh);
+    int rc = validate_ftyp(ctx);
     if (rc != MP4TAG_OK) {
         mp4tag_close(ctx);
         return rc;
     }
 
     /* Parse structure */
-    rc = mp4_parse_structure(ctx->fh, &ctx->info);
+    rc = parse_structure(ctx);
     if (rc != MP4TAG_OK) {
         mp4tag_close(ctx);
         return rc;
@@ -143,21 +593,22 @@ int mp4tag_open(mp4tag_context_t *ctx, const char *path)
 int mp4tag_open_rw(mp4tag_context_t *ctx, const char *path)
 {
     if (!ctx || !path)           return MP4TAG_ERR_INVALID_ARG;
-    if (ctx->fh)                 return MP4TAG_ERR_ALREADY_OPEN;
+    if (ctx_is_open(ctx))        return MP4TAG_ERR_ALREADY_OPEN;
 
     ctx->fh = file_open_rw(path);
     if (!ctx->fh)                return MP4TAG_ERR_IO;
 
-    ctx->path     = str_dup(path);
+    ctx->path     = ctx_keep_path(ctx, path);
     ctx->writable = 1;
+    ctx_note_file(ctx);
 
-    int rc = mp4_validate_ftyp(ctx->fh);
+    int rc = validate_ftyp(ctx);
     if (rc != MP4TAG_OK) {
         mp4tag_close(ctx);
         return rc;
     }
 
-    rc = mp4_parse_structure(ctx->fh, &ctx->info);
+    rc = parse_structure(ctx);
     if (rc != MP4TAG_OK) {
         mp4tag_close(ctx);
         return rc;
@@ -166,23 +617,297 @@ int mp4tag_open_rw(mp4tag_context_t *ctx, const char *path)
     return MP4TAG_OK;
 }
 
+int mp4_open_prefetched(mp4tag_context_t *ctx, const char *path,
+                        const uint8_t *head, size_t head_size,
+                        const mp4_file_info_t *top, dyn_buffer_t *moov)
+{
+    if (!ctx || !path || !head || !top || !moov) return MP4TAG_ERR_INVALID_ARG;
+    if (ctx_is_open(ctx))                        return MP4TAG_ERR_ALREADY_OPEN;
+    if (top->moov_offset < 0 || moov->size != (size_t)top->moov_size)
+        return MP4TAG_ERR_INVALID_ARG;
+
+    mp4_span_t file = { head, 0, head_size };
+    int rc = mp4_validate_ftyp_span(&file);
+    if (rc != MP4TAG_OK) return rc;
+
+    mp4_file_info_t info = *top;
+    mp4_span_t span = { moov->data, top->moov_offset, moov->size };
+    rc = mp4_parse_moov_span(&span, &info);
+    if (rc != MP4TAG_OK) return rc;
+    info.valid = 1;
+
+    ctx->fh = file_open_read(path);
+    if (!ctx->fh) return MP4TAG_ERR_IO;
+    ctx->path     = ctx_keep_path(ctx, path);
+    ctx->writable = 0;
+    ctx->info     = info;
+    ctx_note_file(ctx);
+
+    dyn_buffer_t prev = ctx->moov_buf;
+    ctx->moov_buf = *moov;
+    *moov = prev;
+    moov->size = 0;
+    return MP4TAG_OK;
+}
+
+static int64_t user_io_fetch(void *user, void *buf, size_t len, uint64_t offset)
+{
+    mp4tag_context_t *ctx = user;
+    int64_t n = ctx->user_io.read_at(ctx->user_io.user, buf, len, offset);
+    ctx->io_count.reads++;
+    if (n > 0) ctx->io_count.bytes_read += (uint64_t)n;
+    return n;
+}
+
+int mp4tag_open_io(mp4tag_context_t *ctx, const mp4tag_io_t *io)
+{
+    if (!ctx || !io || !io->read_at || !io->size) return MP4TAG_ERR_INVALID_ARG;
+    if (ctx_is_open(ctx))                         return MP4TAG_ERR_ALREADY_OPEN;
+
+    int64_t size = io->size(io->user);
+    if (size < 0) return MP4TAG_ERR_IO;
+    if (size < 8) return MP4TAG_ERR_NOT_MP4;
+
+    ctx->user_io = *io;
+    int rc = mp4_block_cache_init(&ctx->block_cache, user_io_fetch,
+                                  ctx, size, io->block_size,
+                                  io->cache_blocks);
+    if (rc != MP4TAG_OK) return rc;
+    ctx->has_user_io = 1;
+    ctx->writable    = io->write_at != NULL;
+
+    mp4_reader_t reader = ctx_reader(ctx);
+    rc = mp4_validate_ftyp_reader(&reader);
+    if (rc == MP4TAG_OK)
+        rc = parse_structure(ctx);
+    if (rc != MP4TAG_OK)
+        mp4tag_close(ctx);
+    return rc;
+}
+
+/* Validate and parse a file already held in ctx->mem. */
+static int open_mem_common(mp4tag_context_t *ctx)
+{
+    mp4_span_t file = { ctx->mem, 0, ctx->mem_size };
+
+    int rc = mp4_validate_ftyp_span(&file);
+    if (rc == MP4TAG_OK)
+        rc = mp4_parse_structure_span(&file, &ctx->info);
+
+    if (rc != MP4TAG_OK)
+        mp4tag_close(ctx);
+    return rc;
+}
+
+int mp4tag_open_memory(mp4tag_context_t *ctx, const void *data, size_t size)
+{
+    if (!ctx || !data)           return MP4TAG_ERR_INVALID_ARG;
+    if (ctx_is_open(ctx))        return MP4TAG_ERR_ALREADY_OPEN;
+    if (size < 8)                return MP4TAG_ERR_NOT_MP4;
+
+    ctx->mem        = data;
+    ctx->mem_size   = size;
+    ctx->mem_mapped = 0;
+    ctx->writable   = 0;
+
+    return open_mem_common(ctx);
+}
+
+int mp4tag_open_mapped(mp4tag_context_t *ctx, const char *path)
+{
+    if (!ctx || !path)           return MP4TAG_ERR_INVALID_ARG;
+    if (ctx_is_open(ctx))        return MP4TAG_ERR_ALREADY_OPEN;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)                  return MP4TAG_ERR_IO;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return MP4TAG_ERR_IO; }
+    if (st.st_size < 8)      { close(fd); return MP4TAG_ERR_NOT_MP4; }
+    if ((uint64_t)st.st_size > SIZE_MAX) { close(fd); return MP4TAG_ERR_UNSUPPORTED; }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  /* The mapping keeps the file referenced */
+    if (map == MAP_FAILED)       return MP4TAG_ERR_IO;
+
+    ctx->mem        = map;
+    ctx->mem_size   = (size_t)st.st_size;
+    ctx->mem_mapped = 1;
+    ctx->writable   = 0;
+    ctx->path       = ctx_keep_path(ctx, path);
+
+    return open_mem_common(ctx);
+}
+
+/*
+ * The whole ilst box of the open file (which has one): in the buffered
+ * moov or memory source, or read into the old_moov scratch buffer.
+ */
+static int ctx_ilst_bytes(mp4tag_context_t *ctx, const uint8_t **ilst)
+{
+    const mp4_file_info_t *info = &ctx->info;
+    size_t size = (size_t)info->ilst_size;
+    mp4_span_t span;
+    if (moov_span(ctx, &span) && info->ilst_offset >= span.offset &&
+        info->ilst_offset + info->ilst_size <= span.offset + (int64_t)span.size) {
+        *ilst = span.data + (info->ilst_offset - span.offset);
+        return MP4TAG_OK;
+    }
+    ctx->old_moov.size = 0;
+    if (buffer_append_zeros(&ctx->old_moov, size) != 0)
+        return MP4TAG_ERR_NO_MEMORY;
+    int rc = ctx_read_at(ctx, ctx->old_moov.data, size, info->ilst_offset);
+    if (rc == MP4TAG_ERR_TRUNCATED) rc = MP4TAG_ERR_IO;
+    *ilst = ctx->old_moov.data;
+    return rc;
+}
+
+int mp4_open_cache_hit(mp4tag_context_t *ctx, mp4tag_cache_t *cache,
+                       const char *path, const mp4_cache_key_t *key)
+{
+    if (ctx_is_open(ctx) ||
+        !mp4_cache_lookup(cache, key, &ctx->info, &ctx->view_ilst))
+        return 0;
+
+    ctx->path = ctx_keep_path(ctx, path);
+    if (!ctx->path) {
+        memset(&ctx->info, 0, sizeof(ctx->info));
+        return 0;
+    }
+    ctx->cache_hit = 1;
+    ctx->writable  = 0;
+    if (ctx->info.has_ilst) {
+        ctx->mem        = ctx->view_ilst.data;
+        ctx->mem_size   = ctx->view_ilst.size;
+        ctx->mem_offset = ctx->info.ilst_offset;
+    }
+    return 1;
+}
+
+void mp4_cache_remember(mp4tag_context_t *ctx, mp4tag_cache_t *cache,
+                        const mp4_cache_key_t *key)
+{
+    const mp4_file_info_t *info = &ctx->info;
+    if (!ctx_is_open(ctx) || ctx->cache_hit || ctx->has_user_io || !info->valid)
+        return;
+
+    const uint8_t *ilst = NULL;
+    size_t ilst_size = 0;
+    if (info->has_ilst) {
+        if (info->ilst_size < 8 || !mp4_cache_accepts(cache, (uint64_t)info->ilst_size))
+            return;
+        ilst_size = (size_t)info->ilst_size;
+        if (ctx_ilst_bytes(ctx, &ilst) != MP4TAG_OK)
+            return;
+    }
+    mp4_cache_store(cache, key, info, ilst, ilst_size);
+}
+
+int mp4tag_open_cached(mp4tag_context_t *ctx, mp4tag_cache_t *cache,
+                       const char *path)
+{
+    if (!ctx || !cache || !path) return MP4TAG_ERR_INVALID_ARG;
+    if (ctx_is_open(ctx))        return MP4TAG_ERR_ALREADY_OPEN;
+
+    /* Keyed before the file is read, so a change meanwhile is a miss */
+    mp4_cache_key_t key;
+    int rc = mp4_cache_key(path, &key);
+    if (rc != MP4TAG_OK) return rc;
+    if (mp4_open_cache_hit(ctx, cache, path, &key)) return MP4TAG_OK;
+
+    rc = mp4tag_open(ctx, path);
+    if (rc == MP4TAG_OK)
+        mp4_cache_remember(ctx, cache, &key);
+    return rc;
+}
+
+int mp4tag_set_cache(mp4tag_context_t *ctx, mp4tag_cache_t *cache)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    ctx->cache = cache;
+    return MP4TAG_OK;
+}
+
 void mp4tag_close(mp4tag_context_t *ctx)
 {
     if (!ctx) return;
+    mp4tag_edit_abort(ctx);
     invalidate_cache(ctx);
     if (ctx->fh) {
         file_close(ctx->fh);
         ctx->fh = NULL;
     }
-    free(ctx->path);
+    if (ctx->has_user_io) {
+        mp4_block_cache_free(&ctx->block_cache);
+        memset(&ctx->user_io, 0, sizeof(ctx->user_io));
+        ctx->has_user_io = 0;
+    }
+    if (ctx->mem_mapped)
+        munmap((void *)ctx->mem, ctx->mem_size);
+    ctx->mem        = NULL;
+    ctx->mem_size   = 0;
+    ctx->mem_offset = 0;
+    ctx->mem_mapped = 0;
+    ctx->cache_hit  = 0;
+    mp4_generation_release(ctx->gen);
+    ctx->gen      = NULL;
     ctx->path     = NULL;
     ctx->writable = 0;
+    ctx->fh_id_valid = 0;
     memset(&ctx->info, 0, sizeof(ctx->info));
+    trim_retained(ctx);
+}
+
+void mp4tag_reset(mp4tag_context_t *ctx)
+{
+    if (!ctx) return;
+    mp4tag_close(ctx);
+    set_defaults(ctx);
+}
+
+int mp4tag_set_retain_limit(mp4tag_context_t *ctx, size_t bytes)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    ctx->retain_limit = bytes;
+    if (!ctx_is_open(ctx))
+        trim_retained(ctx);
+    return MP4TAG_OK;
 }
 
 int mp4tag_is_open(const mp4tag_context_t *ctx)
 {
-    return (ctx && ctx->fh) ? 1 : 0;
+    return (ctx && ctx_is_open(ctx)) ? 1 : 0;
+}
+
+int mp4tag_set_moov_read_limit(mp4tag_context_t *ctx, size_t limit)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    ctx->moov_read_limit = limit;
+    return MP4TAG_OK;
+}
+
+int mp4tag_set_io_options(mp4tag_context_t *ctx, const mp4tag_io_options_t *opts)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    if (opts && (opts->flags & ~(MP4TAG_IO_FADVISE | MP4TAG_IO_DIRECT)))
+        return MP4TAG_ERR_INVALID_ARG;
+
+    mp4tag_io_options_t io;
+    memset(&io, 0, sizeof(io));
+    if (opts) io = *opts;
+    if (io.copy_buffer_size == 0) io.copy_buffer_size = MP4TAG_DEFAULT_COPY_BUFFER;
+    if (io.tail_read_size == 0)   io.tail_read_size   = MP4TAG_DEFAULT_TAIL_READ;
+    ctx->io = io;
+    return MP4TAG_OK;
+}
+
+int mp4tag_set_lazy_binary(mp4tag_context_t *ctx, int enable)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    if (enable) ctx->parse_flags |=  MP4_PARSE_LAZY_BINARY;
+    else        ctx->parse_flags &= ~MP4_PARSE_LAZY_BINARY;
+    invalidate_cache(ctx);
+    return MP4TAG_OK;
 }
 
 /* ------------------------------------------------------------------ */
@@ -192,7 +917,7 @@ int mp4tag_is_open(const mp4tag_context_t *ctx)
 int mp4tag_read_tags(mp4tag_context_t *ctx, mp4tag_collection_t **tags)
 {
     if (!ctx || !tags)     return MP4TAG_ERR_INVALID_ARG;
-    if (!ctx->fh)          return MP4TAG_ERR_NOT_OPEN;
+    if (!ctx_is_open(ctx)) return MP4TAG_ERR_NOT_OPEN;
 
     if (ctx->cached_tags) {
         *tags = ctx->cached_tags;
@@ -202,291 +927,1093 @@ int mp4tag_read_tags(mp4tag_context_t *ctx, mp4tag_collection_t **tags)
     if (!ctx->info.has_ilst)
         return MP4TAG_ERR_NO_TAGS;
 
-    mp4tag_collection_t *coll = NULL;
-    int rc = mp4_tags_parse_ilst(ctx->fh, &ctx->info, &coll);
-    if (rc != MP4TAG_OK)
-        return rc;
+    mp4_arena_t *arena = ctx_take_arena(ctx);
+    if (!arena) return MP4TAG_ERR_NO_MEMORY;
+
+    mp4tag_collection_t *coll = NULL;
+    mp4_span_t span;
+    int rc;
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_PARSE);
+    if (moov_span(ctx, &span)) {
+        rc = mp4_tags_parse_ilst_span(&span, &ctx->info, ctx->parse_flags,
+                                      arena, &coll);
+    } else {
+        mp4_io_count_t *prev = mp4_io_count_begin(&ctx->io_count);
+        rc = mp4_tags_parse_ilst(ctx->fh, &ctx->info, ctx->parse_flags,
+                                 arena, &coll);
+        mp4_io_count_end(prev);
+    }
+    phase_end(ctx, MP4TAG_PHASE_PARSE, start);
+    if (rc != MP4TAG_OK) {
+        ctx_give_arena(ctx, arena);
+        return rc;
+    }
+
+    /* Without an index, lookups fall back to a linear scan */
+    if (mp4_tag_index_build(coll, &ctx->tag_index) != MP4TAG_OK)
+        mp4_tag_index_free(&ctx->tag_index);
+
+    ctx->cached_tags = coll;
+    *tags = coll;
+    return MP4TAG_OK;
+}
+
+int mp4tag_read_tags_view(mp4tag_context_t *ctx,
+                          const mp4tag_item_view_t **items, size_t *count)
+{
+    if (!ctx || !items || !count) return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx_is_open(ctx))        return MP4TAG_ERR_NOT_OPEN;
+
+    if (!ctx->views_valid) {
+        const mp4_file_info_t *info = &ctx->info;
+        if (!info->has_ilst) return MP4TAG_ERR_NO_TAGS;
+
+        mp4_span_t span;
+        if (!moov_span(ctx, &span)) {
+            /* moov not buffered: one read of just the ilst box */
+            ctx->view_ilst.size = 0;
+            if (buffer_append_zeros(&ctx->view_ilst, (size_t)info->ilst_size) != 0)
+                return MP4TAG_ERR_NO_MEMORY;
+            int rc = ctx_read_at(ctx, ctx->view_ilst.data, ctx->view_ilst.size,
+                                 info->ilst_offset);
+            if (rc == MP4TAG_ERR_TRUNCATED) rc = MP4TAG_ERR_IO;
+            if (rc != MP4TAG_OK) return rc;
+            span.data   = ctx->view_ilst.data;
+            span.offset = info->ilst_offset;
+            span.size   = ctx->view_ilst.size;
+        }
+
+        int rc = mp4_tags_view_ilst(&span, info, ctx_allocator(ctx), &ctx->views,
+                                    &ctx->view_count, &ctx->view_capacity);
+        if (rc != MP4TAG_OK) return rc;
+        ctx->views_valid = 1;
+    }
+
+    *items = ctx->views;
+    *count = ctx->view_count;
+    return MP4TAG_OK;
+}
+
+int mp4tag_read_snapshot(mp4tag_context_t *ctx, mp4tag_snapshot_t **snap)
+{
+    if (!ctx || !snap)     return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx_is_open(ctx)) return MP4TAG_ERR_NOT_OPEN;
+    if (!ctx->info.has_ilst || ctx->info.ilst_size < 8)
+        return MP4TAG_ERR_NO_TAGS;
+
+    /*
+     * The file's generation cell, held until the next write (which may
+     * replace the inode) or close. Without a path, or if the file can't
+     * be stat'ed, the cell is private to this open
+     */
+    if (!ctx->gen) {
+        mp4_cache_key_t key;
+        int named = ctx->path && mp4_cache_key(ctx->path, &key) == MP4TAG_OK;
+        ctx->gen = mp4_generation_acquire(named ? &key : NULL, 1);
+        if (!ctx->gen) return MP4TAG_ERR_NO_MEMORY;
+    }
+
+    const uint8_t *ilst = NULL;
+    int rc = ctx_ilst_bytes(ctx, &ilst);
+    if (rc != MP4TAG_OK) return rc;
+
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_PARSE);
+    rc = mp4_snapshot_create(&ctx->info, ilst, (size_t)ctx->info.ilst_size,
+                             ctx_allocator(ctx), mp4_generation_retain(ctx->gen),
+                             snap);
+    phase_end(ctx, MP4TAG_PHASE_PARSE, start);
+    return rc;
+}
+
+int mp4tag_read_tag_string(mp4tag_context_t *ctx, const char *name,
+                           char *value, size_t size)
+{
+    if (!ctx || !name || !value || size == 0)
+        return MP4TAG_ERR_INVALID_ARG;
+
+    mp4tag_collection_t *coll = NULL;
+    int rc = mp4tag_read_tags(ctx, &coll);
+    if (rc != MP4TAG_OK) return rc;
+
+    return mp4_tags_copy_value(mp4_tags_find_name(coll, &ctx->tag_index, name),
+                               value, size);
+}
+
+int mp4tag_read_tag_fourcc(mp4tag_context_t *ctx, uint32_t fourcc,
+                           char *value, size_t size)
+{
+    if (!ctx || !value || size == 0)
+        return MP4TAG_ERR_INVALID_ARG;
+
+    mp4tag_collection_t *coll = NULL;
+    int rc = mp4tag_read_tags(ctx, &coll);
+    if (rc != MP4TAG_OK) return rc;
+
+    return mp4_tags_copy_value(mp4_tags_find_fourcc(coll, &ctx->tag_index, fourcc),
+                               value, size);
+}
+
+int mp4tag_read_binary(mp4tag_context_t *ctx, const mp4tag_simple_tag_t *tag,
+                       size_t offset, void *buf, size_t len)
+{
+    if (!ctx || !tag || (!buf && len > 0))  return MP4TAG_ERR_INVALID_ARG;
+    if (offset > tag->binary_size || len > tag->binary_size - offset)
+        return MP4TAG_ERR_INVALID_ARG;
+    if (len == 0) return MP4TAG_OK;
+
+    if (tag->binary) {
+        memcpy(buf, tag->binary + offset, len);
+        return MP4TAG_OK;
+    }
+    if (tag->binary_source)
+        return mp4_binary_source_read(tag->binary_source, buf, len, offset);
+
+    if (!ctx_is_open(ctx)) return MP4TAG_ERR_NOT_OPEN;
+
+    return ctx_read_at(ctx, buf, len, tag->binary_offset + (int64_t)offset);
+}
+
+int mp4tag_binary_view(mp4tag_context_t *ctx, const mp4tag_simple_tag_t *tag,
+                       const uint8_t **data)
+{
+    if (!ctx || !tag || !data) return MP4TAG_ERR_INVALID_ARG;
+
+    if (tag->binary) {
+        *data = tag->binary;
+        return MP4TAG_OK;
+    }
+    if (tag->binary_size == 0) return MP4TAG_ERR_TAG_NOT_FOUND;
+    if (!ctx->mem || tag->binary_source) return MP4TAG_ERR_UNSUPPORTED;
+
+    if (tag->binary_offset < ctx->mem_offset ||
+        (uint64_t)(tag->binary_offset - ctx->mem_offset) + tag->binary_size >
+            ctx->mem_size)
+        return MP4TAG_ERR_TRUNCATED;
+    *data = ctx->mem + (tag->binary_offset - ctx->mem_offset);
+    return MP4TAG_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Write helpers                                                      */
+/* ------------------------------------------------------------------ */
+
+
+/* fdatasync through a descriptor of our own; fh gives no access to one. */
+static int datasync_path(const char *path)
+{
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0) return -1;
+    int rc = fdatasync(fd);
+    close(fd);
+    return rc;
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+/*
+ * Sync what was written through ctx->fh, per the durability policy.
+ * MP4TAG_ERR_IO if the data may not have reached the disk.
+ */
+static int sync_written(mp4tag_context_t *ctx)
+{
+    /* Caller I/O has no sync of its own */
+    if (ctx->durability == MP4TAG_DURABILITY_NONE || ctx->has_user_io)
+        return MP4TAG_OK;
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_SYNC);
+    int rc = MP4TAG_OK;
+    if ((ctx->durability != MP4TAG_DURABILITY_DATA || datasync_path(ctx->path) != 0) &&
+        file_sync(ctx->fh) != 0)
+        rc = MP4TAG_ERR_IO;
+    phase_end(ctx, MP4TAG_PHASE_SYNC, start);
+    return rc;
+}
+
+/* Sync a descriptor we own, per the durability policy. */
+static int sync_fd(mp4tag_context_t *ctx, int fd)
+{
+    if (ctx->durability == MP4TAG_DURABILITY_NONE) return 0;
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_SYNC);
+    int rc;
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    if (ctx->durability == MP4TAG_DURABILITY_DATA)
+        rc = fdatasync(fd);
+    else
+#endif
+        rc = fsync(fd);
+    phase_end(ctx, MP4TAG_PHASE_SYNC, start);
+    return rc;
+}
+
+/* Make a rename in the directory holding `path` durable. */
+static void sync_parent_dir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? str_dup(path) : NULL;
+    if (slash && !dir) return;
+    if (dir) dir[slash == path ? 1 : slash - path] = '\0';
+
+    int fd = open(dir ? dir : ".", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+/* Largest padding we reserve, whatever the policy asks for. */
+#define MP4TAG_MAX_PADDING (64u * 1024u * 1024u)
+
+/*
+ * Padding (total free box size, 0 or >= 8) to reserve after an ilst of
+ * `ilst_size` bytes according to the context's policy.
+ */
+static uint32_t padding_for(const mp4tag_context_t *ctx, uint64_t ilst_size)
+{
+    uint64_t pad = 0;
+
+    switch (ctx->padding_mode) {
+    case MP4TAG_PADDING_FIXED:
+        pad = ctx->padding_value;
+        break;
+    case MP4TAG_PADDING_PERCENT:
+        pad = ilst_size * ctx->padding_value / 100;
+        break;
+    case MP4TAG_PADDING_ROUND_UP:
+        if (ctx->padding_value > 0) {
+            uint64_t n = ctx->padding_value;
+            pad = (ilst_size + n - 1) / n * n - ilst_size;
+            if (pad > 0 && pad < 8)
+                pad += n;
+        }
+        break;
+    case MP4TAG_PADDING_NONE:
+    default:
+        break;
+    }
+
+    if (pad > 0 && pad < 8) pad = 8;
+    if (pad > MP4TAG_MAX_PADDING) pad = MP4TAG_MAX_PADDING;
+    return (uint32_t)pad;
+}
+
+int mp4tag_set_padding(mp4tag_context_t *ctx, mp4tag_padding_mode_t mode,
+                       uint32_t value)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    if (mode < MP4TAG_PADDING_NONE || mode > MP4TAG_PADDING_ROUND_UP)
+        return MP4TAG_ERR_INVALID_ARG;
+    ctx->padding_mode  = mode;
+    ctx->padding_value = value;
+    return MP4TAG_OK;
+}
+
+int mp4tag_set_durability(mp4tag_context_t *ctx, mp4tag_durability_t mode)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    if (mode < MP4TAG_DURABILITY_NONE || mode > MP4TAG_DURABILITY_FULL)
+        return MP4TAG_ERR_INVALID_ARG;
+    ctx->durability = mode;
+    return MP4TAG_OK;
+}
+
+int mp4tag_get_stats(const mp4tag_context_t *ctx, mp4tag_stats_t *stats)
+{
+    if (!ctx || !stats) return MP4TAG_ERR_INVALID_ARG;
+    *stats = ctx->stats;
+    stats->reads         = ctx->io_count.reads;
+    stats->seeks         = ctx->io_count.seeks;
+    stats->writes        = ctx->io_count.writes;
+    stats->bytes_read    = ctx->io_count.bytes_read;
+    stats->bytes_written = ctx->io_count.bytes_written;
+    return MP4TAG_OK;
+}
+
+void mp4tag_reset_stats(mp4tag_context_t *ctx)
+{
+    if (!ctx) return;
+    memset(&ctx->io_count, 0, sizeof(ctx->io_count));
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+int mp4tag_set_trace(mp4tag_context_t *ctx, const mp4tag_trace_t *trace)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    if (trace) ctx->trace = *trace;
+    else       memset(&ctx->trace, 0, sizeof(ctx->trace));
+    return MP4TAG_OK;
+}
+
+int mp4tag_set_write_flags(mp4tag_context_t *ctx, unsigned flags)
+{
+    if (!ctx) return MP4TAG_ERR_INVALID_ARG;
+    if (flags & ~(MP4TAG_WRITE_RELOCATE_MOOV | MP4TAG_WRITE_FASTSTART))
+        return MP4TAG_ERR_INVALID_ARG;
+    ctx->write_flags = flags;
+    return MP4TAG_OK;
+}
+
+static int source_read_at(void *user, void *buf, size_t len, int64_t offset)
+{
+    return mp4_binary_source_read(user, buf, len, (uint64_t)offset);
+}
+
+/*
+ * Write `size` buffered bytes at `offset` with the streamed values of
+ * `splices` expanded in between, each copied from its source through
+ * one bounce buffer rather than loaded whole. The splice positions are
+ * relative to `data + base` (where the serialized udta sits; negative
+ * when `data` is the ilst inside it).
+ */
+static int write_spliced(mp4tag_context_t *ctx, const uint8_t *data, size_t size,
+                         const mp4_splices_t *splices, ptrdiff_t base,
+                         int64_t offset)
+{
+    size_t chunk_size = ctx->io.copy_buffer_size ? ctx->io.copy_buffer_size
+                                                 : MP4_COPY_BUFFER_DEFAULT;
+    uint8_t *chunk = NULL;
+    size_t pos = 0;
+    int rc = MP4TAG_OK;
+
+    for (size_t i = 0; i <= splices->count; i++) {
+        size_t end = i < splices->count
+                   ? (size_t)(base + (ptrdiff_t)splices->items[i].at) : size;
+        if (end > pos) {
+            rc = ctx_write_at(ctx, data + pos, end - pos, offset);
+            if (rc != MP4TAG_OK) break;
+            offset += (int64_t)(end - pos);
+            pos = end;
+        }
+        if (i == splices->count) break;
+
+        const mp4tag_binary_source_t *src = splices->items[i].src;
+        if (!chunk && !(chunk = mp4_mem_alloc(ctx_allocator(ctx), chunk_size))) {
+            rc = MP4TAG_ERR_NO_MEMORY;
+            break;
+        }
+        for (uint64_t done = 0; done < src->size && rc == MP4TAG_OK; ) {
+            size_t n = src->size - done < chunk_size ? (size_t)(src->size - done)
+                                                     : chunk_size;
+            rc = mp4_binary_source_read(src, chunk, n, done);
+            if (rc == MP4TAG_OK)
+                rc = ctx_write_at(ctx, chunk, n, offset);
+            offset += (int64_t)n;
+            done   += n;
+        }
+        if (rc != MP4TAG_OK) break;
+    }
+    mp4_mem_free(ctx_allocator(ctx), chunk);
+    return rc;
+}
+
+/* As write_spliced, as plan segments: streamed values become extern ranges. */
+static int plan_add_spliced(mp4_copy_plan_t *plan, const uint8_t *data,
+                            size_t size, const mp4_splices_t *splices,
+                            size_t base)
+{
+    size_t pos = 0;
+    for (size_t i = 0; i <= splices->count; i++) {
+        size_t end = i < splices->count ? base + splices->items[i].at : size;
+        int rc = mp4_copy_plan_add_memory(plan, data + pos, end - pos);
+        if (rc != MP4TAG_OK) return rc;
+        pos = end;
+        if (i == splices->count) break;
+
+        const mp4tag_binary_source_t *src = splices->items[i].src;
+        rc = src->fd >= 0
+           ? mp4_copy_plan_add_extern(plan, src->fd, NULL, NULL, src->offset,
+                                      (int64_t)src->size)
+           : mp4_copy_plan_add_extern(plan, -1, source_read_at, (void *)src, 0,
+                                      (int64_t)src->size);
+        if (rc != MP4TAG_OK) return rc;
+    }
+    return MP4TAG_OK;
+}
+
+/*
+ * Same-size ilst: write only the item boxes whose bytes differ from the
+ * current ones. The ilst header, the trailing free box and every other
+ * item are left untouched. Returns MP4TAG_ERR_UNSUPPORTED if the current
+ * ilst can't be compared (e.g. a 64-bit header), so the caller falls
+ * back to rewriting the whole ilst.
+ */
+static int patch_ilst_items(mp4tag_context_t *ctx, const uint8_t *content,
+                            size_t content_size, mp4tag_write_plan_t *dry_run)
+{
+    const mp4_file_info_t *info = &ctx->info;
+    int64_t ilst_end = info->ilst_offset + info->ilst_size;
+    dyn_buffer_t tmp;
+    buffer_init(&tmp);
+
+    /* Current ilst bytes: from the buffered moov, or read them */
+    const uint8_t *old;
+    mp4_span_t span;
+    if (moov_span(ctx, &span) && info->ilst_offset >= span.offset &&
+        ilst_end <= span.offset + (int64_t)span.size) {
+        old = span.data + (info->ilst_offset - span.offset);
+    } else {
+        if (buffer_append_zeros(&tmp, (size_t)info->ilst_size) != 0)
+            return MP4TAG_ERR_NO_MEMORY;
+        if (ctx_read_at(ctx, tmp.data, tmp.size, info->ilst_offset) != MP4TAG_OK) {
+            buffer_free(&tmp);
+            return MP4TAG_ERR_IO;
+        }
+        old = tmp.data;
+    }
+
+    int rc = MP4TAG_OK;
+    if (mp4_load_be32(old) != (uint32_t)info->ilst_size ||
+        mp4_load_be32(old + 4) != MP4_BOX_ILST) {
+        rc = MP4TAG_ERR_UNSUPPORTED;
+        goto done;
+    }
+
+    /* The buffered moov is kept in step with the file */
+    uint8_t *cached = old == tmp.data ? NULL : (uint8_t *)old + 8;
+    const uint8_t *cur = old + 8;
+    const uint8_t *src = content;
+    int64_t content_offset = info->ilst_offset + 8;
+    size_t pos = 0;
+    int wrote = 0;
+
+    while (pos < content_size) {
+        size_t len = content_size - pos;
+        if (len >= 8) {
+            uint32_t item = mp4_load_be32(src + pos);
+            if (item >= 8 && item <= len) len = item;
+        }
+        int differs = memcmp(src + pos, cur + pos, len) != 0;
+        if (differs && dry_run) {
+            dry_run->bytes_written += len;
+        } else if (differs) {
+            rc = ctx_write_at(ctx, src + pos, len, content_offset + (int64_t)pos);
+            if (rc != MP4TAG_OK) {
+                parse_structure(ctx);
+                goto done;
+            }
+            if (cached) memcpy(cached + pos, src + pos, len);
+            wrote = 1;
+        }
+        pos += len;
+    }
+
+    /* Same layout: nothing in info moved */
+    if (wrote) rc = sync_written(ctx);
+
+done:
+    buffer_free(&tmp);
+    return rc;
+}
+
+/* mp4_tags_serialize_ilst, timed as the serialize phase. */
+static int serialize_ilst(mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                          dyn_buffer_t *buf, mp4_splices_t *splices)
+{
+    mp4_arena_t *scratch = ctx_take_arena(ctx);
+    if (!scratch) return MP4TAG_ERR_NO_MEMORY;
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_SERIALIZE);
+    int rc = mp4_tags_serialize_ilst(tags, scratch, buf, splices);
+    phase_end(ctx, MP4TAG_PHASE_SERIALIZE, start);
+    ctx_give_arena(ctx, scratch);
+    return rc;
+}
+
+/* mp4_tags_wrap_udta around the serialized ilst, timed as serialize. */
+static int wrap_udta(mp4tag_context_t *ctx, dyn_buffer_t *buf, size_t ilst_end,
+                     const mp4_splices_t *splices, uint32_t padding)
+{
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_SERIALIZE);
+    int rc = mp4_tags_wrap_udta(buf, ilst_end, splices, padding);
+    phase_end(ctx, MP4TAG_PHASE_SERIALIZE, start);
+    return rc;
+}
+
+/*
+ * Strategy 1: In-place replacement.
+ * Replace the ilst content within the existing udta/meta structure,
+ * using any adjacent 'free' box as extra space.
+ *
+ * Like the other strategies, with `dry_run` set this only describes the
+ * write it would make and leaves the file alone.
+ */
+static int try_inplace(mp4tag_context_t *ctx, dyn_buffer_t *ilst,
+                       const mp4_splices_t *splices,
+                       mp4tag_write_plan_t *dry_run,
+                       mp4tag_write_strategy_t *used)
+{
+    mp4_file_info_t *info = &ctx->info;
+    if (!info->has_ilst)
+        return MP4TAG_ERR_NO_SPACE;
+
+    /* The ilst box sits after the udta headroom */
+    const size_t box_at = MP4_UDTA_HEADROOM - 8;
+    const ptrdiff_t base = -(ptrdiff_t)box_at;
+
+    /* Available space = existing ilst + any trailing free */
+    int64_t available = info->ilst_size;
+    if (info->has_free_after_ilst)
+        available += info->free_after_ilst_size;
+
+    /* New ilst box size, streamed values included */
+    uint64_t ilst_total = (uint64_t)(ilst->size - box_at) + splices->size;
+    if (ilst_total > (uint64_t)available)
+        return MP4TAG_ERR_NO_SPACE;
+    uint32_t new_ilst_size = (uint32_t)ilst_total;
+
+    /*
+     * Unchanged length: patch just the items that differ. Streamed values
+     * aren't compared; with any of them the whole ilst goes out.
+     */
+    int rc;
+    if ((int64_t)new_ilst_size == info->ilst_size && splices->count == 0) {
+        if (dry_run) dry_run->strategy = MP4TAG_STRATEGY_IN_PLACE;
+        *used = MP4TAG_STRATEGY_IN_PLACE;
+        rc = patch_ilst_items(ctx, ilst->data + MP4_UDTA_HEADROOM,
+                              ilst->size - MP4_UDTA_HEADROOM, dry_run);
+        if (rc != MP4TAG_ERR_UNSUPPORTED) return rc;
+    }
+    *used = MP4TAG_STRATEGY_PADDED_IN_PLACE;
+
+    if (dry_run) {
+        dry_run->strategy      = MP4TAG_STRATEGY_PADDED_IN_PLACE;
+        dry_run->bytes_written = (uint64_t)available;
+        return MP4TAG_OK;
+    }
+
+    /* New ilst, then a free box (or zeros) over the rest, in one write */
+    int64_t remaining = available - new_ilst_size;
+    size_t ilst_len = ilst->size;
+    mp4_store_be32(ilst->data + box_at, new_ilst_size);
+    mp4_store_be32(ilst->data + box_at + 4, MP4_BOX_ILST);
+    rc = (remaining >= 8 ? mp4_write_free_box(ilst, (uint32_t)remaining)
+                         : buffer_append_zeros(ilst, (size_t)remaining)) == 0
+         ? MP4TAG_OK : MP4TAG_ERR_NO_MEMORY;
+    if (rc == MP4TAG_OK)
+        rc = write_spliced(ctx, ilst->data + box_at, ilst->size - box_at, splices,
+                           base, info->ilst_offset);
+    const uint8_t *region = ilst->data + box_at;
+    size_t region_size = ilst->size - box_at;
+    ilst->size = ilst_len;
+    if (rc != MP4TAG_OK) {
+        if (splices->count > 0) parse_structure(ctx);
+        return rc;
+    }
+
+    /*
+     * Update parent box sizes:
+     * The total space consumed hasn't changed (we filled with free),
+     * but the ilst size within meta may have changed.
+     * Since we keep total space constant, parent sizes stay the same.
+     *
+     * However, if the ilst was previously smaller and there was free space
+     * that we consumed, the meta/udta/moov sizes don't change since the
+     * total footprint is the same.
+     *
+     * The ilst is in the file whether or not the sync succeeds, so the
+     * context follows it either way.
+     */
+
+    rc = sync_written(ctx);
+
+    if ((remaining > 0 && remaining < 8) || splices->count > 0) {
+        /*
+         * Zero fill isn't a box; let the parser decide what it makes of
+         * it. Streamed values aren't in memory to patch the moov with.
+         */
+        parse_structure(ctx);
+        return rc;
+    }
+
+    /* Only the ilst and the free box after it moved */
+    if (ctx->moov_buf.size > 0 && (int64_t)ctx->moov_buf.size == info->moov_size)
+        memcpy(ctx->moov_buf.data + (info->ilst_offset - info->moov_offset),
+               region, region_size);
+    info->ilst_size              = new_ilst_size;
+    info->has_free_after_ilst    = remaining >= 8;
+    info->free_after_ilst_offset = info->ilst_offset + new_ilst_size;
+    info->free_after_ilst_size   = remaining;
+
+    return rc;
+}
+
+/*
+ * Span over the complete moov box: the buffered copy when there is one,
+ * otherwise it is read into `tmp`.
+ */
+static int load_moov(mp4tag_context_t *ctx, dyn_buffer_t *tmp, mp4_span_t *span)
+{
+    const mp4_file_info_t *info = &ctx->info;
+
+    if (moov_span(ctx, span)) {
+        span->data  += info->moov_offset - span->offset;
+        span->offset = info->moov_offset;
+        span->size   = (size_t)info->moov_size;
+        return MP4TAG_OK;
+    }
+
+    tmp->size = 0;
+    if (buffer_append_zeros(tmp, (size_t)info->moov_size) != 0)
+        return MP4TAG_ERR_NO_MEMORY;
+    int rc = ctx_read_at(ctx, tmp->data, tmp->size, info->moov_offset);
+    if (rc != MP4TAG_OK)
+        return rc == MP4TAG_ERR_TRUNCATED ? MP4TAG_ERR_IO : rc;
+
+    span->data   = tmp->data;
+    span->offset = info->moov_offset;
+    span->size   = tmp->size;
+    return MP4TAG_OK;
+}
+
+/*
+ * Strategy 2: Reclaim the free space inside moov.
+ * moov is rebuilt at its current size with the new udta, dropping every
+ * free/skip box among the moov children and the old udta/meta. Whatever
+ * is left over becomes a free box after the new ilst. Only moov is
+ * written; nothing outside it moves. Returns MP4TAG_ERR_NO_SPACE if the
+ * reclaimable space doesn't cover the growth.
+ */
+static int try_reshuffle(mp4tag_context_t *ctx, dyn_buffer_t *udta,
+                         size_t ilst_end, const mp4_splices_t *splices,
+                         mp4tag_write_plan_t *dry_run)
+{
+    mp4_file_info_t *info = &ctx->info;
+    dyn_buffer_t *new_moov = &ctx->new_moov;
+
+    mp4_span_t span;
+    int rc = load_moov(ctx, &ctx->old_moov, &span);
+    if (rc != MP4TAG_OK) return rc;
+
+    /* Tightest moov first; the slack left over becomes ilst padding */
+    rc = wrap_udta(ctx, udta, ilst_end, splices, 0);
+    if (rc != MP4TAG_OK) return rc;
+    rc = mp4_moov_rebuild(&span, udta->data, udta->size, splices->size, NULL,
+                          new_moov);
+    if (rc != MP4TAG_OK) return rc;
+
+    int64_t slack = info->moov_size - (int64_t)(new_moov->size + splices->size);
+    if (slack < 0 || (slack > 0 && slack < 8) || slack > UINT32_MAX)
+        return MP4TAG_ERR_NO_SPACE;
+    if (slack > 0) {
+        rc = wrap_udta(ctx, udta, ilst_end, splices, (uint32_t)slack);
+        if (rc != MP4TAG_OK) return rc;
+        rc = mp4_moov_rebuild(&span, udta->data, udta->size, splices->size, NULL,
+                              new_moov);
+        if (rc != MP4TAG_OK) return rc;
+    }
+    if ((int64_t)(new_moov->size + splices->size) != info->moov_size)
+        return MP4TAG_ERR_NO_SPACE;
+
+    if (dry_run) {
+        dry_run->strategy      = MP4TAG_STRATEGY_RESHUFFLE;
+        dry_run->bytes_written = new_moov->size + splices->size;
+        return MP4TAG_OK;
+    }
+
+    rc = write_spliced(ctx, new_moov->data, new_moov->size, splices,
+                       (ptrdiff_t)(new_moov->size - udta->size), info->moov_offset);
+    if (rc != MP4TAG_OK) { parse_structure(ctx); return rc; }
 
-    ctx->cached_tags = coll;
-    *tags = coll;
-    return MP4TAG_OK;
+    rc = sync_written(ctx);
+    if (splices->count > 0)
+        parse_structure(ctx);
+    else
+        adopt_moov(ctx, new_moov, new_moov->size, info->moov_offset);
+    return rc;
 }
 
-int mp4tag_read_tag_string(mp4tag_context_t *ctx, const char *name,
-                           char *value, size_t size)
+/*
+ * Strategy 3: Relocate moov to the end of the file.
+ * The rebuilt moov is appended at EOF and the old one is retyped to
+ * 'free' (same size), so no media data moves and chunk offsets stay
+ * valid. When moov is already the last box it is simply rewritten in
+ * place. Returns MP4TAG_ERR_UNSUPPORTED if the layout doesn't allow it.
+ */
+static int relocate_moov(mp4tag_context_t *ctx, const dyn_buffer_t *udta_buf,
+                         const mp4_splices_t *splices,
+                         mp4tag_write_plan_t *dry_run)
 {
-    if (!ctx || !name || !value || size == 0)
-        return MP4TAG_ERR_INVALID_ARG;
-
-    mp4tag_collection_t *coll = NULL;
-    int rc = mp4tag_read_tags(ctx, &coll);
+    mp4_file_info_t *info = &ctx->info;
+    int64_t fsize = ctx_file_size(ctx);
+    if (fsize < 0) return MP4TAG_ERR_IO;
+
+    /* Appending is only safe if the top-level boxes end exactly at EOF */
+    mp4_reader_t reader = ctx_reader(ctx);
+    mp4_io_count_t *prev = mp4_io_count_begin(&ctx->io_count);
+    int rc = ctx->has_user_io ? mp4_parse_top_level_finish_reader(&reader, info)
+                              : mp4_parse_top_level_finish(ctx->fh, info);
+    mp4_io_count_end(prev);
     if (rc != MP4TAG_OK) return rc;
+    if (info->top_level_pos != fsize) return MP4TAG_ERR_UNSUPPORTED;
+    int64_t last_offset = info->last_box_offset;
+
+    /* Whole old moov in memory */
+    dyn_buffer_t *new_moov = &ctx->new_moov;
+    mp4_span_t span;
+    rc = load_moov(ctx, &ctx->old_moov, &span);
+    if (rc != MP4TAG_OK) goto done;
+
+    rc = mp4_moov_rebuild(&span, udta_buf->data, udta_buf->size, splices->size,
+                          NULL, new_moov);
+    if (rc != MP4TAG_OK) goto done;
+    size_t udta_at = new_moov->size - udta_buf->size;
+    int64_t moov_total = (int64_t)(new_moov->size + splices->size);
+
+    /* A trailing moov is rewritten over itself, the rest filled with free */
+    int64_t dst = fsize;
+    int64_t slack = 0;
+    if (last_offset == info->moov_offset) {
+        slack = info->moov_size - moov_total;
+        if (slack <= 0 || slack >= 8)
+            dst = info->moov_offset;
+        if (slack < 0) slack = 0;
+    }
+    if (dst == fsize) slack = 0;
 
-    for (const mp4tag_tag_t *tag = coll->tags; tag; tag = tag->next) {
-        for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next) {
-            if (st->name && st->value && str_casecmp(st->name, name) == 0) {
-                return str_copy(value, size, st->value) == 0
-                       ? MP4TAG_OK : MP4TAG_ERR_TAG_TOO_LARGE;
-            }
-        }
+    size_t moov_len = new_moov->size;
+    if (slack > 0 && mp4_write_free_box(new_moov, (uint32_t)slack) != 0) {
+        rc = MP4TAG_ERR_NO_MEMORY; goto done;
+    }
+
+    int64_t end = dst + moov_total + slack;
+    if (dry_run) {
+        /* The old moov is retyped to free: a 4-byte write */
+        dry_run->strategy      = MP4TAG_STRATEGY_RELOCATE;
+        dry_run->bytes_written = (uint64_t)(moov_total + slack) +
+                                 (dst != info->moov_offset ? 4 : 0);
+        dry_run->file_size     = (uint64_t)(end > fsize ? end : fsize);
+        dry_run->temp_space    = dry_run->file_size - (uint64_t)fsize;
+        goto done;
     }
 
-    return MP4TAG_ERR_TAG_NOT_FOUND;
+    rc = write_spliced(ctx, new_moov->data, new_moov->size, splices,
+                       (ptrdiff_t)udta_at, dst);
+    if (rc != MP4TAG_OK) { parse_structure(ctx); goto done; }
+
+    if (dst != info->moov_offset) {
+        /*
+         * New moov is durable before the old one stops being a moov
+         * (with MP4TAG_DURABILITY_NONE that ordering is given up too).
+         * If it may not be, the old moov stays the file's moov.
+         */
+        rc = sync_written(ctx);
+        if (rc != MP4TAG_OK) { parse_structure(ctx); goto done; }
+
+        char free_type[5];
+        mp4_fourcc_to_str(MP4_BOX_FREE, free_type);
+        rc = ctx_write_at(ctx, free_type, 4, info->moov_offset + 4);
+        if (rc != MP4TAG_OK) { parse_structure(ctx); goto done; }
+    }
+
+    rc = sync_written(ctx);
+
+    /* The top level now ends with the new moov and its free padding */
+    info->last_box_offset = slack > 0 ? dst + moov_total : dst;
+    info->top_level_pos   = end > fsize ? end : fsize;
+    if (splices->count > 0)
+        parse_structure(ctx);
+    else
+        adopt_moov(ctx, new_moov, moov_len, dst);
+
+done:
+    return rc;
 }
 
-/* ------------------------------------------------------------------ */
-/*  Write helpers                                                      */
-/* ------------------------------------------------------------------ */
+/* Passes allowed for the moov size to settle after co64 promotion */
+#define MP4TAG_MAX_LAYOUT_PASSES 64
 
-static int write_zeros(file_handle_t *fh, uint32_t count)
+/*
+ * Destination offset of every top-level box for a moov of `moov_size`
+ * bytes emitted before box `moov_slot`. The old moov (`moov_index`) is
+ * skipped. Fills `ranges` for the copied boxes in source order.
+ */
+static void layout_boxes(const mp4_box_t *boxes, size_t count,
+                         size_t moov_index, size_t moov_slot, int64_t moov_size,
+                         mp4_offset_range_t *ranges)
 {
-    uint8_t zeros[4096];
-    memset(zeros, 0, sizeof(zeros));
-    while (count > 0) {
-        uint32_t chunk = count < sizeof(zeros) ? count : (uint32_t)sizeof(zeros);
-        if (file_write(fh, zeros, chunk) != 0)
-            return MP4TAG_ERR_WRITE_FAILED;
-        count -= chunk;
+    int64_t dst = 0;
+    size_t n = 0;
+    for (size_t i = 0; i <= count; i++) {
+        if (i == moov_slot) dst += moov_size;
+        if (i == count) break;
+        if (i == moov_index) continue;
+        ranges[n].src_offset = boxes[i].offset;
+        ranges[n].size       = boxes[i].size;
+        ranges[n].dst_offset = dst;
+        dst += boxes[i].size;
+        n++;
     }
-    return MP4TAG_OK;
 }
 
 /*
- * Strategy 1: In-place replacement.
- * Replace the ilst content within the existing udta/meta structure,
- * using any adjacent 'free' box as extra space.
+ * Output layout of a whole-file write: every top-level box but the old
+ * moov copied from the source, the rebuilt moov at `moov_slot`. Shared
+ * by rewrite_file and mp4tag_write_tags_to.
  */
-static int try_inplace(mp4tag_context_t *ctx, dyn_buffer_t *ilst_content)
+typedef struct {
+    mp4_box_t          *boxes;          /* Source top-level boxes */
+    size_t              count;
+    size_t              moov_index;     /* Old moov among them */
+    size_t              moov_slot;      /* New moov goes before this box */
+    mp4_offset_range_t *ranges;         /* Where the copied boxes land */
+    int64_t             moov_dst;       /* Where the new moov lands */
+    int64_t             moov_size;      /* Its size, streamed values included */
+    dyn_buffer_t       *old_moov;       /* The context's scratch buffers */
+    dyn_buffer_t       *new_moov;
+    mp4_copy_plan_t     plan;
+    const mp4tag_allocator_t *allocator;    /* Of boxes and ranges */
+} rewrite_layout_t;
+
+static void layout_init(mp4tag_context_t *ctx, rewrite_layout_t *l)
 {
-    mp4_file_info_t *info = &ctx->info;
-    if (!info->has_ilst)
-        return MP4TAG_ERR_NO_SPACE;
-
-    /* New ilst box size */
-    uint32_t new_ilst_size = 8 + (uint32_t)ilst_content->size;
-
-    /* Available space = existing ilst + any trailing free */
-    int64_t available = info->ilst_size;
-    if (info->has_free_after_ilst)
-        available += info->free_after_ilst_size;
+    memset(l, 0, sizeof(*l));
+    l->old_moov = &ctx->old_moov;
+    l->new_moov = &ctx->new_moov;
+    l->allocator = ctx_allocator(ctx);
+    mp4_copy_plan_init(&l->plan);
+}
 
-    if ((int64_t)new_ilst_size > available)
-        return MP4TAG_ERR_NO_SPACE;
+static void layout_free(rewrite_layout_t *l)
+{
+    mp4_copy_plan_free(&l->plan);
+    mp4_mem_free(l->allocator, l->ranges);
+    mp4_mem_free(l->allocator, l->boxes);
+}
 
-    /* Write new ilst at the existing ilst offset */
-    int rc = file_seek(ctx->fh, info->ilst_offset);
-    if (rc != 0) return MP4TAG_ERR_SEEK_FAILED;
+/*
+ * Plan the output for a moov carrying `udta_buf`. The moov size decides
+ * where the boxes after it land, and their new offsets decide whether
+ * stco tables need promoting to co64 (which changes the moov size), so
+ * the layout is iterated until the size is stable; it only moves in
+ * one direction, so this converges.
+ */
+static int plan_layout(mp4tag_context_t *ctx, const dyn_buffer_t *udta_buf,
+                       const mp4_splices_t *splices, int64_t src_size,
+                       rewrite_layout_t *l)
+{
+    /* Collect the top-level boxes */
+    size_t capacity = 0, first_mdat = SIZE_MAX;
+    l->moov_index = SIZE_MAX;
+    int64_t pos = 0;
+    while (pos + 8 <= src_size) {
+        uint8_t hdr[16];
+        size_t n = src_size - pos < 16 ? (size_t)(src_size - pos) : 16;
+        int rc = ctx_read_at(ctx, hdr, n, pos);
+        if (rc == MP4TAG_ERR_SEEK_FAILED) return rc;
 
-    /* ilst header */
-    dyn_buffer_t ilst_box;
-    buffer_init(&ilst_box);
-    mp4_write_box_header(&ilst_box, MP4_BOX_ILST, new_ilst_size);
-    rc = file_write(ctx->fh, ilst_box.data, ilst_box.size);
-    buffer_free(&ilst_box);
-    if (rc != 0) return rc;
+        mp4_box_t box;
+        if (rc != MP4TAG_OK ||
+            mp4_parse_box_header(hdr, (size_t)(src_size - pos), pos, &box) != MP4TAG_OK)
+            break;
+        if (box.size < 8) break;
 
-    /* ilst content */
-    rc = file_write(ctx->fh, ilst_content->data, ilst_content->size);
-    if (rc != 0) return rc;
+        if (l->count == capacity) {
+            size_t cap = capacity ? capacity * 2 : 16;
+            mp4_box_t *grown = mp4_mem_realloc(l->allocator, l->boxes,
+                                               capacity * sizeof(*l->boxes),
+                                               cap * sizeof(*l->boxes));
+            if (!grown) return MP4TAG_ERR_NO_MEMORY;
+            l->boxes = grown;
+            capacity = cap;
+        }
+        if (box.offset == ctx->info.moov_offset) l->moov_index = l->count;
+        if (box.type == MP4_BOX_MDAT && first_mdat == SIZE_MAX) first_mdat = l->count;
+        l->boxes[l->count++] = box;
 
-    /* Fill remaining space with a free box */
-    int64_t remaining = available - new_ilst_size;
-    if (remaining >= 8) {
-        dyn_buffer_t free_box;
-        buffer_init(&free_box);
-        mp4_write_free_box(&free_box, (uint32_t)remaining);
-        rc = file_write(ctx->fh, free_box.data, free_box.size);
-        buffer_free(&free_box);
-        if (rc != 0) return rc;
-    } else if (remaining > 0) {
-        /* Too small for a free box, just zero-fill */
-        rc = write_zeros(ctx->fh, (uint32_t)remaining);
-        if (rc != 0) return rc;
+        pos = box.offset + box.size;
     }
+    if (l->moov_index == SIZE_MAX) return MP4TAG_ERR_CORRUPT;
 
-    /*
-     * Update parent box sizes:
-     * The total space consumed hasn't changed (we filled with free),
-     * but the ilst size within meta may have changed.
-     * Since we keep total space constant, parent sizes stay the same.
-     *
-     * However, if the ilst was previously smaller and there was free space
-     * that we consumed, the meta/udta/moov sizes don't change since the
-     * total footprint is the same.
-     */
+    /* Faststart puts moov ahead of the first mdat, otherwise it stays put */
+    l->moov_slot = l->moov_index;
+    if ((ctx->write_flags & MP4TAG_WRITE_FASTSTART) && first_mdat < l->moov_index)
+        l->moov_slot = first_mdat;
 
-    file_sync(ctx->fh);
+    l->ranges = mp4_mem_alloc(l->allocator, l->count * sizeof(*l->ranges));
+    if (!l->ranges) return MP4TAG_ERR_NO_MEMORY;
+    mp4_offset_map_t map = { l->ranges, l->count - 1 };
 
-    /* Re-parse to update info */
-    mp4_parse_structure(ctx->fh, &ctx->info);
+    mp4_span_t span;
+    int rc = load_moov(ctx, l->old_moov, &span);
+    if (rc != MP4TAG_OK) return rc;
 
+    int64_t moov_size = ctx->info.moov_size;
+    for (int pass = 0; ; pass++) {
+        if (pass == MP4TAG_MAX_LAYOUT_PASSES) return MP4TAG_ERR_UNSUPPORTED;
+        layout_boxes(l->boxes, l->count, l->moov_index, l->moov_slot, moov_size,
+                     l->ranges);
+        rc = mp4_moov_rebuild(&span, udta_buf->data, udta_buf->size,
+                              splices->size, &map, l->new_moov);
+        if (rc != MP4TAG_OK) return rc;
+        int64_t built = (int64_t)(l->new_moov->size + splices->size);
+        if (built == moov_size) break;
+        moov_size = built;
+    }
+    l->moov_size = moov_size;
+
+    /* Plan the output; runs of untouched boxes merge into single ranges */
+    for (size_t i = 0; i <= l->count; i++) {
+        rc = MP4TAG_OK;
+        if (i == l->moov_slot) {
+            l->moov_dst = l->plan.total_size;
+            rc = plan_add_spliced(&l->plan, l->new_moov->data, l->new_moov->size,
+                                  splices, l->new_moov->size - udta_buf->size);
+        }
+        if (rc == MP4TAG_OK && i < l->count && i != l->moov_index)
+            rc = mp4_copy_plan_add_source(&l->plan, l->boxes[i].offset,
+                                          l->boxes[i].size);
+        if (rc != MP4TAG_OK) return rc;
+    }
     return MP4TAG_OK;
 }
 
 /*
- * Strategy 2: Rewrite the file.
+ * Strategy 4: Rewrite the file.
  * Write to a temp file, then rename. This handles the case where moov
- * needs to grow.
+ * needs to grow. Every chunk offset table is adjusted for the data that
+ * moves, and with MP4TAG_WRITE_FASTSTART moov is placed ahead of the
+ * first mdat in the same pass.
  */
-static int rewrite_file(mp4tag_context_t *ctx, dyn_buffer_t *udta_buf)
+static int rewrite_file(mp4tag_context_t *ctx, dyn_buffer_t *udta_buf,
+                        const mp4_splices_t *splices,
+                        mp4tag_write_plan_t *dry_run)
 {
-    if (!ctx->path)
+    /* Nothing to rename over for caller I/O */
+    if (ctx->has_user_io)
+        return MP4TAG_ERR_UNSUPPORTED;
+    if (!ctx->path || !ctx->fh)
         return MP4TAG_ERR_INVALID_ARG;
 
     size_t path_len = strlen(ctx->path);
-    char *tmp_path = malloc(path_len + 5);
+    char *tmp_path = mp4_mem_alloc(ctx_allocator(ctx), path_len + 5);
     if (!tmp_path) return MP4TAG_ERR_NO_MEMORY;
     memcpy(tmp_path, ctx->path, path_len);
     memcpy(tmp_path + path_len, ".tmp", 5);
 
-    /* Create temp file */
-    {
-        FILE *f = fopen(tmp_path, "wb");
-        if (!f) { free(tmp_path); return MP4TAG_ERR_IO; }
-        fclose(f);
-    }
-
-    file_handle_t *tmp = file_open_rw(tmp_path);
-    if (!tmp) { free(tmp_path); return MP4TAG_ERR_IO; }
-
-    int result = MP4TAG_OK;
+    int src_fd = -1, dst_fd = -1, direct_fd = -1;
     int64_t src_size = file_size(ctx->fh);
+    rewrite_layout_t l;
+    layout_init(ctx, &l);
+    const mp4_copy_plan_t *plan = &l.plan;
+
+    int result = plan_layout(ctx, udta_buf, splices, src_size, &l);
+    if (result != MP4TAG_OK) goto cleanup;
+
+    uint64_t copied = 0;
+    for (size_t i = 0; i < plan->count; i++)
+        if (plan->segs[i].kind == MP4_SEG_SOURCE)
+            copied += (uint64_t)plan->segs[i].size;
+
+    if (dry_run) {
+        /* The temp file holds a whole copy until the rename */
+        dry_run->strategy      = MP4TAG_STRATEGY_REWRITE;
+        dry_run->bytes_copied  = copied;
+        dry_run->bytes_written = (uint64_t)plan->total_size - copied;
+        dry_run->file_size     = (uint64_t)plan->total_size;
+        dry_run->temp_space    = (uint64_t)plan->total_size;
+        goto cleanup;
+    }
 
-    /*
-     * Strategy: copy the file box by box.
-     * - Copy ftyp and any boxes before moov as-is.
-     * - For moov, rebuild it: copy all children except udta, then append new udta.
-     * - Copy mdat and everything else as-is.
-     */
-
-    /* Pass 1: Collect top-level box positions */
-    int64_t pos = 0;
-
-    while (pos < src_size) {
-        int rc = file_seek(ctx->fh, pos);
-        if (rc != 0) { result = MP4TAG_ERR_SEEK_FAILED; goto cleanup; }
-
-        mp4_box_t box;
-        rc = mp4_read_box_header(ctx->fh, &box);
-        if (rc != 0) break;
-        if (box.size < 8) break;
-
-        if (box.type == MP4_BOX_MOOV) {
-            /*
-             * Rebuild moov:
-             * 1. Collect all moov children except udta
-             * 2. Calculate new moov size
-             * 3. Write moov header + children + new udta
-             */
-
-            /* First pass: calculate total size of non-udta children */
-            int64_t moov_child_pos = box.data_offset;
-            int64_t moov_end = box.offset + box.size;
-            int64_t non_udta_size = 0;
-
-            while (moov_child_pos + 8 <= moov_end) {
-                rc = file_seek(ctx->fh, moov_child_pos);
-                if (rc != 0) break;
-                mp4_box_t child;
-                rc = mp4_read_box_header(ctx->fh, &child);
-                if (rc != 0 || child.size < 8) break;
-
-                if (child.type != MP4_BOX_UDTA)
-                    non_udta_size += child.size;
-
-                moov_child_pos = child.offset + child.size;
-            }
+    /* Create the temp file with the source's permissions */
+    src_fd = ctx_reopen_fd(ctx);
+    if (src_fd < 0) { result = MP4TAG_ERR_IO; goto cleanup; }
 
-            uint32_t new_moov_size = 8 + (uint32_t)non_udta_size +
-                                     (uint32_t)udta_buf->size;
-
-            /* Write moov header */
-            dyn_buffer_t moov_hdr;
-            buffer_init(&moov_hdr);
-            mp4_write_box_header(&moov_hdr, MP4_BOX_MOOV, new_moov_size);
-            rc = file_write(tmp, moov_hdr.data, moov_hdr.size);
-            buffer_free(&moov_hdr);
-            if (rc != 0) { result = rc; goto cleanup; }
-
-            /* Copy non-udta children */
-            moov_child_pos = box.data_offset;
-            while (moov_child_pos + 8 <= moov_end) {
-                rc = file_seek(ctx->fh, moov_child_pos);
-                if (rc != 0) break;
-                mp4_box_t child;
-                rc = mp4_read_box_header(ctx->fh, &child);
-                if (rc != 0 || child.size < 8) break;
-
-                if (child.type != MP4_BOX_UDTA) {
-                    /* Copy this child box */
-                    rc = file_seek(ctx->fh, child.offset);
-                    if (rc != 0) { result = rc; goto cleanup; }
-
-                    int64_t bytes_left = child.size;
-                    uint8_t copy_buf[65536];
-                    while (bytes_left > 0) {
-                        size_t to_read = (size_t)(bytes_left < (int64_t)sizeof(copy_buf)
-                                                  ? bytes_left : (int64_t)sizeof(copy_buf));
-                        int64_t n = file_read_partial(ctx->fh, copy_buf, to_read);
-                        if (n <= 0) break;
-                        rc = file_write(tmp, copy_buf, (size_t)n);
-                        if (rc != 0) { result = rc; goto cleanup; }
-                        bytes_left -= n;
-                    }
-                }
+    struct stat st;
+    if (fstat(src_fd, &st) != 0) { result = MP4TAG_ERR_IO; goto cleanup; }
 
-                moov_child_pos = child.offset + child.size;
-            }
+    dst_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (dst_fd < 0) { result = MP4TAG_ERR_IO; goto cleanup; }
 
-            /* Write new udta */
-            rc = file_write(tmp, udta_buf->data, udta_buf->size);
-            if (rc != 0) { result = rc; goto cleanup; }
-
-        } else {
-            /* Copy box as-is */
-            rc = file_seek(ctx->fh, box.offset);
-            if (rc != 0) { result = rc; goto cleanup; }
-
-            int64_t bytes_left = box.size;
-            uint8_t copy_buf[65536];
-            while (bytes_left > 0) {
-                size_t to_read = (size_t)(bytes_left < (int64_t)sizeof(copy_buf)
-                                          ? bytes_left : (int64_t)sizeof(copy_buf));
-                int64_t n = file_read_partial(ctx->fh, copy_buf, to_read);
-                if (n <= 0) break;
-                rc = file_write(tmp, copy_buf, (size_t)n);
-                if (rc != 0) { result = rc; goto cleanup; }
-                bytes_left -= n;
-            }
-        }
+    /* Without O_DIRECT support the copy just goes through the cache */
+    if (ctx->io.flags & MP4TAG_IO_DIRECT)
+        direct_fd = mp4_open_direct(ctx->path);
+    if (ctx->io.flags & MP4TAG_IO_FADVISE)
+        mp4_advise_sequential(src_fd);
 
-        pos = box.offset + box.size;
+    {
+        mp4_copier_t copier;
+        mp4_copier_init(&copier, src_fd, dst_fd, ctx->io.copy_buffer_size);
+        mp4_copier_set_policy(&copier,
+            ((ctx->io.flags & MP4TAG_IO_FADVISE) ? MP4_COPY_POLICY_DROP : 0) |
+            ((ctx->io.flags & MP4TAG_IO_DIRECT) ? MP4_COPY_POLICY_DIRECT : 0),
+            direct_fd);
+        result = mp4_copy_plan_run(&copier, plan, 0, src_size);
+        mp4_copier_free(&copier);
+        if (result != MP4TAG_OK) goto cleanup;
+        ctx->io_count.bytes_written += (uint64_t)plan->total_size - copied;
+        ctx->stats.bytes_copied     += copied;
     }
 
-    if (file_sync(tmp) != 0) { result = MP4TAG_ERR_IO; goto cleanup; }
+    if (sync_fd(ctx, dst_fd) != 0) { result = MP4TAG_ERR_IO; goto cleanup; }
+    if (ctx->io.flags & MP4TAG_IO_FADVISE) {
+        /* Clean once synced, so these pages can go now */
+        mp4_advise_dontneed(dst_fd);
+        mp4_advise_dontneed(src_fd);
+    }
 
-    file_close(tmp); tmp = NULL;
+    close(dst_fd); dst_fd = -1;
+    close(src_fd); src_fd = -1;
     file_close(ctx->fh); ctx->fh = NULL;
 
-    if (rename(tmp_path, ctx->path) != 0) {
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_RENAME);
+    int renamed = rename(tmp_path, ctx->path) == 0;
+    phase_end(ctx, MP4TAG_PHASE_RENAME, start);
+    if (!renamed) {
         result = MP4TAG_ERR_RENAME_FAILED;
+        unlink(tmp_path);
         ctx->fh = ctx->writable ? file_open_rw(ctx->path)
                                 : file_open_read(ctx->path);
+        ctx_note_file(ctx);
         goto cleanup_path;
     }
 
+    if (ctx->durability == MP4TAG_DURABILITY_FULL) {
+        start = phase_begin(ctx, MP4TAG_PHASE_SYNC);
+        sync_parent_dir(ctx->path);
+        phase_end(ctx, MP4TAG_PHASE_SYNC, start);
+    }
+
     /* Reopen the file */
     ctx->fh = ctx->writable ? file_open_rw(ctx->path)
                             : file_open_read(ctx->path);
     if (!ctx->fh) { result = MP4TAG_ERR_IO; goto cleanup_path; }
+    ctx_note_file(ctx);
 
-    /* Re-parse structure */
-    mp4_parse_structure(ctx->fh, &ctx->info);
+    /* The layout is the one just planned: no need to read it back */
+    {
+        mp4_file_info_t *info = &ctx->info;
+        mp4_top_level_begin(info);
+        size_t n = 0;
+        for (size_t i = 0; i <= l.count; i++) {
+            if (i == l.moov_slot) {
+                mp4_box_t moov = { MP4_BOX_MOOV, l.moov_dst, l.moov_size,
+                                   l.moov_dst + 8, l.moov_size - 8, 8 };
+                mp4_top_level_note(info, &moov);
+            }
+            if (i == l.count) break;
+            if (i == l.moov_index) continue;
+            mp4_box_t box = l.boxes[i];
+            box.offset      = l.ranges[n++].dst_offset;
+            box.data_offset = box.offset + box.header_size;
+            mp4_top_level_note(info, &box);
+        }
+        info->top_level_done = 1;
+        info->top_level_pos  = plan->total_size;
+        if (splices->count > 0)
+            parse_structure(ctx);
+        else
+            adopt_moov(ctx, l.new_moov, l.new_moov->size, l.moov_dst);
+    }
+    goto cleanup_path;
 
 cleanup:
-    if (tmp) { file_close(tmp); unlink(tmp_path); }
+    if (dst_fd >= 0) { close(dst_fd); unlink(tmp_path); }
+    if (src_fd >= 0) close(src_fd);
 cleanup_path:
-    free(tmp_path);
+    if (direct_fd >= 0) close(direct_fd);
+    layout_free(&l);
+    mp4_mem_free(ctx_allocator(ctx), tmp_path);
     return result;
 }
 
@@ -494,40 +2021,301 @@ cleanup_path:
 /*  Tag writing: main entry point                                      */
 /* ------------------------------------------------------------------ */
 
-int mp4tag_write_tags(mp4tag_context_t *ctx, const mp4tag_collection_t *tags)
+/* A lazily parsed value of this file: in neither memory nor a source. */
+static int is_lazy(const mp4tag_simple_tag_t *st)
 {
-    if (!ctx || !tags)   return MP4TAG_ERR_INVALID_ARG;
-    if (!ctx->fh)        return MP4TAG_ERR_NOT_OPEN;
-    if (!ctx->writable)  return MP4TAG_ERR_READ_ONLY;
+    return !st->binary && !st->binary_source && st->binary_size > 0;
+}
 
-    invalidate_cache(ctx);
+/* Reads a lazy value from the open file on behalf of a binary source. */
+typedef struct {
+    mp4tag_context_t *ctx;
+    int64_t           offset;
+} lazy_source_t;
+
+static int64_t lazy_source_read(void *user, void *buf, size_t len, uint64_t offset)
+{
+    const lazy_source_t *ls = user;
+    int rc = ctx_read_at(ls->ctx, buf, len, ls->offset + (int64_t)offset);
+    return rc == MP4TAG_OK ? (int64_t)len : -1;
+}
+
+static int resolve_value(mp4tag_context_t *ctx, mp4_arena_t *arena,
+                         const mp4tag_simple_tag_t *src,
+                         mp4tag_simple_tag_t *st, int splice)
+{
+    st->binary_size = src->binary_size;
+    if (!splice) {
+        st->binary = mp4_arena_alloc(arena, src->binary_size);
+        if (!st->binary) return MP4TAG_ERR_NO_MEMORY;
+        return mp4tag_read_binary(ctx, src, 0, st->binary, src->binary_size);
+    }
+
+    lazy_source_t *ls = mp4_arena_alloc(arena, sizeof(*ls));
+    mp4tag_binary_source_t *bs = mp4_arena_alloc(arena, sizeof(*bs));
+    if (!ls || !bs) return MP4TAG_ERR_NO_MEMORY;
+    ls->ctx     = ctx;
+    ls->offset  = src->binary_offset;
+    bs->fd      = -1;
+    bs->read    = lazy_source_read;
+    bs->user    = ls;
+    bs->size    = src->binary_size;
+    st->binary_source = bs;
+    return MP4TAG_OK;
+}
+
+/*
+ * Lazy values only say where their bytes are in the file, which a write
+ * is about to change. When `tags` has any, `*out` is a working copy in
+ * which each is loaded into memory, or with `splice` (the file stays
+ * as it is) streamed from it as a binary source; everything else is
+ * shared with `tags`. `*out` is NULL when there is nothing to resolve.
+ */
+static int resolve_lazy(mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                        int splice, mp4tag_collection_t **out)
+{
+    *out = NULL;
+    int any = 0;
+    for (const mp4tag_tag_t *tag = tags->tags; tag && !any; tag = tag->next)
+        for (const mp4tag_simple_tag_t *st = tag->simple_tags; st && !any; st = st->next)
+            any = is_lazy(st);
+    if (!any) return MP4TAG_OK;
+
+    mp4tag_collection_t *work = ctx_new_collection(ctx);
+    if (!work) return MP4TAG_ERR_NO_MEMORY;
+
+    int rc = MP4TAG_OK;
+    for (const mp4tag_tag_t *tag = tags->tags; tag && rc == MP4TAG_OK; tag = tag->next) {
+        mp4tag_tag_t *wtag = mp4_tags_add_tag(work, tag->target_type);
+        if (!wtag) { rc = MP4TAG_ERR_NO_MEMORY; break; }
+
+        for (const mp4tag_simple_tag_t *src = tag->simple_tags; src; src = src->next) {
+            mp4tag_simple_tag_t *st = mp4_tags_new_simple(work->arena, NULL, NULL);
+            if (!st) { rc = MP4TAG_ERR_NO_MEMORY; break; }
+            *st = *src;
+            st->next  = NULL;
+            st->arena = work->arena;
+            if (is_lazy(src))
+                rc = resolve_value(ctx, work->arena, src, st, splice);
+            if (rc != MP4TAG_OK) break;
+            mp4_tags_append_simple(wtag, st);
+        }
+    }
+    if (rc != MP4TAG_OK) {
+        ctx_free_collection(ctx, work);
+        return rc;
+    }
+    *out = work;
+    return MP4TAG_OK;
+}
+
+/* Store the file as just written in the attached tag index, if any. */
+static void update_cache(mp4tag_context_t *ctx)
+{
+    mp4_cache_key_t key;
+    if (ctx->cache && ctx->path && mp4_cache_key(ctx->path, &key) == MP4TAG_OK)
+        mp4_cache_remember(ctx, ctx->cache, &key);
+}
+
+/*
+ * Try each strategy in turn and stop at the first that applies. With
+ * `dry_run` set nothing is written; it describes that strategy instead.
+ */
+static int write_tags(mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                      mp4tag_write_plan_t *dry_run)
+{
+    /*
+     * Serialize the ilst once, after headroom for the udta headers, so an
+     * in-place write goes out from this one buffer and the other
+     * strategies turn it into a udta where it stands; streamed values
+     * stay at their source
+     */
+    dyn_buffer_t *ilst = &ctx->ilst_buf;
+    ilst->size = 0;
+    mp4_splices_t splices;
+    mp4_splices_init(&splices, ctx_allocator(ctx));
+    int rc = buffer_append_zeros(ilst, MP4_UDTA_HEADROOM) == 0
+           ? MP4TAG_OK : MP4TAG_ERR_NO_MEMORY;
+    if (rc == MP4TAG_OK)
+        rc = serialize_ilst(ctx, tags, ilst, &splices);
+    if (rc != MP4TAG_OK) goto done;
+    size_t ilst_end = ilst->size;
+    uint64_t ilst_size = ilst_end - (MP4_UDTA_HEADROOM - 8) + splices.size;
+    uint32_t padding = padding_for(ctx, ilst_size);
+
+    /* Note the file's generation cell now: a rewrite replaces the inode */
+    if (!dry_run && !ctx->gen && ctx->path && mp4_generation_watched()) {
+        mp4_cache_key_t key;
+        if (mp4_cache_key(ctx->path, &key) == MP4TAG_OK)
+            ctx->gen = mp4_generation_acquire(&key, 0);
+    }
 
-    /* Serialize ilst content */
-    dyn_buffer_t ilst_content;
-    buffer_init(&ilst_content);
-    int rc = mp4_tags_serialize_ilst(tags, &ilst_content);
-    if (rc != MP4TAG_OK) { buffer_free(&ilst_content); return rc; }
+    uint64_t start = dry_run ? 0 : phase_begin(ctx, MP4TAG_PHASE_WRITE);
+    mp4tag_write_strategy_t used = MP4TAG_STRATEGY_IN_PLACE;
+    mp4tag_inplace_result_t inplace = MP4TAG_INPLACE_NO_ILST;
 
     /* Strategy 1: try in-place if ilst already exists */
     if (ctx->info.has_ilst) {
-        rc = try_inplace(ctx, &ilst_content);
+        rc = try_inplace(ctx, ilst, &splices, dry_run, &used);
+        if (rc == MP4TAG_OK) {
+            inplace = MP4TAG_INPLACE_OK;
+            goto written;
+        }
+        inplace = rc == MP4TAG_ERR_NO_SPACE ? MP4TAG_INPLACE_TOO_LARGE
+                                            : MP4TAG_INPLACE_FAILED;
+        /* A file that fails a write or sync isn't written another way */
+        if (rc == MP4TAG_ERR_IO) goto written;
+    }
+
+    /* Strategy 2: merge the padding scattered through moov */
+    used = MP4TAG_STRATEGY_RESHUFFLE;
+    rc = try_reshuffle(ctx, ilst, ilst_end, &splices, dry_run);
+    if (rc != MP4TAG_ERR_NO_SPACE) goto written;
+
+    rc = wrap_udta(ctx, ilst, ilst_end, &splices, padding);
+
+    /* Strategy 3: move moov to the end, leaving mdat untouched */
+    if (rc == MP4TAG_OK) {
+        rc = MP4TAG_ERR_UNSUPPORTED;
+        used = MP4TAG_STRATEGY_RELOCATE;
+        if ((ctx->write_flags & MP4TAG_WRITE_RELOCATE_MOOV) &&
+            !(ctx->write_flags & MP4TAG_WRITE_FASTSTART))
+            rc = relocate_moov(ctx, ilst, &splices, dry_run);
+    }
+
+    /* Strategy 4: rewrite the file */
+    if (rc == MP4TAG_ERR_UNSUPPORTED) {
+        used = MP4TAG_STRATEGY_REWRITE;
+        rc = rewrite_file(ctx, ilst, &splices, dry_run);
+    }
+
+written:
+    if (!dry_run) {
+        phase_end(ctx, MP4TAG_PHASE_WRITE, start);
+        /* Even a failed write may have changed the file */
+        if (ctx->gen) {
+            mp4_generation_bump(ctx->gen);
+            mp4_generation_release(ctx->gen);
+            ctx->gen = NULL;
+        }
+        ctx->stats.inplace_result = inplace;
         if (rc == MP4TAG_OK) {
-            buffer_free(&ilst_content);
-            return MP4TAG_OK;
+            ctx->stats.write_count++;
+            ctx->stats.last_strategy = used;
+            update_cache(ctx);
         }
     }
 
-    buffer_free(&ilst_content);
+done:
+    mp4_splices_free(&splices);
+    return rc;
+}
+
+int mp4tag_write_tags(mp4tag_context_t *ctx, const mp4tag_collection_t *tags)
+{
+    if (!ctx || !tags)   return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx_is_open(ctx)) return MP4TAG_ERR_NOT_OPEN;
+    if (!ctx->writable)  return MP4TAG_ERR_READ_ONLY;
+
+    /*
+     * `tags` may be the cached collection itself, so it is dropped only
+     * once the write is done with it
+     */
+    mp4tag_collection_t *work = NULL;
+    int rc = resolve_lazy(ctx, tags, 0, &work);
+    if (rc == MP4TAG_OK)
+        rc = write_tags(ctx, work ? work : tags, NULL);
+    ctx_free_collection(ctx, work);
+    invalidate_cache(ctx);
+    return rc;
+}
+
+int mp4tag_plan_write(mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                      mp4tag_write_plan_t *plan)
+{
+    if (!ctx || !tags || !plan) return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx_is_open(ctx))      return MP4TAG_ERR_NOT_OPEN;
+    if (!ctx->fh && !ctx->has_user_io) return MP4TAG_ERR_READ_ONLY;
+
+    int64_t fsize = ctx_file_size(ctx);
+    if (fsize < 0) return MP4TAG_ERR_IO;
+
+    memset(plan, 0, sizeof(*plan));
+    plan->file_size = (uint64_t)fsize;
+    mp4tag_collection_t *work = NULL;
+    int rc = resolve_lazy(ctx, tags, 1, &work);
+    if (rc == MP4TAG_OK)
+        rc = write_tags(ctx, work ? work : tags, plan);
+    ctx_free_collection(ctx, work);
+    return rc;
+}
+
+static int stream_read_at(void *user, void *buf, size_t len, int64_t offset)
+{
+    return ctx_read_at(user, buf, len, offset);
+}
 
-    /* Strategy 2: rewrite the file */
-    dyn_buffer_t udta_buf;
-    buffer_init(&udta_buf);
-    rc = mp4_tags_build_udta(tags, &udta_buf);
-    if (rc != MP4TAG_OK) { buffer_free(&udta_buf); return rc; }
+int mp4tag_write_tags_to(mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                         const mp4tag_sink_t *sink)
+{
+    if (!ctx || !tags || !sink) return MP4TAG_ERR_INVALID_ARG;
+    if (sink->fd < 0 && !sink->write) return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx_is_open(ctx)) return MP4TAG_ERR_NOT_OPEN;
+    if (ctx->cache_hit)    return MP4TAG_ERR_UNSUPPORTED;  /* Only the ilst */
+
+    int64_t src_size = ctx_file_size(ctx);
+    if (src_size < 0) return MP4TAG_ERR_IO;
+
+    /* Sized as a rewrite would size it, so the copy can be edited in place */
+    dyn_buffer_t *udta = &ctx->ilst_buf;
+    udta->size = 0;
+    mp4_splices_t splices;
+    mp4_splices_init(&splices, ctx_allocator(ctx));
+    /* The source isn't changed, so lazy values stream straight from it */
+    mp4tag_collection_t *work = NULL;
+    int rc = resolve_lazy(ctx, tags, 1, &work);
+    if (work) tags = work;
+    if (rc == MP4TAG_OK && buffer_append_zeros(udta, MP4_UDTA_HEADROOM) != 0)
+        rc = MP4TAG_ERR_NO_MEMORY;
+    if (rc == MP4TAG_OK)
+        rc = serialize_ilst(ctx, tags, udta, &splices);
+    if (rc == MP4TAG_OK) {
+        size_t ilst_end = udta->size;
+        uint64_t ilst_size = ilst_end - (MP4_UDTA_HEADROOM - 8) + splices.size;
+        rc = wrap_udta(ctx, udta, ilst_end, &splices, padding_for(ctx, ilst_size));
+    }
+
+    rewrite_layout_t l;
+    layout_init(ctx, &l);
+    if (rc == MP4TAG_OK)
+        rc = plan_layout(ctx, udta, &splices, src_size, &l);
+    if (rc != MP4TAG_OK) goto cleanup;
+
+    mp4_stream_t stream;
+    mp4_stream_init(&stream, ctx->io.copy_buffer_size);
+    /* Through fh if the path no longer names the open file */
+    stream.src_fd = ctx_reopen_fd(ctx);
+    if (stream.src_fd < 0) {
+        stream.read_at   = stream_read_at;
+        stream.read_user = ctx;
+    } else if (ctx->io.flags & MP4TAG_IO_FADVISE) {
+        mp4_advise_sequential(stream.src_fd);
+    }
+    stream.dst_fd     = sink->fd;
+    stream.write      = sink->write;
+    stream.write_user = sink->user;
 
-    rc = rewrite_file(ctx, &udta_buf);
-    buffer_free(&udta_buf);
+    uint64_t start = phase_begin(ctx, MP4TAG_PHASE_WRITE);
+    rc = mp4_stream_plan(&stream, &l.plan, src_size);
+    phase_end(ctx, MP4TAG_PHASE_WRITE, start);
+    ctx->io_count.bytes_written += (uint64_t)stream.bytes_out;
+    if (stream.src_fd >= 0) close(stream.src_fd);
+    mp4_stream_free(&stream);
 
+cleanup:
+    layout_free(&l);
+    mp4_splices_free(&splices);
+    ctx_free_collection(ctx, work);
     return rc;
 }
 
@@ -535,85 +2323,139 @@ int mp4tag_write_tags(mp4tag_context_t *ctx, const mp4tag_collection_t *tags)
 /*  Convenience: set / remove single tag                               */
 /* ------------------------------------------------------------------ */
 
-static mp4tag_simple_tag_t *clone_simple_tag(const mp4tag_simple_tag_t *src)
+static int clone_simple_tag(mp4tag_context_t *ctx, mp4_arena_t *arena,
+                            const mp4tag_simple_tag_t *src,
+                            mp4tag_simple_tag_t **out)
 {
-    mp4tag_simple_tag_t *st = calloc(1, sizeof(*st));
-    if (!st) return NULL;
+    mp4tag_simple_tag_t *st = mp4_tags_new_simple(arena, src->name, src->value);
+    if (!st) return MP4TAG_ERR_NO_MEMORY;
 
-    st->name       = str_dup(src->name);
-    st->value      = str_dup(src->value);
-    st->language   = str_dup(src->language);
-    st->is_default = src->is_default;
+    st->language     = mp4_arena_strdup(arena, src->language);
+    st->is_default   = src->is_default;
+    st->text_invalid = src->text_invalid;
+    if (src->language && !st->language) return MP4TAG_ERR_NO_MEMORY;
 
-    if (src->binary && src->binary_size > 0) {
-        st->binary = malloc(src->binary_size);
-        if (st->binary) {
-            memcpy(st->binary, src->binary, src->binary_size);
-            st->binary_size = src->binary_size;
-        }
+    /*
+     * Lazily-loaded binaries are pulled in here, before the file changes.
+     * A value that cannot be read fails the clone rather than being
+     * written back empty. Partial clones are left to the arena.
+     */
+    if (src->binary_size > 0) {
+        st->binary = mp4_arena_alloc(arena, src->binary_size);
+        if (!st->binary) return MP4TAG_ERR_NO_MEMORY;
+        int rc = mp4tag_read_binary(ctx, src, 0, st->binary, src->binary_size);
+        if (rc != MP4TAG_OK) return rc;
+        st->binary_size = src->binary_size;
     }
 
-    return st;
+    *out = st;
+    return MP4TAG_OK;
 }
 
-int mp4tag_set_tag_string(mp4tag_context_t *ctx, const char *name,
-                          const char *value)
+/*
+ * Working copy of the current tags: a single ALBUM-level tag holding a
+ * clone of every simple tag in the file.
+ */
+static int clone_tags(mp4tag_context_t *ctx, mp4tag_collection_t **out)
 {
-    if (!ctx || !name)   return MP4TAG_ERR_INVALID_ARG;
-    if (!ctx->fh)        return MP4TAG_ERR_NOT_OPEN;
-    if (!ctx->writable)  return MP4TAG_ERR_READ_ONLY;
-
     mp4tag_collection_t *existing = NULL;
     mp4tag_read_tags(ctx, &existing);
 
-    mp4tag_collection_t *work = calloc(1, sizeof(*work));
+    mp4tag_collection_t *work = ctx_new_collection(ctx);
     if (!work) return MP4TAG_ERR_NO_MEMORY;
 
-    mp4tag_tag_t *wtag = calloc(1, sizeof(*wtag));
-    if (!wtag) { free(work); return MP4TAG_ERR_NO_MEMORY; }
-    wtag->target_type = MP4TAG_TARGET_ALBUM;
-    work->tags  = wtag;
-    work->count = 1;
+    mp4tag_tag_t *wtag = mp4_tags_add_tag(work, MP4TAG_TARGET_ALBUM);
+    if (!wtag) {
+        ctx_free_collection(ctx, work);
+        return MP4TAG_ERR_NO_MEMORY;
+    }
 
-    /* Copy existing tags, skipping the one we're replacing */
     if (existing) {
         for (const mp4tag_tag_t *tag = existing->tags; tag; tag = tag->next) {
             for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next) {
-                if (st->name && str_casecmp(st->name, name) == 0)
-                    continue;
-
-                mp4tag_simple_tag_t *copy = clone_simple_tag(st);
-                if (copy) {
-                    if (!wtag->simple_tags) {
-                        wtag->simple_tags = copy;
-                    } else {
-                        mp4tag_simple_tag_t *tail = wtag->simple_tags;
-                        while (tail->next) tail = tail->next;
-                        tail->next = copy;
-                    }
+                mp4tag_simple_tag_t *copy = NULL;
+                int rc = clone_simple_tag(ctx, work->arena, st, &copy);
+                if (rc != MP4TAG_OK) {
+                    ctx_free_collection(ctx, work);
+                    return rc;
                 }
+                mp4_tags_append_simple(wtag, copy);
             }
         }
     }
 
-    /* Add the new/updated tag */
-    if (value) {
-        mp4tag_simple_tag_t *st = calloc(1, sizeof(*st));
-        if (!st) { mp4_tags_free_collection(work); return MP4TAG_ERR_NO_MEMORY; }
-        st->name  = str_dup(name);
-        st->value = str_dup(value);
+    *out = work;
+    return MP4TAG_OK;
+}
 
-        if (!wtag->simple_tags) {
-            wtag->simple_tags = st;
-        } else {
-            mp4tag_simple_tag_t *tail = wtag->simple_tags;
-            while (tail->next) tail = tail->next;
-            tail->next = st;
+/*
+ * Apply one set (value != NULL) or remove (value == NULL) to a working
+ * copy. A set replaces the first tag of that name where it stands and
+ * drops any duplicates; a new name is appended.
+ */
+static int stage_set(mp4tag_collection_t *work, const char *name,
+                     const char *value)
+{
+    mp4tag_tag_t *wtag = work->tags;
+    mp4tag_simple_tag_t **link = &wtag->simple_tags;
+    mp4tag_simple_tag_t *last = NULL;
+    int replaced = 0;
+
+    /* Replaced and dropped values stay in the arena until the commit */
+    while (*link) {
+        mp4tag_simple_tag_t *st = *link;
+        if (!st->name || str_casecmp(st->name, name) != 0) {
+            last = st;
+            link = &st->next;
+            continue;
         }
+        if (value && !replaced) {
+            char *v = mp4_arena_strdup(work->arena, value);
+            if (!v) return MP4TAG_ERR_NO_MEMORY;
+            /* Nothing of the old value carries over to the new one */
+            st->value         = v;
+            st->language      = NULL;
+            st->text_invalid  = 0;
+            st->binary        = NULL;
+            st->binary_size   = 0;
+            st->binary_offset = 0;
+            st->binary_source = NULL;
+            replaced = 1;
+            last = st;
+            link = &st->next;
+            continue;
+        }
+        *link = st->next;
     }
+    wtag->simple_tail = last;
 
-    int rc = mp4tag_write_tags(ctx, work);
-    mp4_tags_free_collection(work);
+    if (value && !replaced) {
+        mp4tag_simple_tag_t *st = mp4_tags_new_simple(work->arena, name, value);
+        if (!st) return MP4TAG_ERR_NO_MEMORY;
+        mp4_tags_append_simple(wtag, st);
+    }
+    return MP4TAG_OK;
+}
+
+int mp4tag_set_tag_string(mp4tag_context_t *ctx, const char *name,
+                          const char *value)
+{
+    if (!ctx || !name)   return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx_is_open(ctx)) return MP4TAG_ERR_NOT_OPEN;
+    if (!ctx->writable)  return MP4TAG_ERR_READ_ONLY;
+
+    /* Inside an edit, just stage the change */
+    if (ctx->edit)
+        return stage_set(ctx->edit, name, value);
+
+    mp4tag_collection_t *work = NULL;
+    int rc = clone_tags(ctx, &work);
+    if (rc != MP4TAG_OK) return rc;
+
+    rc = stage_set(work, name, value);
+    if (rc == MP4TAG_OK)
+        rc = mp4tag_write_tags(ctx, work);
+    ctx_free_collection(ctx, work);
     return rc;
 }
 
@@ -622,14 +2464,60 @@ int mp4tag_remove_tag(mp4tag_context_t *ctx, const char *name)
     return mp4tag_set_tag_string(ctx, name, NULL);
 }
 
+/* ------------------------------------------------------------------ */
+/*  Edit transactions                                                  */
+/* ------------------------------------------------------------------ */
+
+int mp4tag_edit_begin(mp4tag_context_t *ctx)
+{
+    if (!ctx)              return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx_is_open(ctx)) return MP4TAG_ERR_NOT_OPEN;
+    if (!ctx->writable)    return MP4TAG_ERR_READ_ONLY;
+    if (ctx->edit)         return MP4TAG_ERR_EDIT_ACTIVE;
+
+    return clone_tags(ctx, &ctx->edit);
+}
+
+int mp4tag_edit_set(mp4tag_context_t *ctx, const char *name, const char *value)
+{
+    if (!ctx || !name) return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx->edit)    return MP4TAG_ERR_NO_EDIT;
+
+    return stage_set(ctx->edit, name, value);
+}
+
+int mp4tag_edit_remove(mp4tag_context_t *ctx, const char *name)
+{
+    return mp4tag_edit_set(ctx, name, NULL);
+}
+
+int mp4tag_edit_commit(mp4tag_context_t *ctx)
+{
+    if (!ctx)       return MP4TAG_ERR_INVALID_ARG;
+    if (!ctx->edit) return MP4TAG_ERR_NO_EDIT;
+
+    mp4tag_collection_t *work = ctx->edit;
+    ctx->edit = NULL;
+
+    int rc = mp4tag_write_tags(ctx, work);
+    ctx_free_collection(ctx, work);
+    return rc;
+}
+
+void mp4tag_edit_abort(mp4tag_context_t *ctx)
+{
+    if (!ctx) return;
+    ctx_free_collection(ctx, ctx->edit);
+    ctx->edit = NULL;
+}
+
 /* ------------------------------------------------------------------ */
 /*  Collection building API                                            */
 /* ------------------------------------------------------------------ */
 
 mp4tag_collection_t *mp4tag_collection_create(mp4tag_context_t *ctx)
 {
-    (void)ctx;
-    return calloc(1, sizeof(mp4tag_collection_t));
+    return mp4_tags_new_collection(ctx ? ctx_allocator(ctx) : NULL);
 }
 
 void mp4tag_collection_free(mp4tag_context_t *ctx, mp4tag_collection_t *coll)
@@ -645,19 +2533,7 @@ mp4tag_tag_t *mp4tag_collection_add_tag(mp4tag_context_t *ctx,
     (void)ctx;
     if (!coll) return NULL;
 
-    mp4tag_tag_t *tag = calloc(1, sizeof(*tag));
-    if (!tag) return NULL;
-    tag->target_type = type;
-
-    if (!coll->tags) {
-        coll->tags = tag;
-    } else {
-        mp4tag_tag_t *tail = coll->tags;
-        while (tail->next) tail = tail->next;
-        tail->next = tag;
-    }
-    coll->count++;
-    return tag;
+    return mp4_tags_add_tag(coll, type);
 }
 
 mp4tag_simple_tag_t *mp4tag_tag_add_simple(mp4tag_context_t *ctx,
@@ -668,19 +2544,32 @@ mp4tag_simple_tag_t *mp4tag_tag_add_simple(mp4tag_context_t *ctx,
     (void)ctx;
     if (!tag || !name) return NULL;
 
-    mp4tag_simple_tag_t *st = calloc(1, sizeof(*st));
+    mp4tag_simple_tag_t *st = mp4_tags_new_simple(tag->arena, name, value);
     if (!st) return NULL;
-    st->name  = str_dup(name);
-    st->value = value ? str_dup(value) : NULL;
-    if (!st->name) { free(st); return NULL; }
 
-    if (!tag->simple_tags) {
-        tag->simple_tags = st;
-    } else {
-        mp4tag_simple_tag_t *tail = tag->simple_tags;
-        while (tail->next) tail = tail->next;
-        tail->next = st;
-    }
+    mp4_tags_append_simple(tag, st);
+    return st;
+}
+
+mp4tag_simple_tag_t *mp4tag_tag_add_binary_source(mp4tag_context_t *ctx,
+                                                  mp4tag_tag_t *tag,
+                                                  const char *name,
+                                                  const mp4tag_binary_source_t *source)
+{
+    (void)ctx;
+    if (!tag || !name || !source || (source->fd < 0 && !source->read))
+        return NULL;
+
+    mp4tag_simple_tag_t *st = mp4_tags_new_simple(tag->arena, name, NULL);
+    if (!st) return NULL;
+
+    mp4tag_binary_source_t *copy = mp4_arena_memdup(tag->arena, source,
+                                                    sizeof(*source));
+    if (!copy) return NULL;
+    st->binary_source = copy;
+    st->binary_size   = (size_t)source->size;
+
+    mp4_tags_append_simple(tag, st);
     return st;
 }
 
@@ -692,19 +2581,10 @@ mp4tag_simple_tag_t *mp4tag_simple_tag_add_nested(mp4tag_context_t *ctx,
     (void)ctx;
     if (!parent || !name) return NULL;
 
-    mp4tag_simple_tag_t *st = calloc(1, sizeof(*st));
+    mp4tag_simple_tag_t *st = mp4_tags_new_simple(parent->arena, name, value);
     if (!st) return NULL;
-    st->name  = str_dup(name);
-    st->value = value ? str_dup(value) : NULL;
-    if (!st->name) { free(st); return NULL; }
 
-    if (!parent->nested) {
-        parent->nested = st;
-    } else {
-        mp4tag_simple_tag_t *tail = parent->nested;
-        while (tail->next) tail = tail->next;
-        tail->next = st;
-    }
+    mp4_tags_append_nested(parent, st);
     return st;
 }
 
@@ -714,8 +2594,10 @@ int mp4tag_simple_tag_set_language(mp4tag_context_t *ctx,
 {
     (void)ctx;
     if (!simple_tag) return MP4TAG_ERR_INVALID_ARG;
-    free(simple_tag->language);
-    simple_tag->language = language ? str_dup(language) : NULL;
+
+    char *copy = mp4_arena_strdup(simple_tag->arena, language);
+    if (language && !copy) return MP4TAG_ERR_NO_MEMORY;
+    simple_tag->language = copy;
     return MP4TAG_OK;
 }
 
@@ -725,12 +2607,18 @@ int mp4tag_tag_add_track_uid(mp4tag_context_t *ctx, mp4tag_tag_t *tag,
     (void)ctx;
     if (!tag) return MP4TAG_ERR_INVALID_ARG;
 
-    uint64_t *new_uids = realloc(tag->track_uids,
-                                  (tag->track_uid_count + 1) * sizeof(uint64_t));
-    if (!new_uids) return MP4TAG_ERR_NO_MEMORY;
+    /* Capacity doubles from 4: full when the count is 4, 8, 16, ... */
+    size_t count = tag->track_uid_count;
+    if (count == 0 || (count >= 4 && (count & (count - 1)) == 0)) {
+        size_t cap = count ? count * 2 : 4;
+        uint64_t *new_uids = mp4_arena_grow(tag->arena, tag->track_uids,
+                                            count * sizeof(uint64_t),
+                                            cap * sizeof(uint64_t));
+        if (!new_uids) return MP4TAG_ERR_NO_MEMORY;
+        tag->track_uids = new_uids;
+    }
 
-    new_uids[tag->track_uid_count] = uid;
-    tag->track_uids = new_uids;
+    tag->track_uids[count] = uid;
     tag->track_uid_count++;
     return MP4TAG_OK;
 }
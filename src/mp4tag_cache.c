@@ -0,0 +1,392 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+/*
+ * Persistent tag index: a file of records, one appended per stored
+ * file, each keyed by (st_dev, st_ino, mtime, size) and holding the
+ * parsed mp4_file_info_t and a copy of the ilst box.
+ *
+ * The file is mapped read-only. Appends go through write(2) on an
+ * O_APPEND descriptor, and the mapping is extended when a lookup lands
+ * past its end. A table in memory points each (dev, ino) at its latest
+ * record, so a superseded record is never looked at again; it stays in
+ * the file until the file is deleted.
+ *
+ * Records are native-endian and the header describes their layout, so a
+ * file from another build or machine is started afresh rather than
+ * misread. Every record carries a checksum, checked when it is used; a
+ * torn record at the end (a crash mid-append) is cut off at open.
+ */
+
+#include "../include/mp4tag/mp4tag.h"
+#include "mp4tag_internal.h"
+#include <tag_common/buffer.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC         "MP4TAGIX"
+#define CACHE_VERSION       1u
+#define CACHE_BYTE_ORDER    0x01020304u
+#define CACHE_RECORD_MAGIC  0x4D503452u     /* "MP4R" */
+#define CACHE_FIRST_SLOTS   1024u
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t record_size;       /* sizeof(cache_record_t) */
+    uint32_t info_size;         /* sizeof(mp4_file_info_t) */
+    uint64_t reserved;
+} cache_header_t;
+
+/* Followed by ilst_size bytes of ilst, padded to 8 */
+typedef struct {
+    uint32_t         magic;
+    uint32_t         ilst_size;
+    uint64_t         checksum;  /* Of the whole record with this field 0 */
+    mp4_cache_key_t  key;
+    mp4_file_info_t  info;
+} cache_record_t;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t offset;            /* Latest record; 0 for an empty slot */
+} cache_slot_t;
+
+struct mp4tag_cache {
+    pthread_mutex_t  lock;
+    int              fd;
+    const uint8_t   *map;
+    size_t           map_size;
+
+    cache_slot_t    *slots;
+    size_t           capacity;  /* Power of two */
+    size_t           count;
+
+    size_t           max_ilst;
+    dyn_buffer_t     record;    /* Assembly buffer for appends */
+};
+
+static size_t record_span(uint32_t ilst_size)
+{
+    return (sizeof(cache_record_t) + ilst_size + 7u) & ~(size_t)7u;
+}
+
+/* FNV-1a over 8-byte words, the tail bytewise. */
+static uint64_t checksum(const uint8_t *p, size_t n)
+{
+    uint64_t h = 0xCBF29CE484222325u;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0x100000001B3u;
+    }
+    for (; n > 0; p++, n--)
+        h = (h ^ *p) * 0x100000001B3u;
+    return h;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Table                                                              */
+/* ------------------------------------------------------------------ */
+
+static size_t slot_hash(const cache_slot_t *slots, size_t capacity,
+                        uint64_t dev, uint64_t ino)
+{
+    uint64_t h = (ino ^ (dev * 0x9E3779B97F4A7C15u)) * 0xFF51AFD7ED558CCDu;
+    size_t i = (size_t)(h >> 32) & (capacity - 1);
+    while (slots[i].offset != 0 && (slots[i].dev != dev || slots[i].ino != ino))
+        i = (i + 1) & (capacity - 1);
+    return i;
+}
+
+static int table_grow(mp4tag_cache_t *cache)
+{
+    size_t cap = cache->capacity ? cache->capacity * 2 : CACHE_FIRST_SLOTS;
+    cache_slot_t *slots = calloc(cap, sizeof(*slots));
+    if (!slots) return MP4TAG_ERR_NO_MEMORY;
+
+    for (size_t i = 0; i < cache->capacity; i++) {
+        const cache_slot_t *s = &cache->slots[i];
+        if (s->offset != 0)
+            slots[slot_hash(slots, cap, s->dev, s->ino)] = *s;
+    }
+    free(cache->slots);
+    cache->slots    = slots;
+    cache->capacity = cap;
+    return MP4TAG_OK;
+}
+
+/* Point (dev, ino) at the record at `offset`, replacing an older one. */
+static int table_put(mp4tag_cache_t *cache, const mp4_cache_key_t *key,
+                     uint64_t offset)
+{
+    if ((cache->count + 1) * 4 > cache->capacity * 3) {
+        int rc = table_grow(cache);
+        if (rc != MP4TAG_OK) return rc;
+    }
+    cache_slot_t *s = &cache->slots[slot_hash(cache->slots, cache->capacity,
+                                              key->dev, key->ino)];
+    if (s->offset == 0) cache->count++;
+    s->dev    = key->dev;
+    s->ino    = key->ino;
+    s->offset = offset;
+    return MP4TAG_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/*  File                                                               */
+/* ------------------------------------------------------------------ */
+
+/* Map the file as it is now; later appends are picked up by remapping. */
+static int cache_remap(mp4tag_cache_t *cache)
+{
+    struct stat st;
+    if (fstat(cache->fd, &st) != 0) return MP4TAG_ERR_IO;
+    if ((uint64_t)st.st_size > SIZE_MAX) return MP4TAG_ERR_UNSUPPORTED;
+
+    if (cache->map) munmap((void *)cache->map, cache->map_size);
+    cache->map      = NULL;
+    cache->map_size = 0;
+    if (st.st_size == 0) return MP4TAG_OK;
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+                     cache->fd, 0);
+    if (map == MAP_FAILED) return MP4TAG_ERR_IO;
+    cache->map      = map;
+    cache->map_size = (size_t)st.st_size;
+    return MP4TAG_OK;
+}
+
+static void header_init(cache_header_t *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version     = CACHE_VERSION;
+    hdr->byte_order  = CACHE_BYTE_ORDER;
+    hdr->record_size = sizeof(cache_record_t);
+    hdr->info_size   = sizeof(mp4_file_info_t);
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) return MP4TAG_ERR_WRITE_FAILED;
+        p   += n;
+        len -= (size_t)n;
+    }
+    return MP4TAG_OK;
+}
+
+/*
+ * Index every whole record. A file whose header doesn't match this
+ * build is emptied; anything after the last whole record is cut off.
+ */
+static int cache_load(mp4tag_cache_t *cache)
+{
+    int rc = cache_remap(cache);
+    if (rc != MP4TAG_OK) return rc;
+
+    cache_header_t want, have;
+    header_init(&want);
+    if (cache->map_size < sizeof(have) ||
+        (memcpy(&have, cache->map, sizeof(have)),
+         memcmp(&have, &want, sizeof(have)) != 0)) {
+        if (ftruncate(cache->fd, 0) != 0) return MP4TAG_ERR_IO;
+        rc = write_all(cache->fd, &want, sizeof(want));
+        return rc == MP4TAG_OK ? cache_remap(cache) : rc;
+    }
+
+    size_t pos = sizeof(cache_header_t);
+    while (cache->map_size - pos >= sizeof(cache_record_t)) {
+        cache_record_t rec;
+        memcpy(&rec, cache->map + pos, sizeof(rec));
+        size_t span = record_span(rec.ilst_size);
+        if (rec.magic != CACHE_RECORD_MAGIC || span > cache->map_size - pos)
+            break;
+        rc = table_put(cache, &rec.key, pos);
+        if (rc != MP4TAG_OK) return rc;
+        pos += span;
+    }
+    if (pos < cache->map_size) {
+        if (ftruncate(cache->fd, (off_t)pos) != 0) return MP4TAG_ERR_IO;
+        return cache_remap(cache);
+    }
+    return MP4TAG_OK;
+}
+
+int mp4tag_cache_open(const char *path, mp4tag_cache_t **out)
+{
+    if (!path || !out) return MP4TAG_ERR_INVALID_ARG;
+    *out = NULL;
+
+    mp4tag_cache_t *cache = calloc(1, sizeof(*cache));
+    if (!cache) return MP4TAG_ERR_NO_MEMORY;
+    pthread_mutex_init(&cache->lock, NULL);
+    buffer_init(&cache->record);
+    cache->max_ilst = MP4TAG_CACHE_DEFAULT_MAX_ILST;
+
+    cache->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    int rc = cache->fd >= 0 ? cache_load(cache) : MP4TAG_ERR_IO;
+    if (rc != MP4TAG_OK) {
+        mp4tag_cache_close(cache);
+        return rc;
+    }
+    *out = cache;
+    return MP4TAG_OK;
+}
+
+void mp4tag_cache_close(mp4tag_cache_t *cache)
+{
+    if (!cache) return;
+    if (cache->map) munmap((void *)cache->map, cache->map_size);
+    if (cache->fd >= 0) close(cache->fd);
+    free(cache->slots);
+    buffer_free(&cache->record);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+int mp4tag_cache_set_max_ilst(mp4tag_cache_t *cache, size_t bytes)
+{
+    if (!cache || bytes > UINT32_MAX) return MP4TAG_ERR_INVALID_ARG;
+    pthread_mutex_lock(&cache->lock);
+    cache->max_ilst = bytes;
+    pthread_mutex_unlock(&cache->lock);
+    return MP4TAG_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Entries                                                            */
+/* ------------------------------------------------------------------ */
+
+int mp4_cache_key(const char *path, mp4_cache_key_t *key)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return MP4TAG_ERR_IO;
+
+    memset(key, 0, sizeof(*key));
+    key->dev  = (uint64_t)st.st_dev;
+    key->ino  = (uint64_t)st.st_ino;
+    key->size = (int64_t)st.st_size;
+#ifdef __APPLE__
+    key->mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+                    st.st_mtimespec.tv_nsec;
+#else
+    key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+                    st.st_mtim.tv_nsec;
+#endif
+    return MP4TAG_OK;
+}
+
+/* Whole record at `offset` in the mapping (remapped if need be), or NULL. */
+static const uint8_t *record_at(mp4tag_cache_t *cache, uint64_t offset,
+                                cache_record_t *rec)
+{
+    if (offset + sizeof(*rec) > cache->map_size &&
+        cache_remap(cache) != MP4TAG_OK)
+        return NULL;
+    if (offset + sizeof(*rec) > cache->map_size) return NULL;
+    memcpy(rec, cache->map + offset, sizeof(*rec));
+
+    size_t span = record_span(rec->ilst_size);
+    if (span > cache->map_size - offset &&
+        (cache_remap(cache) != MP4TAG_OK || span > cache->map_size - offset))
+        return NULL;
+    return cache->map + offset;
+}
+
+int mp4_cache_lookup(mp4tag_cache_t *cache, const mp4_cache_key_t *key,
+                     mp4_file_info_t *info, dyn_buffer_t *ilst)
+{
+    int hit = 0;
+    pthread_mutex_lock(&cache->lock);
+    if (cache->count == 0) goto done;
+
+    const cache_slot_t *s = &cache->slots[slot_hash(cache->slots, cache->capacity,
+                                                    key->dev, key->ino)];
+    if (s->offset == 0) goto done;
+
+    cache_record_t rec;
+    const uint8_t *p = record_at(cache, s->offset, &rec);
+    if (!p || rec.magic != CACHE_RECORD_MAGIC ||
+        memcmp(&rec.key, key, sizeof(*key)) != 0)
+        goto done;
+
+    /* The ilst copy must be the whole ilst box the offsets describe */
+    if (rec.info.has_ilst ? (int64_t)rec.ilst_size != rec.info.ilst_size
+                          : rec.ilst_size != 0)
+        goto done;
+
+    uint64_t sum = rec.checksum;
+    rec.checksum = 0;
+    uint64_t h = checksum((const uint8_t *)&rec, sizeof(rec));
+    h ^= checksum(p + sizeof(rec), rec.ilst_size);
+    if (h != sum) goto done;
+
+    ilst->size = 0;
+    if (buffer_append(ilst, p + sizeof(rec), rec.ilst_size) != 0) goto done;
+    *info = rec.info;
+    hit = 1;
+
+done:
+    pthread_mutex_unlock(&cache->lock);
+    return hit;
+}
+
+int mp4_cache_accepts(mp4tag_cache_t *cache, uint64_t ilst_size)
+{
+    pthread_mutex_lock(&cache->lock);
+    int ok = ilst_size <= cache->max_ilst;
+    pthread_mutex_unlock(&cache->lock);
+    return ok;
+}
+
+int mp4_cache_store(mp4tag_cache_t *cache, const mp4_cache_key_t *key,
+                    const mp4_file_info_t *info, const uint8_t *ilst,
+                    size_t ilst_size)
+{
+    pthread_mutex_lock(&cache->lock);
+    int rc = MP4TAG_ERR_TAG_TOO_LARGE;
+    if (ilst_size > cache->max_ilst) goto done;
+
+    size_t span = record_span((uint32_t)ilst_size);
+    cache->record.size = 0;
+    rc = MP4TAG_ERR_NO_MEMORY;
+    if (buffer_append_zeros(&cache->record, span) != 0) goto done;
+
+    cache_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.magic     = CACHE_RECORD_MAGIC;
+    rec.ilst_size = (uint32_t)ilst_size;
+    rec.key       = *key;
+    memcpy(&rec.info, info, sizeof(rec.info));
+    rec.checksum  = checksum((const uint8_t *)&rec, sizeof(rec)) ^
+                    checksum(ilst, ilst_size);
+    memcpy(cache->record.data, &rec, sizeof(rec));
+    if (ilst_size > 0)
+        memcpy(cache->record.data + sizeof(rec), ilst, ilst_size);
+
+    /* One write per record; O_APPEND puts it after anyone else's */
+    rc = write_all(cache->fd, cache->record.data, span);
+    if (rc != MP4TAG_OK) goto done;
+    off_t end = lseek(cache->fd, 0, SEEK_CUR);
+    if (end < (off_t)(sizeof(cache_header_t) + span)) {
+        rc = MP4TAG_ERR_IO;
+        goto done;
+    }
+    rc = table_put(cache, key, (uint64_t)end - span);
+
+done:
+    pthread_mutex_unlock(&cache->lock);
+    return rc;
+}
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#ifndef MP4TAG_INTERNAL_H
+#define MP4TAG_INTERNAL_H
+
+#include "../include/mp4tag/mp4tag.h"
+#include "mp4/mp4_parser.h"
+#include <tag_common/buffer.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Open `path` read-only when its structure has already been fetched by
+ * other means (the asynchronous scanner). `head` holds the first
+ * `head_size` bytes of the file (at least the ftyp box), `top` the
+ * result of the top-level walk, and `moov` the whole moov box. The moov
+ * buffer is swapped into the context: on return `moov` holds the
+ * context's previous buffer (size 0), ready for reuse.
+ *
+ * Returns an error without opening anything if the prefetched data does
+ * not describe a supported file; the caller then uses mp4tag_open.
+ */
+int mp4_open_prefetched(mp4tag_context_t *ctx, const char *path,
+                        const uint8_t *head, size_t head_size,
+                        const mp4_file_info_t *top, dyn_buffer_t *moov);
+
+/*
+ * Persistent tag index (src/mp4tag_cache.c). An entry is found by the
+ * file's identity and is only used while mtime and size still match.
+ */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t  mtime_ns;
+    int64_t  size;
+} mp4_cache_key_t;
+
+/* Key of the file at `path` as it is now (one stat). */
+int mp4_cache_key(const char *path, mp4_cache_key_t *key);
+
+/*
+ * Copy the entry for `key` into `info` and `ilst` (the whole ilst box,
+ * empty if the file has none). Returns 1 on a hit, 0 otherwise.
+ * Safe to call from several threads.
+ */
+int mp4_cache_lookup(mp4tag_cache_t *cache, const mp4_cache_key_t *key,
+                     mp4_file_info_t *info, dyn_buffer_t *ilst);
+
+/* Non-zero if an ilst of `ilst_size` bytes is small enough to store. */
+int mp4_cache_accepts(mp4tag_cache_t *cache, uint64_t ilst_size);
+
+/* Append an entry for `key`, superseding any earlier one for the file. */
+int mp4_cache_store(mp4tag_cache_t *cache, const mp4_cache_key_t *key,
+                    const mp4_file_info_t *info, const uint8_t *ilst,
+                    size_t ilst_size);
+
+/*
+ * Open `path` read-only from its cache entry if `key` still matches it;
+ * nothing is read from the file. Returns 1 if the context was opened,
+ * 0 on a miss (the context is left closed).
+ */
+int mp4_open_cache_hit(mp4tag_context_t *ctx, mp4tag_cache_t *cache,
+                       const char *path, const mp4_cache_key_t *key);
+
+/*
+ * Store the structure and ilst of the file open in `ctx` under `key`,
+ * which must have been taken before the file was read. Failures are
+ * ignored: the file is simply parsed again next time.
+ */
+void mp4_cache_remember(mp4tag_context_t *ctx, mp4tag_cache_t *cache,
+                        const mp4_cache_key_t *key);
+
+/*
+ * Write generations (src/mp4tag_snapshot.c). A cell counts the writes
+ * made to one file, found by device and inode in a process-wide table,
+ * for as long as a snapshot or context holds a reference to it.
+ */
+typedef struct mp4_generation mp4_generation_t;
+
+/*
+ * A reference to the cell of the file `key` names, made if there is
+ * none and `create` is set. A NULL key gives a new cell of its own (for
+ * sources with no path). NULL when there is no cell or out of memory.
+ */
+mp4_generation_t *mp4_generation_acquire(const mp4_cache_key_t *key, int create);
+mp4_generation_t *mp4_generation_retain(mp4_generation_t *gen);
+void              mp4_generation_release(mp4_generation_t *gen);
+
+/* Non-zero while any file has a cell, so writers skip the stat if not. */
+int  mp4_generation_watched(void);
+
+/* Record a write: snapshots taken before it are no longer current. */
+void mp4_generation_bump(mp4_generation_t *gen);
+
+/*
+ * Build a snapshot of the tags in the `ilst_size`-byte ilst box at
+ * `ilst` (from the file `info` describes), with memory drawn from
+ * `allocator`. Takes over the caller's reference to `gen`, which is
+ * released on failure.
+ */
+int mp4_snapshot_create(const mp4_file_info_t *info, const uint8_t *ilst,
+                        size_t ilst_size, const mp4tag_allocator_t *allocator,
+                        mp4_generation_t *gen, mp4tag_snapshot_t **out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MP4TAG_INTERNAL_H */
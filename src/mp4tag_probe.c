@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+/*
+ * Read planning: the top-level walk of mp4_parse_structure, driven by
+ * bytes the caller fetches instead of reads of its own.
+ *
+ * Fed bytes are kept as chunks at their file offsets. Each plan walks
+ * the top-level headers as far as the chunks allow, then asks for the
+ * next header, or once moov is known, for the part of it still missing.
+ */
+
+#include "../include/mp4tag/mp4tag.h"
+#include "mp4/mp4_atoms.h"
+#include "mp4/mp4_parser.h"
+#include <tag_common/buffer.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PROBE_HEAD_SIZE  (64u * 1024u)  /* First request at each end */
+#define PROBE_STEP_SIZE  (4u * 1024u)   /* Further header requests */
+
+typedef struct {
+    int64_t  offset;
+    size_t   size;
+    uint8_t *data;
+} probe_chunk_t;
+
+struct mp4tag_probe {
+    int64_t          file_size;
+    probe_chunk_t   *chunks;
+    size_t           count;
+    size_t           capacity;
+
+    int              planned;       /* First plan handed out */
+    int              status;        /* Sticky error, or MP4TAG_OK */
+    int64_t          ftyp_size;     /* 0 until ftyp is validated */
+    mp4_file_info_t  top;           /* Walk state */
+    dyn_buffer_t     result;        /* ftyp + moov once done */
+};
+
+mp4tag_probe_t *mp4tag_probe_create(uint64_t file_size)
+{
+    if (file_size > (uint64_t)INT64_MAX) return NULL;
+    mp4tag_probe_t *probe = calloc(1, sizeof(*probe));
+    if (!probe) return NULL;
+    probe->file_size = (int64_t)file_size;
+    mp4_top_level_begin(&probe->top);
+    buffer_init(&probe->result);
+    return probe;
+}
+
+void mp4tag_probe_destroy(mp4tag_probe_t *probe)
+{
+    if (!probe) return;
+    for (size_t i = 0; i < probe->count; i++)
+        free(probe->chunks[i].data);
+    free(probe->chunks);
+    buffer_free(&probe->result);
+    free(probe);
+}
+
+int mp4tag_probe_feed(mp4tag_probe_t *probe, uint64_t offset,
+                      const void *data, size_t size)
+{
+    if (!probe || (!data && size > 0)) return MP4TAG_ERR_INVALID_ARG;
+    if (offset > (uint64_t)probe->file_size ||
+        size > (uint64_t)probe->file_size - offset)
+        return MP4TAG_ERR_INVALID_ARG;
+    if (size == 0) return MP4TAG_OK;
+
+    if (probe->count == probe->capacity) {
+        size_t cap = probe->capacity ? probe->capacity * 2 : 4;
+        probe_chunk_t *grown = realloc(probe->chunks, cap * sizeof(*grown));
+        if (!grown) return MP4TAG_ERR_NO_MEMORY;
+        probe->chunks   = grown;
+        probe->capacity = cap;
+    }
+    uint8_t *copy = malloc(size);
+    if (!copy) return MP4TAG_ERR_NO_MEMORY;
+    memcpy(copy, data, size);
+
+    probe_chunk_t *chunk = &probe->chunks[probe->count++];
+    chunk->offset = (int64_t)offset;
+    chunk->size   = size;
+    chunk->data   = copy;
+    return MP4TAG_OK;
+}
+
+/* End of the fed bytes running on from `pos` (== pos if `pos` is missing). */
+static int64_t covered_to(const mp4tag_probe_t *probe, int64_t pos)
+{
+    for (int grew = 1; grew; ) {
+        grew = 0;
+        for (size_t i = 0; i < probe->count; i++) {
+            const probe_chunk_t *c = &probe->chunks[i];
+            int64_t end = c->offset + (int64_t)c->size;
+            if (c->offset <= pos && pos < end) {
+                pos  = end;
+                grew = 1;
+            }
+        }
+    }
+    return pos;
+}
+
+/*
+ * Copy [offset, offset + len) out of the chunks. Returns 0, or -1 with
+ * `*missing` set to the part not yet fed.
+ */
+static int gather(const mp4tag_probe_t *probe, int64_t offset, size_t len,
+                  uint8_t *dst, mp4tag_range_t *missing)
+{
+    int64_t end   = offset + (int64_t)len;
+    int64_t first = covered_to(probe, offset);
+    if (first < end) {
+        /* Trim off a fed suffix as well, so only the gap is asked for */
+        int64_t last = end;
+        for (size_t i = 0; i < probe->count; i++) {
+            const probe_chunk_t *c = &probe->chunks[i];
+            if (c->offset > first && c->offset < last &&
+                covered_to(probe, c->offset) >= end)
+                last = c->offset;
+        }
+        missing->offset = (uint64_t)first;
+        missing->size   = (uint64_t)(last - first);
+        return -1;
+    }
+    if (!dst) return 0;
+
+    for (int64_t pos = offset; pos < end; ) {
+        for (size_t i = 0; i < probe->count; i++) {
+            const probe_chunk_t *c = &probe->chunks[i];
+            int64_t cend = c->offset + (int64_t)c->size;
+            if (c->offset <= pos && pos < cend) {
+                int64_t to = cend < end ? cend : end;
+                memcpy(dst + (pos - offset), c->data + (pos - c->offset),
+                       (size_t)(to - pos));
+                pos = to;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+static int64_t min64(int64_t a, int64_t b) { return a < b ? a : b; }
+
+/* Range of up to `len` bytes at `pos`, clipped to the file. */
+static mp4tag_range_t range_at(const mp4tag_probe_t *probe, int64_t pos,
+                               int64_t len)
+{
+    mp4tag_range_t r = { (uint64_t)pos,
+                         (uint64_t)min64(len, probe->file_size - pos) };
+    return r;
+}
+
+/* Validate ftyp from the fed bytes; -1 with `*missing` if not yet fed. */
+static int check_ftyp(mp4tag_probe_t *probe, mp4tag_range_t *missing)
+{
+    uint8_t head[16];
+    size_t n = (size_t)min64(16, probe->file_size);
+    if (gather(probe, 0, n, head, missing) != 0) return -1;
+
+    mp4_box_t box;
+    if (mp4_parse_box_header(head, n, 0, &box) != MP4TAG_OK ||
+        box.type != MP4_BOX_FTYP || box.size > probe->file_size ||
+        box.size < box.header_size) {
+        probe->status = MP4TAG_ERR_NOT_MP4;
+        return 0;
+    }
+
+    uint8_t *ftyp = malloc((size_t)box.size);
+    if (!ftyp) { probe->status = MP4TAG_ERR_NO_MEMORY; return 0; }
+    int rc = gather(probe, 0, (size_t)box.size, ftyp, missing);
+    if (rc == 0) {
+        mp4_span_t span = { ftyp, 0, (size_t)box.size };
+        probe->status = mp4_validate_ftyp_span(&span);
+        if (probe->status == MP4TAG_OK) probe->ftyp_size = box.size;
+    }
+    free(ftyp);
+    return rc;
+}
+
+/* The walk of walk_top_level, over fed headers. */
+static int walk(mp4tag_probe_t *probe, mp4tag_range_t *missing)
+{
+    mp4_file_info_t *top = &probe->top;
+    int64_t fsize = probe->file_size;
+
+    while (top->moov_offset < 0 && top->top_level_pos + 8 <= fsize) {
+        int64_t pos = top->top_level_pos;
+        uint8_t hdr[16];
+        size_t n = (size_t)min64(16, fsize - pos);
+        if (gather(probe, pos, n, hdr, missing) != 0) {
+            *missing = range_at(probe, pos, PROBE_STEP_SIZE);
+            return -1;
+        }
+
+        mp4_box_t box;
+        if (mp4_parse_box_header(hdr, (size_t)(fsize - pos), pos, &box) != MP4TAG_OK ||
+            box.size < 8)
+            break;
+        mp4_top_level_note(top, &box);
+        top->top_level_pos = box.offset + box.size;
+    }
+
+    if (top->moov_offset < 0)
+        probe->status = MP4TAG_ERR_NOT_MP4;
+    else if (top->moov_size < 8 || top->moov_offset + top->moov_size > fsize)
+        probe->status = MP4TAG_ERR_TRUNCATED;
+    return 0;
+}
+
+/* ftyp + moov into the result, checking the moov parses. */
+static void assemble(mp4tag_probe_t *probe)
+{
+    const mp4_file_info_t *top = &probe->top;
+    size_t ftyp = (size_t)probe->ftyp_size, moov = (size_t)top->moov_size;
+    mp4tag_range_t unused;
+
+    probe->result.size = 0;
+    if (buffer_append_zeros(&probe->result, ftyp + moov) != 0) {
+        probe->status = MP4TAG_ERR_NO_MEMORY;
+        return;
+    }
+    gather(probe, 0, ftyp, probe->result.data, &unused);
+    gather(probe, top->moov_offset, moov, probe->result.data + ftyp, &unused);
+
+    mp4_span_t file = { probe->result.data, 0, probe->result.size };
+    mp4_file_info_t info;
+    probe->status = mp4_parse_structure_span(&file, &info);
+    if (probe->status != MP4TAG_OK) probe->result.size = 0;
+}
+
+int mp4tag_probe_plan(mp4tag_probe_t *probe, mp4tag_range_t *ranges,
+                      size_t max, size_t *count)
+{
+    if (!probe || !ranges || max == 0 || !count) return MP4TAG_ERR_INVALID_ARG;
+    *count = 0;
+    if (probe->status != MP4TAG_OK) return probe->status;
+    if (probe->result.size > 0) return MP4TAG_OK;
+    if (probe->file_size < 8) return probe->status = MP4TAG_ERR_NOT_MP4;
+
+    if (!probe->planned && probe->count == 0) {
+        /* Both ends at once: moov is usually near one of them */
+        probe->planned = 1;
+        ranges[(*count)++] = range_at(probe, 0, PROBE_HEAD_SIZE);
+        if (max > 1 && probe->file_size > (int64_t)PROBE_HEAD_SIZE) {
+            int64_t start = probe->file_size - (int64_t)PROBE_HEAD_SIZE;
+            if (start < (int64_t)PROBE_HEAD_SIZE) start = PROBE_HEAD_SIZE;
+            ranges[(*count)++] = range_at(probe, start, probe->file_size - start);
+        }
+        return MP4TAG_OK;
+    }
+    probe->planned = 1;
+
+    mp4tag_range_t missing;
+    if (probe->ftyp_size == 0 && check_ftyp(probe, &missing) != 0) {
+        ranges[(*count)++] = missing;
+        return MP4TAG_OK;
+    }
+    if (probe->status != MP4TAG_OK) return probe->status;
+
+    if (walk(probe, &missing) != 0) {
+        ranges[(*count)++] = missing;
+        return MP4TAG_OK;
+    }
+    if (probe->status != MP4TAG_OK) return probe->status;
+
+    const mp4_file_info_t *top = &probe->top;
+    if (gather(probe, top->moov_offset, (size_t)top->moov_size, NULL, &missing) != 0) {
+        ranges[(*count)++] = missing;
+        return MP4TAG_OK;
+    }
+
+    assemble(probe);
+    return probe->status;
+}
+
+int mp4tag_probe_result(const mp4tag_probe_t *probe, const uint8_t **data,
+                        size_t *size)
+{
+    if (!probe || !data || !size) return MP4TAG_ERR_INVALID_ARG;
+    if (probe->status != MP4TAG_OK) return probe->status;
+    if (probe->result.size == 0)    return MP4TAG_ERR_NOT_OPEN;
+    *data = probe->result.data;
+    *size = probe->result.size;
+    return MP4TAG_OK;
+}
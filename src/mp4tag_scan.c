@@ -0,0 +1,714 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+/*
+ * Batch scanner: reads the tags of many files on a pool of workers.
+ *
+ * Paths are handed out as ranges of a batch. A list scan has a single
+ * batch (the caller's array) split evenly between the workers up front;
+ * a walker scan pulls SCAN_WALK_BATCH paths at a time into a batch of
+ * copies. A worker whose own range is empty refills from the walker, or
+ * steals the back half of another worker's range. Batches are shared by
+ * every range that points into them and freed with the last reference.
+ *
+ * With MP4TAG_SCAN_ASYNC_IO, each worker additionally overlaps the
+ * structure reads of many files on an io_uring (see below).
+ */
+
+#include "../include/mp4tag/mp4tag.h"
+#include "mp4tag_internal.h"
+#include "mp4/mp4_atoms.h"
+#include "mp4/mp4_parser.h"
+#include "util/mp4_buffer_ext.h"
+#include "util/mp4_uring.h"
+#include <tag_common/buffer.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SCAN_WALK_BATCH     16
+#define SCAN_MAX_THREADS    256
+#define SCAN_DEFAULT_DEPTH  16            /* Files in flight per worker */
+#define SCAN_MAX_DEPTH      256
+#define SCAN_HEAD_SIZE      (64u * 1024u) /* First read of each file */
+
+typedef struct {
+    const char *const *paths;
+    size_t             base;       /* Scan index of paths[0] */
+    atomic_int         refs;       /* Ranges and in-flight items using it */
+    int                owned;      /* Walker batch: copies in `copies` */
+    size_t             count;
+    char              *copies[SCAN_WALK_BATCH];
+} scan_batch_t;
+
+typedef struct {
+    pthread_mutex_t  lock;
+    scan_batch_t    *batch;        /* NULL when empty */
+    size_t           lo, hi;       /* Pending positions in batch */
+} scan_queue_t;
+
+struct scan;
+
+typedef struct {
+    struct scan      *scan;
+    unsigned          id;
+    scan_queue_t      queue;
+    mp4tag_context_t *ctx;
+    pthread_t         thread;
+    int               started;
+} scan_worker_t;
+
+typedef struct scan {
+    unsigned               flags;
+    unsigned               queue_depth;  /* Async I/O slots per worker */
+    mp4tag_cache_t        *cache;        /* Tag index, or NULL */
+    mp4tag_scan_result_fn  on_result;
+    void                  *user_data;
+
+    /* Walker source (NULL for list scans) */
+    mp4tag_scan_next_fn    next;
+    void                  *next_data;
+    pthread_mutex_t        next_lock;
+    int                    exhausted;
+    size_t                 next_index;
+    int                    error;      /* Walker scan abandoned (no memory) */
+
+    pthread_mutex_t        result_lock;
+    atomic_int             stop;
+
+    scan_worker_t         *workers;
+    unsigned               nworkers;
+} scan_t;
+
+/* ------------------------------------------------------------------ */
+/*  Batches and queues                                                 */
+/* ------------------------------------------------------------------ */
+
+static void batch_release(scan_batch_t *b)
+{
+    if (!b || atomic_fetch_sub(&b->refs, 1) != 1 || !b->owned) return;
+    for (size_t i = 0; i < b->count; i++)
+        free(b->copies[i]);
+    free(b);
+}
+
+/* Take the next path from a worker's own range. */
+static int queue_pop(scan_queue_t *q, scan_batch_t **batch, size_t *pos)
+{
+    int got = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->batch && q->lo < q->hi) {
+        *batch = q->batch;
+        *pos   = q->lo++;
+        if (q->lo == q->hi)
+            q->batch = NULL;            /* Range's reference moves to the item */
+        else
+            atomic_fetch_add(&(*batch)->refs, 1);
+        got = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return got;
+}
+
+/* Install a range in an (empty) queue; the caller's reference moves in. */
+static void queue_fill(scan_queue_t *q, scan_batch_t *batch, size_t lo, size_t hi)
+{
+    pthread_mutex_lock(&q->lock);
+    q->batch = batch;
+    q->lo    = lo;
+    q->hi    = hi;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* Move the back half of some other worker's range into ours. */
+static int steal(scan_worker_t *w)
+{
+    scan_t *scan = w->scan;
+
+    for (unsigned k = 1; k < scan->nworkers; k++) {
+        scan_queue_t *victim = &scan->workers[(w->id + k) % scan->nworkers].queue;
+        scan_batch_t *batch = NULL;
+        size_t lo = 0, hi = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->batch && victim->lo < victim->hi) {
+            size_t n = victim->hi - victim->lo;
+            batch = victim->batch;
+            hi = victim->hi;
+            lo = hi - (n + 1) / 2;
+            victim->hi = lo;
+            if (victim->lo == victim->hi)
+                victim->batch = NULL;   /* Its reference comes with the range */
+            else
+                atomic_fetch_add(&batch->refs, 1);
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (batch) {
+            queue_fill(&w->queue, batch, lo, hi);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void deliver(scan_t *scan, const char *path, size_t index, int status,
+                    mp4tag_context_t *ctx, const mp4tag_collection_t *tags)
+{
+    pthread_mutex_lock(&scan->result_lock);
+    if (!atomic_load(&scan->stop) &&
+        scan->on_result(path, index, status, ctx, tags, scan->user_data) != 0)
+        atomic_store(&scan->stop, 1);
+    pthread_mutex_unlock(&scan->result_lock);
+}
+
+/* Pull the next batch from the walker into our queue. */
+static int refill(scan_worker_t *w)
+{
+    scan_t *scan = w->scan;
+    int got = 0;
+
+    pthread_mutex_lock(&scan->next_lock);
+    if (!scan->exhausted) {
+        scan_batch_t *b = calloc(1, sizeof(*b));
+        if (!b) {
+            scan->exhausted = 1;
+            scan->error     = MP4TAG_ERR_NO_MEMORY;
+            pthread_mutex_unlock(&scan->next_lock);
+            return 0;
+        }
+        b->owned = 1;
+        b->base  = scan->next_index;
+
+        while (b->count < SCAN_WALK_BATCH) {
+            const char *path = scan->next(scan->next_data);
+            if (!path) {
+                scan->exhausted = 1;
+                break;
+            }
+            size_t len = strlen(path) + 1;
+            char *copy = malloc(len);
+            if (!copy) {
+                /* Report it while the walker's string is still valid, and
+                 * end the batch so its indices stay consecutive */
+                deliver(scan, path, scan->next_index++, MP4TAG_ERR_NO_MEMORY,
+                        NULL, NULL);
+                break;
+            }
+            memcpy(copy, path, len);
+            b->copies[b->count++] = copy;
+            scan->next_index++;
+        }
+
+        if (b->count > 0) {
+            b->paths = (const char *const *)b->copies;
+            atomic_store(&b->refs, 1);
+            queue_fill(&w->queue, b, 0, b->count);
+            got = 1;
+        } else {
+            free(b);
+        }
+    }
+    pthread_mutex_unlock(&scan->next_lock);
+    return got;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Workers                                                            */
+/* ------------------------------------------------------------------ */
+
+/* Read an open context's tags and report the file. */
+static void finish_file(scan_worker_t *w, const char *path, size_t index,
+                        int status)
+{
+    scan_t *scan = w->scan;
+    mp4tag_context_t *ctx = w->ctx;
+    int opened = status == MP4TAG_OK;
+
+    mp4tag_collection_t *tags = NULL;
+    if (opened && !(scan->flags & MP4TAG_SCAN_VIEWS_ONLY))
+        status = mp4tag_read_tags(ctx, &tags);
+
+    deliver(scan, path, index, status, opened ? ctx : NULL,
+            status == MP4TAG_OK ? tags : NULL);
+
+    if (opened)
+        mp4tag_close(ctx);
+}
+
+/*
+ * Answer `path` from the scan's tag index if it knows the file as it is
+ * now. Otherwise `key` is left for remembering the file once read
+ * (size -1 without an index or when the file can't be stat'ed).
+ */
+static int scan_cached(scan_worker_t *w, const char *path, mp4_cache_key_t *key)
+{
+    if (!w->scan->cache || mp4_cache_key(path, key) != MP4TAG_OK) {
+        key->size = -1;
+        return 0;
+    }
+    return mp4_open_cache_hit(w->ctx, w->scan->cache, path, key);
+}
+
+/* Open `path` the blocking way, then finish it. */
+static void scan_open(scan_worker_t *w, const char *path, size_t index,
+                      const mp4_cache_key_t *key)
+{
+    mp4tag_context_t *ctx = w->ctx;
+    int status = (w->scan->flags & MP4TAG_SCAN_MAPPED) ? mp4tag_open_mapped(ctx, path)
+                                                       : mp4tag_open(ctx, path);
+    if (status == MP4TAG_OK && key->size >= 0)
+        mp4_cache_remember(ctx, w->scan->cache, key);
+    finish_file(w, path, index, status);
+}
+
+static void scan_file(scan_worker_t *w, const char *path, size_t index)
+{
+    mp4_cache_key_t key;
+    if (scan_cached(w, path, &key))
+        finish_file(w, path, index, MP4TAG_OK);
+    else
+        scan_open(w, path, index, &key);
+}
+
+/* Next path for this worker: own range, then the walker, then stealing. */
+static int next_item(scan_worker_t *w, scan_batch_t **batch, size_t *pos)
+{
+    scan_t *scan = w->scan;
+    for (;;) {
+        if (atomic_load(&scan->stop)) return 0;
+        if (queue_pop(&w->queue, batch, pos)) return 1;
+        /* Fresh work from the walker first, then whatever others hold */
+        if (scan->next && refill(w)) continue;
+        if (steal(w)) continue;
+        return 0;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Asynchronous structure reads (io_uring)                            */
+/* ------------------------------------------------------------------ */
+
+/*
+ * With MP4TAG_SCAN_ASYNC_IO each worker keeps several files in flight on
+ * its own ring. A file's first SCAN_HEAD_SIZE bytes are read at once;
+ * the top-level walk continues from that buffer, queuing a header read
+ * for each box past it, and the moov read is queued the moment its
+ * position is known. The context is then opened on the prefetched moov
+ * without further I/O. Anything unusual (short reads, oversized moov,
+ * errors) is handed to the blocking path, which reports it precisely.
+ */
+
+typedef enum {
+    SLOT_IDLE = 0,
+    SLOT_HEAD,
+    SLOT_HEADER,
+    SLOT_MOOV
+} slot_state_t;
+
+typedef struct {
+    slot_state_t     state;
+    int              fd;
+    scan_batch_t    *batch;
+    size_t           pos;           /* Path position in batch */
+    int64_t          file_size;
+    int64_t          walk_pos;      /* Next top-level box */
+    mp4_file_info_t  top;
+    uint8_t         *head;          /* SCAN_HEAD_SIZE bytes */
+    size_t           head_len;
+    uint8_t          hdr[16];
+    dyn_buffer_t     moov;
+    mp4_cache_key_t  key;           /* Taken before the first read */
+} scan_slot_t;
+
+/* Release the slot and finish its file: prefetched, or the blocking way. */
+static void slot_finish(scan_worker_t *w, scan_slot_t *slot, int prefetched)
+{
+    const char *path = slot->batch->paths[slot->pos];
+    size_t index = slot->batch->base + slot->pos;
+
+    if (slot->fd >= 0) close(slot->fd);
+    slot->fd    = -1;
+    slot->state = SLOT_IDLE;
+
+    int status = MP4TAG_ERR_UNSUPPORTED;
+    if (prefetched)
+        status = mp4_open_prefetched(w->ctx, path, slot->head, slot->head_len,
+                                     &slot->top, &slot->moov);
+    if (status == MP4TAG_OK) {
+        if (slot->key.size >= 0)
+            mp4_cache_remember(w->ctx, w->scan->cache, &slot->key);
+        finish_file(w, path, index, status);
+    } else {
+        scan_open(w, path, index, &slot->key);
+    }
+
+    batch_release(slot->batch);
+    slot->batch = NULL;
+}
+
+/* Header of the top-level box at `pos`, given `avail` bytes of it. */
+static int parse_top_header(const uint8_t *p, size_t avail, int64_t pos,
+                            int64_t file_size, mp4_box_t *box)
+{
+    int rc = mp4_parse_box_header(p, avail, pos, box);
+    if (rc == MP4TAG_OK && mp4_load_be32(p) == 0) {
+        /* Box extends to end of file, not just to the end of our bytes */
+        box->size      = file_size - pos;
+        box->data_size = box->size - box->header_size;
+    }
+    return rc;
+}
+
+/*
+ * Continue the top-level walk, then start the moov read. Returns 1 if
+ * a read is in flight for the slot, 0 if the slot was finished.
+ */
+static int slot_walk(scan_worker_t *w, mp4_uring_t *ring, scan_slot_t *slot,
+                     uint64_t tag)
+{
+    /* As in the blocking parse, the walk ends at moov */
+    while (slot->top.moov_offset < 0 && slot->walk_pos + 8 <= slot->file_size) {
+        int64_t pos  = slot->walk_pos;
+        int64_t want = slot->file_size - pos < 16 ? slot->file_size - pos : 16;
+
+        if (pos + want > (int64_t)slot->head_len) {
+            slot->state = SLOT_HEADER;
+            if (mp4_uring_queue_read(ring, slot->fd, slot->hdr, (size_t)want,
+                                     pos, tag) == MP4TAG_OK)
+                return 1;
+            slot_finish(w, slot, 0);
+            return 0;
+        }
+
+        mp4_box_t box;
+        if (parse_top_header(slot->head + pos, slot->head_len - (size_t)pos,
+                             pos, slot->file_size, &box) != MP4TAG_OK ||
+            box.size < 8)
+            break;
+        mp4_top_level_note(&slot->top, &box);
+        slot->walk_pos = box.offset + box.size;
+    }
+    slot->top.top_level_pos = slot->walk_pos;
+
+    const mp4_file_info_t *top = &slot->top;
+    if (top->moov_offset < 0 || top->moov_size < 8 ||
+        top->moov_size > (int64_t)MP4TAG_DEFAULT_MOOV_READ_LIMIT ||
+        top->moov_offset + top->moov_size > slot->file_size) {
+        slot_finish(w, slot, 0);
+        return 0;
+    }
+
+    slot->moov.size = 0;
+    if (buffer_append_zeros(&slot->moov, (size_t)top->moov_size) != 0) {
+        slot_finish(w, slot, 0);
+        return 0;
+    }
+
+    if (top->moov_offset + top->moov_size <= (int64_t)slot->head_len) {
+        memcpy(slot->moov.data, slot->head + top->moov_offset, slot->moov.size);
+        slot_finish(w, slot, 1);
+        return 0;
+    }
+
+    slot->state = SLOT_MOOV;
+    if (mp4_uring_queue_read(ring, slot->fd, slot->moov.data, slot->moov.size,
+                             top->moov_offset, tag) == MP4TAG_OK)
+        return 1;
+    slot_finish(w, slot, 0);
+    return 0;
+}
+
+/* Open a file and queue its head read. Returns 1 if a read is in flight. */
+static int slot_start(scan_worker_t *w, mp4_uring_t *ring, scan_slot_t *slot,
+                      uint64_t tag, scan_batch_t *batch, size_t pos)
+{
+    /* Files the tag index knows need no reads at all */
+    if (scan_cached(w, batch->paths[pos], &slot->key)) {
+        finish_file(w, batch->paths[pos], batch->base + pos, MP4TAG_OK);
+        batch_release(batch);
+        return 0;
+    }
+
+    slot->batch = batch;
+    slot->pos   = pos;
+    slot->fd    = open(batch->paths[pos], O_RDONLY | O_CLOEXEC);
+
+    struct stat st;
+    if (slot->fd < 0 || fstat(slot->fd, &st) != 0 || st.st_size < 8) {
+        slot_finish(w, slot, 0);
+        return 0;
+    }
+
+    slot->file_size = (int64_t)st.st_size;
+    slot->walk_pos  = 0;
+    slot->head_len  = st.st_size < SCAN_HEAD_SIZE ? (size_t)st.st_size
+                                                  : SCAN_HEAD_SIZE;
+    mp4_top_level_begin(&slot->top);
+
+    slot->state = SLOT_HEAD;
+    if (mp4_uring_queue_read(ring, slot->fd, slot->head, slot->head_len,
+                             0, tag) == MP4TAG_OK)
+        return 1;
+    slot_finish(w, slot, 0);
+    return 0;
+}
+
+/* A read for the slot completed with `res`. Returns 1 if another is in flight. */
+static int slot_advance(scan_worker_t *w, mp4_uring_t *ring, scan_slot_t *slot,
+                        uint64_t tag, int res)
+{
+    switch (slot->state) {
+    case SLOT_HEAD:
+        if (res < 0 || (size_t)res != slot->head_len) break;
+        return slot_walk(w, ring, slot, tag);
+
+    case SLOT_HEADER: {
+        /* A short or failed read ends the walk, as in the blocking path */
+        mp4_box_t box;
+        if (res >= 0 &&
+            parse_top_header(slot->hdr, (size_t)res, slot->walk_pos,
+                             slot->file_size, &box) == MP4TAG_OK &&
+            box.size >= 8) {
+            mp4_top_level_note(&slot->top, &box);
+            slot->walk_pos = box.offset + box.size;
+        } else {
+            slot->walk_pos = slot->file_size;
+        }
+        return slot_walk(w, ring, slot, tag);
+    }
+
+    case SLOT_MOOV:
+        if (res < 0 || (size_t)res != slot->moov.size) break;
+        slot_finish(w, slot, 1);
+        return 0;
+
+    default:
+        return 0;
+    }
+
+    slot_finish(w, slot, 0);
+    return 0;
+}
+
+/* Returns 0 if no ring could be set up (the caller scans blocking). */
+static int worker_run_async(scan_worker_t *w)
+{
+    scan_t *scan = w->scan;
+    unsigned depth = scan->queue_depth;
+
+    mp4_uring_t *ring = NULL;
+    if (mp4_uring_create(depth, &ring) != MP4TAG_OK) return 0;
+
+    scan_slot_t *slots = calloc(depth, sizeof(*slots));
+    uint8_t *heads = malloc((size_t)depth * SCAN_HEAD_SIZE);
+    if (!slots || !heads) {
+        free(slots);
+        free(heads);
+        mp4_uring_destroy(ring);
+        return 0;
+    }
+    for (unsigned i = 0; i < depth; i++) {
+        slots[i].fd   = -1;
+        slots[i].head = heads + (size_t)i * SCAN_HEAD_SIZE;
+        buffer_init(&slots[i].moov);
+    }
+
+    unsigned busy = 0;
+    int ring_ok = 1;
+    for (;;) {
+        /*
+         * Keep every slot busy while there is work; a file finished
+         * without a read (a cache hit, a failed open) frees its slot again
+         */
+        int more = 1;
+        for (unsigned i = 0; i < depth && ring_ok && more; i++) {
+            while (slots[i].state == SLOT_IDLE) {
+                scan_batch_t *batch;
+                size_t pos;
+                if (!next_item(w, &batch, &pos)) {
+                    more = 0;
+                    break;
+                }
+                busy += (unsigned)slot_start(w, ring, &slots[i], i, batch, pos);
+            }
+        }
+        if (busy == 0) break;
+
+        uint64_t tag;
+        int res;
+        if (!ring_ok || mp4_uring_wait(ring, &tag, &res) != MP4TAG_OK) {
+            /* The ring itself failed: finish what is left blocking */
+            ring_ok = 0;
+            for (unsigned i = 0; i < depth; i++) {
+                if (slots[i].state != SLOT_IDLE) slot_finish(w, &slots[i], 0);
+            }
+            break;
+        }
+        if (tag < depth && slots[tag].state != SLOT_IDLE)
+            busy -= 1u - (unsigned)slot_advance(w, ring, &slots[tag], tag, res);
+    }
+
+    mp4_uring_destroy(ring);
+    for (unsigned i = 0; i < depth; i++)
+        buffer_free(&slots[i].moov);
+    free(heads);
+    free(slots);
+    return 1;
+}
+
+static void *worker_main(void *arg)
+{
+    scan_worker_t *w = arg;
+
+    unsigned flags = w->scan->flags;
+    if ((flags & MP4TAG_SCAN_ASYNC_IO) && !(flags & MP4TAG_SCAN_MAPPED) &&
+        worker_run_async(w))
+        return NULL;
+
+    scan_batch_t *batch;
+    size_t pos;
+    while (next_item(w, &batch, &pos)) {
+        scan_file(w, batch->paths[pos], batch->base + pos);
+        batch_release(batch);
+    }
+    return NULL;
+}
+
+static unsigned worker_count(const mp4tag_scan_options_t *opts)
+{
+    long n = opts && opts->threads ? (long)opts->threads
+                                   : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > SCAN_MAX_THREADS) n = SCAN_MAX_THREADS;
+    return (unsigned)n;
+}
+
+/*
+ * Run a scan whose queues have been set up: worker 0 is the calling
+ * thread. A worker whose thread cannot be started leaves its range to
+ * be stolen by the others.
+ */
+static void run_workers(scan_t *scan)
+{
+    for (unsigned i = 1; i < scan->nworkers; i++) {
+        scan_worker_t *w = &scan->workers[i];
+        w->started = pthread_create(&w->thread, NULL, worker_main, w) == 0;
+    }
+    worker_main(&scan->workers[0]);
+    for (unsigned i = 1; i < scan->nworkers; i++) {
+        if (scan->workers[i].started)
+            pthread_join(scan->workers[i].thread, NULL);
+    }
+}
+
+static void scan_cleanup(scan_t *scan)
+{
+    for (unsigned i = 0; i < scan->nworkers; i++) {
+        scan_worker_t *w = &scan->workers[i];
+        batch_release(w->queue.batch);      /* Left over after a stop */
+        pthread_mutex_destroy(&w->queue.lock);
+        mp4tag_destroy(w->ctx);
+    }
+    free(scan->workers);
+    pthread_mutex_destroy(&scan->next_lock);
+    pthread_mutex_destroy(&scan->result_lock);
+}
+
+static int scan_init(scan_t *scan, unsigned nworkers,
+                     const mp4tag_scan_options_t *opts,
+                     mp4tag_scan_result_fn on_result, void *user_data)
+{
+    memset(scan, 0, sizeof(*scan));
+    scan->flags     = opts ? opts->flags : 0;
+    scan->cache     = opts ? opts->cache : NULL;
+    scan->queue_depth = opts && opts->queue_depth ? opts->queue_depth
+                                                  : SCAN_DEFAULT_DEPTH;
+    if (scan->queue_depth > SCAN_MAX_DEPTH) scan->queue_depth = SCAN_MAX_DEPTH;
+    scan->on_result = on_result;
+    scan->user_data = user_data;
+    atomic_init(&scan->stop, 0);
+    pthread_mutex_init(&scan->next_lock, NULL);
+    pthread_mutex_init(&scan->result_lock, NULL);
+
+    scan->workers = calloc(nworkers, sizeof(*scan->workers));
+    if (!scan->workers) {
+        scan_cleanup(scan);
+        return MP4TAG_ERR_NO_MEMORY;
+    }
+    scan->nworkers = nworkers;
+
+    int rc = MP4TAG_OK;
+    for (unsigned i = 0; i < nworkers; i++) {
+        scan_worker_t *w = &scan->workers[i];
+        w->scan = scan;
+        w->id   = i;
+        pthread_mutex_init(&w->queue.lock, NULL);
+        w->ctx = mp4tag_create(opts ? opts->allocator : NULL);
+        if (!w->ctx) {
+            rc = MP4TAG_ERR_NO_MEMORY;
+        } else if (scan->flags & MP4TAG_SCAN_LAZY_BINARY) {
+            mp4tag_set_lazy_binary(w->ctx, 1);
+        }
+    }
+    if (rc != MP4TAG_OK) scan_cleanup(scan);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Entry points                                                       */
+/* ------------------------------------------------------------------ */
+
+int mp4tag_scan_paths(const char *const *paths, size_t count,
+                      const mp4tag_scan_options_t *opts,
+                      mp4tag_scan_result_fn on_result, void *user_data)
+{
+    if ((!paths && count > 0) || !on_result) return MP4TAG_ERR_INVALID_ARG;
+    if (count == 0) return MP4TAG_OK;
+
+    unsigned nworkers = worker_count(opts);
+    if (nworkers > count) nworkers = (unsigned)count;
+
+    scan_t scan;
+    int rc = scan_init(&scan, nworkers, opts, on_result, user_data);
+    if (rc != MP4TAG_OK) return rc;
+
+    /* The caller's array is one shared batch, split evenly */
+    scan_batch_t list;
+    memset(&list, 0, sizeof(list));
+    list.paths = paths;
+    atomic_init(&list.refs, (int)nworkers);
+    for (unsigned i = 0; i < nworkers; i++) {
+        scan_queue_t *q = &scan.workers[i].queue;
+        q->batch = &list;
+        q->lo = count * i / nworkers;
+        q->hi = count * (i + 1) / nworkers;
+    }
+
+    run_workers(&scan);
+    scan_cleanup(&scan);
+    return MP4TAG_OK;
+}
+
+int mp4tag_scan_walk(mp4tag_scan_next_fn next, void *next_data,
+                     const mp4tag_scan_options_t *opts,
+                     mp4tag_scan_result_fn on_result, void *user_data)
+{
+    if (!next || !on_result) return MP4TAG_ERR_INVALID_ARG;
+
+    scan_t scan;
+    int rc = scan_init(&scan, worker_count(opts), opts, on_result, user_data);
+    if (rc != MP4TAG_OK) return rc;
+    scan.next      = next;
+    scan.next_data = next_data;
+
+    run_workers(&scan);
+    rc = scan.error;
+    scan_cleanup(&scan);
+    return rc;
+}
@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+/*
+ * Shared snapshots: the parsed tags of one file, frozen and reference
+ * counted so one parse can serve concurrent lookups on every thread.
+ *
+ * A snapshot lives in a single arena holding the snapshot itself, a copy
+ * of the ilst box and the collection parsed from it. Binary values and
+ * item views point into the copy, so nothing refers back to the context
+ * or the file. Once built it is never written again; the reference count
+ * is the only field that changes.
+ *
+ * Staleness is tracked by write generations: a cell per watched file,
+ * found by (st_dev, st_ino) in a process-wide table. A snapshot records
+ * the cell's value when it was taken, and writers bump it after writing.
+ * The table lock is only taken to find, create or drop a cell; checking
+ * a snapshot is one atomic load.
+ */
+
+#include "../include/mp4tag/mp4tag.h"
+#include "mp4tag_internal.h"
+#include "mp4/mp4_tags.h"
+#include "util/mp4_arena.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GENERATION_BUCKETS 256u
+
+struct mp4_generation {
+    atomic_uint_fast64_t    value;
+    uint64_t                dev;
+    uint64_t                ino;
+    int                     shared;     /* Linked into the table */
+    size_t                  refs;       /* Under g_generation_lock */
+    struct mp4_generation  *next;
+};
+
+struct mp4tag_snapshot {
+    atomic_size_t        refs;
+    mp4_generation_t    *gen;
+    uint64_t             generation;    /* gen->value when taken */
+
+    mp4_file_info_t      info;
+    mp4tag_collection_t *tags;          /* Owns the arena, and so this */
+    mp4_tag_index_t      tag_index;
+    mp4tag_item_view_t  *views;
+    size_t               view_count;
+};
+
+static pthread_mutex_t   g_generation_lock = PTHREAD_MUTEX_INITIALIZER;
+static mp4_generation_t *g_generations[GENERATION_BUCKETS];
+static atomic_size_t     g_generation_count;
+
+/* ------------------------------------------------------------------ */
+/*  Write generations                                                  */
+/* ------------------------------------------------------------------ */
+
+static size_t generation_bucket(uint64_t dev, uint64_t ino)
+{
+    uint64_t h = (ino ^ (dev * 0x9E3779B97F4A7C15u)) * 0xFF51AFD7ED558CCDu;
+    return (size_t)(h >> 32) & (GENERATION_BUCKETS - 1);
+}
+
+mp4_generation_t *mp4_generation_acquire(const mp4_cache_key_t *key, int create)
+{
+    pthread_mutex_lock(&g_generation_lock);
+    mp4_generation_t *gen = NULL;
+    if (key) {
+        size_t b = generation_bucket(key->dev, key->ino);
+        for (gen = g_generations[b]; gen; gen = gen->next)
+            if (gen->dev == key->dev && gen->ino == key->ino) break;
+        if (gen) {
+            gen->refs++;
+        } else if (create && (gen = calloc(1, sizeof(*gen))) != NULL) {
+            gen->dev    = key->dev;
+            gen->ino    = key->ino;
+            gen->shared = 1;
+            gen->refs   = 1;
+            gen->next   = g_generations[b];
+            g_generations[b] = gen;
+        }
+    } else if (create && (gen = calloc(1, sizeof(*gen))) != NULL) {
+        gen->refs = 1;
+    }
+    if (gen && gen->refs == 1)
+        atomic_fetch_add(&g_generation_count, 1);
+    pthread_mutex_unlock(&g_generation_lock);
+    return gen;
+}
+
+mp4_generation_t *mp4_generation_retain(mp4_generation_t *gen)
+{
+    pthread_mutex_lock(&g_generation_lock);
+    gen->refs++;
+    pthread_mutex_unlock(&g_generation_lock);
+    return gen;
+}
+
+void mp4_generation_release(mp4_generation_t *gen)
+{
+    if (!gen) return;
+    pthread_mutex_lock(&g_generation_lock);
+    if (--gen->refs > 0) {
+        pthread_mutex_unlock(&g_generation_lock);
+        return;
+    }
+    if (gen->shared) {
+        mp4_generation_t **p = &g_generations[generation_bucket(gen->dev, gen->ino)];
+        while (*p != gen) p = &(*p)->next;
+        *p = gen->next;
+    }
+    atomic_fetch_sub(&g_generation_count, 1);
+    pthread_mutex_unlock(&g_generation_lock);
+    free(gen);
+}
+
+int mp4_generation_watched(void)
+{
+    return atomic_load_explicit(&g_generation_count, memory_order_relaxed) > 0;
+}
+
+void mp4_generation_bump(mp4_generation_t *gen)
+{
+    atomic_fetch_add_explicit(&gen->value, 1, memory_order_release);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Snapshots                                                          */
+/* ------------------------------------------------------------------ */
+
+static void snapshot_free(mp4tag_snapshot_t *snap)
+{
+    mp4_generation_t *gen = snap->gen;
+    mp4_tag_index_free(&snap->tag_index);
+    mp4_mem_free(mp4_arena_allocator(snap->tags->arena), snap->views);
+    mp4_tags_free_collection(snap->tags);     /* snap goes with it */
+    mp4_generation_release(gen);
+}
+
+/*
+ * Point the lazily parsed binary values at the ilst copy rather than
+ * copying them a second time.
+ */
+static int attach_binaries(mp4tag_collection_t *coll, const mp4_span_t *ilst)
+{
+    for (mp4tag_tag_t *tag = coll->tags; tag; tag = tag->next) {
+        for (mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next) {
+            if (st->binary || st->binary_size == 0) continue;
+            if (st->binary_offset < ilst->offset ||
+                (uint64_t)(st->binary_offset - ilst->offset) + st->binary_size >
+                    ilst->size)
+                return MP4TAG_ERR_TRUNCATED;
+            st->binary = (uint8_t *)ilst->data + (st->binary_offset - ilst->offset);
+        }
+    }
+    return MP4TAG_OK;
+}
+
+int mp4_snapshot_create(const mp4_file_info_t *info, const uint8_t *ilst,
+                        size_t ilst_size, const mp4tag_allocator_t *allocator,
+                        mp4_generation_t *gen, mp4tag_snapshot_t **out)
+{
+    mp4_arena_t *arena = mp4_arena_create(allocator);
+    mp4tag_snapshot_t *snap = arena ? mp4_arena_alloc(arena, sizeof(*snap)) : NULL;
+    uint8_t *copy = snap ? mp4_arena_memdup(arena, ilst, ilst_size) : NULL;
+    if (!copy) {
+        if (arena) mp4_arena_destroy(arena);
+        mp4_generation_release(gen);
+        return MP4TAG_ERR_NO_MEMORY;
+    }
+
+    mp4_span_t span = { copy, info->ilst_offset, ilst_size };
+    snap->info = *info;
+    int rc = mp4_tags_parse_ilst_span(&span, &snap->info, MP4_PARSE_LAZY_BINARY,
+                                      arena, &snap->tags);
+    if (rc != MP4TAG_OK) {
+        mp4_arena_destroy(arena);
+        mp4_generation_release(gen);
+        return rc;
+    }
+    snap->gen = gen;
+
+    size_t capacity = 0;
+    rc = attach_binaries(snap->tags, &span);
+    if (rc == MP4TAG_OK)
+        rc = mp4_tags_view_ilst(&span, &snap->info, allocator, &snap->views,
+                                &snap->view_count, &capacity);
+    if (rc != MP4TAG_OK) {
+        snapshot_free(snap);
+        return rc;
+    }
+
+    /* Without an index, lookups fall back to a linear scan */
+    if (mp4_tag_index_build(snap->tags, &snap->tag_index) != MP4TAG_OK)
+        mp4_tag_index_free(&snap->tag_index);
+
+    snap->generation = atomic_load_explicit(&gen->value, memory_order_acquire);
+    atomic_init(&snap->refs, 1);
+    *out = snap;
+    return MP4TAG_OK;
+}
+
+mp4tag_snapshot_t *mp4tag_snapshot_retain(mp4tag_snapshot_t *snap)
+{
+    if (snap) atomic_fetch_add_explicit(&snap->refs, 1, memory_order_relaxed);
+    return snap;
+}
+
+void mp4tag_snapshot_release(mp4tag_snapshot_t *snap)
+{
+    if (snap && atomic_fetch_sub_explicit(&snap->refs, 1, memory_order_acq_rel) == 1)
+        snapshot_free(snap);
+}
+
+int mp4tag_snapshot_is_current(const mp4tag_snapshot_t *snap)
+{
+    if (!snap) return 0;
+    return atomic_load_explicit(&snap->gen->value, memory_order_acquire) ==
+           snap->generation;
+}
+
+const mp4tag_collection_t *mp4tag_snapshot_tags(const mp4tag_snapshot_t *snap)
+{
+    return snap ? snap->tags : NULL;
+}
+
+int mp4tag_snapshot_views(const mp4tag_snapshot_t *snap,
+                          const mp4tag_item_view_t **items, size_t *count)
+{
+    if (!snap || !items || !count) return MP4TAG_ERR_INVALID_ARG;
+    *items = snap->views;
+    *count = snap->view_count;
+    return MP4TAG_OK;
+}
+
+int mp4tag_snapshot_tag_string(const mp4tag_snapshot_t *snap, const char *name,
+                               char *value, size_t size)
+{
+    if (!snap || !name || !value || size == 0) return MP4TAG_ERR_INVALID_ARG;
+    return mp4_tags_copy_value(mp4_tags_find_name(snap->tags, &snap->tag_index,
+                                                  name), value, size);
+}
+
+int mp4tag_snapshot_tag_fourcc(const mp4tag_snapshot_t *snap, uint32_t fourcc,
+                               char *value, size_t size)
+{
+    if (!snap || !value || size == 0) return MP4TAG_ERR_INVALID_ARG;
+    return mp4_tags_copy_value(mp4_tags_find_fourcc(snap->tags, &snap->tag_index,
+                                                    fourcc), value, size);
+}
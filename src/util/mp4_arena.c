@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#include "mp4_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN        16u
+#define ARENA_FIRST_BLOCK  (4u * 1024u)
+#define ARENA_MAX_BLOCK    (64u * 1024u)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t              size;   /* Usable bytes in data */
+    size_t              used;
+    uint8_t            *data;
+} arena_block_t;
+
+struct mp4_arena {
+    mp4tag_allocator_t  allocator;
+    int                 has_allocator;
+    arena_block_t      *blocks;      /* Current block first */
+    arena_block_t      *spare;       /* Emptied by mp4_arena_reset */
+    size_t              next_size;   /* Size of the next regular block */
+    void               *last;        /* Most recent allocation (for grow) */
+};
+
+static size_t align_up(size_t n)
+{
+    return (n + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static void *raw_alloc(mp4_arena_t *arena, size_t size)
+{
+    if (arena->has_allocator)
+        return arena->allocator.alloc(size, arena->allocator.user_data);
+    return malloc(size);
+}
+
+static void raw_free(mp4_arena_t *arena, void *p)
+{
+    if (arena->has_allocator)
+        arena->allocator.free(p, arena->allocator.user_data);
+    else
+        free(p);
+}
+
+mp4_arena_t *mp4_arena_create(const mp4tag_allocator_t *allocator)
+{
+    int custom = allocator && allocator->alloc && allocator->free;
+    mp4_arena_t *arena = custom
+        ? allocator->alloc(sizeof(*arena), allocator->user_data)
+        : malloc(sizeof(*arena));
+    if (!arena) return NULL;
+
+    memset(arena, 0, sizeof(*arena));
+    if (custom) {
+        arena->allocator     = *allocator;
+        arena->has_allocator = 1;
+    }
+    arena->next_size = ARENA_FIRST_BLOCK;
+    return arena;
+}
+
+static void free_blocks(mp4_arena_t *arena, arena_block_t *b)
+{
+    while (b) {
+        arena_block_t *next = b->next;
+        raw_free(arena, b);
+        b = next;
+    }
+}
+
+void mp4_arena_destroy(mp4_arena_t *arena)
+{
+    if (!arena) return;
+    free_blocks(arena, arena->blocks);
+    free_blocks(arena, arena->spare);
+    raw_free(arena, arena);
+}
+
+size_t mp4_arena_reset(mp4_arena_t *arena, size_t keep)
+{
+    if (!arena) return 0;
+
+    /* Append the used blocks to the spares, then keep what fits */
+    arena_block_t **tail = &arena->spare;
+    while (*tail) tail = &(*tail)->next;
+    *tail = arena->blocks;
+    arena->blocks    = NULL;
+    arena->last      = NULL;
+    arena->next_size = ARENA_FIRST_BLOCK;
+
+    size_t kept = 0;
+    arena_block_t **link = &arena->spare;
+    while (*link) {
+        arena_block_t *b = *link;
+        if (b->size <= keep - kept) {
+            kept   += b->size;
+            b->used = 0;
+            link    = &b->next;
+        } else {
+            *link = b->next;
+            raw_free(arena, b);
+        }
+    }
+    return kept;
+}
+
+/* Smallest spare block of at least `size` bytes, unlinked, or NULL. */
+static arena_block_t *take_spare(mp4_arena_t *arena, size_t size)
+{
+    arena_block_t **best = NULL;
+    for (arena_block_t **link = &arena->spare; *link; link = &(*link)->next)
+        if ((*link)->size >= size && (!best || (*link)->size < (*best)->size))
+            best = link;
+    if (!best) return NULL;
+    arena_block_t *b = *best;
+    *best = b->next;
+    b->next = NULL;
+    return b;
+}
+
+/* Block header and data in one allocation, data aligned. */
+static arena_block_t *new_block(mp4_arena_t *arena, size_t size)
+{
+    arena_block_t *spare = take_spare(arena, size);
+    if (spare) return spare;
+
+    size_t hdr = align_up(sizeof(arena_block_t));
+    if (size > SIZE_MAX - hdr) return NULL;
+    arena_block_t *b = raw_alloc(arena, hdr + size);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    b->data = (uint8_t *)b + hdr;
+    return b;
+}
+
+void *mp4_arena_alloc(mp4_arena_t *arena, size_t size)
+{
+    if (!arena) return NULL;
+    size_t need = align_up(size ? size : 1);
+    if (need < size) return NULL;
+
+    arena_block_t *cur = arena->blocks;
+    if (!cur || cur->size - cur->used < need) {
+        if (need > arena->next_size / 4) {
+            /* Large values (cover art) get a block of their own, kept
+             * behind the current one so its free space stays usable. */
+            arena_block_t *b = new_block(arena, need);
+            if (!b) return NULL;
+            if (cur) {
+                b->next   = cur->next;
+                cur->next = b;
+            } else {
+                arena->blocks = b;
+            }
+            b->used = need;
+            arena->last = b->data;
+            memset(b->data, 0, need);
+            return b->data;
+        }
+
+        arena_block_t *b = new_block(arena, arena->next_size);
+        if (!b) return NULL;
+        b->next = cur;
+        arena->blocks = cur = b;
+        if (arena->next_size < ARENA_MAX_BLOCK)
+            arena->next_size *= 2;
+    }
+
+    void *p = cur->data + cur->used;
+    cur->used += need;
+    arena->last = p;
+    memset(p, 0, need);
+    return p;
+}
+
+char *mp4_arena_strndup(mp4_arena_t *arena, const char *s, size_t len)
+{
+    if (!s) return NULL;
+    char *p = mp4_arena_alloc(arena, len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+char *mp4_arena_strdup(mp4_arena_t *arena, const char *s)
+{
+    return s ? mp4_arena_strndup(arena, s, strlen(s)) : NULL;
+}
+
+void *mp4_arena_memdup(mp4_arena_t *arena, const void *data, size_t size)
+{
+    if (!data) return NULL;
+    void *p = mp4_arena_alloc(arena, size);
+    if (p && size > 0) memcpy(p, data, size);
+    return p;
+}
+
+void *mp4_arena_grow(mp4_arena_t *arena, void *old, size_t old_size,
+                     size_t new_size)
+{
+    if (!old) return mp4_arena_alloc(arena, new_size);
+    if (new_size <= old_size) return old;
+
+    /* Extend the latest allocation in place if its block has room */
+    arena_block_t *cur = arena->blocks;
+    if (old == arena->last && cur && (uint8_t *)old >= cur->data &&
+        (uint8_t *)old < cur->data + cur->size) {
+        size_t start = (size_t)((uint8_t *)old - cur->data);
+        size_t need  = align_up(new_size);
+        if (need >= new_size && need <= cur->size - start) {
+            memset(cur->data + start + old_size, 0, need - old_size);
+            cur->used = start + need;
+            return old;
+        }
+    }
+
+    void *p = mp4_arena_alloc(arena, new_size);
+    if (p) memcpy(p, old, old_size);
+    return p;
+}
+
+const mp4tag_allocator_t *mp4_arena_allocator(const mp4_arena_t *arena)
+{
+    return arena && arena->has_allocator ? &arena->allocator : NULL;
+}
+
+static int is_custom(const mp4tag_allocator_t *allocator)
+{
+    return allocator && allocator->alloc && allocator->free;
+}
+
+void *mp4_mem_alloc(const mp4tag_allocator_t *allocator, size_t size)
+{
+    if (is_custom(allocator))
+        return allocator->alloc(size ? size : 1, allocator->user_data);
+    return malloc(size ? size : 1);
+}
+
+void *mp4_mem_realloc(const mp4tag_allocator_t *allocator, void *p,
+                      size_t old_size, size_t new_size)
+{
+    if (!is_custom(allocator))
+        return realloc(p, new_size ? new_size : 1);
+    if (allocator->realloc)
+        return allocator->realloc(p, new_size ? new_size : 1, allocator->user_data);
+
+    void *grown = allocator->alloc(new_size ? new_size : 1, allocator->user_data);
+    if (!grown) return NULL;
+    if (p) {
+        memcpy(grown, p, old_size < new_size ? old_size : new_size);
+        allocator->free(p, allocator->user_data);
+    }
+    return grown;
+}
+
+void mp4_mem_free(const mp4tag_allocator_t *allocator, void *p)
+{
+    if (!p) return;
+    if (is_custom(allocator))
+        allocator->free(p, allocator->user_data);
+    else
+        free(p);
+}
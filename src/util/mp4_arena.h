@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#ifndef MP4_ARENA_H
+#define MP4_ARENA_H
+
+#include "../../include/mp4tag/mp4tag_types.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bump allocator backing a tag collection. The collection struct and
+ * every node, string and binary value in it come from its arena, which
+ * is released in one go when the collection is freed. Blocks are obtained from the
+ * context's mp4tag_allocator_t (or malloc/free without one).
+ *
+ * Nothing is freed individually: replacing a value leaves the old bytes
+ * in the arena until the collection goes away.
+ */
+typedef struct mp4_arena mp4_arena_t;
+
+/* `allocator` is copied; NULL (or one without alloc/free) means the C heap. */
+mp4_arena_t *mp4_arena_create(const mp4tag_allocator_t *allocator);
+void         mp4_arena_destroy(mp4_arena_t *arena);
+
+/*
+ * Release every allocation at once, keeping up to `keep` bytes of the
+ * emptied blocks for later allocations to reuse (the rest go back to
+ * the allocator). Returns the bytes kept.
+ */
+size_t mp4_arena_reset(mp4_arena_t *arena, size_t keep);
+
+/* Zeroed, suitably aligned memory. Returns NULL when out of memory. */
+void *mp4_arena_alloc(mp4_arena_t *arena, size_t size);
+
+/* Copies; a NULL source yields NULL. */
+char *mp4_arena_strdup(mp4_arena_t *arena, const char *s);
+char *mp4_arena_strndup(mp4_arena_t *arena, const char *s, size_t len);
+void *mp4_arena_memdup(mp4_arena_t *arena, const void *data, size_t size);
+
+/*
+ * Resize an allocation of `old_size` bytes. The most recent allocation
+ * grows in place when its block has room; otherwise the bytes move.
+ */
+void *mp4_arena_grow(mp4_arena_t *arena, void *old, size_t old_size,
+                     size_t new_size);
+
+/* The allocator the arena draws its blocks from; NULL for the C heap. */
+const mp4tag_allocator_t *mp4_arena_allocator(const mp4_arena_t *arena);
+
+/*
+ * Single allocations from `allocator`, by the same rule as
+ * mp4_arena_create, for the scratch arrays that outlive no collection
+ * (indexes, views, write layouts). mp4_mem_realloc falls back to
+ * alloc, copy and free when the allocator has no realloc.
+ */
+void *mp4_mem_alloc(const mp4tag_allocator_t *allocator, size_t size);
+void *mp4_mem_realloc(const mp4tag_allocator_t *allocator, void *p,
+                      size_t old_size, size_t new_size);
+void  mp4_mem_free(const mp4tag_allocator_t *allocator, void *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MP4_ARENA_H */
@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#include "mp4_block_cache.h"
+#include "../../include/mp4tag/mp4tag_error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int mp4_block_cache_init(mp4_block_cache_t *cache, mp4_fetch_fn fetch,
+                         void *user, int64_t size, size_t block_size,
+                         size_t count)
+{
+    if (!cache || !fetch || size < 0) return MP4TAG_ERR_INVALID_ARG;
+    memset(cache, 0, sizeof(*cache));
+
+    if (block_size == 0) block_size = MP4_CACHE_DEFAULT_BLOCK;
+    if (count == 0)      count      = MP4_CACHE_DEFAULT_BLOCKS;
+    if (count > SIZE_MAX / block_size) return MP4TAG_ERR_INVALID_ARG;
+
+    cache->pool  = malloc(count * block_size);
+    cache->slots = malloc(count * sizeof(*cache->slots));
+    if (!cache->pool || !cache->slots) {
+        mp4_block_cache_free(cache);
+        return MP4TAG_ERR_NO_MEMORY;
+    }
+    for (size_t i = 0; i < count; i++) {
+        cache->slots[i].block = -1;
+        cache->slots[i].used  = 0;
+    }
+
+    cache->fetch      = fetch;
+    cache->user       = user;
+    cache->size       = size;
+    cache->block_size = block_size;
+    cache->count      = count;
+    return MP4TAG_OK;
+}
+
+void mp4_block_cache_free(mp4_block_cache_t *cache)
+{
+    if (!cache) return;
+    free(cache->pool);
+    free(cache->slots);
+    memset(cache, 0, sizeof(*cache));
+}
+
+/* Slot holding `block`, or NULL. A cache this small is searched linearly. */
+static mp4_cache_slot_t *lookup(mp4_block_cache_t *cache, int64_t block)
+{
+    for (size_t i = 0; i < cache->count; i++)
+        if (cache->slots[i].block == block) return &cache->slots[i];
+    return NULL;
+}
+
+static uint8_t *slot_data(const mp4_block_cache_t *cache,
+                          const mp4_cache_slot_t *slot)
+{
+    return cache->pool + (size_t)(slot - cache->slots) * cache->block_size;
+}
+
+/* Empty slot if there is one, else the least recently used. */
+static mp4_cache_slot_t *victim(mp4_block_cache_t *cache)
+{
+    mp4_cache_slot_t *best = &cache->slots[0];
+    for (size_t i = 0; i < cache->count; i++) {
+        mp4_cache_slot_t *s = &cache->slots[i];
+        if (s->block < 0) return s;
+        if (s->used < best->used) best = s;
+    }
+    return best;
+}
+
+/* One request for exactly `len` bytes. */
+static int fetch_exact(mp4_block_cache_t *cache, void *buf, size_t len,
+                       int64_t offset)
+{
+    int64_t n = cache->fetch(cache->user, buf, len, (uint64_t)offset);
+    return n == (int64_t)len ? MP4TAG_OK : MP4TAG_ERR_IO;
+}
+
+/* Fetch blocks [first, first + nblocks) with one request. */
+static int fill(mp4_block_cache_t *cache, int64_t first, size_t nblocks)
+{
+    int64_t start = first * (int64_t)cache->block_size;
+    int64_t end   = start + (int64_t)(nblocks * cache->block_size);
+    if (end > cache->size) end = cache->size;
+
+    size_t len = (size_t)(end - start);
+    uint8_t *run = malloc(len);
+    if (!run) return MP4TAG_ERR_NO_MEMORY;
+
+    int rc = fetch_exact(cache, run, len, start);
+    for (size_t i = 0; rc == MP4TAG_OK && i < nblocks; i++) {
+        size_t at = i * cache->block_size;
+        size_t n  = len - at < cache->block_size ? len - at : cache->block_size;
+        mp4_cache_slot_t *slot = victim(cache);
+        memcpy(slot_data(cache, slot), run + at, n);
+        slot->block = first + (int64_t)i;
+        slot->used  = ++cache->clock;
+    }
+    free(run);
+    return rc;
+}
+
+int mp4_block_cache_read(mp4_block_cache_t *cache, void *buf, size_t len,
+                         int64_t offset)
+{
+    if (!cache || (!buf && len > 0) || offset < 0) return MP4TAG_ERR_INVALID_ARG;
+    if (offset > cache->size || len > (uint64_t)(cache->size - offset))
+        return MP4TAG_ERR_TRUNCATED;
+
+    const int64_t bs = (int64_t)cache->block_size;
+    uint8_t *out = buf;
+    int64_t pos = offset, end = offset + (int64_t)len;
+
+    while (pos < end) {
+        int64_t block = pos / bs;
+        mp4_cache_slot_t *slot = lookup(cache, block);
+        if (slot) {
+            int64_t in   = pos - block * bs;
+            int64_t take = bs - in < end - pos ? bs - in : end - pos;
+            memcpy(out, slot_data(cache, slot) + in, (size_t)take);
+            slot->used = ++cache->clock;
+            out += take;
+            pos += take;
+            continue;
+        }
+
+        /* Run of missing blocks from here to the end of the read */
+        int64_t last = (end - 1) / bs, stop = block + 1;
+        while (stop <= last && !lookup(cache, stop)) stop++;
+
+        size_t nblocks = (size_t)(stop - block);
+        if (nblocks > cache->count / 2) {
+            /* Too big to keep: read it straight through */
+            int64_t to = stop * bs < end ? stop * bs : end;
+            int rc = fetch_exact(cache, out, (size_t)(to - pos), pos);
+            if (rc != MP4TAG_OK) return rc;
+            out += to - pos;
+            pos  = to;
+            continue;
+        }
+
+        int rc = fill(cache, block, nblocks);
+        if (rc != MP4TAG_OK) return rc;
+    }
+    return MP4TAG_OK;
+}
+
+void mp4_block_cache_wrote(mp4_block_cache_t *cache, const void *data,
+                           size_t len, int64_t offset)
+{
+    if (!cache || !cache->slots || len == 0 || offset < 0) return;
+
+    const int64_t bs = (int64_t)cache->block_size;
+    int64_t end = offset + (int64_t)len;
+    for (size_t i = 0; i < cache->count; i++) {
+        mp4_cache_slot_t *slot = &cache->slots[i];
+        if (slot->block < 0) continue;
+
+        int64_t start = slot->block * bs;
+        int64_t from = offset > start ? offset : start;
+        int64_t to   = end < start + bs ? end : start + bs;
+        if (from >= to) continue;
+
+        if (from > cache->size) {
+            /* Bytes between the old end and the write are unknown */
+            slot->block = -1;
+            continue;
+        }
+        memcpy(slot_data(cache, slot) + (from - start),
+               (const uint8_t *)data + (from - offset), (size_t)(to - from));
+    }
+    if (end > cache->size) cache->size = end;
+}
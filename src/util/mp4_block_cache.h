@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#ifndef MP4_BLOCK_CACHE_H
+#define MP4_BLOCK_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fetch `len` bytes at `offset` from the backing source. Returns the
+ * bytes fetched (short only at the end of the source), or -1.
+ */
+typedef int64_t (*mp4_fetch_fn)(void *user, void *buf, size_t len,
+                                uint64_t offset);
+
+/*
+ * Read cache for sources where each request is expensive (HTTP range
+ * GETs against object storage). Reads are served from fixed,
+ * block-aligned blocks kept in LRU order; the blocks a read is missing
+ * are fetched with a single request covering the whole run, so the
+ * parser's many small header reads cost one request per block at most.
+ * A read needing more blocks than half the cache bypasses it and is
+ * fetched in one request straight into the caller's buffer.
+ */
+typedef struct {
+    int64_t  block;         /* Block index, -1 if the slot is empty */
+    uint64_t used;          /* LRU stamp */
+} mp4_cache_slot_t;
+
+typedef struct {
+    mp4_fetch_fn      fetch;
+    void             *user;
+    int64_t           size;         /* Source size in bytes */
+    size_t            block_size;
+    size_t            count;        /* Blocks held */
+    uint8_t          *pool;         /* count * block_size */
+    mp4_cache_slot_t *slots;
+    uint64_t          clock;
+} mp4_block_cache_t;
+
+#define MP4_CACHE_DEFAULT_BLOCK   (256u * 1024u)
+#define MP4_CACHE_DEFAULT_BLOCKS  16u
+
+/* Zero `block_size` / `count` select the defaults above. */
+int  mp4_block_cache_init(mp4_block_cache_t *cache, mp4_fetch_fn fetch,
+                          void *user, int64_t size, size_t block_size,
+                          size_t count);
+void mp4_block_cache_free(mp4_block_cache_t *cache);
+
+/*
+ * Copy `len` bytes at `offset` into `buf`. Returns MP4TAG_OK,
+ * MP4TAG_ERR_TRUNCATED for a range past the end of the source, or
+ * MP4TAG_ERR_IO if a fetch fails or comes back short.
+ */
+int  mp4_block_cache_read(mp4_block_cache_t *cache, void *buf, size_t len,
+                          int64_t offset);
+
+/*
+ * Note that `len` bytes at `offset` were written to the source: cached
+ * blocks are patched to match and the source size grows to cover them.
+ */
+void mp4_block_cache_wrote(mp4_block_cache_t *cache, const void *data,
+                           size_t len, int64_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MP4_BLOCK_CACHE_H */
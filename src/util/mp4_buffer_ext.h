@@ -36,6 +36,33 @@ static inline int buffer_append_be64(dyn_buffer_t *buf, uint64_t val)
     return buffer_append(buf, b, 8);
 }
 
+/* ---------- Big-endian loads from a byte buffer ---------- */
+
+static inline uint16_t mp4_load_be16(const uint8_t *p)
+{
+    return (uint16_t)(((uint16_t)p[0] << 8) | p[1]);
+}
+
+static inline uint32_t mp4_load_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+
+static inline uint64_t mp4_load_be64(const uint8_t *p)
+{
+    return ((uint64_t)mp4_load_be32(p) << 32) | mp4_load_be32(p + 4);
+}
+
+/* Overwrite a big-endian field already in a buffer (e.g. a box size). */
+static inline void mp4_store_be32(uint8_t *p, uint32_t val)
+{
+    p[0] = (uint8_t)(val >> 24);
+    p[1] = (uint8_t)(val >> 16);
+    p[2] = (uint8_t)(val >> 8);
+    p[3] = (uint8_t)val;
+}
+
 #ifdef __cplusplus
 }
 #endif
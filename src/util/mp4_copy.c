@@ -0,0 +1,647 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* copy_file_range */
+#endif
+
+#include "mp4_copy.h"
+#include "../../include/mp4tag/mp4tag_error.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
+/* ------------------------------------------------------------------ */
+/*  Plan                                                               */
+/* ------------------------------------------------------------------ */
+
+void mp4_copy_plan_init(mp4_copy_plan_t *plan)
+{
+    memset(plan, 0, sizeof(*plan));
+}
+
+void mp4_copy_plan_free(mp4_copy_plan_t *plan)
+{
+    free(plan->segs);
+    memset(plan, 0, sizeof(*plan));
+}
+
+static mp4_segment_t *plan_push(mp4_copy_plan_t *plan)
+{
+    if (plan->count == plan->capacity) {
+        size_t cap = plan->capacity ? plan->capacity * 2 : 16;
+        mp4_segment_t *segs = realloc(plan->segs, cap * sizeof(*segs));
+        if (!segs) return NULL;
+        plan->segs     = segs;
+        plan->capacity = cap;
+    }
+    mp4_segment_t *seg = &plan->segs[plan->count++];
+    memset(seg, 0, sizeof(*seg));
+    seg->fd = -1;
+    return seg;
+}
+
+int mp4_copy_plan_add_source(mp4_copy_plan_t *plan, int64_t offset, int64_t size)
+{
+    if (size < 0 || offset < 0) return MP4TAG_ERR_INVALID_ARG;
+    if (size == 0) return MP4TAG_OK;
+
+    if (plan->count > 0) {
+        mp4_segment_t *last = &plan->segs[plan->count - 1];
+        if (last->kind == MP4_SEG_SOURCE &&
+            last->src_offset + last->size == offset) {
+            last->size       += size;
+            plan->total_size += size;
+            return MP4TAG_OK;
+        }
+    }
+
+    mp4_segment_t *seg = plan_push(plan);
+    if (!seg) return MP4TAG_ERR_NO_MEMORY;
+    seg->kind       = MP4_SEG_SOURCE;
+    seg->src_offset = offset;
+    seg->size       = size;
+    seg->data       = NULL;
+    plan->total_size += size;
+    return MP4TAG_OK;
+}
+
+int mp4_copy_plan_add_memory(mp4_copy_plan_t *plan, const void *data, size_t size)
+{
+    if (size == 0) return MP4TAG_OK;
+    if (!data)     return MP4TAG_ERR_INVALID_ARG;
+
+    mp4_segment_t *seg = plan_push(plan);
+    if (!seg) return MP4TAG_ERR_NO_MEMORY;
+    seg->kind       = MP4_SEG_MEMORY;
+    seg->src_offset = -1;
+    seg->size       = (int64_t)size;
+    seg->data       = data;
+    plan->total_size += (int64_t)size;
+    return MP4TAG_OK;
+}
+
+int mp4_copy_plan_add_extern(mp4_copy_plan_t *plan, int fd,
+                             mp4_stream_read_fn read, void *user,
+                             int64_t offset, int64_t size)
+{
+    if (size < 0 || offset < 0 || (fd < 0 && !read))
+        return MP4TAG_ERR_INVALID_ARG;
+    if (size == 0) return MP4TAG_OK;
+
+    mp4_segment_t *seg = plan_push(plan);
+    if (!seg) return MP4TAG_ERR_NO_MEMORY;
+    seg->kind       = MP4_SEG_EXTERN;
+    seg->src_offset = offset;
+    seg->size       = size;
+    seg->data       = NULL;
+    seg->fd         = fd;
+    seg->read       = read;
+    seg->user       = user;
+    plan->total_size += size;
+    return MP4TAG_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Copier                                                             */
+/* ------------------------------------------------------------------ */
+
+void mp4_copier_init(mp4_copier_t *c, int src_fd, int dst_fd, size_t buf_size)
+{
+    memset(c, 0, sizeof(*c));
+    c->src_fd    = src_fd;
+    c->dst_fd    = dst_fd;
+    c->buf_size  = buf_size ? buf_size : MP4_COPY_BUFFER_DEFAULT;
+    c->direct_fd = -1;
+}
+
+void mp4_copier_set_policy(mp4_copier_t *c, unsigned policy, int direct_fd)
+{
+    c->policy    = policy;
+    c->direct_fd = (policy & MP4_COPY_POLICY_DIRECT) ? direct_fd : -1;
+
+    /* Uncached reads need an aligned buffer of whole blocks */
+    if (c->direct_fd >= 0)
+        c->buf_size = (c->buf_size + MP4_COPY_DIRECT_ALIGN - 1) /
+                      MP4_COPY_DIRECT_ALIGN * MP4_COPY_DIRECT_ALIGN;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Page cache advice                                                  */
+/* ------------------------------------------------------------------ */
+
+int mp4_open_direct(const char *path)
+{
+#if defined(O_DIRECT)
+    return open(path, O_RDONLY | O_DIRECT);
+#elif defined(F_NOCACHE)
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+void mp4_advise_sequential(int fd)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+    (void)fd;
+#endif
+}
+
+void mp4_advise_dontneed(int fd)
+{
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    (void)fd;
+#endif
+}
+
+/*
+ * With MP4_COPY_POLICY_DROP, evict what the copy has read and written:
+ * the source range straight away (it is clean), the target once a
+ * window's worth is pending, after waiting for its writeback.
+ */
+static void drop_behind(mp4_copier_t *c, int64_t src_off, int64_t len,
+                        int64_t dst_end)
+{
+    if (!(c->policy & MP4_COPY_POLICY_DROP)) return;
+#ifdef POSIX_FADV_DONTNEED
+    if (len > 0)    /* A length of 0 would mean "to EOF" */
+        posix_fadvise(c->src_fd, (off_t)src_off, (off_t)len, POSIX_FADV_DONTNEED);
+
+    int64_t pending = dst_end - c->dropped;
+    if (pending < (int64_t)MP4_COPY_DROP_WINDOW) return;
+#ifdef SYNC_FILE_RANGE_WRITE
+    sync_file_range(c->dst_fd, (off_t)c->dropped, (off_t)pending,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+    fdatasync(c->dst_fd);
+#endif
+    posix_fadvise(c->dst_fd, (off_t)c->dropped, (off_t)pending,
+                  POSIX_FADV_DONTNEED);
+    c->dropped = dst_end;
+#else
+    (void)c; (void)src_off; (void)len; (void)dst_end;
+#endif
+}
+
+void mp4_copier_free(mp4_copier_t *c)
+{
+    free(c->buf);
+    c->buf = NULL;
+}
+
+int mp4_copy_write(mp4_copier_t *c, const void *data, size_t len, int64_t dst_off)
+{
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = pwrite(c->dst_fd, p, len, (off_t)dst_off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return MP4TAG_ERR_WRITE_FAILED;
+        }
+        if (n == 0) return MP4TAG_ERR_WRITE_FAILED;
+        p       += n;
+        len     -= (size_t)n;
+        dst_off += n;
+    }
+    return MP4TAG_OK;
+}
+
+#ifdef __linux__
+/* Errors meaning "this mechanism can't do this pair", not real failures */
+static int is_unsupported(int err)
+{
+    return err == ENOSYS || err == EOPNOTSUPP || err == EXDEV ||
+           err == EINVAL || err == ENOTTY  || err == EBADF;
+}
+#endif
+
+/*
+ * Share as much of the range as the filesystem allows via reflink.
+ * Returns the number of bytes cloned (possibly 0).
+ */
+static int64_t try_reflink(mp4_copier_t *c, int64_t src_off, int64_t dst_off,
+                           int64_t len)
+{
+#if defined(__linux__) && defined(FICLONERANGE)
+    if (c->disabled & MP4_COPY_REFLINK) return 0;
+
+    struct stat st;
+    if (fstat(c->dst_fd, &st) != 0 || st.st_blksize <= 0) return 0;
+    int64_t blk = st.st_blksize;
+
+    /* Source and destination must share block alignment */
+    if (src_off % blk != 0 || dst_off % blk != 0) return 0;
+
+    int64_t clone_len = len / blk * blk;
+    if (clone_len == 0) return 0;
+
+    struct file_clone_range fcr;
+    fcr.src_fd      = c->src_fd;
+    fcr.src_offset  = (uint64_t)src_off;
+    fcr.src_length  = (uint64_t)clone_len;
+    fcr.dest_offset = (uint64_t)dst_off;
+    if (ioctl(c->dst_fd, FICLONERANGE, &fcr) != 0) {
+        if (is_unsupported(errno)) c->disabled |= MP4_COPY_REFLINK;
+        return 0;
+    }
+    c->bytes_cloned += clone_len;
+    return clone_len;
+#else
+    (void)c; (void)src_off; (void)dst_off; (void)len;
+    return 0;
+#endif
+}
+
+/*
+ * Copy in-kernel with copy_file_range, then sendfile. Returns the
+ * number of bytes copied before the mechanisms gave up, or a negative
+ * error code on a hard failure.
+ */
+static int64_t try_kernel_copy(mp4_copier_t *c, int64_t src_off, int64_t dst_off,
+                               int64_t len)
+{
+#ifdef __linux__
+    int64_t done = 0;
+
+    /* With DROP, copy a window at a time so eviction keeps up */
+    int64_t step = (c->policy & MP4_COPY_POLICY_DROP) ? MP4_COPY_DROP_WINDOW
+                                                      : INT64_MAX;
+
+    while (done < len && !(c->disabled & MP4_COPY_RANGE)) {
+        loff_t in  = (loff_t)(src_off + done);
+        loff_t out = (loff_t)(dst_off + done);
+        int64_t want = len - done < step ? len - done : step;
+        ssize_t n = copy_file_range(c->src_fd, &in, c->dst_fd, &out,
+                                    (size_t)want, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (!is_unsupported(errno)) return MP4TAG_ERR_WRITE_FAILED;
+            c->disabled |= MP4_COPY_RANGE;
+            break;
+        }
+        if (n == 0) goto out;       /* Source EOF */
+        drop_behind(c, src_off + done, n, dst_off + done + n);
+        done += n;
+    }
+
+    if (done < len && !(c->disabled & MP4_COPY_SENDFILE)) {
+        /* sendfile writes at the destination's file position */
+        if (lseek(c->dst_fd, (off_t)(dst_off + done), SEEK_SET) < 0) {
+            c->disabled |= MP4_COPY_SENDFILE;
+            goto out;
+        }
+        while (done < len) {
+            off_t in = (off_t)(src_off + done);
+            int64_t want = len - done < step ? len - done : step;
+            ssize_t n = sendfile(c->dst_fd, c->src_fd, &in, (size_t)want);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (!is_unsupported(errno)) return MP4TAG_ERR_WRITE_FAILED;
+                c->disabled |= MP4_COPY_SENDFILE;
+                break;
+            }
+            if (n == 0) break;
+            drop_behind(c, src_off + done, n, dst_off + done + n);
+            done += n;
+        }
+    }
+
+out:
+    c->bytes_copied += done;
+    return done;
+#else
+    (void)c; (void)src_off; (void)dst_off; (void)len;
+    return 0;
+#endif
+}
+
+/* The bounce buffer, block-aligned so uncached reads can share it. */
+static int copier_buffer(mp4_copier_t *c)
+{
+    if (c->buf) return MP4TAG_OK;
+    void *buf = NULL;
+    if (posix_memalign(&buf, MP4_COPY_DIRECT_ALIGN, c->buf_size) != 0)
+        return MP4TAG_ERR_NO_MEMORY;
+    c->buf = buf;
+    return MP4TAG_OK;
+}
+
+static int buffered_copy(mp4_copier_t *c, int64_t src_off, int64_t dst_off,
+                         int64_t len)
+{
+    int rc = copier_buffer(c);
+    if (rc != MP4TAG_OK) return rc;
+
+    while (len > 0) {
+        size_t chunk = len < (int64_t)c->buf_size ? (size_t)len : c->buf_size;
+        ssize_t n = pread(c->src_fd, c->buf, chunk, (off_t)src_off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return MP4TAG_ERR_IO;
+        }
+        if (n == 0) break;  /* Source shorter than expected */
+
+        rc = mp4_copy_write(c, c->buf, (size_t)n, dst_off);
+        if (rc != MP4TAG_OK) return rc;
+
+        c->bytes_copied += n;
+        drop_behind(c, src_off, n, dst_off + n);
+        src_off += n;
+        dst_off += n;
+        len     -= n;
+    }
+    return MP4TAG_OK;
+}
+
+/*
+ * Uncached copy: whole aligned blocks are read through direct_fd and the
+ * wanted bytes written out. Returns the bytes copied before the source
+ * refused uncached reads (the rest goes the buffered way), or a negative
+ * error code.
+ */
+static int64_t direct_copy(mp4_copier_t *c, int64_t src_off, int64_t dst_off,
+                           int64_t len)
+{
+    if (c->direct_fd < 0 || (c->disabled & MP4_COPY_DIRECT) ||
+        len < (int64_t)MP4_COPY_DIRECT_MIN)
+        return 0;
+
+    int rc = copier_buffer(c);
+    if (rc != MP4TAG_OK) return rc;
+
+    int64_t done = 0;
+    while (done < len) {
+        int64_t pos   = src_off + done;
+        int64_t start = pos / MP4_COPY_DIRECT_ALIGN * MP4_COPY_DIRECT_ALIGN;
+        size_t  skip  = (size_t)(pos - start);
+        int64_t want  = (int64_t)skip + (len - done);
+        if (want > (int64_t)c->buf_size) want = (int64_t)c->buf_size;
+        want = (want + MP4_COPY_DIRECT_ALIGN - 1) / MP4_COPY_DIRECT_ALIGN *
+               MP4_COPY_DIRECT_ALIGN;
+        if (want > (int64_t)c->buf_size) want -= MP4_COPY_DIRECT_ALIGN;
+
+        ssize_t n = pread(c->direct_fd, c->buf, (size_t)want, (off_t)start);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EINVAL) return MP4TAG_ERR_IO;
+            c->disabled |= MP4_COPY_DIRECT;     /* Alignment not accepted */
+            break;
+        }
+        if ((size_t)n <= skip) break;           /* Source EOF */
+
+        int64_t got = (int64_t)((size_t)n - skip);
+        if (got > len - done) got = len - done;
+        rc = mp4_copy_write(c, c->buf + skip, (size_t)got, dst_off + done);
+        if (rc != MP4TAG_OK) return rc;
+
+        c->bytes_copied += got;
+        done += got;
+        drop_behind(c, pos, 0, dst_off + done);    /* Source is uncached */
+    }
+    return done;
+}
+
+int mp4_copy_range(mp4_copier_t *c, int64_t src_off, int64_t dst_off, int64_t len)
+{
+    if (!c || src_off < 0 || dst_off < 0 || len < 0)
+        return MP4TAG_ERR_INVALID_ARG;
+
+    int64_t n = try_reflink(c, src_off, dst_off, len);
+    src_off += n; dst_off += n; len -= n;
+    if (len == 0) return MP4TAG_OK;
+
+    n = direct_copy(c, src_off, dst_off, len);
+    if (n < 0) return (int)n;
+    src_off += n; dst_off += n; len -= n;
+    if (len == 0) return MP4TAG_OK;
+
+    /* The in-kernel copies go through the page cache DIRECT avoids */
+    n = c->direct_fd >= 0 && len >= (int64_t)MP4_COPY_DIRECT_MIN &&
+            !(c->disabled & MP4_COPY_DIRECT)
+        ? 0 : try_kernel_copy(c, src_off, dst_off, len);
+    if (n < 0) return (int)n;
+    src_off += n; dst_off += n; len -= n;
+    if (len == 0) return MP4TAG_OK;
+
+    return buffered_copy(c, src_off, dst_off, len);
+}
+
+/*
+ * Copy an extern segment. An fd range goes through mp4_copy_range with
+ * the copier pointed at that fd for the duration; what it learns about
+ * the pair (and the uncached source) doesn't carry over to the real one.
+ */
+static int copy_extern(mp4_copier_t *c, const mp4_segment_t *seg, int64_t dst_off)
+{
+    if (seg->fd >= 0) {
+        int      src_fd    = c->src_fd;
+        int      direct_fd = c->direct_fd;
+        unsigned disabled  = c->disabled;
+        unsigned policy    = c->policy;
+        c->src_fd    = seg->fd;
+        c->direct_fd = -1;      /* Uncached reads are of the real source */
+        c->disabled  = 0;
+        c->policy   &= ~MP4_COPY_POLICY_DIRECT;
+        int rc = mp4_copy_range(c, seg->src_offset, dst_off, seg->size);
+        c->src_fd    = src_fd;
+        c->direct_fd = direct_fd;
+        c->disabled  = disabled;
+        c->policy    = policy;
+        return rc;
+    }
+
+    int rc = copier_buffer(c);
+    if (rc != MP4TAG_OK) return rc;
+    int64_t done = 0;
+    while (done < seg->size) {
+        size_t chunk = seg->size - done < (int64_t)c->buf_size
+                     ? (size_t)(seg->size - done) : c->buf_size;
+        rc = seg->read(seg->user, c->buf, chunk, seg->src_offset + done);
+        if (rc == MP4TAG_OK)
+            rc = mp4_copy_write(c, c->buf, chunk, dst_off + done);
+        if (rc != MP4TAG_OK) return rc;
+        c->bytes_copied += (int64_t)chunk;
+        done += (int64_t)chunk;
+    }
+    return MP4TAG_OK;
+}
+
+int mp4_copy_plan_run(mp4_copier_t *c, const mp4_copy_plan_t *plan,
+                      int64_t dst_off, int64_t src_size)
+{
+    for (size_t i = 0; i < plan->count; i++) {
+        const mp4_segment_t *seg = &plan->segs[i];
+        int rc;
+
+        if (seg->kind == MP4_SEG_MEMORY) {
+            rc = mp4_copy_write(c, seg->data, (size_t)seg->size, dst_off);
+            dst_off += seg->size;
+        } else if (seg->kind == MP4_SEG_EXTERN) {
+            rc = copy_extern(c, seg, dst_off);
+            dst_off += seg->size;
+        } else {
+            int64_t len = seg->size;
+            if (seg->src_offset + len > src_size)
+                len = src_size - seg->src_offset;
+            if (len <= 0) continue;
+            rc = mp4_copy_range(c, seg->src_offset, dst_off, len);
+            dst_off += len;
+        }
+        if (rc != MP4TAG_OK) return rc;
+    }
+    return MP4TAG_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Sequential output                                                  */
+/* ------------------------------------------------------------------ */
+
+void mp4_stream_init(mp4_stream_t *s, size_t buf_size)
+{
+    memset(s, 0, sizeof(*s));
+    s->src_fd   = -1;
+    s->dst_fd   = -1;
+    s->buf_size = buf_size ? buf_size : MP4_COPY_BUFFER_DEFAULT;
+}
+
+void mp4_stream_free(mp4_stream_t *s)
+{
+    free(s->buf);
+    s->buf = NULL;
+}
+
+static int stream_write(mp4_stream_t *s, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len > 0) {
+        int64_t n;
+        if (s->dst_fd >= 0) {
+            n = write(s->dst_fd, p, len);
+            if (n < 0 && errno == EINTR) continue;
+        } else {
+            n = s->write(s->write_user, p, len);
+        }
+        if (n <= 0 || (uint64_t)n > len) return MP4TAG_ERR_WRITE_FAILED;
+        p            += n;
+        len          -= (size_t)n;
+        s->bytes_out += n;
+    }
+    return MP4TAG_OK;
+}
+
+/*
+ * Kernel copy from src_fd to the output descriptor. Returns the bytes
+ * sent before sendfile gave up, or a negative error code.
+ */
+static int64_t stream_sendfile(mp4_stream_t *s, int src_fd, int64_t src_off,
+                               int64_t len)
+{
+#ifdef __linux__
+    if (src_fd < 0 || s->dst_fd < 0 || (s->disabled & MP4_COPY_SENDFILE))
+        return 0;
+
+    int64_t done = 0;
+    while (done < len) {
+        off_t in = (off_t)(src_off + done);
+        ssize_t n = sendfile(s->dst_fd, src_fd, &in, (size_t)(len - done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (!is_unsupported(errno)) return MP4TAG_ERR_WRITE_FAILED;
+            s->disabled |= MP4_COPY_SENDFILE;
+            break;
+        }
+        if (n == 0) break;      /* Source EOF */
+        done         += n;
+        s->bytes_out += n;
+    }
+    return done;
+#else
+    (void)s; (void)src_fd; (void)src_off; (void)len;
+    return 0;
+#endif
+}
+
+/* Copy a range of `src_fd`, or with src_fd < 0 of what `read` reads. */
+static int stream_range(mp4_stream_t *s, int src_fd, mp4_stream_read_fn read,
+                        void *user, int64_t src_off, int64_t len)
+{
+    int64_t sent = stream_sendfile(s, src_fd, src_off, len);
+    if (sent < 0) return (int)sent;
+    src_off += sent;
+    len     -= sent;
+    if (len == 0) return MP4TAG_OK;
+
+    if (!s->buf) {
+        s->buf = malloc(s->buf_size);
+        if (!s->buf) return MP4TAG_ERR_NO_MEMORY;
+    }
+    while (len > 0) {
+        size_t chunk = len < (int64_t)s->buf_size ? (size_t)len : s->buf_size;
+        if (src_fd >= 0) {
+            ssize_t n = pread(src_fd, s->buf, chunk, (off_t)src_off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return MP4TAG_ERR_IO;
+            /* The source shrank under us: the output would be short */
+            if (n == 0) return MP4TAG_ERR_TRUNCATED;
+            chunk = (size_t)n;
+        } else {
+            int rc = read(user, s->buf, chunk, src_off);
+            if (rc != MP4TAG_OK) return rc;
+        }
+        int rc = stream_write(s, s->buf, chunk);
+        if (rc != MP4TAG_OK) return rc;
+        src_off += (int64_t)chunk;
+        len     -= (int64_t)chunk;
+    }
+    return MP4TAG_OK;
+}
+
+int mp4_stream_plan(mp4_stream_t *s, const mp4_copy_plan_t *plan,
+                    int64_t src_size)
+{
+    if ((s->src_fd < 0 && !s->read_at) || (s->dst_fd < 0 && !s->write))
+        return MP4TAG_ERR_INVALID_ARG;
+
+    for (size_t i = 0; i < plan->count; i++) {
+        const mp4_segment_t *seg = &plan->segs[i];
+        int rc;
+
+        if (seg->kind == MP4_SEG_MEMORY) {
+            rc = stream_write(s, seg->data, (size_t)seg->size);
+        } else if (seg->kind == MP4_SEG_EXTERN) {
+            rc = stream_range(s, seg->fd, seg->read, seg->user,
+                              seg->src_offset, seg->size);
+        } else {
+            int64_t len = seg->size;
+            if (seg->src_offset + len > src_size)
+                len = src_size - seg->src_offset;
+            if (len <= 0) continue;
+            rc = stream_range(s, s->src_fd, s->read_at, s->read_user,
+                              seg->src_offset, len);
+        }
+        if (rc != MP4TAG_OK) return rc;
+    }
+    return MP4TAG_OK;
+}
@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#ifndef MP4_COPY_H
+#define MP4_COPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Positioned read from a non-fd source: MP4TAG_OK once `len` bytes are in */
+typedef int     (*mp4_stream_read_fn)(void *user, void *buf, size_t len,
+                                      int64_t offset);
+
+/*
+ * Output plan for a rewrite: an ordered list of segments that together
+ * form the destination file. A segment is a byte range of the source
+ * file, bytes held in memory, or a byte range of some other input (a
+ * streamed tag value). Adjacent source ranges are merged as they are
+ * added, so long runs of untouched boxes (mdat, moof/mdat pairs) become
+ * a single copy.
+ */
+typedef enum {
+    MP4_SEG_SOURCE = 0,   /* Copy [src_offset, src_offset + size) */
+    MP4_SEG_MEMORY = 1,   /* Write `data` (borrowed, not freed) */
+    MP4_SEG_EXTERN = 2    /* Copy [src_offset, src_offset + size) of `fd`,
+                             or with fd < 0 read it through `read` */
+} mp4_seg_kind_t;
+
+typedef struct {
+    mp4_seg_kind_t      kind;
+    int64_t             src_offset;
+    int64_t             size;
+    const uint8_t      *data;
+    int                 fd;         /* MP4_SEG_EXTERN only */
+    mp4_stream_read_fn  read;
+    void               *user;
+} mp4_segment_t;
+
+typedef struct {
+    mp4_segment_t *segs;
+    size_t         count;
+    size_t         capacity;
+    int64_t        total_size;  /* Sum of all segment sizes */
+} mp4_copy_plan_t;
+
+void mp4_copy_plan_init(mp4_copy_plan_t *plan);
+void mp4_copy_plan_free(mp4_copy_plan_t *plan);
+
+/* Append a source range, merging with the previous segment if adjacent. */
+int mp4_copy_plan_add_source(mp4_copy_plan_t *plan, int64_t offset, int64_t size);
+
+/* Append in-memory bytes. `data` must outlive the plan's execution. */
+int mp4_copy_plan_add_memory(mp4_copy_plan_t *plan, const void *data, size_t size);
+
+/*
+ * Append a range of another input: `fd`, or `read` (with `user`) when
+ * `fd` < 0. Either must stay usable until the plan has run.
+ */
+int mp4_copy_plan_add_extern(mp4_copy_plan_t *plan, int fd,
+                             mp4_stream_read_fn read, void *user,
+                             int64_t offset, int64_t size);
+
+/*
+ * Copy engine. Each range is copied with the cheapest mechanism the
+ * platform and filesystem accept, in order:
+ *   1. FICLONERANGE reflink (Linux, block-aligned ranges on btrfs/XFS)
+ *   2. copy_file_range      (Linux)
+ *   3. sendfile             (Linux)
+ *   4. pread/pwrite through a bounce buffer
+ * A mechanism that reports itself unsupported for this pair of files is
+ * not tried again.
+ */
+typedef struct {
+    int       src_fd;
+    int       dst_fd;
+    unsigned  disabled;         /* MP4_COPY_* mechanisms ruled out */
+    uint8_t  *buf;              /* Bounce buffer for the fallback loop */
+    size_t    buf_size;
+    int64_t   bytes_cloned;     /* Bytes shared via reflink */
+    int64_t   bytes_copied;     /* Bytes copied by any other mechanism */
+
+    /* Cache policy (mp4_copier_set_policy) */
+    unsigned  policy;           /* MP4_COPY_POLICY_* */
+    int       direct_fd;        /* Uncached source descriptor, or -1 */
+    int64_t   dropped;          /* Target bytes already evicted */
+} mp4_copier_t;
+
+#define MP4_COPY_REFLINK    0x1u
+#define MP4_COPY_RANGE      0x2u
+#define MP4_COPY_SENDFILE   0x4u
+#define MP4_COPY_DIRECT     0x8u
+
+/*
+ * Cache policy. DROP evicts the pages a copy has been through, source
+ * and target, every MP4_COPY_DROP_WINDOW bytes (the target is written
+ * back first). DIRECT reads source ranges of at least
+ * MP4_COPY_DIRECT_MIN bytes through `direct_fd`, skipping the in-kernel
+ * copies that would pull them into the page cache; reflinks still win.
+ */
+#define MP4_COPY_POLICY_DROP    0x1u
+#define MP4_COPY_POLICY_DIRECT  0x2u
+
+#define MP4_COPY_DROP_WINDOW    (8u * 1024u * 1024u)
+#define MP4_COPY_DIRECT_MIN     (1024u * 1024u)
+#define MP4_COPY_DIRECT_ALIGN   4096u
+
+/* Default bounce buffer size for the fallback loop */
+#define MP4_COPY_BUFFER_DEFAULT (1024u * 1024u)
+
+/*
+ * Prepare a copier; `buf_size` of 0 selects MP4_COPY_BUFFER_DEFAULT.
+ * The bounce buffer is only allocated if the fallback loop is needed.
+ */
+void mp4_copier_init(mp4_copier_t *c, int src_fd, int dst_fd, size_t buf_size);
+void mp4_copier_free(mp4_copier_t *c);
+
+/*
+ * Set the cache policy. `direct_fd` is the source opened for uncached
+ * reads (see mp4_open_direct), or -1; it stays owned by the caller.
+ */
+void mp4_copier_set_policy(mp4_copier_t *c, unsigned policy, int direct_fd);
+
+/*
+ * Open `path` read-only bypassing the page cache: O_DIRECT where
+ * available, F_NOCACHE on Apple platforms. Returns -1 if neither works.
+ */
+int mp4_open_direct(const char *path);
+
+/* Advise the kernel that `fd` is about to be read front to back. */
+void mp4_advise_sequential(int fd);
+
+/* Drop the (clean) cached pages of `fd`. */
+void mp4_advise_dontneed(int fd);
+
+/* Copy `len` bytes from src_off in the source to dst_off in the target. */
+int mp4_copy_range(mp4_copier_t *c, int64_t src_off, int64_t dst_off, int64_t len);
+
+/* Write a memory block at dst_off in the target. */
+int mp4_copy_write(mp4_copier_t *c, const void *data, size_t len, int64_t dst_off);
+
+/*
+ * Execute a plan, producing the destination from offset `dst_off`.
+ * Source ranges are clamped to `src_size` (truncated final boxes);
+ * extern ranges go through the same mechanisms with their own fd.
+ */
+int mp4_copy_plan_run(mp4_copier_t *c, const mp4_copy_plan_t *plan,
+                      int64_t dst_off, int64_t src_size);
+
+/*
+ * Sequential output: a plan written front to back to a descriptor that
+ * may not seek (pipe, socket) or to a callback. Source ranges come from
+ * `src_fd` when there is one, via sendfile on Linux where the kernel
+ * accepts the pair, otherwise through a bounce buffer filled by pread or
+ * by `read_at`. With `dst_fd` < 0 every byte is handed to `write`.
+ */
+typedef int64_t (*mp4_stream_write_fn)(void *user, const void *buf, size_t len);
+
+typedef struct {
+    int                  src_fd;        /* Source descriptor, or -1 */
+    mp4_stream_read_fn   read_at;       /* Source reads when src_fd < 0 */
+    void                *read_user;
+    int                  dst_fd;        /* Output descriptor, or -1 */
+    mp4_stream_write_fn  write;         /* Output when dst_fd < 0 */
+    void                *write_user;
+    unsigned             disabled;      /* MP4_COPY_SENDFILE once refused */
+    uint8_t             *buf;
+    size_t               buf_size;
+    int64_t              bytes_out;     /* Bytes delivered so far */
+} mp4_stream_t;
+
+/* `buf_size` of 0 selects MP4_COPY_BUFFER_DEFAULT; set the ends after. */
+void mp4_stream_init(mp4_stream_t *s, size_t buf_size);
+void mp4_stream_free(mp4_stream_t *s);
+
+/* Write a plan in order; source ranges are clamped to `src_size`. */
+int mp4_stream_plan(mp4_stream_t *s, const mp4_copy_plan_t *plan,
+                    int64_t src_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MP4_COPY_H */
@@ -0,0 +1,6 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#include "mp4_io_count.h"
+
+_Thread_local mp4_io_count_t *mp4_io_count_current = NULL;
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#ifndef MP4_IO_COUNT_H
+#define MP4_IO_COUNT_H
+
+#include <tag_common/file_io.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * I/O counters for mp4tag_get_stats. The format layers only see a
+ * file_handle_t, so they read and seek through mp4_file_read and
+ * mp4_file_seek, which count into whatever mp4_io_count_begin made
+ * current on this thread (nothing, by default).
+ */
+typedef struct {
+    uint64_t reads;
+    uint64_t seeks;
+    uint64_t writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} mp4_io_count_t;
+
+extern _Thread_local mp4_io_count_t *mp4_io_count_current;
+
+/* Count into `count` until mp4_io_count_end; returns what to restore. */
+static inline mp4_io_count_t *mp4_io_count_begin(mp4_io_count_t *count)
+{
+    mp4_io_count_t *prev = mp4_io_count_current;
+    mp4_io_count_current = count;
+    return prev;
+}
+
+static inline void mp4_io_count_end(mp4_io_count_t *prev)
+{
+    mp4_io_count_current = prev;
+}
+
+static inline int mp4_file_read(file_handle_t *fh, void *buf, size_t n)
+{
+    int rc = file_read(fh, buf, n);
+    mp4_io_count_t *c = mp4_io_count_current;
+    if (c) {
+        c->reads++;
+        if (rc == 0) c->bytes_read += n;
+    }
+    return rc;
+}
+
+static inline int mp4_file_seek(file_handle_t *fh, int64_t offset)
+{
+    mp4_io_count_t *c = mp4_io_count_current;
+    if (c) c->seeks++;
+    return file_seek(fh, offset);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MP4_IO_COUNT_H */
@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#include "mp4_text.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MP4_TEXT_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MP4_TEXT_NEON 1
+#endif
+
+/* ------------------------------------------------------------------ */
+/*  ASCII fast paths                                                   */
+/* ------------------------------------------------------------------ */
+
+/* Copy the leading ASCII bytes of src. Returns how many were copied. */
+static size_t copy_ascii(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+#if defined(MP4_TEXT_SSE2)
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(v) != 0) break;
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+#elif defined(MP4_TEXT_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        if (vmaxvq_u8(v) >= 0x80) break;
+        vst1q_u8(dst + i, v);
+    }
+#endif
+
+    while (i < len && src[i] < 0x80) {
+        dst[i] = src[i];
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Narrow the leading UTF-16BE code units below U+0080 to single bytes.
+ * Returns how many code units were consumed (one output byte each).
+ */
+static size_t narrow_ascii_utf16be(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t n = 0;
+
+#if defined(MP4_TEXT_SSE2)
+    /* As little-endian 16-bit lanes a BE unit reads lo << 8 | hi */
+    const __m128i mask = _mm_set1_epi16((short)0x80FF);
+    const __m128i zero = _mm_setzero_si128();
+    for (; 2 * n + 32 <= len; n += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * n));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * n + 16));
+        __m128i bad = _mm_and_si128(_mm_or_si128(a, b), mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, zero)) != 0xFFFF) break;
+        __m128i lo = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i *)(dst + n), lo);
+    }
+#elif defined(MP4_TEXT_NEON)
+    const uint8x16_t high_bit = vdupq_n_u8(0x80);
+    for (; 2 * n + 32 <= len; n += 16) {
+        uint8x16x2_t v = vld2q_u8(src + 2 * n);     /* val[0] hi, val[1] lo */
+        uint8x16_t bad = vorrq_u8(v.val[0], vandq_u8(v.val[1], high_bit));
+        if (vmaxvq_u8(bad) != 0) break;
+        vst1q_u8(dst + n, v.val[1]);
+    }
+#endif
+
+    while (2 * n + 2 <= len && src[2 * n] == 0 && src[2 * n + 1] < 0x80) {
+        dst[n] = src[2 * n + 1];
+        n++;
+    }
+    return n;
+}
+
+/* ------------------------------------------------------------------ */
+/*  UTF-8 validation                                                   */
+/* ------------------------------------------------------------------ */
+
+static int is_cont(uint8_t c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+/* Length of the well-formed sequence at p, or 0 if it is malformed. */
+static size_t utf8_seq_len(const uint8_t *p, size_t avail)
+{
+    uint8_t c = p[0];
+    if (c < 0x80) return 1;
+    if (c < 0xC2) return 0;                 /* Continuation or overlong */
+
+    if (c < 0xE0)
+        return avail >= 2 && is_cont(p[1]) ? 2 : 0;
+
+    if (c < 0xF0) {
+        if (avail < 3 || !is_cont(p[1]) || !is_cont(p[2])) return 0;
+        if (c == 0xE0 && p[1] < 0xA0) return 0;     /* Overlong */
+        if (c == 0xED && p[1] > 0x9F) return 0;     /* Surrogate */
+        return 3;
+    }
+
+    if (c < 0xF5) {
+        if (avail < 4 || !is_cont(p[1]) || !is_cont(p[2]) || !is_cont(p[3]))
+            return 0;
+        if (c == 0xF0 && p[1] < 0x90) return 0;     /* Overlong */
+        if (c == 0xF4 && p[1] > 0x8F) return 0;     /* Past U+10FFFF */
+        return 4;
+    }
+
+    return 0;
+}
+
+int mp4_text_copy_utf8(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    int valid = 1;
+    size_t i = 0;
+
+    while (i < len) {
+        i += copy_ascii(dst + i, src + i, len - i);
+        if (i >= len) break;
+
+        size_t n = utf8_seq_len(src + i, len - i);
+        if (n == 0) {
+            valid = 0;
+            n = 1;
+        }
+        memcpy(dst + i, src + i, n);
+        i += n;
+    }
+    return valid;
+}
+
+/* ------------------------------------------------------------------ */
+/*  UTF-16BE -> UTF-8                                                  */
+/* ------------------------------------------------------------------ */
+
+static size_t put_utf8(uint8_t *dst, uint32_t cp)
+{
+    if (cp < 0x80) {
+        dst[0] = (uint8_t)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        dst[0] = (uint8_t)(0xC0 | (cp >> 6));
+        dst[1] = (uint8_t)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        dst[0] = (uint8_t)(0xE0 | (cp >> 12));
+        dst[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        dst[2] = (uint8_t)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    dst[0] = (uint8_t)(0xF0 | (cp >> 18));
+    dst[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+    dst[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+    dst[3] = (uint8_t)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+#define REPLACEMENT_CHAR 0xFFFDu
+
+size_t mp4_text_utf16be_to_utf8(uint8_t *dst, const uint8_t *src, size_t len,
+                                int *valid)
+{
+    size_t i = 0, o = 0;
+
+    if (len >= 2 && src[0] == 0xFE && src[1] == 0xFF)
+        i = 2;
+
+    while (i + 2 <= len) {
+        size_t n = narrow_ascii_utf16be(dst + o, src + i, len - i);
+        i += 2 * n;
+        o += n;
+        if (i + 2 > len) break;
+
+        uint32_t u = (uint32_t)src[i] << 8 | src[i + 1];
+        i += 2;
+
+        if (u >= 0xD800 && u <= 0xDBFF && i + 2 <= len) {
+            uint32_t lo = (uint32_t)src[i] << 8 | src[i + 1];
+            if (lo >= 0xDC00 && lo <= 0xDFFF) {
+                i += 2;
+                o += put_utf8(dst + o,
+                              0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00));
+                continue;
+            }
+        }
+        if (u >= 0xD800 && u <= 0xDFFF) {
+            u = REPLACEMENT_CHAR;           /* Unpaired surrogate */
+            *valid = 0;
+        }
+        o += put_utf8(dst + o, u);
+    }
+
+    if (i < len) {
+        o += put_utf8(dst + o, REPLACEMENT_CHAR);   /* Odd trailing byte */
+        *valid = 0;
+    }
+    return o;
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#ifndef MP4_TEXT_H
+#define MP4_TEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Text decoding for ilst data boxes. Both routines copy straight out of
+ * the read buffer and check the text in the same pass; ASCII runs are
+ * handled 16 bytes at a time with SSE2 or NEON where available.
+ */
+
+/* Largest UTF-8 output of mp4_text_utf16be_to_utf8 for `len` input bytes */
+#define MP4_TEXT_UTF16_MAX_UTF8(len)  ((((len) + 1) / 2) * 3)
+
+/*
+ * Copy `len` bytes of UTF-8 from `src` to `dst` verbatim. Returns 1 if
+ * the text is well-formed UTF-8 (no overlong forms, surrogates or code
+ * points past U+10FFFF), 0 otherwise.
+ */
+int mp4_text_copy_utf8(uint8_t *dst, const uint8_t *src, size_t len);
+
+/*
+ * Transcode `len` bytes of UTF-16BE to UTF-8. A leading byte order mark
+ * is dropped. Unpaired surrogates and a trailing odd byte become U+FFFD
+ * and clear `*valid` (which is otherwise left alone). `dst` must hold
+ * MP4_TEXT_UTF16_MAX_UTF8(len) bytes. Returns the bytes written; no NUL
+ * terminator is added.
+ */
+size_t mp4_text_utf16be_to_utf8(uint8_t *dst, const uint8_t *src, size_t len,
+                                int *valid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MP4_TEXT_H */
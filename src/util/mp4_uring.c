@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#include "mp4_uring.h"
+#include "../../include/mp4tag/mp4tag_error.h"
+
+#include <stdlib.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define MP4_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef MP4_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+struct mp4_uring {
+    int                  fd;
+    unsigned             pending;       /* Queued, not yet submitted */
+
+    void                *sq_ring;
+    size_t               sq_ring_size;
+    void                *cq_ring;       /* == sq_ring with a single mmap */
+    size_t               cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t               sqes_size;
+
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete,
+                     unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+void mp4_uring_destroy(mp4_uring_t *ring)
+{
+    if (!ring) return;
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    free(ring);
+}
+
+int mp4_uring_create(unsigned entries, mp4_uring_t **out)
+{
+    if (!out || entries == 0) return MP4TAG_ERR_INVALID_ARG;
+    *out = NULL;
+
+    mp4_uring_t *ring = calloc(1, sizeof(*ring));
+    if (!ring) return MP4TAG_ERR_NO_MEMORY;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = sys_setup(entries, &p);
+    if (ring->fd < 0) {
+        /* ENOSYS, or blocked by seccomp / sysctl */
+        free(ring);
+        return MP4TAG_ERR_UNSUPPORTED;
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_ring_size > ring->sq_ring_size)
+        ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto fail;
+    }
+    if (single) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    uint8_t *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head    = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail    = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask    = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+    ring->sq_array   = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head    = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail    = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask    = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes       = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    *out = ring;
+    return MP4TAG_OK;
+
+fail:
+    mp4_uring_destroy(ring);
+    return MP4TAG_ERR_UNSUPPORTED;
+}
+
+int mp4_uring_queue_read(mp4_uring_t *ring, int fd, void *buf, size_t len,
+                         int64_t offset, uint64_t tag)
+{
+    if (!ring || !buf || len > UINT32_MAX) return MP4TAG_ERR_INVALID_ARG;
+
+    unsigned tail = *ring->sq_tail;         /* Only we move the tail */
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= *ring->sq_entries) return MP4TAG_ERR_NO_SPACE;
+
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)buf;
+    sqe->len       = (uint32_t)len;
+    sqe->off       = (uint64_t)offset;
+    sqe->user_data = tag;
+
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    return MP4TAG_OK;
+}
+
+int mp4_uring_submit(mp4_uring_t *ring)
+{
+    if (!ring) return MP4TAG_ERR_INVALID_ARG;
+    while (ring->pending > 0) {
+        int n = sys_enter(ring->fd, ring->pending, 0, 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return MP4TAG_ERR_IO;
+        }
+        ring->pending -= (unsigned)n;
+    }
+    return MP4TAG_OK;
+}
+
+int mp4_uring_wait(mp4_uring_t *ring, uint64_t *tag, int *res)
+{
+    if (!ring || !tag || !res) return MP4TAG_ERR_INVALID_ARG;
+
+    for (;;) {
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            *tag = cqe->user_data;
+            *res = cqe->res;
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return MP4TAG_OK;
+        }
+
+        int n = sys_enter(ring->fd, ring->pending, 1, IORING_ENTER_GETEVENTS);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return MP4TAG_ERR_IO;
+        }
+        ring->pending -= (unsigned)n;
+    }
+}
+
+#else /* !MP4_HAVE_IO_URING */
+
+int mp4_uring_create(unsigned entries, mp4_uring_t **out)
+{
+    (void)entries;
+    if (out) *out = NULL;
+    return MP4TAG_ERR_UNSUPPORTED;
+}
+
+void mp4_uring_destroy(mp4_uring_t *ring)
+{
+    (void)ring;
+}
+
+int mp4_uring_queue_read(mp4_uring_t *ring, int fd, void *buf, size_t len,
+                         int64_t offset, uint64_t tag)
+{
+    (void)ring; (void)fd; (void)buf; (void)len; (void)offset; (void)tag;
+    return MP4TAG_ERR_UNSUPPORTED;
+}
+
+int mp4_uring_submit(mp4_uring_t *ring)
+{
+    (void)ring;
+    return MP4TAG_ERR_UNSUPPORTED;
+}
+
+int mp4_uring_wait(mp4_uring_t *ring, uint64_t *tag, int *res)
+{
+    (void)ring; (void)tag; (void)res;
+    return MP4TAG_ERR_UNSUPPORTED;
+}
+
+#endif /* MP4_HAVE_IO_URING */
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Morgan Prior */
+
+#ifndef MP4_URING_H
+#define MP4_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Minimal io_uring wrapper for positioned reads, talking to the kernel
+ * through the raw syscalls (no liburing). On platforms or kernels
+ * without io_uring, mp4_uring_create returns MP4TAG_ERR_UNSUPPORTED and
+ * callers keep to blocking reads.
+ *
+ * One thread per ring: submission and completion are not locked.
+ */
+typedef struct mp4_uring mp4_uring_t;
+
+/* A ring with room for `entries` reads in flight. */
+int  mp4_uring_create(unsigned entries, mp4_uring_t **out);
+void mp4_uring_destroy(mp4_uring_t *ring);
+
+/*
+ * Queue a read of `len` bytes at `offset` into `buf`, identified by
+ * `tag` in its completion. Returns MP4TAG_ERR_NO_SPACE if the submission
+ * queue is full; nothing reaches the kernel until mp4_uring_submit or
+ * mp4_uring_wait.
+ */
+int mp4_uring_queue_read(mp4_uring_t *ring, int fd, void *buf, size_t len,
+                         int64_t offset, uint64_t tag);
+
+/* Hand every queued read to the kernel. */
+int mp4_uring_submit(mp4_uring_t *ring);
+
+/*
+ * Submit anything queued, then wait for one completion. `*res` is the
+ * byte count read or a negated errno.
+ */
+int mp4_uring_wait(mp4_uring_t *ring, uint64_t *tag, int *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MP4_URING_H */
@@ -9,9 +9,13 @@
  */
 
 #include <mp4tag/mp4tag.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 static int g_pass = 0;
 static int g_fail = 0;
@@ -46,6 +50,28 @@ static void write_bytes(FILE *f, const void *data, size_t n)
     fwrite(data, 1, n, f);
 }
 
+static void copy_file(const char *src_path, const char *dst_path)
+{
+    FILE *src = fopen(src_path, "rb");
+    FILE *dst = fopen(dst_path, "wb");
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), src)) > 0)
+        fwrite(buf, 1, n, dst);
+    fclose(src);
+    fclose(dst);
+}
+
+static long file_length(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
 /* ------------------------------------------------------------------ */
 /*  Minimal MP4 file generator                                         */
 /* ------------------------------------------------------------------ */
@@ -338,6 +364,213 @@ static void create_mp4_with_int_tags(const char *path)
     fclose(f);
 }
 
+/*
+ * An ilst item for write_mp4_with_items: a 4-byte atom type plus a
+ * single data box payload.
+ */
+typedef struct {
+    uint8_t        type[4];
+    uint32_t       data_type;
+    const uint8_t *data;
+    uint32_t       size;
+} test_item_t;
+
+static void write_test_mdat(FILE *f)
+{
+    write_be32(f, 16);
+    write_fourcc(f, "mdat");
+    write_be32(f, 0xDEADBEEF);
+    write_be32(f, 0xCAFEF00D);
+}
+
+/*
+ * Create an MP4 whose ilst holds the given items, followed by a free box
+ * of `free_size` bytes inside meta (0 for none). Layout:
+ *   ftyp, moov { mvhd, [trak], [free], udta { meta { hdlr, ilst, [free] } } },
+ *   mdat
+ * With `with_track`, a trak/mdia/minf/stbl/stco chain points two chunks
+ * at the mdat payload; `moov_free_size` adds a free box between the moov
+ * children; `mdat_first` puts mdat ahead of moov.
+ */
+static void write_mp4_layout(const char *path, const test_item_t *items,
+                             size_t count, uint32_t free_size,
+                             int with_track, uint32_t moov_free_size,
+                             int mdat_first)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return;
+
+    write_be32(f, 20);
+    write_fourcc(f, "ftyp");
+    write_fourcc(f, "M4A ");
+    write_be32(f, 0);
+    write_fourcc(f, "isom");
+
+    uint32_t ilst_size = 8;
+    for (size_t i = 0; i < count; i++)
+        ilst_size += 8 + 16 + items[i].size;
+
+    uint32_t hdlr_size = 33;
+    uint32_t meta_size = 8 + 4 + hdlr_size + ilst_size + free_size;
+    uint32_t udta_size = 8 + meta_size;
+    uint32_t mvhd_size = 108;
+    uint32_t trak_size = with_track ? 56 : 0;
+    uint32_t moov_size = 8 + mvhd_size + trak_size + moov_free_size + udta_size;
+    uint32_t mdat_offset = mdat_first ? 20 : 20 + moov_size;
+
+    if (mdat_first)
+        write_test_mdat(f);
+
+    write_be32(f, moov_size);
+    write_fourcc(f, "moov");
+
+    write_be32(f, mvhd_size);
+    write_fourcc(f, "mvhd");
+    uint8_t mvhd_data[100];
+    memset(mvhd_data, 0, sizeof(mvhd_data));
+    mvhd_data[14] = 0x03; mvhd_data[15] = 0xE8;
+    mvhd_data[99] = 1;
+    write_bytes(f, mvhd_data, sizeof(mvhd_data));
+
+    if (with_track) {
+        write_be32(f, 56); write_fourcc(f, "trak");
+        write_be32(f, 48); write_fourcc(f, "mdia");
+        write_be32(f, 40); write_fourcc(f, "minf");
+        write_be32(f, 32); write_fourcc(f, "stbl");
+        write_be32(f, 24); write_fourcc(f, "stco");
+        write_be32(f, 0);
+        write_be32(f, 2);
+        write_be32(f, mdat_offset + 8);
+        write_be32(f, mdat_offset + 12);
+    }
+
+    if (moov_free_size >= 8) {
+        write_be32(f, moov_free_size);
+        write_fourcc(f, "free");
+        for (uint32_t i = 8; i < moov_free_size; i++)
+            fputc(0, f);
+    }
+
+    write_be32(f, udta_size);
+    write_fourcc(f, "udta");
+    write_be32(f, meta_size);
+    write_fourcc(f, "meta");
+    write_be32(f, 0);
+
+    write_be32(f, hdlr_size);
+    write_fourcc(f, "hdlr");
+    write_be32(f, 0); write_be32(f, 0);
+    write_fourcc(f, "mdir"); write_fourcc(f, "appl");
+    write_be32(f, 0); write_be32(f, 0);
+    { uint8_t z = 0; write_bytes(f, &z, 1); }
+
+    write_be32(f, ilst_size);
+    write_fourcc(f, "ilst");
+    for (size_t i = 0; i < count; i++) {
+        write_be32(f, 8 + 16 + items[i].size);
+        write_bytes(f, items[i].type, 4);
+        write_be32(f, 16 + items[i].size);
+        write_fourcc(f, "data");
+        write_be32(f, items[i].data_type);
+        write_be32(f, 0);
+        write_bytes(f, items[i].data, items[i].size);
+    }
+
+    if (free_size >= 8) {
+        write_be32(f, free_size);
+        write_fourcc(f, "free");
+        for (uint32_t i = 8; i < free_size; i++)
+            fputc(0, f);
+    }
+
+    if (!mdat_first)
+        write_test_mdat(f);
+
+    fclose(f);
+}
+
+static void write_mp4_with_items(const char *path, const test_item_t *items,
+                                 size_t count, uint32_t free_size)
+{
+    write_mp4_layout(path, items, count, free_size, 0, 0, 0);
+}
+
+/*
+ * Walk the top-level boxes of a file. Returns how many boxes of `type`
+ * were found and the offset/size of the last one.
+ */
+static int find_top_level(const char *path, const char *type,
+                          long *offset, long *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+
+    int found = 0;
+    long pos = 0;
+    uint8_t hdr[8];
+    while (fseek(f, pos, SEEK_SET) == 0 && fread(hdr, 1, 8, f) == 8) {
+        long box_size = (long)(((uint32_t)hdr[0] << 24) | ((uint32_t)hdr[1] << 16) |
+                               ((uint32_t)hdr[2] << 8)  |  (uint32_t)hdr[3]);
+        if (box_size < 8) break;
+        if (memcmp(hdr + 4, type, 4) == 0) {
+            found++;
+            if (offset) *offset = pos;
+            if (size)   *size   = box_size;
+        }
+        pos += box_size;
+    }
+    fclose(f);
+    return found;
+}
+
+/* Load a whole file into a malloc'd buffer (NULL on failure). */
+static uint8_t *read_whole_file(const char *path, size_t *len)
+{
+    long size = file_length(path);
+    FILE *f = fopen(path, "rb");
+    if (!f || size <= 0) { if (f) fclose(f); return NULL; }
+    uint8_t *data = malloc((size_t)size);
+    *len = data ? fread(data, 1, (size_t)size, f) : 0;
+    fclose(f);
+    return data;
+}
+
+/*
+ * Read the entries of the first stco/co64 table in a file. Returns the
+ * entry count (at most `max`), or -1 if there is none. `*is64` is set
+ * for co64.
+ */
+static int read_chunk_offsets(const char *path, uint64_t *out, int max, int *is64)
+{
+    size_t n = 0;
+    uint8_t *data = read_whole_file(path, &n);
+    if (!data) return -1;
+
+    int result = -1;
+    for (size_t i = 4; i + 12 <= n; i++) {
+        int stco = memcmp(data + i, "stco", 4) == 0;
+        if (!stco && memcmp(data + i, "co64", 4) != 0) continue;
+
+        const uint8_t *p = data + i + 8;
+        uint32_t count = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                         ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+        size_t width = stco ? 4 : 8;
+        p += 4;
+        result = 0;
+        for (uint32_t k = 0; k < count && result < max; k++) {
+            if ((size_t)(p - data) + width > n) break;
+            uint64_t v = 0;
+            for (size_t b = 0; b < width; b++) v = (v << 8) | p[b];
+            out[result++] = v;
+            p += width;
+        }
+        if (is64) *is64 = !stco;
+        break;
+    }
+    free(data);
+    return result;
+}
+
 /* ------------------------------------------------------------------ */
 /*  Test suites                                                        */
 /* ------------------------------------------------------------------ */
@@ -758,6 +991,2587 @@ static void test_reopen_after_write(const char *path)
     remove(work_path);
 }
 
+static void test_moov_read_limit(const char *path)
+{
+    printf("\n--- Buffered vs box-by-box moov parse ---\n");
+
+    size_t limits[2] = { MP4TAG_DEFAULT_MOOV_READ_LIMIT, 0 };
+    for (int i = 0; i < 2; i++) {
+        mp4tag_context_t *ctx = mp4tag_create(NULL);
+        int rc = mp4tag_set_moov_read_limit(ctx, limits[i]);
+        CHECK_RC(rc, "set_moov_read_limit");
+
+        rc = mp4tag_open(ctx, path);
+        CHECK_RC(rc, limits[i] ? "open with buffered moov" : "open unbuffered");
+
+        char buf[256];
+        rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+        CHECK(rc == MP4TAG_OK && strcmp(buf, "Test Title") == 0,
+              "TITLE matches");
+        rc = mp4tag_read_tag_string(ctx, "ARTIST", buf, sizeof(buf));
+        CHECK(rc == MP4TAG_OK && strcmp(buf, "Test Artist") == 0,
+              "ARTIST matches");
+
+        mp4tag_destroy(ctx);
+    }
+
+    /* A limit smaller than moov falls back to the box-by-box walk */
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_set_moov_read_limit(ctx, 64);
+    int rc = mp4tag_open(ctx, path);
+    CHECK_RC(rc, "open with limit below moov size");
+    char buf[256];
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Test Title") == 0,
+          "TITLE matches via fallback");
+    mp4tag_destroy(ctx);
+}
+
+static void test_open_memory_and_mapped(const char *path)
+{
+    printf("\n--- Memory and mapped open modes ---\n");
+
+    /* Load the file into a caller-owned buffer */
+    FILE *f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    long fsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc((size_t)fsize);
+    size_t got = fread(data, 1, (size_t)fsize, f);
+    fclose(f);
+    CHECK(got == (size_t)fsize, "loaded file into memory");
+
+    char buf[256];
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    int rc = mp4tag_open_memory(ctx, data, (size_t)fsize);
+    CHECK_RC(rc, "open_memory");
+    CHECK(mp4tag_is_open(ctx) == 1, "memory context is open");
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Test Title") == 0,
+          "TITLE from memory");
+    rc = mp4tag_set_tag_string(ctx, "TITLE", "Nope");
+    CHECK(rc == MP4TAG_ERR_READ_ONLY, "memory mode is read-only");
+    mp4tag_close(ctx);
+
+    rc = mp4tag_open_memory(ctx, "not an mp4 file", 15);
+    CHECK(rc == MP4TAG_ERR_NOT_MP4, "open_memory on garbage returns NOT_MP4");
+
+    /* Truncated buffer: moov cut short */
+    rc = mp4tag_open_memory(ctx, data, 100);
+    CHECK(rc != MP4TAG_OK, "open_memory on truncated buffer fails");
+
+    rc = mp4tag_open_mapped(ctx, path);
+    CHECK_RC(rc, "open_mapped");
+    rc = mp4tag_read_tag_string(ctx, "ARTIST", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Test Artist") == 0,
+          "ARTIST from mapping");
+    rc = mp4tag_open_mapped(ctx, path);
+    CHECK(rc == MP4TAG_ERR_ALREADY_OPEN, "open_mapped twice returns ALREADY_OPEN");
+    mp4tag_destroy(ctx);
+
+    free(data);
+}
+
+static int lazy_cover_ok(const char *path, size_t moov_limit,
+                         const uint8_t *image, size_t size)
+{
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_set_moov_read_limit(ctx, moov_limit);
+    mp4tag_collection_t *coll = NULL;
+    const mp4tag_simple_tag_t *covr = NULL;
+    if (mp4tag_open(ctx, path) == MP4TAG_OK &&
+        mp4tag_read_tags(ctx, &coll) == MP4TAG_OK) {
+        for (const mp4tag_simple_tag_t *st = coll->tags->simple_tags; st; st = st->next)
+            if (strcmp(st->name, "COVER_ART") == 0) covr = st;
+    }
+    int ok = covr && covr->binary && covr->binary_size == size &&
+             memcmp(covr->binary, image, size) == 0;
+    mp4tag_destroy(ctx);
+    return ok;
+}
+
+static void test_lazy_binary(void)
+{
+    printf("\n--- Lazy binary (cover art) ---\n");
+
+    const char *path = "/tmp/test_mp4tag_lazy.m4a";
+    static uint8_t image[4096];
+    image[0] = 0xFF; image[1] = 0xD8;   /* JPEG SOI */
+    for (size_t i = 2; i < sizeof(image); i++)
+        image[i] = (uint8_t)(i * 7);
+
+    test_item_t items[2] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Cover Song", 10 },
+        { { 'c', 'o', 'v', 'r' }, 13, image, (uint32_t)sizeof(image) },
+    };
+    write_mp4_with_items(path, items, 2, 64);
+
+    /* Read eagerly from the file handle, the cover lands in the arena */
+    CHECK(lazy_cover_ok(path, 0, image, sizeof(image)),
+          "unbuffered parse reads the cover whole");
+
+    size_t limits[2] = { MP4TAG_DEFAULT_MOOV_READ_LIMIT, 0 };
+    for (int i = 0; i < 2; i++) {
+        mp4tag_context_t *ctx = mp4tag_create(NULL);
+        mp4tag_set_moov_read_limit(ctx, limits[i]);
+        mp4tag_set_lazy_binary(ctx, 1);
+        int rc = mp4tag_open(ctx, path);
+        CHECK_RC(rc, "open for lazy read");
+
+        mp4tag_collection_t *coll = NULL;
+        rc = mp4tag_read_tags(ctx, &coll);
+        CHECK_RC(rc, "read_tags in lazy mode");
+
+        const mp4tag_simple_tag_t *covr = NULL;
+        for (const mp4tag_simple_tag_t *st = coll->tags->simple_tags; st; st = st->next)
+            if (strcmp(st->name, "COVER_ART") == 0) covr = st;
+        CHECK(covr != NULL, "COVER_ART present");
+        CHECK(covr && covr->binary == NULL, "cover bytes not loaded");
+        CHECK(covr && covr->binary_size == sizeof(image), "cover size recorded");
+
+        uint8_t part[100];
+        rc = mp4tag_read_binary(ctx, covr, 1000, part, sizeof(part));
+        CHECK(rc == MP4TAG_OK && memcmp(part, image + 1000, sizeof(part)) == 0,
+              "read_binary streams the requested range");
+        rc = mp4tag_read_binary(ctx, covr, sizeof(image) - 10, part, 20);
+        CHECK(rc == MP4TAG_ERR_INVALID_ARG, "read_binary past the end is rejected");
+
+        const uint8_t *view = NULL;
+        rc = mp4tag_binary_view(ctx, covr, &view);
+        CHECK(rc == MP4TAG_ERR_UNSUPPORTED, "binary_view needs a mapping");
+        mp4tag_destroy(ctx);
+    }
+
+    /* Mapped mode hands back a pointer into the mapping */
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_set_lazy_binary(ctx, 1);
+    int rc = mp4tag_open_mapped(ctx, path);
+    CHECK_RC(rc, "open_mapped lazy");
+    mp4tag_collection_t *coll = NULL;
+    mp4tag_read_tags(ctx, &coll);
+    const mp4tag_simple_tag_t *covr = coll->tags->simple_tags->next;
+    const uint8_t *view = NULL;
+    rc = mp4tag_binary_view(ctx, covr, &view);
+    CHECK(rc == MP4TAG_OK && view && memcmp(view, image, sizeof(image)) == 0,
+          "binary_view points at the cover bytes");
+    mp4tag_destroy(ctx);
+
+    /* Editing another tag in lazy mode keeps the cover art */
+    ctx = mp4tag_create(NULL);
+    mp4tag_set_lazy_binary(ctx, 1);
+    mp4tag_open_rw(ctx, path);
+    rc = mp4tag_set_tag_string(ctx, "TITLE", "Retitled");
+    CHECK_RC(rc, "set TITLE with lazy cover");
+    mp4tag_destroy(ctx);
+
+    ctx = mp4tag_create(NULL);
+    mp4tag_open(ctx, path);
+    mp4tag_read_tags(ctx, &coll);
+    covr = NULL;
+    for (const mp4tag_simple_tag_t *st = coll->tags->simple_tags; st; st = st->next)
+        if (strcmp(st->name, "COVER_ART") == 0) covr = st;
+    CHECK(covr && covr->binary && covr->binary_size == sizeof(image) &&
+          memcmp(covr->binary, image, sizeof(image)) == 0,
+          "cover art preserved after lazy edit");
+    mp4tag_destroy(ctx);
+
+    /* Writing back the lazily read collection itself keeps the cover */
+    const char *copy = "/tmp/test_mp4tag_lazy_copy.m4a";
+    ctx = mp4tag_create(NULL);
+    mp4tag_set_lazy_binary(ctx, 1);
+    mp4tag_open_rw(ctx, path);
+    mp4tag_read_tags(ctx, &coll);
+    mp4tag_write_plan_t plan;
+    CHECK(mp4tag_plan_write(ctx, coll, &plan) == MP4TAG_OK &&
+          plan.strategy != MP4TAG_STRATEGY_REWRITE, "plan counts the lazy cover");
+    CHECK_RC(mp4tag_write_tags(ctx, coll), "write back the lazy collection");
+    CHECK(lazy_cover_ok(path, MP4TAG_DEFAULT_MOOV_READ_LIMIT, image, sizeof(image)),
+          "cover kept by an in-place write");
+
+    mp4tag_read_tags(ctx, &coll);
+    char comment[2048];
+    memset(comment, 'c', sizeof(comment) - 1);
+    comment[sizeof(comment) - 1] = '\0';
+    mp4tag_tag_add_simple(ctx, coll->tags, "COMMENT", comment);
+    CHECK_RC(mp4tag_write_tags(ctx, coll), "grow the lazy collection");
+    CHECK(lazy_cover_ok(path, MP4TAG_DEFAULT_MOOV_READ_LIMIT, image, sizeof(image)),
+          "cover kept when moov moves");
+
+    mp4tag_read_tags(ctx, &coll);
+    FILE *out = fopen(copy, "wb");
+    mp4tag_sink_t sink = { out ? fileno(out) : -1, NULL, NULL };
+    CHECK_RC(mp4tag_write_tags_to(ctx, coll, &sink), "stream the lazy collection");
+    if (out) fclose(out);
+    CHECK(lazy_cover_ok(copy, MP4TAG_DEFAULT_MOOV_READ_LIMIT, image, sizeof(image)),
+          "streamed copy carries the cover");
+    mp4tag_destroy(ctx);
+    remove(copy);
+
+    remove(path);
+}
+
+static void test_padding_policy(const char *path)
+{
+    printf("\n--- Padding policy on rewrite ---\n");
+
+    const char *work_path = "/tmp/test_mp4tag_padding.mp4";
+    copy_file(path, work_path);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    int rc = mp4tag_set_padding(ctx, (mp4tag_padding_mode_t)42, 0);
+    CHECK(rc == MP4TAG_ERR_INVALID_ARG, "unknown padding mode rejected");
+    rc = mp4tag_set_padding(ctx, MP4TAG_PADDING_FIXED, 1024);
+    CHECK_RC(rc, "set_padding FIXED 1024");
+
+    mp4tag_open_rw(ctx, work_path);
+    long before = file_length(work_path);
+    rc = mp4tag_set_tag_string(ctx, "TITLE", "Short");
+    CHECK_RC(rc, "rewrite with padding");
+    long after_rewrite = file_length(work_path);
+    CHECK(after_rewrite >= before + 1024, "rewrite reserved the padding");
+
+    /* Growing the tags now fits in the reserved free box */
+    rc = mp4tag_set_tag_string(ctx, "ARTIST", "An artist name that grows the ilst");
+    CHECK_RC(rc, "grow tags after padded rewrite");
+    CHECK(file_length(work_path) == after_rewrite, "growth stayed in place");
+
+    char buf[256];
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Short") == 0, "TITLE intact");
+    mp4tag_destroy(ctx);
+
+    /* Round-up mode: ilst + padding lands on the granularity */
+    copy_file(path, work_path);
+    ctx = mp4tag_create(NULL);
+    mp4tag_set_padding(ctx, MP4TAG_PADDING_ROUND_UP, 4096);
+    mp4tag_open_rw(ctx, work_path);
+    rc = mp4tag_set_tag_string(ctx, "TITLE", "Rounded");
+    CHECK_RC(rc, "rewrite with round-up padding");
+    CHECK(file_length(work_path) >= before + 4000, "round-up padding reserved");
+    mp4tag_destroy(ctx);
+
+    remove(work_path);
+}
+
+static void test_rewrite_preserves_media(void)
+{
+    printf("\n--- Rewrite preserves media boxes ---\n");
+
+    const char *path = "/tmp/test_mp4tag_media.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Media", 5 },
+    };
+    write_mp4_with_items(path, items, 1, 0);
+
+    /* Append a large mdat and a trailing free box */
+    const uint32_t payload = 300000;
+    FILE *f = fopen(path, "ab");
+    write_be32(f, 8 + payload);
+    write_fourcc(f, "mdat");
+    for (uint32_t i = 0; i < payload; i++)
+        fputc((int)((i * 31) & 0xFF), f);
+    write_be32(f, 16);
+    write_fourcc(f, "free");
+    write_be32(f, 0); write_be32(f, 0);
+    fclose(f);
+    long before = file_length(path);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, path);
+    mp4tag_set_write_flags(ctx, 0);
+    int rc = mp4tag_set_tag_string(ctx, "COMMENT",
+                                   "A comment long enough to force a rewrite");
+    CHECK_RC(rc, "rewrite with large mdat");
+    mp4tag_destroy(ctx);
+
+    long after = file_length(path);
+    CHECK(after > before, "file grew by the new tag");
+
+    /* The last 8 + payload + 16 bytes are the appended boxes, unchanged */
+    f = fopen(path, "rb");
+    fseek(f, after - (long)(8 + payload + 16) + 8, SEEK_SET);
+    int same = 1;
+    for (uint32_t i = 0; i < payload; i++) {
+        if (fgetc(f) != (int)((i * 31) & 0xFF)) { same = 0; break; }
+    }
+    fclose(f);
+    CHECK(same, "mdat payload copied intact");
+
+    ctx = mp4tag_create(NULL);
+    mp4tag_open(ctx, path);
+    char buf[256];
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Media") == 0, "TITLE survives rewrite");
+    mp4tag_destroy(ctx);
+
+    remove(path);
+}
+
+static void test_relocate_moov(void)
+{
+    printf("\n--- Relocate moov to end ---\n");
+
+    const char *path = "/tmp/test_mp4tag_reloc.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Reloc", 5 },
+    };
+    write_mp4_with_items(path, items, 1, 0);
+
+    long before = file_length(path);
+    long old_moov = 0, old_moov_size = 0, mdat_before = 0;
+    find_top_level(path, "moov", &old_moov, &old_moov_size);
+    find_top_level(path, "mdat", &mdat_before, NULL);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    CHECK(mp4tag_set_write_flags(ctx, 0x80) == MP4TAG_ERR_INVALID_ARG,
+          "unknown write flag rejected");
+    mp4tag_open_rw(ctx, path);
+    int rc = mp4tag_set_tag_string(ctx, "COMMENT",
+                                   "A comment long enough to outgrow moov");
+    CHECK_RC(rc, "grow tags with relocation");
+
+    long moov = 0, moov_size = 0, mdat = 0, free_off = 0, free_size = 0;
+    CHECK(find_top_level(path, "moov", &moov, &moov_size) == 1,
+          "exactly one moov after relocation");
+    find_top_level(path, "mdat", &mdat, NULL);
+    find_top_level(path, "free", &free_off, &free_size);
+    CHECK(mdat == mdat_before, "mdat did not move");
+    CHECK(moov > mdat, "moov appended after mdat");
+    CHECK(free_off == old_moov && free_size == old_moov_size,
+          "old moov became a free box of the same size");
+    CHECK(file_length(path) == before + moov_size,
+          "file grew by the new moov only");
+
+    {
+        FILE *f = fopen(path, "rb");
+        uint8_t payload[8] = { 0 };
+        fseek(f, mdat + 8, SEEK_SET);
+        size_t n = fread(payload, 1, 8, f);
+        fclose(f);
+        CHECK(n == 8 && payload[0] == 0xDE && payload[7] == 0x0D,
+              "mdat payload untouched");
+    }
+
+    /* moov is now last: growing again rewrites it where it is */
+    rc = mp4tag_set_tag_string(ctx, "ARTIST",
+                               "An artist name that grows moov once more");
+    CHECK_RC(rc, "grow trailing moov");
+    long moov2 = 0, moov2_size = 0;
+    find_top_level(path, "moov", &moov2, &moov2_size);
+    CHECK(moov2 == moov && moov2_size > moov_size, "trailing moov grew in place");
+    CHECK(file_length(path) == moov2 + moov2_size, "no stale data after moov");
+    mp4tag_destroy(ctx);
+
+    ctx = mp4tag_create(NULL);
+    mp4tag_open(ctx, path);
+    char buf[256];
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Reloc") == 0, "TITLE survives relocation");
+    rc = mp4tag_read_tag_string(ctx, "COMMENT", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "A comment long enough to outgrow moov") == 0,
+          "COMMENT readable from relocated moov");
+    mp4tag_destroy(ctx);
+
+    /* Opting out keeps moov ahead of mdat */
+    write_mp4_with_items(path, items, 1, 0);
+    ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, path);
+    mp4tag_set_write_flags(ctx, 0);
+    rc = mp4tag_set_tag_string(ctx, "COMMENT",
+                               "A comment long enough to outgrow moov");
+    CHECK_RC(rc, "grow tags without relocation");
+    mp4tag_destroy(ctx);
+
+    find_top_level(path, "moov", &moov, NULL);
+    find_top_level(path, "mdat", &mdat, NULL);
+    CHECK(moov < mdat, "moov stays before mdat when relocation is off");
+    CHECK(find_top_level(path, "free", NULL, NULL) == 0, "no free box left behind");
+
+    remove(path);
+}
+
+/* Check both chunk offsets land on the DEADBEEF/CAFEF00D payload words */
+static int chunks_hit_payload(const char *path)
+{
+    uint64_t offs[2];
+    int is64 = 0;
+    if (read_chunk_offsets(path, offs, 2, &is64) != 2) return 0;
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    uint8_t a[4] = { 0 }, b[4] = { 0 };
+    fseek(f, (long)offs[0], SEEK_SET);
+    size_t n = fread(a, 1, 4, f);
+    fseek(f, (long)offs[1], SEEK_SET);
+    n += fread(b, 1, 4, f);
+    fclose(f);
+    return n == 8 && a[0] == 0xDE && a[3] == 0xEF && b[0] == 0xCA && b[3] == 0x0D;
+}
+
+static void test_chunk_offset_relocation(void)
+{
+    printf("\n--- Chunk offset relocation ---\n");
+
+    const char *path = "/tmp/test_mp4tag_stco.m4a";
+    const char *comment = "A comment long enough to force a full rewrite";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Track", 5 },
+    };
+
+    /* moov before mdat: a rewrite that grows moov shifts the media */
+    write_mp4_layout(path, items, 1, 0, 1, 0, 0);
+    CHECK(chunks_hit_payload(path), "fixture chunk offsets valid");
+    long mdat_before = 0, mdat = 0;
+    find_top_level(path, "mdat", &mdat_before, NULL);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, path);
+    mp4tag_set_write_flags(ctx, 0);
+    int rc = mp4tag_set_tag_string(ctx, "COMMENT", comment);
+    CHECK_RC(rc, "rewrite with chunk offsets");
+    mp4tag_destroy(ctx);
+
+    find_top_level(path, "mdat", &mdat, NULL);
+    CHECK(mdat > mdat_before, "mdat shifted by the grown moov");
+    CHECK(chunks_hit_payload(path), "stco follows shifted mdat");
+
+    /* mdat before moov: faststart moves moov to the front */
+    write_mp4_layout(path, items, 1, 0, 1, 0, 1);
+    CHECK(chunks_hit_payload(path), "mdat-first fixture chunk offsets valid");
+
+    ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, path);
+    mp4tag_set_write_flags(ctx, MP4TAG_WRITE_FASTSTART);
+    rc = mp4tag_set_tag_string(ctx, "COMMENT", comment);
+    CHECK_RC(rc, "faststart rewrite");
+    mp4tag_destroy(ctx);
+
+    long moov = 0;
+    find_top_level(path, "moov", &moov, NULL);
+    find_top_level(path, "mdat", &mdat, NULL);
+    CHECK(moov < mdat, "moov placed ahead of mdat");
+    CHECK(chunks_hit_payload(path), "stco follows mdat after faststart");
+
+    ctx = mp4tag_create(NULL);
+    mp4tag_open(ctx, path);
+    char buf[256];
+    rc = mp4tag_read_tag_string(ctx, "COMMENT", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, comment) == 0, "COMMENT after faststart");
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Track") == 0, "TITLE after faststart");
+    mp4tag_destroy(ctx);
+
+    remove(path);
+}
+
+static void test_moov_reshuffle(void)
+{
+    printf("\n--- Reclaim free space inside moov ---\n");
+
+    const char *path = "/tmp/test_mp4tag_shuffle.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Shuffle", 7 },
+    };
+    /* No free after ilst, but 200 bytes of padding elsewhere in moov */
+    write_mp4_layout(path, items, 1, 0, 1, 200, 0);
+
+    long before = file_length(path);
+    long moov = 0, moov_size = 0, mdat_before = 0;
+    find_top_level(path, "moov", &moov, &moov_size);
+    find_top_level(path, "mdat", &mdat_before, NULL);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, path);
+    int rc = mp4tag_set_tag_string(ctx, "COMMENT",
+                                   "Grows past the ilst, but fits the moov padding");
+    CHECK_RC(rc, "write using moov padding");
+
+    long moov2 = 0, moov2_size = 0, mdat = 0;
+    find_top_level(path, "moov", &moov2, &moov2_size);
+    find_top_level(path, "mdat", &mdat, NULL);
+    CHECK(file_length(path) == before, "file size unchanged");
+    CHECK(moov2 == moov && moov2_size == moov_size, "moov kept its place and size");
+    CHECK(mdat == mdat_before, "mdat untouched");
+    CHECK(chunks_hit_payload(path), "chunk offsets still valid");
+
+    /* The leftover padding now sits after ilst */
+    rc = mp4tag_set_tag_string(ctx, "ARTIST", "Artist");
+    CHECK_RC(rc, "second write in place");
+    CHECK(file_length(path) == before, "still no growth");
+
+    /* More growth than the padding holds falls through to relocation */
+    char big[400];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    rc = mp4tag_set_tag_string(ctx, "DESCRIPTION", big);
+    CHECK_RC(rc, "write beyond moov padding");
+    CHECK(file_length(path) > before, "file grew once padding ran out");
+    mp4tag_destroy(ctx);
+
+    ctx = mp4tag_create(NULL);
+    mp4tag_open(ctx, path);
+    char buf[512];
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Shuffle") == 0, "TITLE survives reshuffle");
+    rc = mp4tag_read_tag_string(ctx, "ARTIST", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Artist") == 0, "ARTIST readable");
+    CHECK(chunks_hit_payload(path), "chunk offsets valid at the end");
+    mp4tag_destroy(ctx);
+
+    remove(path);
+}
+
+static void test_edit_transaction(const char *path)
+{
+    printf("\n--- Edit transactions ---\n");
+
+    const char *work_path = "/tmp/test_mp4tag_edit.mp4";
+    copy_file(path, work_path);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, work_path);
+    CHECK(mp4tag_edit_set(ctx, "TITLE", "x") == MP4TAG_ERR_NO_EDIT,
+          "edit_set without begin rejected");
+    CHECK(mp4tag_edit_commit(ctx) == MP4TAG_ERR_NO_EDIT,
+          "commit without begin rejected");
+
+    int rc = mp4tag_edit_begin(ctx);
+    CHECK_RC(rc, "edit_begin");
+    CHECK(mp4tag_edit_begin(ctx) == MP4TAG_ERR_EDIT_ACTIVE,
+          "nested edit_begin rejected");
+
+    CHECK_RC(mp4tag_edit_set(ctx, "TITLE", "Batched Title"), "stage TITLE");
+    CHECK_RC(mp4tag_edit_set(ctx, "ALBUM", "Batched Album"), "stage ALBUM");
+    CHECK_RC(mp4tag_edit_remove(ctx, "ARTIST"), "stage ARTIST removal");
+    CHECK_RC(mp4tag_set_tag_string(ctx, "GENRE", "Staged Genre"),
+             "set_tag_string stages inside an edit");
+
+    /* Nothing has reached the file yet */
+    char buf[256];
+    mp4tag_context_t *peek = mp4tag_create(NULL);
+    mp4tag_open(peek, work_path);
+    rc = mp4tag_read_tag_string(peek, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Test Title") == 0,
+          "file unchanged before commit");
+    mp4tag_destroy(peek);
+
+    rc = mp4tag_edit_commit(ctx);
+    CHECK_RC(rc, "edit_commit");
+    CHECK(mp4tag_edit_commit(ctx) == MP4TAG_ERR_NO_EDIT, "commit ends the edit");
+
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Batched Title") == 0, "TITLE committed");
+    rc = mp4tag_read_tag_string(ctx, "ALBUM", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Batched Album") == 0, "ALBUM committed");
+    rc = mp4tag_read_tag_string(ctx, "GENRE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Staged Genre") == 0, "GENRE committed");
+    rc = mp4tag_read_tag_string(ctx, "ARTIST", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_ERR_TAG_NOT_FOUND, "ARTIST removed");
+
+    /* Abort throws the staged changes away */
+    mp4tag_edit_begin(ctx);
+    mp4tag_edit_set(ctx, "TITLE", "Never Written");
+    mp4tag_edit_abort(ctx);
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Batched Title") == 0, "abort discards edits");
+
+    /* Closing with an open edit must not leak or write */
+    mp4tag_edit_begin(ctx);
+    mp4tag_edit_set(ctx, "TITLE", "Also Never Written");
+    mp4tag_destroy(ctx);
+
+    ctx = mp4tag_create(NULL);
+    mp4tag_open(ctx, work_path);
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Batched Title") == 0, "close aborts the edit");
+    mp4tag_destroy(ctx);
+
+    remove(work_path);
+}
+
+static void test_same_size_patch(void)
+{
+    printf("\n--- Same-size item patching ---\n");
+
+    const char *path = "/tmp/test_mp4tag_patch.m4a";
+    static const uint8_t trkn[8] = { 0, 0, 0, 1, 0, 10, 0, 0 };
+    test_item_t items[3] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Patch", 5 },
+        { { 't', 'r', 'k', 'n' },  0, trkn, 8 },
+        { { 0xA9, 'A', 'R', 'T' }, 1, (const uint8_t *)"Patcher", 7 },
+    };
+    write_mp4_with_items(path, items, 3, 64);
+
+    /* Mark the free box payload: a whole-ilst rewrite would zero it */
+    size_t len = 0;
+    uint8_t *before = read_whole_file(path, &len);
+    size_t free_at = 0;
+    for (size_t i = len - 16; i > 4; i--) {
+        if (memcmp(before + i, "free", 4) == 0) { free_at = i + 4; break; }
+    }
+    memset(before + free_at, 0xAA, 64 - 8);
+    FILE *f = fopen(path, "wb");
+    fwrite(before, 1, len, f);
+    fclose(f);
+
+    /* ftyp 20, moov 8, mvhd 108, udta 8, meta 12, hdlr 33, ilst 8, then items */
+    size_t trkn_at = 20 + 8 + 108 + 8 + 12 + 33 + 8 + (8 + 16 + 5);
+    size_t trkn_end = trkn_at + 8 + 16 + 8;
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, path);
+    int rc = mp4tag_set_tag_string(ctx, "TRACK_NUMBER", "3/10");
+    CHECK_RC(rc, "same-size TRACK_NUMBER change");
+
+    char buf[64];
+    rc = mp4tag_read_tag_string(ctx, "TRACK_NUMBER", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "3/10") == 0, "TRACK_NUMBER updated");
+    mp4tag_destroy(ctx);
+
+    size_t len2 = 0;
+    uint8_t *after = read_whole_file(path, &len2);
+    CHECK(len2 == len, "file size unchanged");
+
+    size_t first = len, last = 0;
+    for (size_t i = 0; i < len && i < len2; i++) {
+        if (before[i] != after[i]) {
+            if (first == len) first = i;
+            last = i;
+        }
+    }
+    CHECK(first >= trkn_at && last < trkn_end, "only the trkn item changed");
+    CHECK(after[free_at] == 0xAA && after[free_at + 55] == 0xAA,
+          "free box left untouched");
+
+    free(before);
+    free(after);
+    remove(path);
+}
+
+static void test_tag_lookup(const char *path)
+{
+    printf("\n--- Tag lookup by name and FourCC ---\n");
+
+    const char *work_path = "/tmp/test_mp4tag_lookup.mp4";
+    copy_file(path, work_path);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, work_path);
+
+    char buf[256];
+    int rc = mp4tag_read_tag_fourcc(ctx, MP4TAG_FOURCC(0xA9, 'n', 'a', 'm'),
+                                    buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Test Title") == 0, "TITLE by FourCC");
+    rc = mp4tag_read_tag_fourcc(ctx, MP4TAG_FOURCC('z', 'z', 'z', 'z'),
+                                buf, sizeof(buf));
+    CHECK(rc == MP4TAG_ERR_TAG_NOT_FOUND, "unknown FourCC not found");
+
+    /* Every mapped name survives a write/parse round trip */
+    static const struct { const char *name; const char *value; } names[] = {
+        { "TITLE", "t" },            { "ARTIST", "a" },
+        { "ALBUM", "al" },           { "ALBUM_ARTIST", "aa" },
+        { "DATE_RELEASED", "2024" }, { "TRACK_NUMBER", "3/12" },
+        { "DISC_NUMBER", "1/2" },    { "GENRE", "g" },
+        { "COMPOSER", "c" },         { "COMMENT", "cm" },
+        { "ENCODER", "e" },          { "COPYRIGHT", "cp" },
+        { "BPM", "128" },            { "LYRICS", "l" },
+        { "GROUPING", "gr" },        { "DESCRIPTION", "d" },
+        { "COMPILATION", "1" },      { "GAPLESS", "1" },
+        { "SORT_NAME", "sn" },       { "SORT_ARTIST", "sa" },
+        { "SORT_ALBUM", "sal" },     { "SORT_ALBUM_ARTIST", "saa" },
+        { "SORT_COMPOSER", "sc" },
+    };
+    size_t n = sizeof(names) / sizeof(names[0]);
+
+    mp4tag_edit_begin(ctx);
+    for (size_t i = 0; i < n; i++)
+        mp4tag_edit_set(ctx, names[i].name, names[i].value);
+    rc = mp4tag_edit_commit(ctx);
+    CHECK_RC(rc, "write every mapped tag");
+
+    int all = 1;
+    for (size_t i = 0; i < n; i++) {
+        rc = mp4tag_read_tag_string(ctx, names[i].name, buf, sizeof(buf));
+        if (rc != MP4TAG_OK || strcmp(buf, names[i].value) != 0) {
+            printf("    mismatch: %s\n", names[i].name);
+            all = 0;
+        }
+    }
+    CHECK(all, "all mapped names round-trip");
+
+    rc = mp4tag_read_tag_string(ctx, "sort_album_artist", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "saa") == 0, "lookup is case-insensitive");
+    rc = mp4tag_set_tag_string(ctx, "abcd", "raw");
+    CHECK_RC(rc, "write an unmapped FourCC");
+    CHECK(mp4tag_read_tag_string(ctx, "abcd", buf, sizeof(buf)) == MP4TAG_OK &&
+          strcmp(buf, "raw") == 0 &&
+          mp4tag_read_tag_string(ctx, "ABCD", buf, sizeof(buf)) == MP4TAG_OK &&
+          strcmp(buf, "raw") == 0, "raw FourCC names are case-insensitive too");
+    rc = mp4tag_read_tag_fourcc(ctx, MP4TAG_FOURCC('t', 'm', 'p', 'o'),
+                                buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "128") == 0, "BPM by FourCC");
+
+    mp4tag_destroy(ctx);
+    remove(work_path);
+}
+
+/* Counting allocator: every block the library takes must come back */
+typedef struct {
+    size_t allocs;
+    size_t frees;
+} alloc_stats_t;
+
+static void *counting_alloc(size_t size, void *user_data)
+{
+    ((alloc_stats_t *)user_data)->allocs++;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *user_data)
+{
+    if (!ptr) ((alloc_stats_t *)user_data)->allocs++;
+    return realloc(ptr, size);
+}
+
+static void counting_free(void *ptr, void *user_data)
+{
+    if (ptr) ((alloc_stats_t *)user_data)->frees++;
+    free(ptr);
+}
+
+static void test_arena_allocator(const char *path)
+{
+    printf("\n--- Arena collections and custom allocator ---\n");
+
+    alloc_stats_t stats = { 0, 0 };
+    mp4tag_allocator_t allocator = {
+        counting_alloc, counting_realloc, counting_free, &stats
+    };
+
+    mp4tag_context_t *ctx = mp4tag_create(&allocator);
+    size_t base = stats.allocs;
+
+    int rc = mp4tag_open(ctx, path);
+    CHECK_RC(rc, "open with custom allocator");
+    mp4tag_collection_t *tags = NULL;
+    rc = mp4tag_read_tags(ctx, &tags);
+    CHECK(rc == MP4TAG_OK && tags && tags->tags, "parse with custom allocator");
+    CHECK(stats.allocs > base, "parsed tags come from the allocator");
+    size_t after_parse = stats.allocs;
+
+    /* A second read hits the cache */
+    mp4tag_read_tags(ctx, &tags);
+    CHECK(stats.allocs == after_parse, "cached read allocates nothing");
+    size_t frees = stats.frees;
+    mp4tag_close(ctx);
+    CHECK(stats.frees == frees, "close keeps the arena for the next file");
+    mp4tag_set_retain_limit(ctx, 0);
+    CHECK(stats.frees == stats.allocs - 1, "a zero retain limit releases the parsed tags");
+
+    /* Views, the path and an unbuffered parse draw on the allocator too */
+    mp4tag_set_retain_limit(ctx, MP4TAG_DEFAULT_RETAIN_LIMIT);
+    mp4tag_set_moov_read_limit(ctx, 0);
+    base = stats.allocs;
+    const mp4tag_item_view_t *views = NULL;
+    size_t view_count = 0;
+    rc = mp4tag_open(ctx, path);
+    if (rc == MP4TAG_OK) rc = mp4tag_read_tags(ctx, &tags);
+    if (rc == MP4TAG_OK) rc = mp4tag_read_tags_view(ctx, &views, &view_count);
+    CHECK(rc == MP4TAG_OK && view_count > 0 && stats.allocs > base,
+          "unbuffered parse and views through the allocator");
+    mp4tag_close(ctx);
+    mp4tag_set_retain_limit(ctx, 0);
+    CHECK(stats.frees == stats.allocs - 1, "and released with the rest");
+    mp4tag_set_moov_read_limit(ctx, MP4TAG_DEFAULT_MOOV_READ_LIMIT);
+
+    /* Thousands of appends, far fewer blocks */
+    mp4tag_collection_t *coll = mp4tag_collection_create(ctx);
+    mp4tag_tag_t *tag = mp4tag_collection_add_tag(ctx, coll, MP4TAG_TARGET_ALBUM);
+    size_t before = stats.allocs;
+    int ok = 1;
+    for (int i = 0; i < 5000 && ok; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "NAME%d", i);
+        mp4tag_simple_tag_t *st = mp4tag_tag_add_simple(ctx, tag, name, "v");
+        ok = st && mp4tag_simple_tag_set_language(ctx, st, "eng") == MP4TAG_OK;
+    }
+    for (uint64_t uid = 1; uid <= 100 && ok; uid++)
+        ok = mp4tag_tag_add_track_uid(ctx, tag, uid) == MP4TAG_OK;
+    CHECK(ok, "5000 simple tags and 100 UIDs added");
+    CHECK(stats.allocs - before < 100, "appends are served from arena blocks");
+
+    size_t count = 0;
+    const mp4tag_simple_tag_t *last = NULL;
+    for (const mp4tag_simple_tag_t *st = tag->simple_tags; st; st = st->next) {
+        last = st;
+        count++;
+    }
+    CHECK(count == 5000 && last && strcmp(last->name, "NAME4999") == 0,
+          "appends keep their order");
+    CHECK(tag->track_uid_count == 100 && tag->track_uids[0] == 1 &&
+          tag->track_uids[99] == 100, "track UIDs kept");
+
+    mp4tag_simple_tag_t *parent = tag->simple_tags;
+    for (int i = 0; i < 5000 && ok; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "CHILD%d", i);
+        ok = mp4tag_simple_tag_add_nested(ctx, parent, name, "v") != NULL;
+    }
+    count = 0;
+    last = NULL;
+    for (const mp4tag_simple_tag_t *st = parent->nested; st; st = st->next) {
+        last = st;
+        count++;
+    }
+    CHECK(ok && count == 5000 && last && strcmp(last->name, "CHILD4999") == 0,
+          "nested appends keep their order");
+
+    mp4tag_collection_free(ctx, coll);
+    mp4tag_destroy(ctx);
+    CHECK(stats.allocs == stats.frees, "every allocation released");
+}
+
+static const mp4tag_simple_tag_t *find_simple(const mp4tag_collection_t *coll,
+                                              const char *name)
+{
+    for (const mp4tag_tag_t *t = coll->tags; t; t = t->next)
+        for (const mp4tag_simple_tag_t *st = t->simple_tags; st; st = st->next)
+            if (st->name && strcmp(st->name, name) == 0)
+                return st;
+    return NULL;
+}
+
+static void test_text_decoding(void)
+{
+    printf("\n--- UTF-16 transcoding and UTF-8 validation ---\n");
+
+    const char *path = "/tmp/test_mp4tag_text.mp4";
+
+    /* Long enough to cover the vector paths on either side of the
+     * non-ASCII characters: 40 x 'a', e-acute, U+1F600, 40 x 'b' */
+    uint8_t utf16[2 + 2 * 84];
+    size_t n = 0;
+    utf16[n++] = 0xFE; utf16[n++] = 0xFF;               /* BOM */
+    for (int i = 0; i < 40; i++) { utf16[n++] = 0; utf16[n++] = 'a'; }
+    utf16[n++] = 0x00; utf16[n++] = 0xE9;
+    utf16[n++] = 0xD8; utf16[n++] = 0x3D;
+    utf16[n++] = 0xDE; utf16[n++] = 0x00;
+    for (int i = 0; i < 40; i++) { utf16[n++] = 0; utf16[n++] = 'b'; }
+
+    char expect[128];
+    memset(expect, 'a', 40);
+    memcpy(expect + 40, "\xC3\xA9\xF0\x9F\x98\x80", 6);
+    memset(expect + 46, 'b', 40);
+    expect[86] = '\0';
+
+    static const uint8_t lone_surrogate[] = { 0, 'x', 0xDC, 0x00, 0, 'y' };
+
+    uint8_t good_utf8[64];
+    memset(good_utf8, 'c', sizeof(good_utf8));
+    memcpy(good_utf8 + 30, "\xE2\x82\xAC", 3);          /* Euro sign */
+
+    uint8_t bad_utf8[64];
+    memset(bad_utf8, 'd', sizeof(bad_utf8));
+    memcpy(bad_utf8 + 20, "\xC0\xAF", 2);                /* Overlong '/' */
+
+    test_item_t items[] = {
+        { { 0xA9, 'l', 'y', 'r' }, 2, utf16, (uint32_t)n },
+        { { 0xA9, 'n', 'a', 'm' }, 2, lone_surrogate, sizeof(lone_surrogate) },
+        { { 0xA9, 'A', 'R', 'T' }, 1, good_utf8, sizeof(good_utf8) },
+        { { 0xA9, 'c', 'm', 't' }, 1, bad_utf8, sizeof(bad_utf8) },
+    };
+    write_mp4_with_items(path, items, 4, 0);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    int rc = mp4tag_open(ctx, path);
+    CHECK_RC(rc, "open file with text atoms");
+
+    mp4tag_collection_t *tags = NULL;
+    rc = mp4tag_read_tags(ctx, &tags);
+    CHECK_RC(rc, "read text atoms");
+
+    const mp4tag_simple_tag_t *lyr = tags ? find_simple(tags, "LYRICS") : NULL;
+    CHECK(lyr && lyr->value && strcmp(lyr->value, expect) == 0,
+          "UTF-16 lyrics transcoded to UTF-8");
+    CHECK(lyr && !lyr->text_invalid && !lyr->binary, "UTF-16 lyrics valid");
+
+    const mp4tag_simple_tag_t *nam = tags ? find_simple(tags, "TITLE") : NULL;
+    CHECK(nam && nam->value && strcmp(nam->value, "x\xEF\xBF\xBDy") == 0,
+          "lone surrogate replaced with U+FFFD");
+    CHECK(nam && nam->text_invalid, "lone surrogate flagged");
+
+    const mp4tag_simple_tag_t *art = tags ? find_simple(tags, "ARTIST") : NULL;
+    CHECK(art && art->value && memcmp(art->value, good_utf8, 64) == 0 &&
+          !art->text_invalid, "valid UTF-8 copied and not flagged");
+
+    const mp4tag_simple_tag_t *cmt = tags ? find_simple(tags, "COMMENT") : NULL;
+    CHECK(cmt && cmt->value && memcmp(cmt->value, bad_utf8, 64) == 0 &&
+          cmt->text_invalid, "malformed UTF-8 kept verbatim and flagged");
+    mp4tag_close(ctx);
+
+    /* A replaced value drops the old one's flag along with it */
+    tags = NULL;
+    rc = mp4tag_open_rw(ctx, path);
+    if (rc == MP4TAG_OK) rc = mp4tag_edit_begin(ctx);
+    if (rc == MP4TAG_OK) rc = mp4tag_edit_set(ctx, "COMMENT", "Now valid");
+    if (rc == MP4TAG_OK) rc = mp4tag_edit_commit(ctx);
+    if (rc == MP4TAG_OK) rc = mp4tag_read_tags(ctx, &tags);
+    cmt = tags ? find_simple(tags, "COMMENT") : NULL;
+    CHECK(rc == MP4TAG_OK && cmt && strcmp(cmt->value, "Now valid") == 0 &&
+          !cmt->text_invalid && !cmt->language,
+          "replaced malformed value is no longer flagged");
+
+    mp4tag_destroy(ctx);
+    remove(path);
+}
+
+static void test_tags_view(const char *path)
+{
+    printf("\n--- Borrowed tag views ---\n");
+
+    /* Buffered moov, unbuffered moov, and mapped file */
+    for (int mode = 0; mode < 3; mode++) {
+        mp4tag_context_t *ctx = mp4tag_create(NULL);
+        if (mode == 1) mp4tag_set_moov_read_limit(ctx, 0);
+        int rc = mode == 2 ? mp4tag_open_mapped(ctx, path)
+                           : mp4tag_open(ctx, path);
+        CHECK_RC(rc, "open for view");
+
+        const mp4tag_item_view_t *items = NULL;
+        size_t count = 0;
+        rc = mp4tag_read_tags_view(ctx, &items, &count);
+        CHECK(rc == MP4TAG_OK && count == 2, "view lists both items");
+
+        if (rc == MP4TAG_OK && count == 2) {
+            CHECK(items[0].fourcc == MP4TAG_FOURCC(0xA9, 'n', 'a', 'm') &&
+                  items[0].name && strcmp(items[0].name, "TITLE") == 0 &&
+                  items[0].data_type == 1 && items[0].size == 10 &&
+                  memcmp(items[0].data, "Test Title", 10) == 0,
+                  "TITLE view borrows the raw value");
+            CHECK(items[1].name && strcmp(items[1].name, "ARTIST") == 0,
+                  "ARTIST view");
+
+            const mp4tag_item_view_t *again = NULL;
+            mp4tag_read_tags_view(ctx, &again, &count);
+            CHECK(again == items && again[0].data == items[0].data,
+                  "repeat view is cached");
+        }
+        mp4tag_destroy(ctx);
+    }
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    const mp4tag_item_view_t *items = NULL;
+    size_t count = 0;
+    int rc = mp4tag_read_tags_view(ctx, &items, &count);
+    CHECK(rc == MP4TAG_ERR_NOT_OPEN, "view needs an open file");
+    mp4tag_destroy(ctx);
+}
+
+#define SCAN_FILES 40
+
+typedef struct {
+    int    seen[SCAN_FILES];
+    int    ok;
+    int    failed;
+    int    titles;
+    int    stop_after;
+    size_t walked;
+    const char *const *paths;
+} scan_result_t;
+
+static int scan_collect(const char *path, size_t index, int status,
+                        mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                        void *user_data)
+{
+    scan_result_t *r = user_data;
+    if (index < SCAN_FILES && strcmp(path, r->paths[index]) == 0)
+        r->seen[index]++;
+
+    if (status == MP4TAG_OK) {
+        char title[64];
+        r->ok++;
+        if (ctx && mp4tag_read_tag_string(ctx, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+            strcmp(title, "Test Title") == 0)
+            r->titles++;
+        (void)tags;
+    } else {
+        r->failed++;
+    }
+    return r->stop_after && r->ok + r->failed >= r->stop_after;
+}
+
+static const char *scan_next(void *user_data)
+{
+    scan_result_t *r = user_data;
+    return r->walked < SCAN_FILES ? r->paths[r->walked++] : NULL;
+}
+
+static void test_scan_paths(const char *path)
+{
+    printf("\n--- Parallel batch scan ---\n");
+
+    static char names[SCAN_FILES][64];
+    const char *paths[SCAN_FILES];
+    for (int i = 0; i < SCAN_FILES; i++) {
+        snprintf(names[i], sizeof(names[i]), "/tmp/test_mp4tag_scan_%d.mp4", i);
+        /* Every fifth path does not exist */
+        if (i % 5 != 4) copy_file(path, names[i]);
+        paths[i] = names[i];
+    }
+
+    mp4tag_scan_options_t opts = { 4, 0, NULL };
+    scan_result_t r;
+    memset(&r, 0, sizeof(r));
+    r.paths = paths;
+    int rc = mp4tag_scan_paths(paths, SCAN_FILES, &opts, scan_collect, &r);
+    CHECK_RC(rc, "scan path list");
+    int once = 1;
+    for (int i = 0; i < SCAN_FILES; i++)
+        if (r.seen[i] != 1) once = 0;
+    CHECK(once, "every path reported exactly once with its index");
+    CHECK(r.ok == 32 && r.failed == 8, "per-file status reported");
+    CHECK(r.titles == 32, "callback reads through the worker context");
+
+    /* Walker source, views only, default thread count */
+    memset(&r, 0, sizeof(r));
+    r.paths = paths;
+    opts.threads = 0;
+    opts.flags   = MP4TAG_SCAN_VIEWS_ONLY | MP4TAG_SCAN_MAPPED;
+    rc = mp4tag_scan_walk(scan_next, &r, &opts, scan_collect, &r);
+    CHECK_RC(rc, "scan from walker");
+    once = 1;
+    for (int i = 0; i < SCAN_FILES; i++)
+        if (r.seen[i] != 1) once = 0;
+    CHECK(once && r.ok == 32 && r.titles == 32, "walker scan covers every path");
+
+    /* Stop early */
+    memset(&r, 0, sizeof(r));
+    r.paths = paths;
+    r.stop_after = 5;
+    rc = mp4tag_scan_paths(paths, SCAN_FILES, NULL, scan_collect, &r);
+    CHECK(rc == MP4TAG_OK && r.ok + r.failed == 5, "callback can stop the scan");
+
+    CHECK(mp4tag_scan_paths(paths, SCAN_FILES, NULL, NULL, NULL) ==
+          MP4TAG_ERR_INVALID_ARG, "scan needs a callback");
+
+    for (int i = 0; i < SCAN_FILES; i++)
+        remove(names[i]);
+}
+
+#define ASYNC_FILES 20
+
+typedef struct {
+    int status[ASYNC_FILES];
+    int titled[ASYNC_FILES];
+} async_result_t;
+
+static int async_collect(const char *path, size_t index, int status,
+                         mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                         void *user_data)
+{
+    async_result_t *r = user_data;
+    char title[64];
+    (void)path; (void)tags;
+    if (index >= ASYNC_FILES) return 1;
+    r->status[index] = status;
+    r->titled[index] = ctx &&
+        mp4tag_read_tag_string(ctx, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+        strcmp(title, "Test Title") == 0;
+    return 0;
+}
+
+/* Copy `src` with a `type` box of `pad` bytes inserted after its ftyp. */
+static void write_padded_copy(const char *src, const char *dst,
+                              const char *type, uint32_t pad)
+{
+    FILE *in = fopen(src, "rb");
+    FILE *out = fopen(dst, "wb");
+    if (!in || !out) {
+        if (in) fclose(in);
+        if (out) fclose(out);
+        return;
+    }
+    uint8_t hdr[8];
+    if (fread(hdr, 1, 8, in) == 8) {
+        uint32_t ftyp_size = ((uint32_t)hdr[0] << 24) | ((uint32_t)hdr[1] << 16) |
+                             ((uint32_t)hdr[2] << 8) | hdr[3];
+        fwrite(hdr, 1, 8, out);
+        for (uint32_t i = 8; i < ftyp_size; i++) fputc(fgetc(in), out);
+        write_be32(out, pad);
+        write_fourcc(out, type);
+        for (uint32_t i = 8; i < pad; i++) fputc(0, out);
+        int c;
+        while ((c = fgetc(in)) != EOF) fputc(c, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static void test_scan_async_io(const char *path)
+{
+    printf("\n--- Async I/O batch scan ---\n");
+
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Test Title", 10 },
+    };
+
+    static char names[ASYNC_FILES][64];
+    const char *paths[ASYNC_FILES];
+    for (int i = 0; i < ASYNC_FILES; i++) {
+        snprintf(names[i], sizeof(names[i]), "/tmp/test_mp4tag_async_%d.mp4", i);
+        paths[i] = names[i];
+        switch (i % 5) {
+        case 0: copy_file(path, names[i]); break;
+        /* moov beyond the first read: header and moov reads are chained */
+        case 1: write_padded_copy(path, names[i], "free", 200000); break;
+        case 2: write_mp4_layout(names[i], items, 1, 0, 1, 0, 1); break;
+        case 3: {
+            FILE *f = fopen(names[i], "wb");
+            if (f) { fputs("not an mp4 file at all", f); fclose(f); }
+            break;
+        }
+        default: break;     /* Missing */
+        }
+    }
+
+    async_result_t sync_r, async_r;
+    memset(&sync_r, 0, sizeof(sync_r));
+    memset(&async_r, 0, sizeof(async_r));
+
+    mp4tag_scan_options_t opts = { 2, 0, NULL, 0 };
+    int rc = mp4tag_scan_paths(paths, ASYNC_FILES, &opts, async_collect, &sync_r);
+    CHECK_RC(rc, "blocking reference scan");
+
+    opts.flags = MP4TAG_SCAN_ASYNC_IO;
+    opts.queue_depth = 3;
+    rc = mp4tag_scan_paths(paths, ASYNC_FILES, &opts, async_collect, &async_r);
+    CHECK_RC(rc, "async I/O scan");
+
+    int titled = 0;
+    for (int i = 0; i < ASYNC_FILES; i++) titled += async_r.titled[i];
+    CHECK(memcmp(&sync_r, &async_r, sizeof(sync_r)) == 0,
+          "async scan matches the blocking scan file for file");
+    CHECK(titled == 12, "async scan reads every layout");
+    CHECK(async_r.status[3] != MP4TAG_OK && async_r.status[4] != MP4TAG_OK,
+          "async scan reports bad and missing files");
+
+    for (int i = 0; i < ASYNC_FILES; i++)
+        remove(names[i]);
+}
+
+static int title_is(const char *path, const char *expect, int unbuffered)
+{
+    char title[64];
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    if (unbuffered) mp4tag_set_moov_read_limit(ctx, 0);
+    int ok = mp4tag_open(ctx, path) == MP4TAG_OK &&
+             mp4tag_read_tag_string(ctx, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+             strcmp(title, expect) == 0;
+    mp4tag_destroy(ctx);
+    return ok;
+}
+
+static void test_early_exit_parse(void)
+{
+    printf("\n--- Early-exit structure parse ---\n");
+
+    const char *path = "/tmp/test_mp4tag_frag.mp4";
+    const char *src  = "/tmp/test_mp4tag_frag_src.mp4";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Test Title", 10 },
+    };
+
+    /* Fragmented: moov followed by many moof/mdat pairs */
+    write_mp4_layout(path, items, 1, 0, 0, 0, 0);
+    FILE *f = fopen(path, "ab");
+    for (int i = 0; f && i < 500; i++) {
+        write_be32(f, 8);  write_fourcc(f, "moof");
+        write_be32(f, 12); write_fourcc(f, "mdat"); write_be32(f, 0);
+    }
+    if (f) fclose(f);
+    long before = file_length(path);
+    CHECK(title_is(path, "Test Title", 0), "fragmented file reads from moov");
+
+    /* Relocation needs the rest of the walk, done on demand */
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    int rc = mp4tag_open_rw(ctx, path);
+    if (rc == MP4TAG_OK)
+        rc = mp4tag_set_tag_string(ctx, "COMMENT",
+                                   "A comment long enough to need more room");
+    CHECK_RC(rc, "grow tags on fragmented file");
+    mp4tag_destroy(ctx);
+    CHECK(file_length(path) > before && title_is(path, "Test Title", 0),
+          "moov relocated past the fragments");
+
+    /* moov-last, more than the probe beyond the first mdat: found at EOF */
+    write_mp4_layout(path, items, 1, 0, 0, 0, 1);
+    write_padded_copy(path, src, "mdat", 3u * 1024u * 1024u);
+    write_padded_copy(src, path, "mdat", 16);
+    CHECK(title_is(path, "Test Title", 0), "trailing moov from tail probe");
+    CHECK(title_is(path, "Test Title", 1), "trailing moov, unbuffered");
+
+    /* moov inside the tail but not last: the walk continues in memory */
+    write_mp4_layout(src, items, 1, 0, 0, 0, 0);
+    write_padded_copy(src, path, "mdat", 3u * 1024u * 1024u);
+    CHECK(title_is(path, "Test Title", 0), "moov between mdats");
+
+    /* A moov nested in a trailing box also ends at EOF, but is not the one */
+    test_item_t decoy[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Decoy", 5 },
+    };
+    const char *boxes[2] = { "free", "mdat" };
+    for (int b = 0; b < 2; b++) {
+        size_t len = 0;
+        write_mp4_layout(src, decoy, 1, 0, 0, 0, 1);
+        uint8_t *data = read_whole_file(src, &len);
+        size_t moov = 4;
+        while (data && moov + 4 <= len && memcmp(data + moov, "moov", 4) != 0) moov++;
+
+        write_mp4_layout(src, items, 1, 0, 0, 0, 1);
+        write_padded_copy(src, path, "mdat", 3u * 1024u * 1024u);
+        write_padded_copy(path, src, "mdat", 16);
+        FILE *f2 = fopen(src, "ab");
+        if (f2 && data && moov + 4 <= len) {
+            write_be32(f2, (uint32_t)(8 + len - (moov - 4)));
+            write_fourcc(f2, boxes[b]);
+            fwrite(data + moov - 4, 1, len - (moov - 4), f2);
+        }
+        if (f2) fclose(f2);
+        free(data);
+
+        CHECK(title_is(src, "Test Title", 0) && title_is(src, "Test Title", 1),
+              b ? "moov bytes in a trailing mdat ignored"
+                : "moov nested in a trailing free box ignored");
+        ctx = mp4tag_create(NULL);
+        rc = mp4tag_open_rw(ctx, src);
+        if (rc == MP4TAG_OK) rc = mp4tag_set_tag_string(ctx, "TITLE", "New Title");
+        mp4tag_destroy(ctx);
+        CHECK(rc == MP4TAG_OK && title_is(src, "New Title", 0),
+              "write past a nested moov keeps the real one");
+    }
+
+    remove(path);
+    remove(src);
+}
+
+/*
+ * Plan writing TITLE (and COMMENT, if given) on a read-only context,
+ * check the file was not touched, then really write it. Returns 1 if the
+ * written file has the size the plan predicted.
+ */
+static int plan_then_write(const char *path, unsigned flags, const char *title,
+                           const char *comment, mp4tag_write_plan_t *plan)
+{
+    size_t len = 0, len2 = 0;
+    uint8_t *before = read_whole_file(path, &len);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_set_write_flags(ctx, flags);
+    mp4tag_collection_t *coll = mp4tag_collection_create(ctx);
+    mp4tag_tag_t *tag = mp4tag_collection_add_tag(ctx, coll, MP4TAG_TARGET_ALBUM);
+    mp4tag_tag_add_simple(ctx, tag, "TITLE", title);
+    if (comment) mp4tag_tag_add_simple(ctx, tag, "COMMENT", comment);
+
+    int ok = mp4tag_open(ctx, path) == MP4TAG_OK &&
+             mp4tag_plan_write(ctx, coll, plan) == MP4TAG_OK;
+    mp4tag_close(ctx);
+
+    uint8_t *after = read_whole_file(path, &len2);
+    ok = ok && before && after && len == len2 && memcmp(before, after, len) == 0;
+
+    ok = ok && mp4tag_open_rw(ctx, path) == MP4TAG_OK &&
+         mp4tag_write_tags(ctx, coll) == MP4TAG_OK &&
+         (uint64_t)file_length(path) == plan->file_size;
+
+    mp4tag_collection_free(ctx, coll);
+    mp4tag_destroy(ctx);
+    free(before);
+    free(after);
+    return ok;
+}
+
+static void test_plan_write(void)
+{
+    printf("\n--- Write planning ---\n");
+
+    const char *path = "/tmp/test_mp4tag_plan.m4a";
+    const char *comment = "A comment long enough to outgrow the ilst";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Patch", 5 },
+    };
+    mp4tag_write_plan_t plan;
+
+    /* ilst followed by a 64-byte free box */
+    write_mp4_layout(path, items, 1, 64, 0, 0, 0);
+    long len = file_length(path);
+    CHECK(plan_then_write(path, MP4TAG_WRITE_DEFAULT, "Batch", NULL, &plan),
+          "same-size plan leaves the file alone and predicts its size");
+    CHECK(plan.strategy == MP4TAG_STRATEGY_IN_PLACE &&
+          plan.bytes_written == 8 + 16 + 5 && plan.bytes_copied == 0 &&
+          plan.temp_space == 0 && plan.file_size == (uint64_t)len,
+          "same-size change patches one item");
+
+    CHECK(plan_then_write(path, MP4TAG_WRITE_DEFAULT, "Pat", NULL, &plan) &&
+          plan.strategy == MP4TAG_STRATEGY_PADDED_IN_PLACE &&
+          plan.bytes_written == 8 + (8 + 16 + 5) + 64 && plan.temp_space == 0,
+          "shorter ilst rewritten over ilst and free");
+
+    /* Padding elsewhere in moov */
+    write_mp4_layout(path, items, 1, 0, 1, 200, 0);
+    long moov_size = 0;
+    find_top_level(path, "moov", NULL, &moov_size);
+    CHECK(plan_then_write(path, MP4TAG_WRITE_DEFAULT, "Patch", comment, &plan) &&
+          plan.strategy == MP4TAG_STRATEGY_RESHUFFLE &&
+          plan.bytes_written == (uint64_t)moov_size,
+          "growth within moov padding reshuffles moov");
+
+    /* No padding at all */
+    write_mp4_layout(path, items, 1, 0, 1, 0, 0);
+    len = file_length(path);
+    CHECK(plan_then_write(path, MP4TAG_WRITE_DEFAULT, "Patch", comment, &plan) &&
+          plan.strategy == MP4TAG_STRATEGY_RELOCATE &&
+          plan.bytes_copied == 0 && plan.file_size > (uint64_t)len &&
+          plan.temp_space == plan.file_size - (uint64_t)len,
+          "growth without padding relocates moov");
+
+    write_mp4_layout(path, items, 1, 0, 1, 0, 0);
+    len = file_length(path);
+    CHECK(plan_then_write(path, 0, "Patch", comment, &plan) &&
+          plan.strategy == MP4TAG_STRATEGY_REWRITE &&
+          plan.bytes_copied > 0 && plan.bytes_copied < (uint64_t)len &&
+          plan.bytes_written + plan.bytes_copied == plan.file_size &&
+          plan.temp_space == plan.file_size,
+          "without relocation the file is rewritten");
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_collection_t *coll = mp4tag_collection_create(ctx);
+    CHECK(mp4tag_plan_write(ctx, coll, &plan) == MP4TAG_ERR_NOT_OPEN,
+          "plan needs an open file");
+    mp4tag_collection_free(ctx, coll);
+    mp4tag_destroy(ctx);
+    remove(path);
+}
+
+static void test_io_options(void)
+{
+    printf("\n--- I/O options ---\n");
+
+    const char *path = "/tmp/test_mp4tag_io.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Media", 5 },
+    };
+    write_mp4_with_items(path, items, 1, 0);
+
+    /* Several MiB of media at an unaligned offset */
+    const uint32_t payload = 3u * 1024u * 1024u + 123u;
+    FILE *f = fopen(path, "ab");
+    write_be32(f, 8 + payload);
+    write_fourcc(f, "mdat");
+    for (uint32_t i = 0; i < payload; i++)
+        fputc((int)((i * 31 + (i >> 12)) & 0xFF), f);
+    fclose(f);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_io_options_t io = { 4097, 0, MP4TAG_IO_FADVISE | MP4TAG_IO_DIRECT };
+    CHECK_RC(mp4tag_set_io_options(ctx, &io), "set I/O options");
+    io.flags = 0x80;
+    CHECK(mp4tag_set_io_options(ctx, &io) == MP4TAG_ERR_INVALID_ARG,
+          "unknown I/O flags rejected");
+
+    mp4tag_open_rw(ctx, path);
+    mp4tag_set_write_flags(ctx, 0);
+    int rc = mp4tag_set_tag_string(ctx, "COMMENT",
+                                   "A comment long enough to force a rewrite");
+    CHECK_RC(rc, "uncached rewrite with a small copy buffer");
+    mp4tag_destroy(ctx);
+
+    long after = file_length(path);
+    f = fopen(path, "rb");
+    int same = f != NULL;
+    if (f) {
+        fseek(f, after - (long)payload, SEEK_SET);
+        for (uint32_t i = 0; i < payload; i++) {
+            if (fgetc(f) != (int)((i * 31 + (i >> 12)) & 0xFF)) { same = 0; break; }
+        }
+        fclose(f);
+    }
+    CHECK(same, "mdat payload copied intact");
+
+    ctx = mp4tag_create(NULL);
+    CHECK_RC(mp4tag_set_io_options(ctx, NULL), "reset I/O options");
+    char buf[64];
+    mp4tag_open(ctx, path);
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Media") == 0, "TITLE survives rewrite");
+    mp4tag_destroy(ctx);
+
+    remove(path);
+}
+
+/*
+ * Plan `probe` on the context that did the writing and on a fresh one,
+ * and read TITLE and COMMENT through both. Returns 1 if they all agree.
+ */
+static int matches_reopened(mp4tag_context_t *ctx, const char *path,
+                            const mp4tag_collection_t *probe)
+{
+    static const char *const names[2] = { "TITLE", "COMMENT" };
+    mp4tag_context_t *fresh = mp4tag_create(NULL);
+    mp4tag_write_plan_t a, b;
+    int ok = mp4tag_open(fresh, path) == MP4TAG_OK &&
+             mp4tag_plan_write(ctx, probe, &a) == MP4TAG_OK &&
+             mp4tag_plan_write(fresh, probe, &b) == MP4TAG_OK &&
+             memcmp(&a, &b, sizeof(a)) == 0;
+
+    for (int i = 0; ok && i < 2; i++) {
+        char x[2048], y[2048];
+        int rx = mp4tag_read_tag_string(ctx, names[i], x, sizeof(x));
+        int ry = mp4tag_read_tag_string(fresh, names[i], y, sizeof(y));
+        ok = rx == ry && (rx != MP4TAG_OK || strcmp(x, y) == 0);
+    }
+    mp4tag_destroy(fresh);
+    return ok;
+}
+
+static void test_durability(void)
+{
+    printf("\n--- Durability and incremental file info ---\n");
+
+    const char *path = "/tmp/test_mp4tag_durable.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Patch", 5 },
+    };
+    static char medium[101], large[401], huge[1601];
+    memset(medium, 'm', sizeof(medium) - 1);
+    memset(large, 'l', sizeof(large) - 1);
+    memset(huge, 'h', sizeof(huge) - 1);
+
+    /* Each step takes the next strategy down the chain */
+    static const struct {
+        unsigned                flags;
+        const char             *name;
+        const char             *value;
+        mp4tag_write_strategy_t strategy;
+    } steps[] = {
+        { MP4TAG_WRITE_DEFAULT, "TITLE",   "Batch", MP4TAG_STRATEGY_IN_PLACE },
+        { MP4TAG_WRITE_DEFAULT, "TITLE",   "Pat",   MP4TAG_STRATEGY_PADDED_IN_PLACE },
+        { MP4TAG_WRITE_DEFAULT, "COMMENT", medium,  MP4TAG_STRATEGY_RESHUFFLE },
+        { MP4TAG_WRITE_DEFAULT, "COMMENT", large,   MP4TAG_STRATEGY_RELOCATE },
+        { 0,                    "COMMENT", huge,    MP4TAG_STRATEGY_REWRITE },
+        { 0,                    "TITLE",   "Put",   MP4TAG_STRATEGY_IN_PLACE },
+    };
+    const size_t nsteps = sizeof(steps) / sizeof(steps[0]);
+
+    static const mp4tag_durability_t modes[3] = {
+        MP4TAG_DURABILITY_NONE, MP4TAG_DURABILITY_DATA, MP4TAG_DURABILITY_FULL,
+    };
+    for (int m = 0; m < 3; m++) {
+        write_mp4_layout(path, items, 1, 64, 1, 200, 0);
+
+        mp4tag_context_t *ctx = mp4tag_create(NULL);
+        CHECK_RC(mp4tag_set_durability(ctx, modes[m]), "set durability");
+        mp4tag_collection_t *probe = mp4tag_collection_create(ctx);
+        mp4tag_tag_t *tag = mp4tag_collection_add_tag(ctx, probe, MP4TAG_TARGET_ALBUM);
+        mp4tag_tag_add_simple(ctx, tag, "TITLE", "A title that needs more room");
+
+        int strategies_ok = 1, info_ok = 1;
+        int rc = mp4tag_open_rw(ctx, path);
+        for (size_t i = 0; rc == MP4TAG_OK && i < nsteps; i++) {
+            mp4tag_write_plan_t plan = { 0 };
+            mp4tag_set_write_flags(ctx, steps[i].flags);
+
+            /* The tags so far, with this step's change, read from ctx */
+            mp4tag_collection_t *coll = mp4tag_collection_create(ctx);
+            tag = mp4tag_collection_add_tag(ctx, coll, MP4TAG_TARGET_ALBUM);
+            for (int k = 0; k < 2; k++) {
+                const char *name = k ? "COMMENT" : "TITLE";
+                char value[2048];
+                if (strcmp(name, steps[i].name) == 0)
+                    mp4tag_tag_add_simple(ctx, tag, name, steps[i].value);
+                else if (mp4tag_read_tag_string(ctx, name, value, sizeof(value)) == MP4TAG_OK)
+                    mp4tag_tag_add_simple(ctx, tag, name, value);
+            }
+            rc = mp4tag_plan_write(ctx, coll, &plan);
+            if (rc == MP4TAG_OK) rc = mp4tag_write_tags(ctx, coll);
+            mp4tag_collection_free(ctx, coll);
+
+            if (plan.strategy != steps[i].strategy) strategies_ok = 0;
+            if (!matches_reopened(ctx, path, probe)) info_ok = 0;
+        }
+        CHECK_RC(rc, "write sequence");
+        CHECK(strategies_ok, "sequence exercises every strategy");
+        CHECK(info_ok, "file info after each write matches a reopen");
+        mp4tag_collection_free(ctx, probe);
+        mp4tag_destroy(ctx);
+    }
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    CHECK(mp4tag_set_durability(ctx, (mp4tag_durability_t)3) == MP4TAG_ERR_INVALID_ARG,
+          "unknown durability rejected");
+    mp4tag_destroy(ctx);
+    remove(path);
+}
+
+/* An object held in memory, served through mp4tag_io_t callbacks */
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    int      reads;
+    uint64_t fail_at;       /* Reads covering this offset fail (0: none) */
+} test_object_t;
+
+static int64_t object_read(void *user, void *buf, size_t len, uint64_t offset)
+{
+    test_object_t *obj = user;
+    obj->reads++;
+    if (offset > obj->size) return -1;
+    if (obj->fail_at && offset <= obj->fail_at && obj->fail_at - offset < len)
+        return -1;
+    size_t n = obj->size - (size_t)offset < len ? obj->size - (size_t)offset : len;
+    memcpy(buf, obj->data + offset, n);
+    return (int64_t)n;
+}
+
+static int64_t object_write(void *user, const void *buf, size_t len, uint64_t offset)
+{
+    test_object_t *obj = user;
+    if (offset + len > obj->size) {
+        uint8_t *grown = realloc(obj->data, (size_t)offset + len);
+        if (!grown) return -1;
+        obj->data = grown;
+        obj->size = (size_t)offset + len;
+    }
+    memcpy(obj->data + offset, buf, len);
+    return (int64_t)len;
+}
+
+static int64_t object_size(void *user)
+{
+    return (int64_t)((test_object_t *)user)->size;
+}
+
+static void test_user_io(void)
+{
+    printf("\n--- Caller-supplied I/O ---\n");
+
+    const char *path = "/tmp/test_mp4tag_userio.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Remote", 6 },
+    };
+
+    /* moov first, then 1 MiB of media */
+    write_mp4_layout(path, items, 1, 0, 1, 0, 0);
+    FILE *f = fopen(path, "ab");
+    write_be32(f, 8 + 1024 * 1024);
+    write_fourcc(f, "mdat");
+    for (int i = 0; i < 1024 * 1024; i++) fputc(i & 0xFF, f);
+    fclose(f);
+
+    test_object_t obj = { NULL, 0, 0 };
+    obj.data = read_whole_file(path, &obj.size);
+    mp4tag_io_t io = { object_read, NULL, object_size, &obj, 64 * 1024, 4 };
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    CHECK_RC(mp4tag_open_io(ctx, &io), "open through read callbacks");
+    char buf[2048];
+    int rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Remote") == 0, "TITLE read through callbacks");
+    CHECK(obj.reads == 1, "moov-first open and read take one request");
+    CHECK(mp4tag_set_tag_string(ctx, "TITLE", "Remoto") == MP4TAG_ERR_READ_ONLY,
+          "no write_at: read-only");
+    CHECK(mp4tag_open_io(ctx, &io) == MP4TAG_ERR_ALREADY_OPEN, "open twice rejected");
+    mp4tag_close(ctx);
+
+    /* Writable: in place, then a moov relocation that grows the object */
+    io.write_at = object_write;
+    CHECK_RC(mp4tag_open_io(ctx, &io), "open through read/write callbacks");
+    CHECK_RC(mp4tag_set_tag_string(ctx, "TITLE", "Remoto"), "same-size write");
+    size_t before = obj.size;
+    static char comment[401];
+    memset(comment, 'c', sizeof(comment) - 1);
+    CHECK_RC(mp4tag_set_tag_string(ctx, "COMMENT", comment), "relocating write");
+    CHECK(obj.size > before, "moov appended to the object");
+
+    static char huge[1601];
+    memset(huge, 'h', sizeof(huge) - 1);
+    mp4tag_set_write_flags(ctx, 0);
+    CHECK(mp4tag_set_tag_string(ctx, "COMMENT", huge) == MP4TAG_ERR_UNSUPPORTED,
+          "full rewrite unsupported for caller I/O");
+    rc = mp4tag_read_tag_string(ctx, "COMMENT", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, comment) == 0, "context still reads the object");
+    mp4tag_destroy(ctx);
+
+    f = fopen(path, "wb");
+    fwrite(obj.data, 1, obj.size, f);
+    fclose(f);
+    ctx = mp4tag_create(NULL);
+    mp4tag_open(ctx, path);
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Remoto") == 0, "TITLE written through callbacks");
+    rc = mp4tag_read_tag_string(ctx, "COMMENT", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, comment) == 0, "COMMENT written through callbacks");
+    mp4tag_close(ctx);
+
+    /* A moov over several blocks: its missing blocks come in one request */
+    write_mp4_layout(path, items, 1, 0, 1, 12000, 0);
+    free(obj.data);
+    obj.data    = read_whole_file(path, &obj.size);
+    io.write_at = NULL;
+    io.block_size = 4096;
+    for (int blocks = 16; blocks >= 4; blocks -= 12) {
+        /* 16 blocks cache the run; with 4 it is read straight through */
+        io.cache_blocks = (size_t)blocks;
+        obj.reads = 0;
+        rc = mp4tag_open_io(ctx, &io);
+        if (rc == MP4TAG_OK)
+            rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+        CHECK(rc == MP4TAG_OK && strcmp(buf, "Remote") == 0 && obj.reads == 2,
+              "multi-block moov read in two requests");
+        mp4tag_close(ctx);
+    }
+
+    /* moov last: one request per box header, the moov's block among them */
+    write_mp4_layout(path, items, 1, 0, 1, 0, 1);
+    free(obj.data);
+    obj.data  = read_whole_file(path, &obj.size);
+    obj.reads = 0;
+    CHECK_RC(mp4tag_open_io(ctx, &io), "open moov-last object");
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Remote") == 0 && obj.reads <= 3,
+          "moov-last object read in a few requests");
+
+    io.read_at = NULL;
+    mp4tag_close(ctx);
+    CHECK(mp4tag_open_io(ctx, &io) == MP4TAG_ERR_INVALID_ARG, "read_at required");
+    mp4tag_destroy(ctx);
+    free(obj.data);
+
+    /* A lazy cover that cannot be read fails the edit, not the file */
+    static uint8_t image[32 * 1024];
+    for (size_t i = 0; i < sizeof(image); i++)
+        image[i] = (uint8_t)(i * 13 + 1);
+    test_item_t covered[2] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Remote", 6 },
+        { { 'c', 'o', 'v', 'r' }, 13, image, (uint32_t)sizeof(image) },
+    };
+    write_mp4_with_items(path, covered, 2, 64);
+    obj.data = read_whole_file(path, &obj.size);
+    uint64_t cover_mid = 0;
+    for (size_t i = 0; obj.data && i + sizeof(image) <= obj.size; i++)
+        if (memcmp(obj.data + i, image, sizeof(image)) == 0)
+            cover_mid = i + sizeof(image) / 2;
+    io.read_at    = object_read;
+    io.write_at   = object_write;
+    io.block_size = 4096;
+    io.cache_blocks = 4;
+
+    ctx = mp4tag_create(NULL);
+    mp4tag_set_lazy_binary(ctx, 1);
+    CHECK_RC(mp4tag_open_io(ctx, &io), "open object with a lazy cover");
+    obj.fail_at = cover_mid;
+    CHECK(cover_mid && mp4tag_set_tag_string(ctx, "TITLE", "Remoto") == MP4TAG_ERR_IO,
+          "set fails when the lazy cover cannot be read");
+    CHECK(mp4tag_edit_begin(ctx) == MP4TAG_ERR_IO,
+          "edit fails when the lazy cover cannot be read");
+    mp4tag_destroy(ctx);
+
+    obj.fail_at = 0;
+    ctx = mp4tag_create(NULL);
+    mp4tag_open_io(ctx, &io);
+    rc = mp4tag_read_tag_string(ctx, "TITLE", buf, sizeof(buf));
+    CHECK(rc == MP4TAG_OK && strcmp(buf, "Remote") == 0, "object left untouched");
+    mp4tag_destroy(ctx);
+    f = fopen(path, "wb");
+    fwrite(obj.data, 1, obj.size, f);
+    fclose(f);
+    CHECK(lazy_cover_ok(path, MP4TAG_DEFAULT_MOOV_READ_LIMIT, image, sizeof(image)),
+          "cover still in the object");
+    free(obj.data);
+    remove(path);
+}
+
+/*
+ * Drive a probe over `path`, answering each plan from the file. Returns
+ * 1 if the stand-in it produces opens with the expected TITLE;
+ * `*rounds` counts the plans that asked for bytes, `*fetched` the bytes.
+ */
+static int probe_file(const char *path, size_t max, int *rounds, uint64_t *fetched)
+{
+    size_t len = 0;
+    uint8_t *file = read_whole_file(path, &len);
+    mp4tag_probe_t *probe = mp4tag_probe_create(len);
+    *rounds  = 0;
+    *fetched = 0;
+
+    mp4tag_range_t ranges[2];
+    size_t count = 0;
+    int rc = MP4TAG_OK;
+    while (file && probe && *rounds < 16 &&
+           (rc = mp4tag_probe_plan(probe, ranges, max, &count)) == MP4TAG_OK &&
+           count > 0) {
+        (*rounds)++;
+        for (size_t i = 0; i < count; i++) {
+            *fetched += ranges[i].size;
+            mp4tag_probe_feed(probe, ranges[i].offset, file + ranges[i].offset,
+                              (size_t)ranges[i].size);
+        }
+    }
+
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    char title[64];
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    int ok = rc == MP4TAG_OK &&
+             mp4tag_probe_result(probe, &data, &size) == MP4TAG_OK &&
+             mp4tag_open_memory(ctx, data, size) == MP4TAG_OK &&
+             mp4tag_read_tag_string(ctx, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+             strcmp(title, "Planned") == 0;
+    mp4tag_destroy(ctx);
+    mp4tag_probe_destroy(probe);
+    free(file);
+    return ok;
+}
+
+static void test_probe_plan(void)
+{
+    printf("\n--- Read planning ---\n");
+
+    const char *path = "/tmp/test_mp4tag_probe.m4a";
+    const char *src  = "/tmp/test_mp4tag_probe_src.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Planned", 7 },
+    };
+    int rounds;
+    uint64_t fetched;
+
+    write_mp4_layout(path, items, 1, 0, 1, 0, 0);
+    CHECK(probe_file(path, 2, &rounds, &fetched) && rounds == 1 &&
+          fetched == (uint64_t)file_length(path),
+          "small file: one request for the whole of it");
+
+    /* ftyp, 1 MiB mdat, mdat, moov */
+    write_mp4_layout(src, items, 1, 0, 1, 0, 1);
+    write_padded_copy(src, path, "mdat", 1024 * 1024);
+    CHECK(probe_file(path, 2, &rounds, &fetched) && rounds == 1,
+          "moov-last: head and tail in one round");
+    CHECK(probe_file(path, 1, &rounds, &fetched) && rounds == 2 &&
+          fetched < 128 * 1024,
+          "one range at a time: head, then the next box header");
+
+    /* ftyp, 1 MiB free, moov, 1 MiB free: moov in neither end */
+    write_mp4_layout(src, items, 1, 0, 1, 0, 0);
+    write_padded_copy(src, path, "free", 1024 * 1024);
+    FILE *f = fopen(path, "ab");
+    write_be32(f, 1024 * 1024);
+    write_fourcc(f, "free");
+    for (int i = 8; i < 1024 * 1024; i++) fputc(0, f);
+    fclose(f);
+    CHECK(probe_file(path, 2, &rounds, &fetched) && rounds == 2 &&
+          fetched < 256 * 1024,
+          "moov mid-file: found by following the top-level headers");
+
+    mp4tag_probe_t *probe = mp4tag_probe_create(4096);
+    mp4tag_range_t r;
+    size_t count = 0;
+    const uint8_t *data;
+    size_t size;
+    uint8_t junk[4096];
+    memset(junk, 0x5A, sizeof(junk));
+    CHECK(mp4tag_probe_plan(probe, &r, 1, &count) == MP4TAG_OK && count == 1 &&
+          r.offset == 0 && r.size == 4096, "first plan asks for the head");
+    CHECK(mp4tag_probe_result(probe, &data, &size) == MP4TAG_ERR_NOT_OPEN,
+          "no result while ranges are outstanding");
+    CHECK(mp4tag_probe_feed(probe, 4000, junk, 200) == MP4TAG_ERR_INVALID_ARG,
+          "bytes past the end rejected");
+    mp4tag_probe_feed(probe, 0, junk, sizeof(junk));
+    CHECK(mp4tag_probe_plan(probe, &r, 1, &count) == MP4TAG_ERR_NOT_MP4 && count == 0,
+          "non-MP4 bytes end the plan");
+    mp4tag_probe_destroy(probe);
+
+    remove(path);
+    remove(src);
+}
+
+/* Callback sink collecting into memory, taking at most `step` per call. */
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    size_t   step;
+    size_t   calls;
+} test_sink_t;
+
+static int64_t sink_collect(void *user, const void *buf, size_t len)
+{
+    test_sink_t *s = user;
+    if (len > s->step) len = s->step;
+    uint8_t *grown = realloc(s->data, s->size + len);
+    if (!grown) return -1;
+    memcpy(grown + s->size, buf, len);
+    s->data = grown;
+    s->size += len;
+    s->calls++;
+    return (int64_t)len;
+}
+
+static int64_t sink_refuse(void *user, const void *buf, size_t len)
+{
+    (void)user; (void)buf; (void)len;
+    return -1;
+}
+
+static int write_to_file(mp4tag_context_t *ctx, const mp4tag_collection_t *tags,
+                         const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return MP4TAG_ERR_IO;
+    mp4tag_sink_t sink = { fileno(f), NULL, NULL };
+    int rc = mp4tag_write_tags_to(ctx, tags, &sink);
+    fclose(f);
+    return rc;
+}
+
+static void test_write_tags_to(void)
+{
+    printf("\n--- Streamed write ---\n");
+
+    const char *src  = "/tmp/test_mp4tag_stream_src.m4a";
+    const char *path = "/tmp/test_mp4tag_stream.m4a";
+    const char *out  = "/tmp/test_mp4tag_stream_out.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Streamed", 8 },
+    };
+
+    /* ftyp, mdat, moov: the mdat chunks move with FASTSTART */
+    write_mp4_layout(path, items, 1, 0, 1, 0, 1);
+    size_t before_len = 0;
+    uint8_t *before = read_whole_file(path, &before_len);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_open(ctx, path);
+    mp4tag_collection_t *tags = mp4tag_collection_create(ctx);
+    mp4tag_tag_t *tag = mp4tag_collection_add_tag(ctx, tags, MP4TAG_TARGET_ALBUM);
+    mp4tag_tag_add_simple(ctx, tag, "TITLE", "Sent elsewhere");
+    mp4tag_tag_add_simple(ctx, tag, "COMMENT", "Longer than the tags it replaces");
+
+    CHECK_RC(write_to_file(ctx, tags, out), "read-only context streams to an fd");
+    CHECK(title_is(out, "Sent elsewhere", 0), "copy carries the new tags");
+    CHECK(chunks_hit_payload(out), "copy's chunk offsets hit the payload");
+    CHECK(title_is(path, "Streamed", 0), "source tags unchanged");
+    size_t after_len = 0;
+    uint8_t *after = read_whole_file(path, &after_len);
+    CHECK(after && before && after_len == before_len &&
+          memcmp(after, before, after_len) == 0, "source bytes unchanged");
+    free(after);
+
+    size_t fd_len = 0;
+    uint8_t *fd_copy = read_whole_file(out, &fd_len);
+    test_sink_t sink_buf = { NULL, 0, 1000, 0 };
+    mp4tag_sink_t sink = { -1, sink_collect, &sink_buf };
+    CHECK_RC(mp4tag_write_tags_to(ctx, tags, &sink), "stream to a callback");
+    CHECK(fd_copy && sink_buf.size == fd_len &&
+          memcmp(sink_buf.data, fd_copy, fd_len) == 0 &&
+          sink_buf.calls >= fd_len / 1000,
+          "callback gets the same bytes, with short writes resumed");
+
+    /* A memory-backed context produces the same file */
+    mp4tag_context_t *mem = mp4tag_create(NULL);
+    mp4tag_open_memory(mem, before, before_len);
+    test_sink_t mem_buf = { NULL, 0, SIZE_MAX, 0 };
+    sink.user = &mem_buf;
+    CHECK(mp4tag_write_tags_to(mem, tags, &sink) == MP4TAG_OK &&
+          mem_buf.size == fd_len && memcmp(mem_buf.data, fd_copy, fd_len) == 0,
+          "memory context streams the same bytes");
+    mp4tag_destroy(mem);
+    free(mem_buf.data);
+    free(sink_buf.data);
+    free(fd_copy);
+
+    mp4tag_set_write_flags(ctx, MP4TAG_WRITE_DEFAULT | MP4TAG_WRITE_FASTSTART);
+    CHECK_RC(write_to_file(ctx, tags, out), "faststart stream");
+    long moov_off = 0, mdat_off = 0;
+    CHECK(find_top_level(out, "moov", &moov_off, NULL) == 1 &&
+          find_top_level(out, "mdat", &mdat_off, NULL) == 1 &&
+          moov_off < mdat_off && chunks_hit_payload(out),
+          "faststart copy has moov ahead of mdat");
+
+    /* The path renamed over after open: the copy still comes from the open file */
+    size_t kept_len = 0, moved_len = 0;
+    uint8_t *kept = read_whole_file(out, &kept_len);
+    write_mp4_layout(src, items, 1, 0, 1, 0, 0);
+    CHECK(rename(src, path) == 0 && write_to_file(ctx, tags, out) == MP4TAG_OK,
+          "stream after the path is replaced");
+    uint8_t *moved = read_whole_file(out, &moved_len);
+    CHECK(kept && moved && moved_len == kept_len &&
+          memcmp(moved, kept, kept_len) == 0,
+          "replaced path does not leak into the copy");
+    free(kept);
+    free(moved);
+
+    /* Small enough to sit in a pipe buffer whole */
+    write_mp4_layout(src, items, 1, 0, 1, 0, 0);
+    mp4tag_context_t *small = mp4tag_create(NULL);
+    mp4tag_open(small, src);
+    int fds[2];
+    int piped = 0;
+    if (pipe(fds) == 0) {
+        mp4tag_sink_t ps = { fds[1], NULL, NULL };
+        int rc = mp4tag_write_tags_to(small, tags, &ps);
+        close(fds[1]);
+        FILE *f = fopen(out, "wb");
+        uint8_t chunk[4096];
+        ssize_t n;
+        while ((n = read(fds[0], chunk, sizeof(chunk))) > 0)
+            fwrite(chunk, 1, (size_t)n, f);
+        fclose(f);
+        close(fds[0]);
+        piped = rc == MP4TAG_OK && title_is(out, "Sent elsewhere", 0) &&
+                chunks_hit_payload(out);
+    }
+    CHECK(piped, "stream through a pipe");
+    mp4tag_destroy(small);
+
+    mp4tag_sink_t refuse = { -1, sink_refuse, NULL };
+    mp4tag_sink_t none = { -1, NULL, NULL };
+    CHECK(mp4tag_write_tags_to(ctx, tags, &refuse) == MP4TAG_ERR_WRITE_FAILED,
+          "sink refusal reported");
+    CHECK(mp4tag_write_tags_to(ctx, tags, &none) == MP4TAG_ERR_INVALID_ARG,
+          "sink needs an fd or a callback");
+
+    mp4tag_collection_free(ctx, tags);
+    mp4tag_destroy(ctx);
+    free(before);
+    remove(src);
+    remove(path);
+    remove(out);
+}
+
+/*
+ * Image bytes behind a read callback, recording the largest request and
+ * the 2-byte format sniffs the serializer makes.
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t         size;
+    size_t         largest;
+    int            sniffs;
+} test_image_t;
+
+static int64_t image_read(void *user, void *buf, size_t len, uint64_t offset)
+{
+    test_image_t *img = user;
+    if (len > img->largest) img->largest = len;
+    if (offset == 0 && len == 2) img->sniffs++;
+    if (offset >= img->size) return 0;
+    if (len > img->size - offset) len = img->size - (size_t)offset;
+    memcpy(buf, img->data + offset, len);
+    return (int64_t)len;
+}
+
+static int cover_is(mp4tag_context_t *ctx, const uint8_t *image, size_t size)
+{
+    mp4tag_collection_t *coll = NULL;
+    if (mp4tag_read_tags(ctx, &coll) != MP4TAG_OK) return 0;
+    const mp4tag_simple_tag_t *covr = find_simple(coll, "COVER_ART");
+    return covr && covr->binary && covr->binary_size == size &&
+           memcmp(covr->binary, image, size) == 0;
+}
+
+static int file_cover_is(const char *path, const uint8_t *image, size_t size)
+{
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    int ok = mp4tag_open(ctx, path) == MP4TAG_OK && cover_is(ctx, image, size);
+    mp4tag_destroy(ctx);
+    return ok;
+}
+
+/* A collection of TITLE plus a streamed COVER_ART. */
+static mp4tag_collection_t *cover_tags(mp4tag_context_t *ctx,
+                                       const mp4tag_binary_source_t *src)
+{
+    mp4tag_collection_t *coll = mp4tag_collection_create(ctx);
+    mp4tag_tag_t *tag = mp4tag_collection_add_tag(ctx, coll, MP4TAG_TARGET_ALBUM);
+    mp4tag_tag_add_simple(ctx, tag, "TITLE", "Covered");
+    mp4tag_tag_add_binary_source(ctx, tag, "COVER_ART", src);
+    return coll;
+}
+
+static void test_streamed_cover(void)
+{
+    printf("\n--- Streamed cover art ---\n");
+
+    const char *path = "/tmp/test_mp4tag_cover.m4a";
+    const char *bin  = "/tmp/test_mp4tag_cover.bin";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Plain", 5 },
+    };
+    write_mp4_layout(path, items, 1, 0, 1, 0, 0);
+
+    /* Two JPEG-looking images; the first sits 7 bytes into a file */
+    const size_t small = 300000, large = 400000;
+    uint8_t *image = malloc(large);
+    uint8_t *other = malloc(large);
+    for (size_t i = 0; i < large; i++) {
+        image[i] = (uint8_t)(i * 13 + (i >> 11));
+        other[i] = (uint8_t)(i * 7 + 1);
+    }
+    image[0] = other[0] = 0xFF;
+    image[1] = other[1] = 0xD8;
+    FILE *f = fopen(bin, "wb");
+    fwrite("garbage", 1, 7, f);
+    fwrite(image, 1, small, f);
+    fclose(f);
+    FILE *img_file = fopen(bin, "rb");
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_open_rw(ctx, path);
+    mp4tag_io_options_t io = { 65536, 0, 0 };
+    mp4tag_set_io_options(ctx, &io);
+
+    /* Relocated moov, the value copied from the fd in bounded chunks */
+    mp4tag_binary_source_t from_fd = { fileno(img_file), 7, NULL, NULL, small };
+    mp4tag_collection_t *tags = cover_tags(ctx, &from_fd);
+    mp4tag_write_plan_t plan;
+    CHECK(mp4tag_plan_write(ctx, tags, &plan) == MP4TAG_OK &&
+          plan.strategy == MP4TAG_STRATEGY_RELOCATE &&
+          plan.bytes_written > small, "plan counts the streamed value");
+    CHECK_RC(mp4tag_write_tags(ctx, tags), "write cover from an fd");
+    CHECK(cover_is(ctx, image, small), "cover reads back through the same context");
+    CHECK(file_cover_is(path, image, small) && chunks_hit_payload(path),
+          "cover reads back after reopening");
+    const mp4tag_simple_tag_t *st = find_simple(tags, "COVER_ART");
+    uint8_t head[4];
+    CHECK(st && st->binary_size == small &&
+          mp4tag_read_binary(ctx, st, 1, head, 4) == MP4TAG_OK &&
+          memcmp(head, image + 1, 4) == 0, "read_binary reads from the source");
+    mp4tag_collection_free(ctx, tags);
+
+    /* Same size from a callback: rewritten over the old ilst */
+    test_image_t cb = { other, small, 0 };
+    mp4tag_binary_source_t from_cb = { -1, 0, image_read, &cb, small };
+    tags = cover_tags(ctx, &from_cb);
+    CHECK(mp4tag_plan_write(ctx, tags, &plan) == MP4TAG_OK &&
+          plan.strategy == MP4TAG_STRATEGY_PADDED_IN_PLACE, "same size goes in place");
+    CHECK_RC(mp4tag_write_tags(ctx, tags), "write cover from a callback");
+    CHECK(file_cover_is(path, other, small) && cb.largest <= 65536,
+          "in-place cover streamed through the copy buffer");
+    mp4tag_collection_free(ctx, tags);
+
+    /* Larger, with relocation off: a full rewrite */
+    cb.size = large;
+    cb.largest = 0;
+    from_cb.size = large;
+    mp4tag_set_write_flags(ctx, 0);
+    tags = cover_tags(ctx, &from_cb);
+    CHECK(mp4tag_plan_write(ctx, tags, &plan) == MP4TAG_OK &&
+          plan.strategy == MP4TAG_STRATEGY_REWRITE, "larger cover rewrites");
+    cb.sniffs = 0;
+    CHECK_RC(mp4tag_write_tags(ctx, tags), "rewrite with a streamed cover");
+    CHECK(cb.sniffs == 1, "ilst serialized once across the strategies");
+    CHECK(file_cover_is(path, other, large) && chunks_hit_payload(path) &&
+          cb.largest <= 65536, "rewritten cover streamed through the copy buffer");
+
+    /* Streamed to a sink, and a source that comes up short */
+    test_sink_t out = { NULL, 0, SIZE_MAX, 0 };
+    mp4tag_sink_t sink = { -1, sink_collect, &out };
+    CHECK_RC(mp4tag_write_tags_to(ctx, tags, &sink), "stream a copy with the cover");
+    mp4tag_context_t *mem = mp4tag_create(NULL);
+    CHECK(mp4tag_open_memory(mem, out.data, out.size) == MP4TAG_OK &&
+          cover_is(mem, other, large), "copy carries the streamed cover");
+    mp4tag_destroy(mem);
+    free(out.data);
+    mp4tag_collection_free(ctx, tags);
+
+    from_fd.size = large;           /* The file only holds `small` */
+    tags = cover_tags(ctx, &from_fd);
+    CHECK(mp4tag_write_tags(ctx, tags) != MP4TAG_OK, "short source fails the write");
+    CHECK(file_cover_is(path, other, large), "file intact after the failed write");
+    mp4tag_collection_free(ctx, tags);
+
+    /* Uncached source reads must not be used for a big fd value */
+    const size_t huge = 2u * 1024u * 1024u;
+    uint8_t *big = malloc(huge);
+    for (size_t i = 0; i < huge; i++) big[i] = (uint8_t)(i * 31 + (i >> 9));
+    big[0] = 0xFF;
+    big[1] = 0xD8;
+    f = fopen(bin, "wb");
+    fwrite(big, 1, huge, f);
+    fclose(f);
+    FILE *big_file = fopen(bin, "rb");
+    mp4tag_io_options_t direct = { 65536, 0, MP4TAG_IO_DIRECT };
+    mp4tag_set_io_options(ctx, &direct);
+    mp4tag_binary_source_t from_big = { fileno(big_file), 0, NULL, NULL, huge };
+    tags = cover_tags(ctx, &from_big);
+    CHECK_RC(mp4tag_write_tags(ctx, tags), "uncached rewrite with a large fd cover");
+    CHECK(file_cover_is(path, big, huge) && chunks_hit_payload(path),
+          "large fd cover intact with MP4TAG_IO_DIRECT");
+    mp4tag_collection_free(ctx, tags);
+    fclose(big_file);
+    free(big);
+
+    mp4tag_destroy(ctx);
+    fclose(img_file);
+    free(image);
+    free(other);
+    remove(path);
+    remove(bin);
+}
+
+/* Trace callbacks check that phases nest and pair up */
+typedef struct {
+    int            begins;
+    int            ends;
+    int            depth;
+    int            bad;
+    mp4tag_phase_t open[16];
+} trace_log_t;
+
+static void trace_begin(void *user, mp4tag_phase_t phase)
+{
+    trace_log_t *log = user;
+    log->begins++;
+    if (log->depth < 16) log->open[log->depth] = phase;
+    log->depth++;
+}
+
+static void trace_end(void *user, mp4tag_phase_t phase, uint64_t elapsed_ns)
+{
+    trace_log_t *log = user;
+    log->ends++;
+    log->depth--;
+    if (log->depth < 0 || (log->depth < 16 && log->open[log->depth] != phase))
+        log->bad = 1;
+    (void)elapsed_ns;
+}
+
+static void test_stats(void)
+{
+    printf("\n--- Statistics and tracing ---\n");
+
+    const char *path = "/tmp/test_mp4tag_stats.m4a";
+    test_item_t items[1] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Stats", 5 },
+    };
+    write_mp4_layout(path, items, 1, 64, 1, 0, 0);
+
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    trace_log_t log;
+    memset(&log, 0, sizeof(log));
+    mp4tag_trace_t trace = { trace_begin, trace_end, &log };
+    CHECK_RC(mp4tag_set_trace(ctx, &trace), "set_trace");
+
+    mp4tag_stats_t st;
+    CHECK_RC(mp4tag_open_rw(ctx, path), "open_rw");
+    CHECK_RC(mp4tag_get_stats(ctx, &st), "get_stats");
+    CHECK(st.reads > 0 && st.seeks > 0 && st.bytes_read > 0 &&
+          st.phase_count[MP4TAG_PHASE_PARSE] == 1 && st.write_count == 0,
+          "open counts its reads and one parse");
+
+    mp4tag_collection_t *coll = NULL;
+    CHECK_RC(mp4tag_read_tags(ctx, &coll), "read_tags");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.phase_count[MP4TAG_PHASE_PARSE] == 2, "tag parsing is a parse phase");
+
+    CHECK_RC(mp4tag_set_tag_string(ctx, "TITLE", "Stat"), "shorter title");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.write_count == 1 &&
+          st.last_strategy == MP4TAG_STRATEGY_PADDED_IN_PLACE &&
+          st.inplace_result == MP4TAG_INPLACE_OK &&
+          st.bytes_written == 8 + (8 + 16 + 4) + 65 && st.writes == 1 &&
+          st.bytes_copied == 0,
+          "padded in-place write recorded");
+    CHECK(st.phase_count[MP4TAG_PHASE_WRITE] == 1 &&
+          st.phase_count[MP4TAG_PHASE_SERIALIZE] >= 1 &&
+          st.phase_count[MP4TAG_PHASE_SYNC] == 1 &&
+          st.phase_count[MP4TAG_PHASE_RENAME] == 0,
+          "write, serialize and sync phases timed");
+
+    /* Outgrow everything with relocation off: a rewrite */
+    char comment[256];
+    memset(comment, 'c', sizeof(comment) - 1);
+    comment[sizeof(comment) - 1] = '\0';
+    mp4tag_reset_stats(ctx);
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads == 0 && st.write_count == 0 &&
+          st.phase_count[MP4TAG_PHASE_PARSE] == 0, "reset_stats clears");
+    mp4tag_set_write_flags(ctx, 0);
+    CHECK_RC(mp4tag_set_tag_string(ctx, "COMMENT", comment), "grow past padding");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.write_count == 1 && st.last_strategy == MP4TAG_STRATEGY_REWRITE &&
+          st.inplace_result == MP4TAG_INPLACE_TOO_LARGE &&
+          st.bytes_copied > 0 &&
+          st.bytes_copied + st.bytes_written == (uint64_t)file_length(path),
+          "rewrite records copied and written bytes");
+    CHECK(st.phase_count[MP4TAG_PHASE_RENAME] == 1 &&
+          st.phase_count[MP4TAG_PHASE_SYNC] == 2,
+          "rewrite syncs the file and directory around its rename");
+
+    CHECK(log.begins > 0 && log.begins == log.ends && log.depth == 0 &&
+          !log.bad, "trace callbacks pair up and nest");
+
+    /* Tracing off */
+    int seen = log.begins;
+    mp4tag_set_trace(ctx, NULL);
+    mp4tag_close(ctx);
+    CHECK_RC(mp4tag_open(ctx, path), "reopen");
+    CHECK(log.begins == seen, "no callbacks once tracing is off");
+    mp4tag_close(ctx);
+
+    /* A file without tags can't be written in place */
+    create_mp4_no_tags(path);
+    CHECK_RC(mp4tag_open_rw(ctx, path), "open untagged");
+    CHECK_RC(mp4tag_set_tag_string(ctx, "TITLE", "New"), "tag untagged file");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.inplace_result == MP4TAG_INPLACE_NO_ILST &&
+          st.last_strategy != MP4TAG_STRATEGY_IN_PLACE &&
+          st.last_strategy != MP4TAG_STRATEGY_PADDED_IN_PLACE,
+          "missing ilst recorded");
+
+    CHECK(mp4tag_get_stats(NULL, &st) == MP4TAG_ERR_INVALID_ARG &&
+          mp4tag_get_stats(ctx, NULL) == MP4TAG_ERR_INVALID_ARG,
+          "get_stats rejects NULL");
+    mp4tag_destroy(ctx);
+    remove(path);
+}
+
+static void test_context_reuse(void)
+{
+    printf("\n--- Context reuse and retained buffers ---\n");
+
+    const char *paths[3] = {
+        "/tmp/test_mp4tag_reuse0.m4a", "/tmp/test_mp4tag_reuse1.m4a",
+        "/tmp/test_mp4tag_reuse2.m4a",
+    };
+    test_item_t items[2] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Reuse", 5 },
+        { { 0xA9, 'A', 'R', 'T' }, 1, (const uint8_t *)"Artist", 6 },
+    };
+    for (int i = 0; i < 3; i++)
+        write_mp4_layout(paths[i], items, 2, 256, 1, 0, 0);
+
+    alloc_stats_t stats = { 0, 0 };
+    mp4tag_allocator_t allocator = {
+        counting_alloc, counting_realloc, counting_free, &stats
+    };
+    mp4tag_context_t *ctx = mp4tag_create(&allocator);
+
+    /* The first file warms the arenas; the rest reuse them */
+    size_t warm = 0;
+    int ok = 1;
+    for (int i = 0; i < 3; i++) {
+        ok &= mp4tag_open_rw(ctx, paths[i]) == MP4TAG_OK;
+        mp4tag_collection_t *coll = NULL;
+        ok &= mp4tag_read_tags(ctx, &coll) == MP4TAG_OK;
+        ok &= mp4tag_set_tag_string(ctx, "TITLE", "Again") == MP4TAG_OK;
+        mp4tag_close(ctx);
+        if (i == 0) warm = stats.allocs;
+    }
+    CHECK(ok, "three files through one context");
+    CHECK(stats.allocs == warm, "later files allocate nothing");
+
+    char value[16] = "";
+    CHECK_RC(mp4tag_open(ctx, paths[2]), "reopen");
+    CHECK(mp4tag_read_tag_string(ctx, "TITLE", value, sizeof(value)) == MP4TAG_OK &&
+          strcmp(value, "Again") == 0, "reused context wrote the title");
+
+    /* Reset closes and restores the defaults */
+    trace_log_t log;
+    memset(&log, 0, sizeof(log));
+    mp4tag_trace_t trace = { trace_begin, trace_end, &log };
+    mp4tag_set_trace(ctx, &trace);
+    mp4tag_reset(ctx);
+    CHECK(!mp4tag_is_open(ctx), "reset closes the file");
+    mp4tag_stats_t st;
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads == 0 && st.phase_count[MP4TAG_PHASE_PARSE] == 0,
+          "reset clears the statistics");
+    CHECK_RC(mp4tag_open(ctx, paths[0]), "open after reset");
+    CHECK(log.begins == 0, "reset drops the trace callbacks");
+    mp4tag_collection_t *coll = NULL;
+    CHECK(mp4tag_read_tags(ctx, &coll) == MP4TAG_OK && stats.allocs == warm,
+          "reset keeps the warm arenas");
+    mp4tag_reset(ctx);
+
+    /* A zero limit hands everything back */
+    CHECK_RC(mp4tag_set_retain_limit(ctx, 0), "retain limit 0");
+    CHECK(stats.frees == stats.allocs - 1, "only the context itself is left");
+    CHECK(mp4tag_set_retain_limit(NULL, 0) == MP4TAG_ERR_INVALID_ARG,
+          "set_retain_limit rejects NULL");
+    mp4tag_reset(NULL);
+
+    mp4tag_destroy(ctx);
+    CHECK(stats.frees == stats.allocs, "destroy frees the rest");
+    for (int i = 0; i < 3; i++) remove(paths[i]);
+}
+
+static void test_tag_cache(void)
+{
+    printf("\n--- Persistent tag index ---\n");
+
+    const char *index = "/tmp/test_mp4tag_index.bin";
+    const char *files[3] = {
+        "/tmp/test_mp4tag_cached0.m4a", "/tmp/test_mp4tag_cached1.m4a",
+        "/tmp/test_mp4tag_cached2.m4a",
+    };
+    uint8_t cover[64];
+    for (size_t i = 0; i < sizeof(cover); i++) cover[i] = (uint8_t)(0xD8 + i);
+    test_item_t items[2] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Test Title", 10 },
+        { { 'c', 'o', 'v', 'r' }, 13, cover, sizeof(cover) },
+    };
+    for (int i = 0; i < 3; i++)
+        write_mp4_layout(files[i], items, 2, 64, 1, 0, 0);
+    remove(index);
+
+    mp4tag_cache_t *cache = NULL;
+    CHECK_RC(mp4tag_cache_open(index, &cache), "create index");
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_stats_t st;
+    char title[64];
+
+    /* A miss parses the file and stores it; a hit reads nothing */
+    CHECK_RC(mp4tag_open_cached(ctx, cache, files[0]), "open_cached (miss)");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads > 0, "a miss reads the file");
+    mp4tag_close(ctx);
+
+    mp4tag_reset_stats(ctx);
+    CHECK_RC(mp4tag_open_cached(ctx, cache, files[0]), "open_cached (hit)");
+    mp4tag_collection_t *coll = NULL;
+    CHECK(mp4tag_read_tags(ctx, &coll) == MP4TAG_OK &&
+          mp4tag_read_tag_string(ctx, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+          strcmp(title, "Test Title") == 0, "tags served from the index");
+    const mp4tag_item_view_t *views = NULL;
+    size_t nviews = 0;
+    CHECK(mp4tag_read_tags_view(ctx, &views, &nviews) == MP4TAG_OK && nviews == 2 &&
+          views[1].size == sizeof(cover) && memcmp(views[1].data, cover, sizeof(cover)) == 0,
+          "views served from the index");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads == 0 && st.seeks == 0 && st.phase_count[MP4TAG_PHASE_PARSE] == 1,
+          "a hit does no file I/O");
+    CHECK(mp4tag_set_tag_string(ctx, "TITLE", "x") == MP4TAG_ERR_READ_ONLY,
+          "a hit is read-only");
+    mp4tag_sink_t sink = { -1, NULL, NULL };
+    sink.fd = 1;
+    CHECK(mp4tag_write_tags_to(ctx, coll, &sink) == MP4TAG_ERR_UNSUPPORTED,
+          "a hit can't be streamed out");
+
+    /* Lazy binaries come from the entry too */
+    mp4tag_set_lazy_binary(ctx, 1);
+    CHECK_RC(mp4tag_read_tags(ctx, &coll), "lazy read from the index");
+    const mp4tag_simple_tag_t *art = NULL;
+    for (const mp4tag_simple_tag_t *t = coll->tags->simple_tags; t; t = t->next)
+        if (t->binary_size > 0) art = t;
+    const uint8_t *bytes = NULL;
+    uint8_t buf[sizeof(cover)];
+    CHECK(art && !art->binary &&
+          mp4tag_binary_view(ctx, art, &bytes) == MP4TAG_OK &&
+          memcmp(bytes, cover, sizeof(cover)) == 0 &&
+          mp4tag_read_binary(ctx, art, 0, buf, sizeof(buf)) == MP4TAG_OK &&
+          memcmp(buf, cover, sizeof(cover)) == 0, "lazy cover art from the index");
+    mp4tag_reset(ctx);
+
+    /* The index persists, and writes refresh their entry */
+    mp4tag_cache_close(cache);
+    CHECK_RC(mp4tag_cache_open(index, &cache), "reopen index");
+    CHECK_RC(mp4tag_open_rw(ctx, files[0]), "open_rw");
+    mp4tag_set_cache(ctx, cache);
+    CHECK_RC(mp4tag_set_tag_string(ctx, "TITLE", "Indexed"), "write through the index");
+    mp4tag_reset(ctx);
+    CHECK_RC(mp4tag_open_cached(ctx, cache, files[0]), "open after the write");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads == 0 &&
+          mp4tag_read_tag_string(ctx, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+          strcmp(title, "Indexed") == 0, "the write updated the entry");
+    mp4tag_close(ctx);
+
+    /* A change behind the index's back is a miss */
+    struct timespec times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+    CHECK(utimensat(AT_FDCWD, files[0], times, 0) == 0, "touch the file");
+    mp4tag_reset_stats(ctx);
+    CHECK_RC(mp4tag_open_cached(ctx, cache, files[0]), "open after the change");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads > 0, "a changed file is read again");
+    mp4tag_close(ctx);
+
+    /* Scans answer from the index and fill it */
+    const char *paths[3] = { files[0], files[1], files[2] };
+    mp4tag_scan_options_t opts = { 2, MP4TAG_SCAN_ASYNC_IO, NULL, 0, cache };
+    int ok = 1;
+    for (int pass = 0; pass < 2; pass++) {
+        scan_result_t r;
+        memset(&r, 0, sizeof(r));
+        r.paths = paths;
+        ok &= mp4tag_scan_paths(paths, 3, &opts, scan_collect, &r) == MP4TAG_OK &&
+              r.ok == 3 && r.titles == 2;
+        opts.flags = 0;
+    }
+    CHECK(ok, "scans through the index");
+    mp4tag_reset_stats(ctx);
+    CHECK_RC(mp4tag_open_cached(ctx, cache, files[2]), "open a scanned file");
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads == 0, "the scan stored its entry");
+    mp4tag_close(ctx);
+    mp4tag_cache_close(cache);
+
+    /* A torn record at the end is dropped; the rest still hits */
+    long whole = file_length(index);
+    FILE *f = fopen(index, "ab");
+    if (f) { fwrite("torn", 1, 4, f); fclose(f); }
+    CHECK_RC(mp4tag_cache_open(index, &cache), "open index with a torn tail");
+    CHECK(file_length(index) == whole, "torn tail cut off");
+    mp4tag_reset_stats(ctx);
+    mp4tag_open_cached(ctx, cache, files[1]);
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads == 0, "earlier entries survive");
+    mp4tag_close(ctx);
+
+    /* Entries over the size limit are not stored */
+    mp4tag_cache_set_max_ilst(cache, 16);
+    write_mp4_layout(files[1], items, 2, 128, 1, 0, 0);
+    mp4tag_open_cached(ctx, cache, files[1]);
+    mp4tag_close(ctx);
+    mp4tag_reset_stats(ctx);
+    mp4tag_open_cached(ctx, cache, files[1]);
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads > 0, "oversized tags are not cached");
+    mp4tag_close(ctx);
+    mp4tag_cache_close(cache);
+
+    /* An index from another layout starts empty */
+    f = fopen(index, "r+b");
+    if (f) { fwrite("NOTANIDX", 1, 8, f); fclose(f); }
+    CHECK_RC(mp4tag_cache_open(index, &cache), "open foreign index");
+    mp4tag_reset_stats(ctx);
+    mp4tag_open_cached(ctx, cache, files[2]);
+    mp4tag_get_stats(ctx, &st);
+    CHECK(st.reads > 0, "foreign index discarded");
+    mp4tag_close(ctx);
+
+    CHECK(mp4tag_open_cached(ctx, NULL, files[2]) == MP4TAG_ERR_INVALID_ARG &&
+          mp4tag_cache_open(NULL, &cache) == MP4TAG_ERR_INVALID_ARG,
+          "cache functions reject NULL");
+    mp4tag_cache_close(cache);
+    mp4tag_destroy(ctx);
+    remove(index);
+    for (int i = 0; i < 3; i++) remove(files[i]);
+}
+
+typedef struct {
+    mp4tag_snapshot_t *snap;
+    int                ok;
+} snapshot_reader_t;
+
+static void *snapshot_lookups(void *arg)
+{
+    snapshot_reader_t *r = arg;
+    char title[64];
+    r->ok = 1;
+    for (int i = 0; i < 2000; i++) {
+        mp4tag_snapshot_t *own = mp4tag_snapshot_retain(r->snap);
+        r->ok &= mp4tag_snapshot_tag_string(own, "title", title, sizeof(title)) == MP4TAG_OK &&
+                 strcmp(title, "Test Title") == 0 &&
+                 mp4tag_snapshot_tag_fourcc(own, MP4TAG_FOURCC('c', 'o', 'v', 'r'),
+                                            title, sizeof(title)) == MP4TAG_ERR_TAG_NOT_FOUND;
+        mp4tag_snapshot_release(own);
+    }
+    return NULL;
+}
+
+static void test_snapshot(void)
+{
+    printf("\n--- Shared snapshots ---\n");
+
+    const char *tmp = "/tmp/test_mp4tag_snapshot.m4a";
+    uint8_t cover[48];
+    for (size_t i = 0; i < sizeof(cover); i++) cover[i] = (uint8_t)(0x89 + i);
+    test_item_t items[2] = {
+        { { 0xA9, 'n', 'a', 'm' }, 1, (const uint8_t *)"Test Title", 10 },
+        { { 'c', 'o', 'v', 'r' }, 13, cover, sizeof(cover) },
+    };
+    write_mp4_layout(tmp, items, 2, 64, 1, 0, 0);
+
+    /* Unbuffered and lazy, so the snapshot has to fetch and copy */
+    mp4tag_context_t *ctx = mp4tag_create(NULL);
+    mp4tag_set_moov_read_limit(ctx, 0);
+    mp4tag_set_lazy_binary(ctx, 1);
+    mp4tag_snapshot_t *snap = NULL;
+    CHECK(mp4tag_read_snapshot(ctx, &snap) == MP4TAG_ERR_NOT_OPEN, "snapshot needs an open file");
+    CHECK_RC(mp4tag_open(ctx, tmp), "open");
+    CHECK_RC(mp4tag_read_snapshot(ctx, &snap), "take snapshot");
+    mp4tag_destroy(ctx);
+
+    /* It outlives the context and owns everything it points at */
+    char title[64];
+    const mp4tag_collection_t *coll = mp4tag_snapshot_tags(snap);
+    const mp4tag_simple_tag_t *art = coll ? find_simple(coll, "COVER_ART") : NULL;
+    CHECK(mp4tag_snapshot_tag_string(snap, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+          strcmp(title, "Test Title") == 0, "title from the snapshot");
+    CHECK(art && art->binary && art->binary_size == sizeof(cover) &&
+          memcmp(art->binary, cover, sizeof(cover)) == 0, "cover art loaded");
+    const mp4tag_item_view_t *views = NULL;
+    size_t nviews = 0;
+    CHECK(mp4tag_snapshot_views(snap, &views, &nviews) == MP4TAG_OK && nviews == 2 &&
+          views[0].size == 10 && memcmp(views[0].data, "Test Title", 10) == 0 &&
+          art && views[1].data == art->binary, "views share the ilst copy");
+    CHECK(mp4tag_snapshot_is_current(snap), "fresh snapshot is current");
+
+    /* Concurrent readers need no locks */
+    pthread_t threads[4];
+    snapshot_reader_t readers[4];
+    for (int i = 0; i < 4; i++) {
+        readers[i].snap = snap;
+        pthread_create(&threads[i], NULL, snapshot_lookups, &readers[i]);
+    }
+    int ok = 1;
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        ok &= readers[i].ok;
+    }
+    CHECK(ok, "lookups from four threads");
+
+    /* A write from another context makes it stale; a new one is current */
+    ctx = mp4tag_create(NULL);
+    CHECK_RC(mp4tag_open_rw(ctx, tmp), "open_rw");
+    CHECK_RC(mp4tag_set_tag_string(ctx, "TITLE", "Shared"), "write");
+    CHECK(!mp4tag_snapshot_is_current(snap), "write makes the snapshot stale");
+    CHECK(mp4tag_snapshot_tag_string(snap, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+          strcmp(title, "Test Title") == 0, "stale snapshot still readable");
+    mp4tag_snapshot_t *fresh = NULL;
+    CHECK(mp4tag_read_snapshot(ctx, &fresh) == MP4TAG_OK &&
+          mp4tag_snapshot_is_current(fresh) &&
+          mp4tag_snapshot_tag_string(fresh, "TITLE", title, sizeof(title)) == MP4TAG_OK &&
+          strcmp(title, "Shared") == 0, "snapshot after the write");
+    mp4tag_snapshot_release(snap);
+
+    /* A rewrite (new inode) still reaches snapshots of the old file */
+    mp4tag_set_write_flags(ctx, 0);
+    char big[4096];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    CHECK_RC(mp4tag_set_tag_string(ctx, "COMMENT", big), "rewrite");
+    CHECK(!mp4tag_snapshot_is_current(fresh), "rewrite makes the snapshot stale");
+    mp4tag_snapshot_release(fresh);
+    mp4tag_close(ctx);
+
+    /* Memory sources get a generation of their own */
+    size_t len = 0;
+    uint8_t *data = read_whole_file(tmp, &len);
+    CHECK_RC(mp4tag_open_memory(ctx, data, len), "open memory");
+    CHECK(mp4tag_read_snapshot(ctx, &snap) == MP4TAG_OK &&
+          mp4tag_snapshot_is_current(snap) &&
+          mp4tag_snapshot_tag_string(snap, "COMMENT", big, sizeof(big)) == MP4TAG_OK &&
+          strlen(big) == sizeof(big) - 1, "snapshot of a memory source");
+    mp4tag_destroy(ctx);
+    mp4tag_snapshot_release(snap);
+    free(data);
+
+    mp4tag_snapshot_release(NULL);
+    CHECK(mp4tag_snapshot_tags(NULL) == NULL && !mp4tag_snapshot_is_current(NULL) &&
+          mp4tag_snapshot_views(NULL, &views, &nviews) == MP4TAG_ERR_INVALID_ARG,
+          "snapshot functions reject NULL");
+    remove(tmp);
+}
+
 static void test_m4a_brand(void)
 {
     printf("\n--- M4A brand detection ---\n");
@@ -829,6 +3643,34 @@ int main(void)
     test_write_collection(tagged_path);
     test_read_only_protection(tagged_path);
     test_reopen_after_write(tagged_path);
+    test_moov_read_limit(tagged_path);
+    test_open_memory_and_mapped(tagged_path);
+    test_lazy_binary();
+    test_padding_policy(notag_path);
+    test_rewrite_preserves_media();
+    test_relocate_moov();
+    test_chunk_offset_relocation();
+    test_moov_reshuffle();
+    test_edit_transaction(tagged_path);
+    test_same_size_patch();
+    test_tag_lookup(tagged_path);
+    test_arena_allocator(tagged_path);
+    test_text_decoding();
+    test_tags_view(tagged_path);
+    test_scan_paths(tagged_path);
+    test_scan_async_io(tagged_path);
+    test_early_exit_parse();
+    test_plan_write();
+    test_io_options();
+    test_durability();
+    test_user_io();
+    test_probe_plan();
+    test_write_tags_to();
+    test_streamed_cover();
+    test_stats();
+    test_context_reuse();
+    test_tag_cache();
+    test_snapshot();
     test_m4a_brand();
 
     /* Cleanup */